@@ -0,0 +1,132 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "xhook.h"
+#include "arena.h"
+
+//Threads of libbench_arena.so churn through small blocks, with libc malloc and then
+//redirected to the library's arena, and the cost per step is compared. Blocks allocated
+//in the arena are then freed and resized by the benchmark itself (another library), and
+//the arena's accounting is printed.
+//
+//usage: arena_bench [threads] [steps per thread]
+
+#define BENCH_STATS_MAX   16
+#define BENCH_STRINGS_CNT 1000
+
+extern void  bench_arena_churn(unsigned int seed, size_t steps);
+extern char *bench_arena_string(size_t size);
+
+typedef struct
+{
+    pthread_t tid;
+    int       idx;
+    size_t    steps;
+} bench_worker_t;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void *worker_func(void *arg)
+{
+    bench_worker_t *w = (bench_worker_t *)arg;
+    bench_arena_churn((unsigned int)w->idx + 1, w->steps);
+    return NULL;
+}
+
+static void run(const char *name, int threads, size_t steps)
+{
+    bench_worker_t *ws = calloc((size_t)threads, sizeof(bench_worker_t));
+    uint64_t        t0, t1;
+    int             i;
+
+    if(NULL == ws) exit(1);
+    t0 = now_ns();
+    for(i = 0; i < threads; i++)
+    {
+        ws[i].idx = i;
+        ws[i].steps = steps;
+        pthread_create(&ws[i].tid, NULL, worker_func, &ws[i]);
+    }
+    for(i = 0; i < threads; i++)
+        pthread_join(ws[i].tid, NULL);
+    t1 = now_ns();
+
+    printf("%-8s %10.1f %12.1f\n", name, (double)(t1 - t0) / 1e6, (double)(t1 - t0) / (double)((size_t)threads * steps));
+    free(ws);
+}
+
+static void print_stats(const char *when)
+{
+    arena_stats_t stats[BENCH_STATS_MAX];
+    size_t        i, n = arena_get_stats(stats, BENCH_STATS_MAX);
+
+    for(i = 0; i < n && i < BENCH_STATS_MAX; i++)
+        printf("%s: %s: %lld bytes in use, %llu mapped, %llu allocs, %llu frees, %llu fallbacks\n", when,
+               stats[i].pathname, (long long)stats[i].bytes_in_use, (unsigned long long)stats[i].bytes_mapped,
+               (unsigned long long)stats[i].allocs, (unsigned long long)stats[i].frees,
+               (unsigned long long)stats[i].fallbacks);
+}
+
+int main(int argc, char **argv)
+{
+    int    threads = (argc > 1 ? atoi(argv[1]) : 4);
+    size_t steps = (argc > 2 ? (size_t)atol(argv[2]) : 2000000);
+    char  *strs[BENCH_STRINGS_CNT];
+    char  *s;
+    size_t i, bad = 0;
+
+    if(threads < 1) threads = 1;
+    printf("%d threads x %zu steps\n", threads, steps);
+    printf("%-8s %10s %12s\n", "phase", "ms", "ns/step");
+    run("libc", threads, steps);
+
+    if(0 != arena_init(0)) return 1;
+    if(0 != arena_register(".*/libbench_arena\\.so$")) return 1;
+    if(0 != xhook_refresh(0)) return 1;
+    run("arena", threads, steps);
+    print_stats("after churn");
+
+    //allocated in the arena, resized and freed here
+    for(i = 0; i < BENCH_STRINGS_CNT; i++)
+        strs[i] = bench_arena_string(16 + i * 97);
+    print_stats("strings  ");
+    for(i = 0; i < BENCH_STRINGS_CNT; i++)
+    {
+        if(NULL == (s = realloc(strs[i], 32 + i * 131))) return 1;
+        if(strlen(s) != 15 + i * 97) bad++;
+        free(s);
+    }
+    print_stats("freed    ");
+    printf("cross-library realloc/free: %s\n", 0 == bad ? "ok" : "BROKEN");
+    return 0;
+}
@@ -0,0 +1,64 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+//caller library for the arena benchmark: an allocation heavy library
+
+#define BENCH_ARENA_WINDOW 4096
+
+//keeps a window of live blocks of 16 .. 2048 bytes, replacing a random one per step,
+//1 in 8 steps resizes instead
+void bench_arena_churn(unsigned int seed, size_t steps)
+{
+    void   *live[BENCH_ARENA_WINDOW] = {NULL};
+    size_t  i, j, size;
+    void   *p;
+
+    for(i = 0; i < steps; i++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        j = (seed >> 8) % BENCH_ARENA_WINDOW;
+        size = 16 + (seed >> 16) % 2033;
+        if(0 == (seed & 7) && NULL != live[j])
+        {
+            if(NULL != (p = realloc(live[j], size))) live[j] = p;
+        }
+        else
+        {
+            free(live[j]);
+            if(NULL != (live[j] = malloc(size))) memset(live[j], 0x5a, 16);
+        }
+    }
+    for(j = 0; j < BENCH_ARENA_WINDOW; j++)
+        free(live[j]);
+}
+
+//freed by the caller, from outside the arena's library
+char *bench_arena_string(size_t size)
+{
+    char *s = calloc(1, size);
+    if(NULL != s && size > 1) memset(s, 'x', size - 1);
+    return s;
+}
@@ -0,0 +1,43 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#ifndef CALLPATH_H
+#define CALLPATH_H 1
+
+//one callee per slot: X(index)
+#define CALLPATH_SLOTS(X) \
+    X(00) X(01) X(02) X(03) X(04) X(05) X(06) X(07) \
+    X(08) X(09) X(10) X(11) X(12) X(13) X(14) X(15)
+
+#define CALLPATH_SLOTS_CNT 16
+
+#define CALLPATH_DECLARE(i) int callpath_callee_##i(int x);
+CALLPATH_SLOTS(CALLPATH_DECLARE)
+#undef CALLPATH_DECLARE
+
+//n calls of callpath_callee_00, each depends on the previous one
+int callpath_mono(int n, int x);
+
+//n calls spread over the 16 callees (16 call sites, 16 GOT slots)
+int callpath_poly(int n, int x);
+
+#endif
@@ -0,0 +1,309 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <dlfcn.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "xhook.h"
+#include "callpath.h"
+
+//Cost of one call through a hooked GOT slot, for each wrapper style, compared with
+//the unhooked call. libcallpath_caller.so calls the 16 callpath_callee_* functions of
+//libcallpath_callee.so in two loops: one call site in a dependency chain (mono), and
+//16 call sites / slots / wrappers round-robin (poly, more branch targets and code).
+//
+//Each (mode, loop) runs reps times, ns/call is the median of the reps. Hardware
+//counters are read with perf_event_open when available (null otherwise).
+//The result is printed as JSON.
+//
+//usage: callpath_bench [calls per rep] [reps]
+
+#define BENCH_TARGET     ".*/libcallpath_caller\\.so$"
+#define BENCH_COUNTERS   5
+#define BENCH_REPS_MAX   1000
+
+static const char *counter_names[BENCH_COUNTERS] =
+    {"cycles", "instructions", "branch_misses", "l1i_misses", "l1d_misses"};
+static int counter_fds[BENCH_COUNTERS];
+
+static const char *symbols[CALLPATH_SLOTS_CNT];
+static void       *origs[CALLPATH_SLOTS_CNT];
+
+//wrapper styles, one set of handlers per slot
+static int (*olds[CALLPATH_SLOTS_CNT])(int);
+static __thread int guard;
+
+#define BENCH_HANDLERS(i)                                                               \
+    static int replace_##i(int x) { return x + 1; }                                     \
+    static int wrap_##i(int x) { return olds[1##i - 100](x); }                          \
+    static int guard_##i(int x)                                                         \
+    {                                                                                   \
+        int r;                                                                          \
+        if(guard) return olds[1##i - 100](x);                                           \
+        guard = 1;                                                                      \
+        r = olds[1##i - 100](x);                                                        \
+        guard = 0;                                                                      \
+        return r;                                                                       \
+    }
+CALLPATH_SLOTS(BENCH_HANDLERS)
+#undef BENCH_HANDLERS
+
+#define BENCH_LIST(prefix) {                                                    \
+    (void *)prefix##00, (void *)prefix##01, (void *)prefix##02, (void *)prefix##03, \
+    (void *)prefix##04, (void *)prefix##05, (void *)prefix##06, (void *)prefix##07, \
+    (void *)prefix##08, (void *)prefix##09, (void *)prefix##10, (void *)prefix##11, \
+    (void *)prefix##12, (void *)prefix##13, (void *)prefix##14, (void *)prefix##15}
+static void *replaces[CALLPATH_SLOTS_CNT] = BENCH_LIST(replace_);
+static void *wraps[CALLPATH_SLOTS_CNT]    = BENCH_LIST(wrap_);
+static void *guards[CALLPATH_SLOTS_CNT]   = BENCH_LIST(guard_);
+
+#define MODE_BASELINE             0 //unhooked
+#define MODE_REPLACE              1 //new_func does the work itself
+#define MODE_WRAP                 2 //new_func calls old_func
+#define MODE_GUARD                3 //new_func calls old_func, with a thread-local reentrancy guard
+#define MODE_GOVERNED             4 //wrapper behind the governor stub (counting trampoline)
+#define MODE_GOVERNED_PASSTHROUGH 5 //governor stub, over budget, straight to old_func
+#define MODE_CNT                  6
+
+static const char *mode_names[MODE_CNT] =
+    {"baseline", "replace", "wrapper", "guarded", "governed", "governed_passthrough"};
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int counter_open(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type           = type;
+    attr.size           = sizeof(attr);
+    attr.config         = config;
+    attr.disabled       = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static int counters_open()
+{
+    int i, cnt = 0;
+
+    counter_fds[0] = counter_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    counter_fds[1] = counter_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    counter_fds[2] = counter_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    counter_fds[3] = counter_open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1I |
+                                  (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    counter_fds[4] = counter_open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                                  (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    for(i = 0; i < BENCH_COUNTERS; i++)
+        if(counter_fds[i] >= 0) cnt++;
+    return cnt;
+}
+
+static void counters_ctl(unsigned long req)
+{
+    int i;
+
+    for(i = 0; i < BENCH_COUNTERS; i++)
+        if(counter_fds[i] >= 0) ioctl(counter_fds[i], req, 0);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+//restore the original functions, then hook with the handlers of the mode
+static int set_mode(int mode)
+{
+    xhook_governor_t  governor;
+    void            **handlers = NULL;
+    int               i, r;
+
+    xhook_clear();
+    for(i = 0; i < CALLPATH_SLOTS_CNT; i++)
+        if(0 != (r = xhook_register(BENCH_TARGET, symbols[i], origs[i], NULL))) return r;
+    if(0 != (r = xhook_refresh(0))) return r;
+    if(MODE_BASELINE == mode) return 0;
+
+    xhook_clear();
+    memset(&governor, 0, sizeof(governor));
+    governor.max_calls_per_sec = (MODE_GOVERNED_PASSTHROUGH == mode ? 1 : UINT64_MAX); //never over budget
+    governor.policy = XHOOK_GOVERNOR_POLICY_PASSTHROUGH;
+    switch(mode)
+    {
+    case MODE_REPLACE: handlers = replaces; break;
+    case MODE_GUARD:   handlers = guards; break;
+    default:           handlers = wraps; break;
+    }
+    for(i = 0; i < CALLPATH_SLOTS_CNT; i++)
+    {
+        if(MODE_GOVERNED == mode || MODE_GOVERNED_PASSTHROUGH == mode)
+            r = xhook_register_governed(BENCH_TARGET, symbols[i], handlers[i], (void **)&olds[i], &governor);
+        else
+            r = xhook_register(BENCH_TARGET, symbols[i], handlers[i], (void **)&olds[i]);
+        if(0 != r) return r;
+    }
+    return xhook_refresh(0);
+}
+
+//call until the governor has switched the hooks to pass-through
+static int wait_passthrough()
+{
+    xhook_governor_state_t states[CALLPATH_SLOTS_CNT];
+    uint64_t               end = now_ns() + 3000000000ULL;
+    size_t                 cnt, i;
+
+    while(now_ns() < end)
+    {
+        callpath_poly(CALLPATH_SLOTS_CNT * 1000, 0);
+        if((cnt = xhook_get_governor_states(states, CALLPATH_SLOTS_CNT)) != CALLPATH_SLOTS_CNT) return -1;
+        for(i = 0; i < cnt; i++)
+            if(XHOOK_GOVERNOR_MODE_PASSTHROUGH != states[i].mode) break;
+        if(i == cnt) return 0;
+        usleep(10000);
+    }
+    return -1;
+}
+
+static void run(int mode, const char *loop, int (*func)(int, int), int calls, int reps,
+                double base_ns, double *out_ns, int first)
+{
+    uint64_t ns[BENCH_REPS_MAX], t;
+    uint64_t counters[BENCH_COUNTERS];
+    double   median;
+    int      i, x = 0;
+
+    func(calls, 0); //warm up
+
+    counters_ctl(PERF_EVENT_IOC_RESET);
+    for(i = 0; i < reps; i++)
+    {
+        t = now_ns();
+        counters_ctl(PERF_EVENT_IOC_ENABLE);
+        x += func(calls, i);
+        counters_ctl(PERF_EVENT_IOC_DISABLE);
+        ns[i] = now_ns() - t;
+    }
+    for(i = 0; i < BENCH_COUNTERS; i++)
+        if(counter_fds[i] < 0 || sizeof(uint64_t) != read(counter_fds[i], &counters[i], sizeof(uint64_t)))
+            counters[i] = UINT64_MAX;
+
+    qsort(ns, (size_t)reps, sizeof(uint64_t), cmp_u64);
+    median = (double)ns[reps / 2] / calls;
+    *out_ns = median;
+
+    printf("%s    {\"mode\": \"%s\", \"loop\": \"%s\", \"ns_per_call\": %.3f, \"ns_per_call_min\": %.3f, "
+           "\"overhead_ns\": %.3f", first ? "" : ",\n", mode_names[mode], loop, median,
+           (double)ns[0] / calls, base_ns > 0 ? median - base_ns : 0.0);
+    for(i = 0; i < BENCH_COUNTERS; i++)
+    {
+        if(UINT64_MAX == counters[i])
+            printf(", \"%s_per_call\": null", counter_names[i]);
+        else
+            printf(", \"%s_per_call\": %.4f", counter_names[i], (double)counters[i] / ((double)calls * reps));
+    }
+    printf(", \"check\": %d}", x);
+}
+
+int main(int argc, char **argv)
+{
+    int       calls = (argc > 1 ? atoi(argv[1]) : 1000000);
+    int       reps = (argc > 2 ? atoi(argv[2]) : 21);
+    double    base[2] = {0, 0}, ns;
+    cpu_set_t cpus;
+    int       mode, i, r, cpu, counters, first = 1;
+
+    if(calls < CALLPATH_SLOTS_CNT) calls = CALLPATH_SLOTS_CNT;
+    calls -= calls % CALLPATH_SLOTS_CNT;
+    if(reps < 1) reps = 1;
+    if(reps > BENCH_REPS_MAX) reps = BENCH_REPS_MAX;
+
+    //stay on one CPU, the counters and the caches are per CPU
+    if((cpu = sched_getcpu()) >= 0)
+    {
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        sched_setaffinity(0, sizeof(cpus), &cpus);
+    }
+
+    //resolve all the imports before the first hook
+    if(CALLPATH_SLOTS_CNT != callpath_poly(CALLPATH_SLOTS_CNT, 0)) return 1;
+#define BENCH_RESOLVE(i)                                                \
+    symbols[1##i - 100] = "callpath_callee_" #i;                        \
+    origs[1##i - 100] = (void *)callpath_callee_##i;
+    CALLPATH_SLOTS(BENCH_RESOLVE)
+#undef BENCH_RESOLVE
+
+    counters = counters_open();
+
+    printf("{\n  \"benchmark\": \"callpath\",\n");
+#if defined(__x86_64__)
+    printf("  \"arch\": \"x86_64\",\n");
+#elif defined(__aarch64__)
+    printf("  \"arch\": \"arm64\",\n");
+#else
+    printf("  \"arch\": \"other\",\n");
+#endif
+    printf("  \"calls_per_rep\": %d,\n  \"reps\": %d,\n  \"perf_counters\": %d,\n  \"results\": [\n",
+           calls, reps, counters);
+
+    for(mode = 0; mode < MODE_CNT; mode++)
+    {
+        if(0 != (r = set_mode(mode)))
+        {
+            fprintf(stderr, "%s: hook failed (%d), skipped\n", mode_names[mode], r);
+            continue;
+        }
+        if(MODE_GOVERNED_PASSTHROUGH == mode && 0 != wait_passthrough())
+        {
+            fprintf(stderr, "%s: governor did not switch, skipped\n", mode_names[mode]);
+            continue;
+        }
+        run(mode, "mono", callpath_mono, calls, reps, base[0], &ns, first);
+        if(MODE_BASELINE == mode) base[0] = ns;
+        first = 0;
+        run(mode, "poly", callpath_poly, calls, reps, base[1], &ns, first);
+        if(MODE_BASELINE == mode) base[1] = ns;
+    }
+    printf("\n  ]\n}\n");
+
+    set_mode(MODE_BASELINE);
+    xhook_clear();
+    for(i = 0; i < BENCH_COUNTERS; i++)
+        if(counter_fds[i] >= 0) close(counter_fds[i]);
+    return 0;
+}
@@ -0,0 +1,47 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include "callpath.h"
+
+//caller library for the call-path benchmark, all calls go through its PLT
+
+int callpath_mono(int n, int x)
+{
+    int i;
+
+    for(i = 0; i < n; i++)
+        x = callpath_callee_00(x);
+    return x;
+}
+
+int callpath_poly(int n, int x)
+{
+    int i;
+
+#define CALLPATH_CALL(i) x = callpath_callee_##i(x);
+    for(i = 0; i + CALLPATH_SLOTS_CNT <= n; i += CALLPATH_SLOTS_CNT)
+    {
+        CALLPATH_SLOTS(CALLPATH_CALL)
+    }
+#undef CALLPATH_CALL
+    return x;
+}
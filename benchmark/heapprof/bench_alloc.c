@@ -0,0 +1,59 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stdlib.h>
+#include <stddef.h>
+
+//caller library for the heap profiler benchmark
+
+void bench_alloc_churn(size_t loops, size_t size)
+{
+    size_t i;
+    void  *p;
+
+    for(i = 0; i < loops; i++)
+    {
+        p = malloc(size + (i & 63));
+        __asm__ __volatile__("" : : "r"(p) : "memory");
+        free(p);
+    }
+}
+
+void **bench_alloc_hold(size_t cnt, size_t size)
+{
+    void  **ps;
+    size_t  i;
+
+    if(NULL == (ps = calloc(cnt, sizeof(void *)))) return NULL;
+    for(i = 0; i < cnt; i++)
+        ps[i] = malloc(size);
+    return ps;
+}
+
+void bench_alloc_release(void **ps, size_t cnt)
+{
+    size_t i;
+
+    for(i = 0; i < cnt; i++)
+        free(ps[i]);
+    free(ps);
+}
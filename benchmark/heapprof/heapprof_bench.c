@@ -0,0 +1,118 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "xhook.h"
+#include "heapprof.h"
+
+#define BENCH_LOOPS      10000000
+#define BENCH_HOLD_CNT   65536
+#define BENCH_HOLD_SIZE  1024
+#define BENCH_INTERVAL   (512 * 1024)
+
+extern void   bench_alloc_churn(size_t loops, size_t size);
+extern void **bench_alloc_hold(size_t cnt, size_t size);
+extern void   bench_alloc_release(void **ps, size_t cnt);
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static double churn_ns_per_op(size_t size)
+{
+    uint64_t start = now_ns();
+    bench_alloc_churn(BENCH_LOOPS, size);
+    return (double)(now_ns() - start) / BENCH_LOOPS;
+}
+
+static void dump(const char *title, heapprof_snapshot_t *s)
+{
+    size_t i;
+
+    printf("%s:\n", title);
+    for(i = 0; i < s->lib_cnt; i++)
+    {
+        if(0 == s->libs[i].sampled_count && 0 == s->libs[i].live_bytes) continue;
+        printf("  %12lld bytes (est) %10lld allocs (est) %8lld samples  %s\n",
+               (long long)s->libs[i].live_bytes, (long long)s->libs[i].live_count,
+               (long long)s->libs[i].sampled_count, s->libs[i].pathname);
+    }
+}
+
+int main()
+{
+    static const size_t sizes[] = {16, 256, 4096};
+    double              base[sizeof(sizes) / sizeof(sizes[0])];
+    double              hooked;
+    size_t              i;
+    void              **held;
+    heapprof_snapshot_t *s0, *s1, *d;
+
+    churn_ns_per_op(sizes[0]); //warm up
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        base[i] = churn_ns_per_op(sizes[i]);
+
+    if(0 != heapprof_init(BENCH_INTERVAL, 1 << 16)) return 1;
+    if(0 != heapprof_register(".*/libbench_alloc\\.so$")) return 1;
+    if(0 != xhook_refresh(0)) return 1;
+
+    printf("malloc+free, sample interval %d bytes:\n", BENCH_INTERVAL);
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        hooked = churn_ns_per_op(sizes[i]);
+        printf("  size %5zu: %6.2f ns/op -> %6.2f ns/op (%+.1f%%)\n",
+               sizes[i], base[i], hooked, (hooked - base[i]) * 100.0 / base[i]);
+    }
+
+    s0 = heapprof_snapshot();
+    held = bench_alloc_hold(BENCH_HOLD_CNT, BENCH_HOLD_SIZE);
+    s1 = heapprof_snapshot();
+    d = heapprof_diff(s0, s1);
+    printf("held %d bytes in %d allocs\n", BENCH_HOLD_CNT * BENCH_HOLD_SIZE, BENCH_HOLD_CNT);
+    dump("diff", d);
+
+    //free() of unsampled blocks while samples are live
+    printf("malloc+free, with live samples:\n");
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        hooked = churn_ns_per_op(sizes[i]);
+        printf("  size %5zu: %6.2f ns/op -> %6.2f ns/op (%+.1f%%)\n",
+               sizes[i], base[i], hooked, (hooked - base[i]) * 100.0 / base[i]);
+    }
+    bench_alloc_release(held, BENCH_HOLD_CNT);
+    heapprof_free(s0);
+    heapprof_free(s1);
+    heapprof_free(d);
+
+    s0 = heapprof_snapshot();
+    dump("after release", s0);
+    heapprof_free(s0);
+    printf("dropped samples: %zu\n", heapprof_dropped());
+    return 0;
+}
@@ -0,0 +1,46 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stdio.h>
+#include <string.h>
+#include <dlfcn.h>
+
+//loaded by the benchmark, its constructor works for about 2ms and loads
+//libbench_load_leaf.so through the helper
+
+extern void *bench_load(const char *pathname);
+extern void  bench_load_spin(long ns);
+
+__attribute__((constructor)) static void bench_load_mid_init()
+{
+    Dl_info info;
+    char    path[512];
+    char   *p;
+
+    bench_load_spin(1000000);
+    if(0 == dladdr((void *)bench_load_mid_init, &info) || NULL == info.dli_fname) return;
+    snprintf(path, sizeof(path), "%s", info.dli_fname);
+    if(NULL == (p = strrchr(path, '/'))) return;
+    snprintf(p + 1, sizeof(path) - (size_t)(p + 1 - path), "libbench_load_leaf.so");
+    bench_load(path);
+    bench_load_spin(1000000);
+}
@@ -0,0 +1,97 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include "xhook.h"
+#include "loadprof.h"
+
+//libbench_load.so (the loader helper) loads libbench_load_mid.so, whose constructor
+//loads libbench_load_leaf.so through the helper again, and the load tree is printed.
+//Then the cost of a load is measured without and with the profiler, with dlopen/dlclose
+//of a library which is already loaded (the cheapest load there is). The profiled number
+//includes the first touch of each load's record (a page fault every few loads).
+//
+//usage: loadprof_bench [loads]
+
+extern void *bench_load(const char *pathname);
+extern int   bench_unload(void *handle);
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static double run(const char *path, size_t cnt)
+{
+    uint64_t t0;
+    size_t   i;
+    void    *h;
+
+    t0 = now_ns();
+    for(i = 0; i < cnt; i++)
+    {
+        if(NULL == (h = bench_load(path))) exit(1);
+        bench_unload(h);
+    }
+    return (double)(now_ns() - t0) / (double)cnt;
+}
+
+int main(int argc, char **argv)
+{
+    size_t cnt = (argc > 1 ? (size_t)atol(argv[1]) : 1000);
+    char   dir[512], mid[600], leaf[600];
+    char  *p;
+    void  *h;
+    double direct, profiled;
+
+    if(readlink("/proc/self/exe", dir, sizeof(dir) - 1) < 0) return 1;
+    dir[sizeof(dir) - 1] = '\0';
+    if(NULL == (p = strrchr(dir, '/'))) return 1;
+    *p = '\0';
+    snprintf(mid, sizeof(mid), "%s/libbench_load_mid.so", dir);
+    snprintf(leaf, sizeof(leaf), "%s/libbench_load_leaf.so", dir);
+
+    //the baseline, with libbench_load_leaf.so loaded once and unloaded after
+    if(NULL == (h = dlopen(leaf, RTLD_NOW))) return 1;
+    direct = run(leaf, cnt);
+    dlclose(h);
+
+    if(0 != loadprof_register(".*/libbench_load\\.so$")) return 1;
+    if(0 != xhook_refresh(0)) return 1;
+    if(NULL == (h = bench_load(mid))) return 1;
+    loadprof_dump(STDOUT_FILENO);
+
+    //libbench_load_leaf.so stays loaded by libbench_load_mid.so
+    profiled = run(leaf, cnt);
+    printf("%zu loads of a loaded library: %.1f ns direct, %.1f ns profiled\n", cnt, direct, profiled);
+    printf("%zu loads recorded, %zu dropped\n", loadprof_get_loads(NULL, 0), loadprof_dropped());
+    bench_unload(h);
+    return 0;
+}
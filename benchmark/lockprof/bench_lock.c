@@ -0,0 +1,73 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stddef.h>
+#include <pthread.h>
+
+//caller library for the lock profiler benchmark
+
+static pthread_mutex_t  bench_mutex  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t  bench_shared = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t bench_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static volatile size_t  bench_counter;
+
+void bench_lock_uncontended(size_t loops)
+{
+    size_t i;
+
+    for(i = 0; i < loops; i++)
+    {
+        pthread_mutex_lock(&bench_mutex);
+        bench_counter++;
+        pthread_mutex_unlock(&bench_mutex);
+    }
+}
+
+void bench_lock_uncontended_rd(size_t loops)
+{
+    size_t i;
+
+    for(i = 0; i < loops; i++)
+    {
+        pthread_rwlock_rdlock(&bench_rwlock);
+        bench_counter++;
+        pthread_rwlock_unlock(&bench_rwlock);
+    }
+}
+
+//called by several threads at once, a short critical section on one mutex
+void bench_lock_contended(size_t loops, size_t work)
+{
+    size_t i, j;
+
+    for(i = 0; i < loops; i++)
+    {
+        pthread_mutex_lock(&bench_shared);
+        for(j = 0; j < work; j++) bench_counter++;
+        pthread_mutex_unlock(&bench_shared);
+    }
+}
+
+void *bench_lock_shared()
+{
+    return &bench_shared;
+}
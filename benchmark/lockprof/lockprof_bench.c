@@ -0,0 +1,110 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include "xhook.h"
+#include "lockprof.h"
+
+#define BENCH_LOOPS      10000000
+#define BENCH_THREADS    4
+#define BENCH_CONTENDED  200000
+#define BENCH_WORK       64
+#define BENCH_TOP        5
+
+extern void  bench_lock_uncontended(size_t loops);
+extern void  bench_lock_uncontended_rd(size_t loops);
+extern void  bench_lock_contended(size_t loops, size_t work);
+extern void *bench_lock_shared();
+
+static const char *kinds[] = {"mutex", "rwlock_rd", "rwlock_wr", "cond"};
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static double ns_per_op(void (*func)(size_t))
+{
+    uint64_t start = now_ns();
+    func(BENCH_LOOPS);
+    return (double)(now_ns() - start) / BENCH_LOOPS;
+}
+
+static void *contended_func(void *arg)
+{
+    (void)arg;
+    bench_lock_contended(BENCH_CONTENDED, BENCH_WORK);
+    return NULL;
+}
+
+static double contended_ms()
+{
+    pthread_t tids[BENCH_THREADS];
+    uint64_t  start = now_ns();
+    int       i;
+
+    for(i = 0; i < BENCH_THREADS; i++)
+        pthread_create(&tids[i], NULL, contended_func, NULL);
+    for(i = 0; i < BENCH_THREADS; i++)
+        pthread_join(tids[i], NULL);
+    return (double)(now_ns() - start) / 1e6;
+}
+
+int main()
+{
+    double          base_mutex, base_rd, base_contended, hooked;
+    lockprof_site_t sites[BENCH_TOP];
+    size_t          i, cnt;
+
+    base_mutex = ns_per_op(bench_lock_uncontended);
+    base_rd = ns_per_op(bench_lock_uncontended_rd);
+    base_contended = contended_ms();
+
+    if(0 != lockprof_init(256)) return 1;
+    if(0 != lockprof_register(".*/libbench_lock\\.so$")) return 1;
+    if(0 != xhook_refresh(0)) return 1;
+
+    printf("uncontended lock+unlock:\n");
+    hooked = ns_per_op(bench_lock_uncontended);
+    printf("  mutex:     %6.2f ns/op -> %6.2f ns/op (%+.1f%%)\n", base_mutex, hooked, (hooked - base_mutex) * 100.0 / base_mutex);
+    hooked = ns_per_op(bench_lock_uncontended_rd);
+    printf("  rwlock rd: %6.2f ns/op -> %6.2f ns/op (%+.1f%%)\n", base_rd, hooked, (hooked - base_rd) * 100.0 / base_rd);
+
+    hooked = contended_ms();
+    printf("%d threads x %d locks of one mutex: %.1f ms -> %.1f ms\n",
+           BENCH_THREADS, BENCH_CONTENDED, base_contended, hooked);
+
+    cnt = lockprof_top(sites, BENCH_TOP);
+    printf("top %zu sites (shared mutex at %p):\n", cnt, bench_lock_shared());
+    for(i = 0; i < cnt; i++)
+        printf("  %-9s %p %8llu waits %10.3f ms total %8.1f us max %6llu try failed  %s\n", kinds[sites[i].kind],
+               sites[i].lock, (unsigned long long)sites[i].contended, (double)sites[i].wait_ns / 1e6,
+               (double)sites[i].max_wait_ns / 1e3, (unsigned long long)sites[i].try_failed, sites[i].pathname);
+    printf("dropped sites: %zu\n", lockprof_dropped());
+    return 0;
+}
@@ -0,0 +1,114 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "xhook.h"
+#include "loglimit.h"
+
+//Threads of libbench_log.so print lines to stderr (redirected to /dev/null) and to
+//syslog, without and with the limiter, and the cost per line is compared. The dropped
+//lines are never formatted, so the limited run should cost a small part of the direct
+//one.
+//
+//usage: loglimit_bench [threads] [lines per thread]
+
+#define BENCH_ENTRIES_MAX 64
+
+extern void bench_log_lines(int thread, size_t cnt);
+
+typedef struct
+{
+    pthread_t tid;
+    int       idx;
+    size_t    cnt;
+} bench_worker_t;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void *worker_func(void *arg)
+{
+    bench_worker_t *w = (bench_worker_t *)arg;
+    bench_log_lines(w->idx, w->cnt);
+    return NULL;
+}
+
+static void run(const char *name, int threads, size_t cnt)
+{
+    bench_worker_t *ws = calloc((size_t)threads, sizeof(bench_worker_t));
+    uint64_t        t0, t1;
+    int             i;
+
+    if(NULL == ws) exit(1);
+    t0 = now_ns();
+    for(i = 0; i < threads; i++)
+    {
+        ws[i].idx = i;
+        ws[i].cnt = cnt;
+        pthread_create(&ws[i].tid, NULL, worker_func, &ws[i]);
+    }
+    for(i = 0; i < threads; i++)
+        pthread_join(ws[i].tid, NULL);
+    t1 = now_ns();
+
+    printf("%-8s %10.1f %12.1f\n", name, (double)(t1 - t0) / 1e6, (double)(t1 - t0) / (double)((size_t)threads * cnt));
+    free(ws);
+}
+
+int main(int argc, char **argv)
+{
+    int               threads = (argc > 1 ? atoi(argv[1]) : 4);
+    size_t            cnt = (argc > 2 ? (size_t)atol(argv[2]) : 200000);
+    loglimit_policy_t policy = {.rate = 100, .burst = 200, .sample = 1000, .pass_prio = LOGLIMIT_PRIO_ERROR};
+    loglimit_entry_t  entries[BENCH_ENTRIES_MAX];
+    size_t            i, n;
+    int               fd;
+
+    if(threads < 1) threads = 1;
+    if((fd = open("/dev/null", O_WRONLY)) < 0 || dup2(fd, STDERR_FILENO) < 0) return 1;
+    close(fd);
+
+    printf("%d threads x %zu lines\n", threads, cnt);
+    printf("%-8s %10s %12s\n", "phase", "ms", "ns/line");
+    run("direct", threads, cnt);
+
+    if(0 != loglimit_register(".*/libbench_log\\.so$", &policy)) return 1;
+    if(0 != xhook_refresh(0)) return 1;
+    run("limited", threads, cnt);
+
+    n = loglimit_get_entries(entries, BENCH_ENTRIES_MAX);
+    for(i = 0; i < n && i < BENCH_ENTRIES_MAX; i++)
+        printf("%s [%s] prio %d: %llu passed, %llu suppressed\n", entries[i].pathname, entries[i].tag, entries[i].prio,
+               (unsigned long long)entries[i].passed, (unsigned long long)entries[i].suppressed);
+    printf("%llu lines suppressed\n", (unsigned long long)loglimit_get_suppressed());
+    return 0;
+}
@@ -0,0 +1,37 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+
+#include "bench_dep.h"
+
+//dependency of libbench_target.so, the slots of these functions are patched by the benchmark
+
+int bench_dep_f0(int x) { return x + 0; }
+int bench_dep_f1(int x) { return x + 1; }
+int bench_dep_f2(int x) { return x + 2; }
+int bench_dep_f3(int x) { return x + 3; }
+int bench_dep_f4(int x) { return x + 4; }
+int bench_dep_f5(int x) { return x + 5; }
+int bench_dep_f6(int x) { return x + 6; }
+int bench_dep_f7(int x) { return x + 7; }
+
+int bench_dep_plain(int x) { return x ^ 1; }
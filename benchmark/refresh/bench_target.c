@@ -0,0 +1,42 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+
+#include "bench_dep.h"
+
+//caller library for the refresh interference benchmark, all calls go through its PLT
+
+int bench_target_hooked(int x)
+{
+    return bench_dep_f0(x);
+}
+
+int bench_target_plain(int x)
+{
+    return bench_dep_plain(x);
+}
+
+int bench_target_all(int x)
+{
+    return bench_dep_f0(x) + bench_dep_f1(x) + bench_dep_f2(x) + bench_dep_f3(x) +
+        bench_dep_f4(x) + bench_dep_f5(x) + bench_dep_f6(x) + bench_dep_f7(x);
+}
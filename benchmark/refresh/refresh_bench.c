@@ -0,0 +1,226 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "xhook.h"
+#include "bench_dep.h"
+
+//Worker threads call a hooked and an unhooked function in a tight loop, while the
+//main thread refreshes repeatedly. Each refresh re-registers the 8 bench_dep_f* hooks
+//with alternating handlers, so every refresh really patches 8 slots.
+//
+//usage: refresh_bench [workers] [seconds per phase]
+
+#define BENCH_BATCH      64   //calls of each function per latency sample
+#define BENCH_HIST_CNT   1024
+#define BENCH_TARGET     ".*/libbench_target\\.so$"
+
+typedef struct
+{
+    pthread_t tid;
+    uint64_t  calls;
+    uint64_t  hist[BENCH_HIST_CNT];
+    int       sink;
+} bench_worker_t;
+
+static volatile int bench_running;
+
+#define BENCH_HANDLERS(set)                                             \
+    static int bench_##set##_f0(int x) { return x + 0; }               \
+    static int bench_##set##_f1(int x) { return x + 1; }               \
+    static int bench_##set##_f2(int x) { return x + 2; }               \
+    static int bench_##set##_f3(int x) { return x + 3; }               \
+    static int bench_##set##_f4(int x) { return x + 4; }               \
+    static int bench_##set##_f5(int x) { return x + 5; }               \
+    static int bench_##set##_f6(int x) { return x + 6; }               \
+    static int bench_##set##_f7(int x) { return x + 7; }               \
+    static void *bench_##set[8] = {(void *)bench_##set##_f0, (void *)bench_##set##_f1, \
+                                   (void *)bench_##set##_f2, (void *)bench_##set##_f3, \
+                                   (void *)bench_##set##_f4, (void *)bench_##set##_f5, \
+                                   (void *)bench_##set##_f6, (void *)bench_##set##_f7};
+BENCH_HANDLERS(a)
+BENCH_HANDLERS(b)
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+//log-linear histogram: exact below 64ns, then 16 sub-buckets per power of 2
+static size_t hist_idx(uint64_t v)
+{
+    int e;
+
+    if(v < 64) return (size_t)v;
+    e = 63 - __builtin_clzll(v);
+    return 64 + (size_t)(e - 6) * 16 + (size_t)((v >> (e - 4)) & 15);
+}
+
+static uint64_t hist_val(size_t idx)
+{
+    size_t e;
+
+    if(idx < 64) return idx;
+    e = (idx - 64) / 16 + 6;
+    return (1ULL << e) + (((idx - 64) % 16) << (e - 4));
+}
+
+static uint64_t hist_pct(const uint64_t *hist, uint64_t total, double pct)
+{
+    uint64_t want = (uint64_t)(total * pct), seen = 0;
+    size_t   i;
+
+    for(i = 0; i < BENCH_HIST_CNT; i++)
+    {
+        seen += hist[i];
+        if(seen > want) return hist_val(i);
+    }
+    return hist_val(BENCH_HIST_CNT - 1);
+}
+
+static void *worker_func(void *arg)
+{
+    bench_worker_t *w = (bench_worker_t *)arg;
+    uint64_t        t0, t1;
+    int             i, sink = 0;
+
+    while(bench_running)
+    {
+        t0 = now_ns();
+        for(i = 0; i < BENCH_BATCH; i++)
+            sink += bench_target_hooked(i) + bench_target_plain(i);
+        t1 = now_ns();
+        w->hist[hist_idx(t1 - t0)]++;
+        w->calls += BENCH_BATCH * 2;
+    }
+    w->sink = sink;
+    return NULL;
+}
+
+static int rehook(int flip)
+{
+    static const char *symbols[8] = {"bench_dep_f0", "bench_dep_f1", "bench_dep_f2", "bench_dep_f3",
+                                     "bench_dep_f4", "bench_dep_f5", "bench_dep_f6", "bench_dep_f7"};
+    void **handlers = (flip ? bench_b : bench_a);
+    int    i;
+
+    xhook_clear();
+    for(i = 0; i < 8; i++)
+        if(0 != xhook_register(BENCH_TARGET, symbols[i], handlers[i], NULL)) return -1;
+    return xhook_refresh(0);
+}
+
+//backend < 0: no refresh; backend == 99: refresh without patching (maps read only)
+static double run_phase(const char *name, int backend, int workers, double seconds, double base_tput)
+{
+    bench_worker_t *ws = calloc((size_t)workers, sizeof(bench_worker_t));
+    uint64_t        hist[BENCH_HIST_CNT];
+    uint64_t        calls = 0, samples = 0, start, end, refreshes = 0, refresh_ns = 0, t;
+    double          tput;
+    int             i;
+    size_t          j;
+
+    if(NULL == ws) exit(1);
+    if(backend >= 0 && backend != 99) xhook_set_patch_backend(backend);
+
+    bench_running = 1;
+    for(i = 0; i < workers; i++)
+        pthread_create(&ws[i].tid, NULL, worker_func, &ws[i]);
+
+    start = now_ns();
+    end = start + (uint64_t)(seconds * 1e9);
+    while((t = now_ns()) < end)
+    {
+        if(backend < 0)
+        {
+            usleep(10000);
+            continue;
+        }
+        if(99 == backend)
+            xhook_refresh(0);
+        else
+            rehook((int)(refreshes & 1));
+        refresh_ns += now_ns() - t;
+        refreshes++;
+    }
+    bench_running = 0;
+    end = now_ns();
+
+    memset(hist, 0, sizeof(hist));
+    for(i = 0; i < workers; i++)
+    {
+        pthread_join(ws[i].tid, NULL);
+        calls += ws[i].calls;
+        for(j = 0; j < BENCH_HIST_CNT; j++)
+        {
+            hist[j] += ws[i].hist[j];
+            samples += ws[i].hist[j];
+        }
+    }
+    free(ws);
+
+    tput = (double)calls * 1e3 / (double)(end - start); //Mcalls/s
+    printf("%-10s %9llu %10.1f %10.1f %+8.2f%% %8llu %8llu %8llu %9llu\n", name,
+           (unsigned long long)refreshes, refreshes ? (double)refresh_ns / (double)refreshes / 1e3 : 0.0,
+           tput, base_tput > 0 ? (tput - base_tput) * 100.0 / base_tput : 0.0,
+           (unsigned long long)hist_pct(hist, samples, 0.5),
+           (unsigned long long)hist_pct(hist, samples, 0.99),
+           (unsigned long long)hist_pct(hist, samples, 0.999),
+           (unsigned long long)hist_pct(hist, samples, 0.99999));
+    return tput;
+}
+
+int main(int argc, char **argv)
+{
+    long   ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int    workers = (argc > 1 ? atoi(argv[1]) : (int)(ncpu > 1 ? ncpu - 1 : 1));
+    double seconds = (argc > 2 ? atof(argv[2]) : 2.0);
+    double base;
+
+    if(workers < 1) workers = 1;
+    
+    //make sure libbench_target.so is loaded and all 8 imports are resolved
+    if(36 != bench_target_all(1)) return 1;
+    if(0 != rehook(0)) return 1;
+
+    printf("%d workers, %.1fs per phase, latency of %d hooked + %d unhooked calls in ns\n",
+           workers, seconds, BENCH_BATCH, BENCH_BATCH);
+    printf("%-10s %9s %10s %10s %9s %8s %8s %8s %9s\n",
+           "phase", "refreshes", "us/refresh", "Mcalls/s", "drop", "p50", "p99", "p99.9", "p99.999");
+    base = run_phase("idle", -1, workers, seconds, 0);
+    run_phase("maps-only", 99, workers, seconds, base);
+    run_phase("mprotect", XHOOK_PATCH_BACKEND_MPROTECT, workers, seconds, base);
+    run_phase("batch", XHOOK_PATCH_BACKEND_BATCH, workers, seconds, base);
+    run_phase("proc_mem", XHOOK_PATCH_BACKEND_PROC_MEM, workers, seconds, base);
+
+    xhook_clear();
+    return 0;
+}
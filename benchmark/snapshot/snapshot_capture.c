@@ -0,0 +1,139 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+//Save the maps of a running process, and every file it has an executable mapping of,
+//for snapshot_replay:
+//
+//  <dir>/maps         copy of /proc/<pid>/maps
+//  <dir>/root/<path>  copy of each file, at its original path under root/
+//
+//usage: snapshot_capture <pid|self> <dir>
+
+#define SNAPSHOT_PATHS_MAX 4096
+
+static char *paths[SNAPSHOT_PATHS_MAX];
+static int   paths_cnt;
+
+static int mkdirs(char *path)
+{
+    char *p;
+
+    for(p = path + 1; '\0' != *p; p++)
+    {
+        if('/' != *p) continue;
+        *p = '\0';
+        if(0 != mkdir(path, 0755) && EEXIST != errno)
+        {
+            *p = '/';
+            return -1;
+        }
+        *p = '/';
+    }
+    return 0;
+}
+
+static int copy_file(const char *src, const char *dst)
+{
+    char    buf[65536];
+    ssize_t n;
+    int     in, out, r = 0;
+
+    if((in = open(src, O_RDONLY | O_CLOEXEC)) < 0) return -1;
+    if((out = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+    {
+        close(in);
+        return -1;
+    }
+    while((n = read(in, buf, sizeof(buf))) > 0)
+        if(write(out, buf, (size_t)n) != n) r = -1;
+    if(n < 0) r = -1;
+    close(in);
+    close(out);
+    return r;
+}
+
+int main(int argc, char **argv)
+{
+    char   maps_path[64], line[1024], perm[5], src[4096], dst[4096];
+    FILE  *in, *out;
+    char  *pathname;
+    int    pathname_pos, i, copied = 0;
+    size_t len;
+
+    if(argc < 3)
+    {
+        fprintf(stderr, "usage: %s <pid|self> <dir>\n", argv[0]);
+        return 1;
+    }
+    snprintf(maps_path, sizeof(maps_path), "/proc/%s/maps", argv[1]);
+    snprintf(dst, sizeof(dst), "%s/maps", argv[2]);
+    if(0 != mkdirs(dst)) return 1;
+    if(NULL == (in = fopen(maps_path, "r")) || NULL == (out = fopen(dst, "w")))
+    {
+        fprintf(stderr, "open %s or %s failed: %s\n", maps_path, dst, strerror(errno));
+        return 1;
+    }
+
+    //read it once, the maps of a running process keep changing
+    while(fgets(line, sizeof(line), in))
+    {
+        fputs(line, out);
+        if(sscanf(line, "%*x-%*x %4s %*x %*x:%*x %*d%n", perm, &pathname_pos) != 1) continue;
+        if('x' != perm[2]) continue;
+        for(pathname = line + pathname_pos; ' ' == *pathname; pathname++);
+        if('/' != *pathname) continue;
+        if((len = strlen(pathname)) > 0 && '\n' == pathname[len - 1]) pathname[len - 1] = '\0';
+
+        for(i = 0; i < paths_cnt; i++)
+            if(0 == strcmp(paths[i], pathname)) break;
+        if(i < paths_cnt || SNAPSHOT_PATHS_MAX == paths_cnt) continue;
+        if(NULL == (paths[paths_cnt] = strdup(pathname))) return 1;
+        paths_cnt++;
+    }
+    fclose(in);
+    fclose(out);
+
+    for(i = 0; i < paths_cnt; i++)
+    {
+        snprintf(dst, sizeof(dst), "%s/root%s", argv[2], paths[i]);
+        if(0 != mkdirs(dst)) continue;
+
+        //the process may run in another mount namespace
+        snprintf(src, sizeof(src), "/proc/%s/root%s", argv[1], paths[i]);
+        if(0 != copy_file(src, dst) && 0 != copy_file(paths[i], dst))
+        {
+            fprintf(stderr, "copy %s failed: %s\n", paths[i], strerror(errno));
+            continue;
+        }
+        copied++;
+    }
+    printf("%d of %d files saved to %s\n", copied, paths_cnt, argv[2]);
+    return 0;
+}
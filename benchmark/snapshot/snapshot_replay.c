@@ -0,0 +1,302 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include "xhook.h"
+#include "xh_util.h"
+
+//Replay a snapshot saved by snapshot_capture: map the saved files at the recorded
+//addresses, point xhook to the recorded maps, and time the refresh with a rule
+//manifest (the handler names are bound to a dummy function, nothing calls them).
+//Libraries which overlap the mappings of this process are skipped.
+//
+//Every iteration maps the files again, so the cold refresh always starts from the
+//unpatched slots, then a warm refresh (nothing to do) follows.
+//
+//The files must be of the arch of this host, this is built with the xhook sources.
+//
+//usage: snapshot_replay <dir> <manifest> [iterations]
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+#define REPLAY_ITERS_MAX 1000
+
+typedef struct
+{
+    uintptr_t  start;
+    uintptr_t  end;
+    char       perm[5];
+    off_t      offset;
+    char      *pathname;
+    char      *line;
+    int        lib; //index in libs, -1 if not mapped by us
+} replay_map_t;
+
+typedef struct
+{
+    char *pathname;
+    int   mapped;
+} replay_lib_t;
+
+static replay_map_t *maps;
+static size_t        maps_cnt;
+static replay_lib_t *libs;
+static size_t        libs_cnt;
+
+static int dummy_handler()
+{
+    return 0;
+}
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static char *read_file(const char *path, size_t *len)
+{
+    FILE *fp;
+    char *buf = NULL;
+    long  n;
+
+    if(NULL == (fp = fopen(path, "r"))) return NULL;
+    if(0 == fseek(fp, 0, SEEK_END) && (n = ftell(fp)) >= 0 && 0 == fseek(fp, 0, SEEK_SET) &&
+       NULL != (buf = malloc((size_t)n + 1)))
+    {
+        *len = fread(buf, 1, (size_t)n, fp);
+        buf[*len] = '\0';
+    }
+    fclose(fp);
+    return buf;
+}
+
+static int load_maps(const char *dir)
+{
+    char          path[4096], line[1024];
+    FILE         *fp;
+    replay_map_t  m;
+    int           pathname_pos;
+    size_t        len, i;
+    void         *p;
+
+    snprintf(path, sizeof(path), "%s/maps", dir);
+    if(NULL == (fp = fopen(path, "r"))) return -1;
+    while(fgets(line, sizeof(line), fp))
+    {
+        memset(&m, 0, sizeof(m));
+        if(sscanf(line, "%"SCNxPTR"-%"SCNxPTR" %4s %jx %*x:%*x %*d%n",
+                  &m.start, &m.end, m.perm, (uintmax_t *)&m.offset, &pathname_pos) != 4) continue;
+        for(m.pathname = line + pathname_pos; ' ' == *m.pathname; m.pathname++);
+        if('/' != *m.pathname || 'p' != m.perm[3]) continue;
+        if(NULL == (m.line = strdup(line))) return -1;
+        if((len = strlen(m.pathname)) > 0 && '\n' == m.pathname[len - 1]) m.pathname[len - 1] = '\0';
+        if(NULL == (m.pathname = strdup(m.pathname))) return -1;
+        if(NULL == (p = realloc(maps, (maps_cnt + 1) * sizeof(replay_map_t)))) return -1;
+        maps = (replay_map_t *)p;
+        maps[maps_cnt++] = m;
+    }
+    fclose(fp);
+
+    //the libraries: pathnames with an executable mapping, saved by snapshot_capture
+    for(i = 0; i < maps_cnt; i++)
+    {
+        maps[i].lib = -1;
+        if('x' != maps[i].perm[2]) continue;
+        for(len = 0; len < libs_cnt; len++)
+            if(0 == strcmp(libs[len].pathname, maps[i].pathname)) break;
+        if(len < libs_cnt) continue;
+        snprintf(path, sizeof(path), "%s/root%s", dir, maps[i].pathname);
+        if(0 != access(path, R_OK)) continue;
+        if(NULL == (p = realloc(libs, (libs_cnt + 1) * sizeof(replay_lib_t)))) return -1;
+        libs = (replay_lib_t *)p;
+        libs[libs_cnt].pathname = maps[i].pathname;
+        libs[libs_cnt].mapped = 1;
+        libs_cnt++;
+    }
+    for(i = 0; i < maps_cnt; i++)
+        for(len = 0; len < libs_cnt; len++)
+            if(0 == strcmp(libs[len].pathname, maps[i].pathname)) maps[i].lib = (int)len;
+    return 0;
+}
+
+static int prot_of(const char *perm)
+{
+    return ('r' == perm[0] ? PROT_READ : 0) | ('w' == perm[1] ? PROT_WRITE : 0) | ('x' == perm[2] ? PROT_EXEC : 0);
+}
+
+//map every segment of every library, skip the library if one of them overlaps
+//first: MAP_FIXED_NOREPLACE; later: MAP_FIXED over our own mappings
+static void map_libs(const char *dir, int first)
+{
+    char    path[4096];
+    size_t  i, j;
+    void   *p;
+    int     fd;
+
+    for(i = 0; i < maps_cnt; i++)
+    {
+        if(maps[i].lib < 0 || !libs[maps[i].lib].mapped) continue;
+        snprintf(path, sizeof(path), "%s/root%s", dir, maps[i].pathname);
+        if((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+            p = MAP_FAILED;
+        else
+        {
+            p = mmap((void *)maps[i].start, maps[i].end - maps[i].start, prot_of(maps[i].perm),
+                     MAP_PRIVATE | (first ? MAP_FIXED_NOREPLACE : MAP_FIXED), fd, maps[i].offset);
+            close(fd);
+        }
+        if(MAP_FAILED != p && (uintptr_t)p == maps[i].start) continue;
+        if(MAP_FAILED != p) munmap(p, maps[i].end - maps[i].start); //old kernel, hint only
+
+        fprintf(stderr, "skip %s: %"PRIxPTR" is in use\n", maps[i].pathname, maps[i].start);
+        libs[maps[i].lib].mapped = 0;
+        for(j = 0; j < i; j++)
+            if(maps[j].lib == maps[i].lib) munmap((void *)maps[j].start, maps[j].end - maps[j].start);
+    }
+}
+
+//the recorded lines of the mapped libraries only
+static int write_replay_maps(const char *dir, char *path, size_t path_len)
+{
+    FILE   *fp;
+    size_t  i;
+
+    snprintf(path, path_len, "%s/maps.replay", dir);
+    if(NULL == (fp = fopen(path, "w"))) return -1;
+    for(i = 0; i < maps_cnt; i++)
+        if(maps[i].lib >= 0 && libs[maps[i].lib].mapped) fputs(maps[i].line, fp);
+    fclose(fp);
+    return 0;
+}
+
+//bind the handler names of the "hook" lines to the dummy function
+static int add_handlers(const char *manifest)
+{
+    xhook_handler_t  h;
+    char            *buf, *line, *save = NULL, *save2, *tok, *tokens[4];
+    int              n, r = 0;
+
+    if(NULL == (buf = strdup(manifest))) return -1;
+    for(line = strtok_r(buf, "\n", &save); NULL != line && 0 == r; line = strtok_r(NULL, "\n", &save))
+    {
+        save2 = NULL;
+        for(n = 0, tok = strtok_r(line, " \t\r", &save2); NULL != tok && n < 4; tok = strtok_r(NULL, " \t\r", &save2))
+            tokens[n++] = tok;
+        if(4 != n || 0 != strcmp(tokens[0], "hook")) continue;
+        h.name = tokens[3];
+        h.new_func = (void *)dummy_handler;
+        h.old_func = NULL;
+        r = xhook_add_handlers(&h, 1);
+    }
+    free(buf);
+    return r;
+}
+
+static void print_ns(const char *name, uint64_t *ns, int cnt)
+{
+    qsort(ns, (size_t)cnt, sizeof(uint64_t), cmp_u64);
+    printf("%-6s %10.1f %10.1f %10.1f\n", name, (double)ns[cnt / 2] / 1e3, (double)ns[0] / 1e3,
+           (double)ns[cnt - 1] / 1e3);
+}
+
+int main(int argc, char **argv)
+{
+    char      replay_maps[4096];
+    char     *manifest;
+    size_t    manifest_len = 0, i, mapped = 0;
+    int       iters = (argc > 3 ? atoi(argv[3]) : 10);
+    uint64_t  cold[REPLAY_ITERS_MAX], warm[REPLAY_ITERS_MAX], t;
+    int       n, r;
+
+    if(argc < 3)
+    {
+        fprintf(stderr, "usage: %s <dir> <manifest> [iterations]\n", argv[0]);
+        return 1;
+    }
+    if(iters < 1) iters = 1;
+    if(iters > REPLAY_ITERS_MAX) iters = REPLAY_ITERS_MAX;
+
+    if(0 != load_maps(argv[1]))
+    {
+        fprintf(stderr, "load %s/maps failed\n", argv[1]);
+        return 1;
+    }
+    if(NULL == (manifest = read_file(argv[2], &manifest_len)) || 0 != add_handlers(manifest))
+    {
+        fprintf(stderr, "load manifest %s failed\n", argv[2]);
+        return 1;
+    }
+
+    map_libs(argv[1], 1);
+    for(i = 0; i < libs_cnt; i++)
+        if(libs[i].mapped) mapped++;
+    if(0 != write_replay_maps(argv[1], replay_maps, sizeof(replay_maps))) return 1;
+    xh_util_set_maps_path(replay_maps);
+
+    printf("%zu libraries mapped, %zu skipped, %d iterations, refresh time in us\n",
+           mapped, libs_cnt - mapped, iters);
+    printf("%-6s %10s %10s %10s\n", "", "median", "min", "max");
+    for(n = 0; n < iters; n++)
+    {
+        if(n > 0) map_libs(argv[1], 0);
+
+        xhook_clear();
+        if(0 != (r = xhook_register_manifest(manifest, manifest_len)))
+        {
+            fprintf(stderr, "register manifest failed: %d\n", r);
+            return 1;
+        }
+        t = now_ns();
+        if(0 != (r = xhook_refresh(0))) fprintf(stderr, "refresh failed: %d\n", r);
+        cold[n] = now_ns() - t;
+
+        t = now_ns();
+        xhook_refresh(0);
+        warm[n] = now_ns() - t;
+    }
+    print_ns("cold", cold, iters);
+    print_ns("warm", warm, iters);
+
+    xhook_clear();
+    xh_util_set_maps_path(NULL);
+    free(manifest);
+    return 0;
+}
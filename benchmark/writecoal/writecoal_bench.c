@@ -0,0 +1,157 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "xhook.h"
+#include "writecoal.h"
+
+//Threads write log lines to one O_APPEND file through libbench_write.so, one write()
+//per line, without and with the shim. The write syscalls are counted by the kernel
+//(syscw of /proc/self/io), and the file is checked: every line is there, and the
+//lines of each thread are in order.
+//
+//usage: writecoal_bench [threads] [lines per thread]
+
+#define BENCH_BUFFER_SIZE   (64 * 1024)
+#define BENCH_MAX_DELAY_MS  100
+
+extern void bench_write_lines(int fd, int thread, size_t cnt);
+extern int  bench_write_close(int fd);
+
+typedef struct
+{
+    pthread_t tid;
+    int       fd;
+    int       idx;
+    size_t    cnt;
+} bench_worker_t;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t write_syscalls()
+{
+    char     line[128];
+    uint64_t v = 0;
+    FILE    *fp;
+
+    if(NULL == (fp = fopen("/proc/self/io", "r"))) return 0;
+    while(fgets(line, sizeof(line), fp))
+        if(1 == sscanf(line, "syscw: %"SCNu64, &v)) break;
+    fclose(fp);
+    return v;
+}
+
+static void *worker_func(void *arg)
+{
+    bench_worker_t *w = (bench_worker_t *)arg;
+    bench_write_lines(w->fd, w->idx, w->cnt);
+    return NULL;
+}
+
+//every line present, each thread's lines in order
+static int check(const char *path, int threads, size_t cnt)
+{
+    char     line[128];
+    size_t  *next = calloc((size_t)threads, sizeof(size_t));
+    size_t   seq, lines = 0;
+    int      t, ok = 1;
+    FILE    *fp;
+
+    if(NULL == next || NULL == (fp = fopen(path, "r"))) return 0;
+    while(fgets(line, sizeof(line), fp))
+    {
+        lines++;
+        if(2 != sscanf(line, "t%d %zu", &t, &seq) || t < 0 || t >= threads || seq != next[t]++) ok = 0;
+    }
+    fclose(fp);
+    free(next);
+    return ok && lines == (size_t)threads * cnt;
+}
+
+static void run(const char *name, const char *path, int threads, size_t cnt)
+{
+    bench_worker_t *ws = calloc((size_t)threads, sizeof(bench_worker_t));
+    uint64_t        sys0, sys1, t0, t1;
+    int             i, fd;
+
+    if(NULL == ws) exit(1);
+    if((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644)) < 0) exit(1);
+
+    sys0 = write_syscalls();
+    t0 = now_ns();
+    for(i = 0; i < threads; i++)
+    {
+        ws[i].fd = fd;
+        ws[i].idx = i;
+        ws[i].cnt = cnt;
+        pthread_create(&ws[i].tid, NULL, worker_func, &ws[i]);
+    }
+    for(i = 0; i < threads; i++)
+        pthread_join(ws[i].tid, NULL);
+    bench_write_close(fd); //flushed here
+    t1 = now_ns();
+    sys1 = write_syscalls();
+
+    printf("%-8s %10.1f %12llu %14.2f %8s\n", name, (double)(t1 - t0) / 1e6, (unsigned long long)(sys1 - sys0),
+           (double)(sys1 - sys0) * 1e3 / ((double)(t1 - t0) / 1e6), check(path, threads, cnt) ? "ok" : "BROKEN");
+    free(ws);
+}
+
+int main(int argc, char **argv)
+{
+    int               threads = (argc > 1 ? atoi(argv[1]) : 4);
+    size_t            cnt = (argc > 2 ? (size_t)atol(argv[2]) : 100000);
+    char              path[64];
+    writecoal_stats_t stats;
+
+    if(threads < 1) threads = 1;
+    snprintf(path, sizeof(path), "/tmp/writecoal_bench.%d.log", (int)getpid());
+
+    printf("%d threads x %zu lines\n", threads, cnt);
+    printf("%-8s %10s %12s %14s %8s\n", "phase", "ms", "syscalls", "syscalls/s", "order");
+    run("direct", path, threads, cnt);
+
+    if(0 != writecoal_init(BENCH_BUFFER_SIZE, BENCH_MAX_DELAY_MS)) return 1;
+    if(0 != writecoal_register(".*/libbench_write\\.so$")) return 1;
+    if(0 != xhook_refresh(0)) return 1;
+    run("buffered", path, threads, cnt);
+
+    writecoal_get_stats(&stats);
+    printf("buffered %llu writes, %llu bytes, in %llu flushes, %llu bytes dropped\n",
+           (unsigned long long)stats.writes, (unsigned long long)stats.bytes,
+           (unsigned long long)stats.flushes, (unsigned long long)stats.dropped_bytes);
+    unlink(path);
+    return 0;
+}
@@ -1,5 +1,12 @@
 #!/bin/bash
 
 ndk-build -C ./libxhook/jni
+ndk-build -C ./libloglimit/jni #before libbiz, which links it
 ndk-build -C ./libbiz/jni
 ndk-build -C ./libtest/jni
+ndk-build -C ./libheapprof/jni
+ndk-build -C ./liblockprof/jni
+ndk-build -C ./libthreadgov/jni
+ndk-build -C ./libwritecoal/jni
+ndk-build -C ./libarena/jni
+ndk-build -C ./libloadprof/jni
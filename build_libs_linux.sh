@@ -0,0 +1,80 @@
+#!/bin/bash
+
+# Build libxhook, modules and benchmarks for Linux host (x86_64 or aarch64).
+
+set -e
+
+CC=${CC:-cc}
+OUT=./libs_linux
+CFLAGS="-std=c11 -D_GNU_SOURCE -O2 -g -fPIC -Wall -Wextra -Werror"
+XHOOK_SRC="libxhook/jni/xhook.c \
+           libxhook/jni/xh_core.c \
+           libxhook/jni/xh_discovery.c \
+           libxhook/jni/xh_elf.c \
+           libxhook/jni/xh_governor.c \
+           libxhook/jni/xh_log.c \
+           libxhook/jni/xh_manifest.c \
+           libxhook/jni/xh_oneshot.c \
+           libxhook/jni/xh_stats.c \
+           libxhook/jni/xh_stub.c \
+           libxhook/jni/xh_trace.c \
+           libxhook/jni/xh_util.c \
+           libxhook/jni/xh_version.c"
+
+mkdir -p $OUT
+
+# libxhook, and libxhook_agent with the agent constructor for LD_PRELOAD
+$CC $CFLAGS -fvisibility=hidden -shared -o $OUT/libxhook.so $XHOOK_SRC -Ilibxhook/jni -ldl -lpthread
+$CC $CFLAGS -fvisibility=hidden -shared -o $OUT/libxhook_agent.so $XHOOK_SRC libxhook/jni/xh_agent.c \
+    -Ilibxhook/jni -ldl -lpthread
+
+# modules
+$CC $CFLAGS -fvisibility=hidden -shared -o $OUT/libheapprof.so libheapprof/jni/heapprof.c \
+    -Ilibxhook/jni -L$OUT -lxhook -ldl -lm -lpthread
+$CC $CFLAGS -fvisibility=hidden -shared -o $OUT/liblockprof.so liblockprof/jni/lockprof.c \
+    -Ilibxhook/jni -L$OUT -lxhook -ldl -lpthread
+$CC $CFLAGS -fvisibility=hidden -shared -o $OUT/libthreadgov.so libthreadgov/jni/threadgov.c \
+    -Ilibxhook/jni -L$OUT -lxhook -ldl -lpthread
+$CC $CFLAGS -fvisibility=hidden -shared -o $OUT/libwritecoal.so libwritecoal/jni/writecoal.c \
+    -Ilibxhook/jni -L$OUT -lxhook -ldl -lpthread
+$CC $CFLAGS -fvisibility=hidden -shared -o $OUT/libloglimit.so libloglimit/jni/loglimit.c \
+    -Ilibxhook/jni -L$OUT -lxhook -ldl -lpthread
+$CC $CFLAGS -fvisibility=hidden -shared -o $OUT/libarena.so libarena/jni/arena.c \
+    -Ilibxhook/jni -L$OUT -lxhook -ldl -lpthread
+$CC $CFLAGS -fvisibility=hidden -shared -o $OUT/libloadprof.so libloadprof/jni/loadprof.c \
+    -Ilibxhook/jni -L$OUT -lxhook -ldl -lpthread
+
+# benchmarks
+$CC $CFLAGS -O0 -shared -o $OUT/libbench_alloc.so benchmark/heapprof/bench_alloc.c
+$CC $CFLAGS -o $OUT/heapprof_bench benchmark/heapprof/heapprof_bench.c \
+    -Ilibxhook/jni -Ilibheapprof/jni -L$OUT -lheapprof -lxhook -lbench_alloc -Wl,-rpath,'$ORIGIN'
+$CC $CFLAGS -shared -o $OUT/libbench_lock.so benchmark/lockprof/bench_lock.c -lpthread
+$CC $CFLAGS -o $OUT/lockprof_bench benchmark/lockprof/lockprof_bench.c \
+    -Ilibxhook/jni -Iliblockprof/jni -L$OUT -llockprof -lxhook -lbench_lock -lpthread -Wl,-rpath,'$ORIGIN'
+$CC $CFLAGS -shared -o $OUT/libbench_load.so benchmark/loadprof/bench_load.c -ldl
+$CC $CFLAGS -shared -o $OUT/libbench_load_mid.so benchmark/loadprof/bench_load_mid.c \
+    -L$OUT -lbench_load -ldl -Wl,-rpath,'$ORIGIN'
+$CC $CFLAGS -shared -o $OUT/libbench_load_leaf.so benchmark/loadprof/bench_load_leaf.c \
+    -L$OUT -lbench_load -Wl,-rpath,'$ORIGIN'
+$CC $CFLAGS -o $OUT/loadprof_bench benchmark/loadprof/loadprof_bench.c \
+    -Ilibxhook/jni -Ilibloadprof/jni -L$OUT -lloadprof -lxhook -lbench_load -ldl -Wl,-rpath,'$ORIGIN'
+$CC $CFLAGS -shared -o $OUT/libbench_arena.so benchmark/arena/bench_arena.c
+$CC $CFLAGS -o $OUT/arena_bench benchmark/arena/arena_bench.c \
+    -Ilibxhook/jni -Ilibarena/jni -L$OUT -larena -lxhook -lbench_arena -lpthread -Wl,-rpath,'$ORIGIN'
+$CC $CFLAGS -shared -o $OUT/libbench_log.so benchmark/loglimit/bench_log.c
+$CC $CFLAGS -o $OUT/loglimit_bench benchmark/loglimit/loglimit_bench.c \
+    -Ilibxhook/jni -Ilibloglimit/jni -L$OUT -lloglimit -lxhook -lbench_log -lpthread -Wl,-rpath,'$ORIGIN'
+$CC $CFLAGS -shared -o $OUT/libbench_write.so benchmark/writecoal/bench_write.c
+$CC $CFLAGS -o $OUT/writecoal_bench benchmark/writecoal/writecoal_bench.c \
+    -Ilibxhook/jni -Ilibwritecoal/jni -L$OUT -lwritecoal -lxhook -lbench_write -lpthread -Wl,-rpath,'$ORIGIN'
+$CC $CFLAGS -shared -o $OUT/libbench_dep.so benchmark/refresh/bench_dep.c
+$CC $CFLAGS -shared -o $OUT/libbench_target.so benchmark/refresh/bench_target.c -L$OUT -lbench_dep -Wl,-rpath,'$ORIGIN'
+$CC $CFLAGS -o $OUT/refresh_bench benchmark/refresh/refresh_bench.c \
+    -Ilibxhook/jni -L$OUT -lxhook -lbench_target -lbench_dep -lpthread -Wl,-rpath,'$ORIGIN'
+$CC $CFLAGS -shared -o $OUT/libcallpath_callee.so benchmark/callpath/callpath_callee.c
+$CC $CFLAGS -shared -Wl,-z,now -o $OUT/libcallpath_caller.so benchmark/callpath/callpath_caller.c \
+    -L$OUT -lcallpath_callee -Wl,-rpath,'$ORIGIN'
+$CC $CFLAGS -o $OUT/callpath_bench benchmark/callpath/callpath_bench.c \
+    -Ilibxhook/jni -Ibenchmark/callpath -L$OUT -lxhook -lcallpath_caller -lcallpath_callee -Wl,-rpath,'$ORIGIN'
+$CC $CFLAGS -o $OUT/snapshot_capture benchmark/snapshot/snapshot_capture.c
+$CC $CFLAGS -o $OUT/snapshot_replay benchmark/snapshot/snapshot_replay.c $XHOOK_SRC -Ilibxhook/jni -ldl -lpthread
@@ -3,3 +3,10 @@
 ndk-build -C ./libbiz/jni clean
 ndk-build -C ./libxhook/jni clean
 ndk-build -C ./libtest/jni clean
+ndk-build -C ./libheapprof/jni clean
+ndk-build -C ./liblockprof/jni clean
+ndk-build -C ./libthreadgov/jni clean
+ndk-build -C ./libwritecoal/jni clean
+ndk-build -C ./libarena/jni clean
+ndk-build -C ./libloadprof/jni clean
+ndk-build -C ./libloglimit/jni clean
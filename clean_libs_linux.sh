@@ -0,0 +1,3 @@
+#!/bin/bash
+
+rm -rf ./libs_linux
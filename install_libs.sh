@@ -24,6 +24,12 @@ cp -f ./libbiz/libs/arm64-v8a/libbiz.so       ./xhookwrapper/biz/libs/arm64-v8a/
 cp -f ./libbiz/libs/x86/libbiz.so             ./xhookwrapper/biz/libs/x86/
 cp -f ./libbiz/libs/x86_64/libbiz.so          ./xhookwrapper/biz/libs/x86_64/
 
+cp -f ./libloglimit/libs/armeabi/libloglimit.so     ./xhookwrapper/biz/libs/armeabi/
+cp -f ./libloglimit/libs/armeabi-v7a/libloglimit.so ./xhookwrapper/biz/libs/armeabi-v7a/
+cp -f ./libloglimit/libs/arm64-v8a/libloglimit.so   ./xhookwrapper/biz/libs/arm64-v8a/
+cp -f ./libloglimit/libs/x86/libloglimit.so         ./xhookwrapper/biz/libs/x86/
+cp -f ./libloglimit/libs/x86_64/libloglimit.so      ./xhookwrapper/biz/libs/x86_64/
+
 mkdir -p ./xhookwrapper/app/libs/armeabi
 mkdir -p ./xhookwrapper/app/libs/armeabi-v7a
 mkdir -p ./xhookwrapper/app/libs/arm64-v8a
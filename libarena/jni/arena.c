@@ -0,0 +1,910 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <regex.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include "xhook.h"
+#include "arena.h"
+
+//malloc/calloc/memalign/posix_memalign/aligned_alloc of the matched libraries are served
+//from an arena per library. All the arenas live in one address range reserved by
+//arena_init(), so "is it ours" is one compare: free/realloc/malloc_usable_size are
+//hooked in all libraries and send the pointers of the range to their arena and the
+//others to libc, whoever allocated and whoever frees them.
+//
+//The range is cut into 64KB spans. A small size (up to 16KB, 36 classes, all multiples
+//of 16) is served from the spans of its class in the caller's arena, through a cache of
+//a few objects per thread, per arena and per class, so most calls take no lock. A larger
+//size takes a run of whole spans, given back (MADV_DONTNEED) to a free-run list when
+//freed. The spans of the small classes stay with their class.
+//
+//Not redirected: the allocations libc makes for the library (strdup, fopen ...) and the
+//C++ operators new/delete, which call malloc from libc++/libstdc++ and not from the
+//library. They are normal libc pointers for the free hook.
+//
+//libc can't tell an arena pointer from its own: one freed or resized by a call which
+//doesn't go through a hooked GOT slot corrupts the heap. That's a library loaded after
+//the last refresh, or libc itself freeing a buffer of the caller without its PLT (glibc
+//goes through it, so its slots are hooked too, bionic doesn't). getline/getdelim (their
+//internal realloc) and reallocarray are hooked in all libraries for that: the buffer is
+//moved to libc before the call. See the contract in arena.h.
+
+#define ARENA_MAX            16
+#define ARENA_LIBS_MAX       256
+#define ARENA_PATHNAME_MAX   256
+#define ARENA_SITES_MAX      1024 //power of 2
+#define ARENA_PROBE_MAX      16
+#define ARENA_POLICIES_MAX   32
+
+#define ARENA_SPAN_SHIFT     16
+#define ARENA_SPAN_SIZE      ((size_t)1 << ARENA_SPAN_SHIFT)
+#define ARENA_COMMIT_SIZE    ((size_t)4 << 20) //mprotect the reserved range in these steps
+#define ARENA_SMALL_MAX      16384
+#define ARENA_CLASSES        36
+#define ARENA_CLASS_LARGE    0xff
+#define ARENA_RUN_NONE       UINT32_MAX
+#define ARENA_CACHE_BATCH    32 //objects moved between a thread cache and its class at once
+#define ARENA_PUBLISH_OPS    64 //a thread publishes its accounting every N calls
+
+#if defined(__LP64__)
+#define ARENA_RESERVE_DEFAULT ((size_t)16 << 30)
+#else
+#define ARENA_RESERVE_DEFAULT ((size_t)256 << 20)
+#endif
+
+#define ARENA_TLS_DEAD       ((void *)1) //the thread cache has been destroyed
+
+#if (defined(__ANDROID__) && __ANDROID_API__ >= 29) || \
+    (defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 26))
+#define ARENA_HAVE_REALLOCARRAY 1
+#else
+#define ARENA_HAVE_REALLOCARRAY 0
+#endif
+
+//span metadata, indexed by (addr - base) >> ARENA_SPAN_SHIFT
+typedef struct
+{
+    uint16_t arena; //index + 1, 0: not in use
+    uint8_t  cls;   //or ARENA_CLASS_LARGE
+    uint8_t  reserved;
+    uint32_t run;   //spans in the run, at the first span of a large or free run
+    uint32_t next;  //free-run list
+} arena_span_t;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    void           *free_list;
+    uintptr_t       cur; //unused part of the class's newest span
+    uintptr_t       end;
+} arena_class_t;
+
+typedef struct
+{
+    int           idx;
+    const char   *pathname;
+    arena_class_t classes[ARENA_CLASSES];
+    int64_t       bytes_in_use;
+    uint64_t      bytes_mapped;
+    uint64_t      allocs;
+    uint64_t      frees;
+    uint64_t      fallbacks;
+} arena_t;
+
+//caller library (interned, never removed)
+typedef struct
+{
+    uintptr_t  base;
+    char       pathname[ARENA_PATHNAME_MAX];
+    arena_t   *arena; //NULL: not matched
+} arena_lib_t;
+
+//call site -> caller library
+typedef struct
+{
+    uintptr_t    caller; //0: empty, written last
+    arena_lib_t *lib;
+} arena_site_t;
+
+typedef struct
+{
+    void     *head;
+    uint32_t  cnt;
+} arena_cache_t;
+
+//one thread's view of one arena
+typedef struct
+{
+    arena_cache_t caches[ARENA_CLASSES];
+    int64_t       bytes_in_use;
+    uint64_t      allocs;
+    uint64_t      frees;
+    uint32_t      ops;
+} arena_tcache_t;
+
+typedef struct
+{
+    arena_tcache_t *tcaches[ARENA_MAX];
+} arena_tls_t;
+
+static int               arena_inited = 0;
+static uintptr_t         arena_base;
+static size_t            arena_size;
+static arena_span_t     *arena_spans;
+static size_t            arena_spans_cnt;
+static size_t            arena_spans_used = 0;      //bump
+static size_t            arena_spans_committed = 0; //readable and writable
+static uint32_t          arena_free_runs = ARENA_RUN_NONE;
+static pthread_mutex_t   arena_spans_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t     arena_tls_key;
+static pthread_key_t     arena_resolving_key;
+
+static arena_t           arenas[ARENA_MAX];
+static size_t            arenas_cnt = 0;
+static regex_t           arena_rules[ARENA_POLICIES_MAX];
+static size_t            arena_rules_cnt = 0;
+static arena_lib_t       arena_libs[ARENA_LIBS_MAX] = {{.pathname = "unknown"}};
+static size_t            arena_libs_cnt = 1; //0 is reserved for unknown
+static arena_site_t      arena_sites[ARENA_SITES_MAX];
+static pthread_mutex_t   arena_mutex = PTHREAD_MUTEX_INITIALIZER; //never held while calling out
+static pthread_mutex_t   arena_register_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int               arena_global_hooked = 0;
+
+static size_t arena_class_size(int cls)
+{
+    int k, shift;
+
+    if(cls < 8) return (size_t)(cls + 1) * 16;
+    k = cls - 8;
+    shift = 7 + k / 4;
+    return ((size_t)1 << shift) + (size_t)(k % 4 + 1) * ((size_t)1 << (shift - 2));
+}
+
+//16, 32 ... 128, then 4 classes per power of 2 up to ARENA_SMALL_MAX
+static int arena_size_class(size_t size)
+{
+    int shift;
+
+    if(size <= 128) return (size <= 16 ? 0 : (int)((size + 15) >> 4) - 1);
+    shift = (int)(sizeof(unsigned long) * 8 - 1) - __builtin_clzl((unsigned long)(size - 1));
+    return 8 + (shift - 7) * 4 + (int)(((size - 1) >> (shift - 2)) & 3);
+}
+
+//how many objects move between a thread cache and its class at once
+static uint32_t arena_class_batch(int cls)
+{
+    size_t n = ARENA_SPAN_SIZE / arena_class_size(cls) / 4;
+    return (uint32_t)(n < 1 ? 1 : (n > ARENA_CACHE_BATCH ? ARENA_CACHE_BATCH : n));
+}
+
+static int arena_owns(const void *ptr)
+{
+    return (uintptr_t)ptr - arena_base < arena_size;
+}
+
+static arena_span_t *arena_span_of(const void *ptr)
+{
+    return &arena_spans[((uintptr_t)ptr - arena_base) >> ARENA_SPAN_SHIFT];
+}
+
+static void *arena_span_addr(size_t idx)
+{
+    return (void *)(arena_base + (idx << ARENA_SPAN_SHIFT));
+}
+
+//a run of n spans, NULL if the range is exhausted
+static void *arena_spans_alloc(arena_t *arena, size_t n, uint8_t cls)
+{
+    uint32_t *prev, cur;
+    size_t    idx = 0, commit;
+    int       found = 0;
+
+    pthread_mutex_lock(&arena_spans_mutex);
+
+    //first fit in the free runs
+    for(prev = &arena_free_runs; ARENA_RUN_NONE != (cur = *prev); prev = &arena_spans[cur].next)
+    {
+        if(arena_spans[cur].run < n) continue;
+        idx = cur;
+        if(arena_spans[cur].run > n)
+        {
+            arena_spans[cur + n].run = arena_spans[cur].run - (uint32_t)n;
+            arena_spans[cur + n].next = arena_spans[cur].next;
+            *prev = (uint32_t)(cur + n);
+        }
+        else
+            *prev = arena_spans[cur].next;
+        found = 1;
+        break;
+    }
+
+    if(!found)
+    {
+        if(arena_spans_used + n > arena_spans_cnt) goto err;
+        idx = arena_spans_used;
+        if(idx + n > arena_spans_committed)
+        {
+            commit = ((((idx + n) << ARENA_SPAN_SHIFT) + ARENA_COMMIT_SIZE - 1) & ~(ARENA_COMMIT_SIZE - 1)) >> ARENA_SPAN_SHIFT;
+            if(commit > arena_spans_cnt) commit = arena_spans_cnt;
+            if(0 != mprotect(arena_span_addr(arena_spans_committed), (commit - arena_spans_committed) << ARENA_SPAN_SHIFT,
+                             PROT_READ | PROT_WRITE)) goto err;
+            arena_spans_committed = commit;
+        }
+        arena_spans_used += n;
+    }
+
+    arena_spans[idx].arena = (uint16_t)(arena->idx + 1);
+    arena_spans[idx].cls = cls;
+    arena_spans[idx].run = (uint32_t)n;
+    pthread_mutex_unlock(&arena_spans_mutex);
+
+    __atomic_add_fetch(&arena->bytes_mapped, n << ARENA_SPAN_SHIFT, __ATOMIC_RELAXED);
+    return arena_span_addr(idx);
+
+ err:
+    pthread_mutex_unlock(&arena_spans_mutex);
+    return NULL;
+}
+
+static void arena_spans_free(arena_t *arena, void *ptr)
+{
+    size_t idx = ((uintptr_t)ptr - arena_base) >> ARENA_SPAN_SHIFT;
+    size_t n = arena_spans[idx].run;
+
+    madvise(ptr, n << ARENA_SPAN_SHIFT, MADV_DONTNEED); //zero filled when reused
+
+    pthread_mutex_lock(&arena_spans_mutex);
+    arena_spans[idx].arena = 0;
+    arena_spans[idx].next = arena_free_runs;
+    arena_free_runs = (uint32_t)idx;
+    pthread_mutex_unlock(&arena_spans_mutex);
+
+    __atomic_sub_fetch(&arena->bytes_mapped, n << ARENA_SPAN_SHIFT, __ATOMIC_RELAXED);
+}
+
+//move up to max objects of the class to *list, returns the count
+static uint32_t arena_class_take(arena_t *arena, int cls, uint32_t max, void **list)
+{
+    arena_class_t *c = &arena->classes[cls];
+    size_t         size = arena_class_size(cls);
+    uint32_t       n = 0;
+    void          *obj, *span;
+
+    pthread_mutex_lock(&c->lock);
+    while(n < max)
+    {
+        if(NULL != (obj = c->free_list))
+            c->free_list = *(void **)obj;
+        else if(c->cur + size <= c->end)
+        {
+            obj = (void *)c->cur;
+            c->cur += size;
+        }
+        else if(0 == n && NULL != (span = arena_spans_alloc(arena, 1, (uint8_t)cls)))
+        {
+            c->cur = (uintptr_t)span;
+            c->end = (uintptr_t)span + ARENA_SPAN_SIZE;
+            continue;
+        }
+        else
+            break;
+        *(void **)obj = *list;
+        *list = obj;
+        n++;
+    }
+    pthread_mutex_unlock(&c->lock);
+    return n;
+}
+
+//give n objects back to the class
+static void arena_class_put(arena_t *arena, int cls, void *head, void *tail)
+{
+    arena_class_t *c = &arena->classes[cls];
+
+    pthread_mutex_lock(&c->lock);
+    *(void **)tail = c->free_list;
+    c->free_list = head;
+    pthread_mutex_unlock(&c->lock);
+}
+
+static void arena_tcache_publish(arena_t *arena, arena_tcache_t *tc)
+{
+    __atomic_add_fetch(&arena->bytes_in_use, tc->bytes_in_use, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&arena->allocs, tc->allocs, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&arena->frees, tc->frees, __ATOMIC_RELAXED);
+    tc->bytes_in_use = 0;
+    tc->allocs = 0;
+    tc->frees = 0;
+    tc->ops = 0;
+}
+
+static void arena_tls_free(void *arg)
+{
+    arena_tls_t    *tls = (arena_tls_t *)arg;
+    arena_tcache_t *tc;
+    arena_cache_t  *cache;
+    void           *tail;
+    size_t          i;
+    int             cls;
+
+    if(ARENA_TLS_DEAD == arg) return;
+
+    for(i = 0; i < ARENA_MAX; i++)
+    {
+        if(NULL == (tc = tls->tcaches[i])) continue;
+        for(cls = 0; cls < ARENA_CLASSES; cls++)
+        {
+            cache = &tc->caches[cls];
+            if(NULL == cache->head) continue;
+            for(tail = cache->head; NULL != *(void **)tail; tail = *(void **)tail);
+            arena_class_put(&arenas[i], cls, cache->head, tail);
+        }
+        arena_tcache_publish(&arenas[i], tc);
+        free(tc);
+    }
+    free(tls);
+
+    //the later calls of this thread (other TLS destructors) go to the classes directly
+    pthread_setspecific(arena_tls_key, ARENA_TLS_DEAD);
+}
+
+//NULL: no cache, use the classes directly
+static arena_tcache_t *arena_tcache_get(arena_t *arena)
+{
+    arena_tls_t *tls = (arena_tls_t *)pthread_getspecific(arena_tls_key);
+
+    if(ARENA_TLS_DEAD == tls) return NULL;
+    if(NULL == tls)
+    {
+        if(NULL == (tls = calloc(1, sizeof(arena_tls_t)))) return NULL;
+        if(0 != pthread_setspecific(arena_tls_key, tls))
+        {
+            free(tls);
+            return NULL;
+        }
+    }
+    if(NULL == tls->tcaches[arena->idx])
+        tls->tcaches[arena->idx] = calloc(1, sizeof(arena_tcache_t));
+    return tls->tcaches[arena->idx];
+}
+
+static void arena_account(arena_t *arena, arena_tcache_t *tc, int64_t bytes)
+{
+    if(NULL == tc)
+    {
+        __atomic_add_fetch(&arena->bytes_in_use, bytes, __ATOMIC_RELAXED);
+        __atomic_add_fetch(bytes > 0 ? &arena->allocs : &arena->frees, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    tc->bytes_in_use += bytes;
+    if(bytes > 0) tc->allocs++;
+    else tc->frees++;
+    if(++tc->ops >= ARENA_PUBLISH_OPS) arena_tcache_publish(arena, tc);
+}
+
+static void *arena_small_alloc(arena_t *arena, int cls)
+{
+    arena_tcache_t *tc = arena_tcache_get(arena);
+    arena_cache_t  *cache;
+    void           *obj = NULL;
+
+    if(NULL == tc)
+    {
+        if(0 == arena_class_take(arena, cls, 1, &obj)) return NULL;
+    }
+    else
+    {
+        cache = &tc->caches[cls];
+        if(NULL == cache->head)
+            cache->cnt = arena_class_take(arena, cls, arena_class_batch(cls), &cache->head);
+        if(NULL == (obj = cache->head)) return NULL;
+        cache->head = *(void **)obj;
+        cache->cnt--;
+    }
+    arena_account(arena, tc, (int64_t)arena_class_size(cls));
+    return obj;
+}
+
+static void arena_small_free(arena_t *arena, int cls, void *obj)
+{
+    arena_tcache_t *tc = arena_tcache_get(arena);
+    arena_cache_t  *cache;
+    uint32_t        batch, i;
+    void           *head, *tail;
+
+    if(NULL == tc)
+        arena_class_put(arena, cls, obj, obj);
+    else
+    {
+        cache = &tc->caches[cls];
+        *(void **)obj = cache->head;
+        cache->head = obj;
+        cache->cnt++;
+
+        //keep at most 2 batches per class
+        batch = arena_class_batch(cls);
+        if(cache->cnt > batch * 2)
+        {
+            head = tail = cache->head;
+            for(i = 1; i < batch; i++)
+                tail = *(void **)tail;
+            cache->head = *(void **)tail;
+            cache->cnt -= batch;
+            arena_class_put(arena, cls, head, tail);
+        }
+    }
+    arena_account(arena, tc, -(int64_t)arena_class_size(cls));
+}
+
+//align: power of 2, 0 for the default; NULL: let libc do it
+static void *arena_alloc(arena_t *arena, size_t size, size_t align)
+{
+    size_t n;
+
+    if(0 == size) size = 1;
+    if(align > 16)
+    {
+        //the power of 2 classes are aligned to their size, the runs to ARENA_SPAN_SIZE
+        if(align > ARENA_SPAN_SIZE) return NULL;
+        if(size < align) size = align;
+        if(size <= ARENA_SMALL_MAX) size = (size_t)1 << (sizeof(unsigned long) * 8 - (size_t)__builtin_clzl((unsigned long)(size - 1)));
+    }
+    if(size <= ARENA_SMALL_MAX) return arena_small_alloc(arena, arena_size_class(size));
+
+    if(size > arena_size) return NULL;
+    n = (size + ARENA_SPAN_SIZE - 1) >> ARENA_SPAN_SHIFT;
+    return arena_spans_alloc(arena, n, ARENA_CLASS_LARGE);
+}
+
+static void arena_free(void *ptr)
+{
+    arena_span_t *span = arena_span_of(ptr);
+    uint16_t      idx = __atomic_load_n(&span->arena, __ATOMIC_RELAXED);
+
+    if(0 == idx) return; //double free
+    if(ARENA_CLASS_LARGE == span->cls)
+        arena_spans_free(&arenas[idx - 1], ptr);
+    else
+        arena_small_free(&arenas[idx - 1], span->cls, ptr);
+}
+
+static size_t arena_usable_size(const void *ptr)
+{
+    arena_span_t *span = arena_span_of(ptr);
+
+    if(ARENA_CLASS_LARGE == span->cls) return (size_t)span->run << ARENA_SPAN_SHIFT;
+    return arena_class_size(span->cls);
+}
+
+//lock free, the rules are never changed once counted
+static int arena_match(const char *pathname)
+{
+    size_t i, cnt = __atomic_load_n(&arena_rules_cnt, __ATOMIC_ACQUIRE);
+
+    for(i = 0; i < cnt; i++)
+        if(0 == regexec(&arena_rules[i], pathname, 0, NULL, 0)) return 1;
+    return 0;
+}
+
+//called with the mutex held
+static arena_t *arena_new(const char *pathname)
+{
+    arena_t *arena;
+    size_t   i;
+
+    if(arenas_cnt >= ARENA_MAX) return NULL;
+    arena = &arenas[arenas_cnt];
+    arena->idx = (int)arenas_cnt;
+    arena->pathname = pathname;
+    for(i = 0; i < ARENA_CLASSES; i++)
+        pthread_mutex_init(&arena->classes[i].lock, NULL);
+    __atomic_store_n(&arenas_cnt, arenas_cnt + 1, __ATOMIC_RELEASE);
+    return arena;
+}
+
+//dladdr() and regexec() run without the mutex: they take the loader's lock and allocate
+static arena_lib_t *arena_lib_get(void *caller)
+{
+    Dl_info   info;
+    uintptr_t base;
+    size_t    i, cnt;
+    int       matched;
+
+    if(0 == dladdr(caller, &info) || NULL == info.dli_fbase || NULL == info.dli_fname)
+        return &arena_libs[0];
+    base = (uintptr_t)info.dli_fbase;
+
+    cnt = __atomic_load_n(&arena_libs_cnt, __ATOMIC_ACQUIRE);
+    for(i = 1; i < cnt; i++)
+        if(arena_libs[i].base == base) return &arena_libs[i];
+    matched = arena_match(info.dli_fname);
+
+    pthread_mutex_lock(&arena_mutex);
+    cnt = arena_libs_cnt;
+    for(i = 1; i < cnt; i++)
+        if(arena_libs[i].base == base) goto end;
+    if(cnt >= ARENA_LIBS_MAX)
+    {
+        i = 0;
+        goto end;
+    }
+    arena_libs[i].base = base;
+    strncpy(arena_libs[i].pathname, info.dli_fname, ARENA_PATHNAME_MAX - 1);
+    __atomic_store_n(&arena_libs[i].arena, (matched ? arena_new(arena_libs[i].pathname) : NULL), __ATOMIC_RELEASE);
+    __atomic_store_n(&arena_libs_cnt, cnt + 1, __ATOMIC_RELEASE);
+ end:
+    pthread_mutex_unlock(&arena_mutex);
+    return &arena_libs[i];
+}
+
+//the arena of the caller's library, NULL for libc
+static arena_t *arena_of_caller(void *caller)
+{
+    uintptr_t     c = (uintptr_t)caller, cur;
+    size_t        h = (size_t)((c >> 2) * 0x9E3779B97F4A7C15ULL >> 32);
+    size_t        i;
+    arena_site_t *site;
+    arena_lib_t  *lib;
+
+    for(i = 0; i < ARENA_PROBE_MAX; i++)
+    {
+        site = &arena_sites[(h + i) & (ARENA_SITES_MAX - 1)];
+        if(c == (cur = __atomic_load_n(&site->caller, __ATOMIC_ACQUIRE)))
+            return __atomic_load_n(&site->lib->arena, __ATOMIC_ACQUIRE);
+        if(0 == cur) break;
+    }
+
+    //the allocations made by the resolution itself (libc's realloc(NULL, ...) in regexec ...)
+    if(NULL != pthread_getspecific(arena_resolving_key)) return NULL;
+    pthread_setspecific(arena_resolving_key, (void *)1);
+    lib = arena_lib_get(caller);
+    pthread_setspecific(arena_resolving_key, NULL);
+
+    pthread_mutex_lock(&arena_mutex);
+    for(i = 0; i < ARENA_PROBE_MAX; i++)
+    {
+        site = &arena_sites[(h + i) & (ARENA_SITES_MAX - 1)];
+        if(c == site->caller) break;
+        if(0 == site->caller)
+        {
+            site->lib = lib;
+            __atomic_store_n(&site->caller, c, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&arena_mutex);
+    return __atomic_load_n(&lib->arena, __ATOMIC_ACQUIRE);
+}
+
+static void *arena_alloc_for(void *caller, size_t size, size_t align)
+{
+    arena_t *arena = arena_of_caller(caller);
+    void    *ptr;
+
+    if(NULL == arena) return NULL;
+    if(NULL == (ptr = arena_alloc(arena, size, align)))
+        __atomic_add_fetch(&arena->fallbacks, 1, __ATOMIC_RELAXED);
+    return ptr;
+}
+
+static void *arena_malloc_hook(size_t size)
+{
+    void *ptr = arena_alloc_for(__builtin_return_address(0), size, 0);
+    return (NULL != ptr ? ptr : malloc(size));
+}
+
+static void *arena_calloc_hook(size_t nmemb, size_t size)
+{
+    void   *ptr;
+    size_t  total;
+
+    if(__builtin_mul_overflow(nmemb, size, &total))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if(NULL == (ptr = arena_alloc_for(__builtin_return_address(0), total, 0))) return calloc(nmemb, size);
+
+    //the runs are zero filled when they are taken, the objects may be reused
+    if(ARENA_CLASS_LARGE != arena_span_of(ptr)->cls) memset(ptr, 0, total);
+    return ptr;
+}
+
+static void *arena_memalign_hook(size_t alignment, size_t size)
+{
+    void *ptr = NULL;
+
+    if(0 == (alignment & (alignment - 1)))
+        ptr = arena_alloc_for(__builtin_return_address(0), size, alignment);
+    return (NULL != ptr ? ptr : memalign(alignment, size));
+}
+
+static void *arena_aligned_alloc_hook(size_t alignment, size_t size)
+{
+    void *ptr = NULL;
+
+    if(0 == (alignment & (alignment - 1)))
+        ptr = arena_alloc_for(__builtin_return_address(0), size, alignment);
+    return (NULL != ptr ? ptr : memalign(alignment, size));
+}
+
+static int arena_posix_memalign_hook(void **memptr, size_t alignment, size_t size)
+{
+    void *ptr;
+
+    if(0 == alignment || 0 != (alignment & (alignment - 1)) || 0 != alignment % sizeof(void *)) return EINVAL;
+    if(NULL == (ptr = arena_alloc_for(__builtin_return_address(0), size, alignment)))
+        return posix_memalign(memptr, alignment, size);
+    *memptr = ptr;
+    return 0;
+}
+
+static void arena_free_hook(void *ptr)
+{
+    if(arena_owns(ptr)) arena_free(ptr);
+    else free(ptr);
+}
+
+static void *arena_realloc_for(void *caller, void *ptr, size_t size)
+{
+    arena_span_t *span;
+    void         *new_ptr;
+    size_t        usable;
+
+    if(NULL == ptr)
+    {
+        new_ptr = arena_alloc_for(caller, size, 0);
+        return (NULL != new_ptr ? new_ptr : malloc(size));
+    }
+    if(!arena_owns(ptr)) return realloc(ptr, size);
+
+    if(0 == size)
+    {
+        arena_free(ptr);
+        return NULL;
+    }
+    span = arena_span_of(ptr);
+    usable = arena_usable_size(ptr);
+    if(size <= usable && size > usable / 2) return ptr;
+
+    //stays in the arena which owns it
+    if(NULL == (new_ptr = arena_alloc(&arenas[span->arena - 1], size, 0)))
+    {
+        __atomic_add_fetch(&arenas[span->arena - 1].fallbacks, 1, __ATOMIC_RELAXED);
+        if(NULL == (new_ptr = malloc(size))) return NULL;
+    }
+    memcpy(new_ptr, ptr, size < usable ? size : usable);
+    arena_free(ptr);
+    return new_ptr;
+}
+
+static void *arena_realloc_hook(void *ptr, size_t size)
+{
+    return arena_realloc_for(__builtin_return_address(0), ptr, size);
+}
+
+#if ARENA_HAVE_REALLOCARRAY
+//libc's reallocarray() calls its internal realloc
+static void *arena_reallocarray_hook(void *ptr, size_t nmemb, size_t size)
+{
+    size_t total;
+
+    if(__builtin_mul_overflow(nmemb, size, &total))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return arena_realloc_for(__builtin_return_address(0), ptr, total);
+}
+#endif
+
+#if !defined(__ANDROID__) || __ANDROID_API__ >= 18
+//the buffer of getline/getdelim is resized by libc's internal realloc, give it a libc one
+static int arena_line_to_libc(char **lineptr, size_t *n)
+{
+    char   *p;
+    size_t  usable;
+
+    if(NULL == lineptr || NULL == n || !arena_owns(*lineptr)) return 0;
+    usable = arena_usable_size(*lineptr);
+    if(NULL == (p = malloc(usable))) return -1;
+    memcpy(p, *lineptr, usable);
+    arena_free(*lineptr);
+    *lineptr = p;
+    *n = usable;
+    return 0;
+}
+
+static ssize_t arena_getdelim_hook(char **lineptr, size_t *n, int delim, FILE *stream)
+{
+    if(0 != arena_line_to_libc(lineptr, n))
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    return getdelim(lineptr, n, delim, stream);
+}
+
+static ssize_t arena_getline_hook(char **lineptr, size_t *n, FILE *stream)
+{
+    if(0 != arena_line_to_libc(lineptr, n))
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    return getline(lineptr, n, stream);
+}
+#endif
+
+#if !defined(__ANDROID__) || __ANDROID_API__ >= 17
+static size_t arena_malloc_usable_size_hook(const void *ptr)
+{
+    if(arena_owns(ptr)) return arena_usable_size(ptr);
+    return malloc_usable_size((void *)ptr);
+}
+#endif
+
+int arena_init(size_t reserve_size)
+{
+    void   *addr;
+    size_t  len;
+    int     r = 0;
+
+    pthread_mutex_lock(&arena_register_mutex);
+    if(arena_inited) goto end;
+
+    if(0 == reserve_size) reserve_size = ARENA_RESERVE_DEFAULT;
+    reserve_size = (reserve_size + ARENA_COMMIT_SIZE - 1) & ~(ARENA_COMMIT_SIZE - 1);
+
+    //aligned to ARENA_COMMIT_SIZE, the unaligned head and tail are given back
+    len = reserve_size + ARENA_COMMIT_SIZE;
+    if(MAP_FAILED == (addr = mmap(NULL, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)))
+    {
+        r = ENOMEM;
+        goto end;
+    }
+    arena_base = ((uintptr_t)addr + ARENA_COMMIT_SIZE - 1) & ~(ARENA_COMMIT_SIZE - 1);
+    if(arena_base > (uintptr_t)addr) munmap(addr, arena_base - (uintptr_t)addr);
+    munmap((void *)(arena_base + reserve_size), (uintptr_t)addr + len - arena_base - reserve_size);
+
+    arena_spans_cnt = reserve_size >> ARENA_SPAN_SHIFT;
+    if(NULL == (arena_spans = calloc(arena_spans_cnt, sizeof(arena_span_t))))
+    {
+        munmap((void *)arena_base, reserve_size);
+        r = ENOMEM;
+        goto end;
+    }
+    if(0 != pthread_key_create(&arena_tls_key, arena_tls_free))
+    {
+        free(arena_spans);
+        munmap((void *)arena_base, reserve_size);
+        r = EAGAIN;
+        goto end;
+    }
+    if(0 != pthread_key_create(&arena_resolving_key, NULL))
+    {
+        pthread_key_delete(arena_tls_key);
+        free(arena_spans);
+        munmap((void *)arena_base, reserve_size);
+        r = EAGAIN;
+        goto end;
+    }
+    __atomic_store_n(&arena_size, reserve_size, __ATOMIC_RELEASE);
+    __atomic_store_n(&arena_inited, 1, __ATOMIC_RELEASE);
+
+ end:
+    pthread_mutex_unlock(&arena_register_mutex);
+    return r;
+}
+
+int arena_register(const char *pathname_regex_str)
+{
+    regex_t regex;
+    size_t  i, cnt;
+    int     r = 0;
+
+    if(NULL == pathname_regex_str || !__atomic_load_n(&arena_inited, __ATOMIC_ACQUIRE)) return EINVAL;
+
+    //not under arena_mutex: regcomp() and xhook allocate, and libc's realloc(NULL, ...) is ours
+    pthread_mutex_lock(&arena_register_mutex);
+
+    //any library may free or resize an arena's memory
+    if(!arena_global_hooked)
+    {
+        if(0 != (r = xhook_ignore(".*/libarena\\.so$", NULL))) goto end;
+        if(0 != (r = xhook_register(".*", "free",    arena_free_hook,    NULL))) goto end;
+        if(0 != (r = xhook_register(".*", "realloc", arena_realloc_hook, NULL))) goto end;
+#if !defined(__ANDROID__) || __ANDROID_API__ >= 17
+        if(0 != (r = xhook_register(".*", "malloc_usable_size", arena_malloc_usable_size_hook, NULL))) goto end;
+#endif
+#if !defined(__ANDROID__) || __ANDROID_API__ >= 18
+        if(0 != (r = xhook_register(".*", "getline",  arena_getline_hook,  NULL))) goto end;
+        if(0 != (r = xhook_register(".*", "getdelim", arena_getdelim_hook, NULL))) goto end;
+#endif
+#if ARENA_HAVE_REALLOCARRAY
+        if(0 != (r = xhook_register(".*", "reallocarray", arena_reallocarray_hook, NULL))) goto end;
+#endif
+        arena_global_hooked = 1;
+    }
+
+    if(arena_rules_cnt >= ARENA_POLICIES_MAX)
+    {
+        r = ENOSPC;
+        goto end;
+    }
+    if(0 != regcomp(&regex, pathname_regex_str, REG_NOSUB))
+    {
+        r = EINVAL;
+        goto end;
+    }
+    if(0 != (r = xhook_register(pathname_regex_str, "malloc",         arena_malloc_hook,         NULL)) ||
+       0 != (r = xhook_register(pathname_regex_str, "calloc",         arena_calloc_hook,         NULL)) ||
+       0 != (r = xhook_register(pathname_regex_str, "memalign",       arena_memalign_hook,       NULL)) ||
+       0 != (r = xhook_register(pathname_regex_str, "aligned_alloc",  arena_aligned_alloc_hook,  NULL)) ||
+       0 != (r = xhook_register(pathname_regex_str, "posix_memalign", arena_posix_memalign_hook, NULL)))
+    {
+        regfree(&regex);
+        goto end;
+    }
+    arena_rules[arena_rules_cnt] = regex;
+    __atomic_store_n(&arena_rules_cnt, arena_rules_cnt + 1, __ATOMIC_RELEASE);
+
+    //the libraries which have called realloc(NULL, ...) before
+    cnt = __atomic_load_n(&arena_libs_cnt, __ATOMIC_ACQUIRE);
+    for(i = 1; i < cnt; i++)
+    {
+        if(NULL != __atomic_load_n(&arena_libs[i].arena, __ATOMIC_ACQUIRE)) continue;
+        if(0 != regexec(&regex, arena_libs[i].pathname, 0, NULL, 0)) continue;
+        pthread_mutex_lock(&arena_mutex);
+        if(NULL == arena_libs[i].arena)
+            __atomic_store_n(&arena_libs[i].arena, arena_new(arena_libs[i].pathname), __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&arena_mutex);
+    }
+
+ end:
+    pthread_mutex_unlock(&arena_register_mutex);
+    return r;
+}
+
+size_t arena_get_stats(arena_stats_t *stats, size_t stats_cnt)
+{
+    size_t i, cnt = __atomic_load_n(&arenas_cnt, __ATOMIC_ACQUIRE);
+
+    for(i = 0; i < cnt && i < stats_cnt; i++)
+    {
+        stats[i].pathname     = arenas[i].pathname;
+        stats[i].bytes_in_use = __atomic_load_n(&arenas[i].bytes_in_use, __ATOMIC_RELAXED);
+        stats[i].bytes_mapped = __atomic_load_n(&arenas[i].bytes_mapped, __ATOMIC_RELAXED);
+        stats[i].allocs       = __atomic_load_n(&arenas[i].allocs,       __ATOMIC_RELAXED);
+        stats[i].frees        = __atomic_load_n(&arenas[i].frees,        __ATOMIC_RELAXED);
+        stats[i].fallbacks    = __atomic_load_n(&arenas[i].fallbacks,    __ATOMIC_RELAXED);
+    }
+    return cnt;
+}
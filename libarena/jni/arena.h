@@ -0,0 +1,66 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#ifndef ARENA_H
+#define ARENA_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ARENA_EXPORT __attribute__((visibility("default")))
+
+//memory of one library's arena
+typedef struct
+{
+    const char *pathname;
+    int64_t     bytes_in_use;  //of the size classes, updated in batches by each thread
+    uint64_t    bytes_mapped;  //spans taken from the reserved range
+    uint64_t    allocs;
+    uint64_t    frees;
+    uint64_t    fallbacks;     //served by libc, the arena couldn't (full, huge alignment)
+} arena_stats_t;
+
+//reserve_size: address space for all the arenas, 0: default (16GB, 256MB on 32-bit)
+int arena_init(size_t reserve_size) ARENA_EXPORT;
+
+//each matched library gets its own arena
+//
+//The arena's memory is not known by libc: it must only be freed or resized through the
+//hooked GOT slots (free, realloc, reallocarray, getline, getdelim and malloc_usable_size
+//are hooked in all libraries). Call xhook_refresh() after dlopen(), or enable the
+//discovery, before a new library can be handed an arena pointer. Passing one to a libc
+//function which frees or resizes it internally (other than getline/getdelim), or to a
+//statically linked allocator, corrupts the heap.
+int arena_register(const char *pathname_regex_str) ARENA_EXPORT;
+
+//returns the number of arenas, at most stats_cnt are copied
+size_t arena_get_stats(arena_stats_t *stats, size_t stats_cnt) ARENA_EXPORT;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
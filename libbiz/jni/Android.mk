@@ -6,10 +6,16 @@ LOCAL_SRC_FILES         := $(LOCAL_PATH)/../../libxhook/libs/$(TARGET_ARCH_ABI)/
 LOCAL_EXPORT_C_INCLUDES := $(LOCAL_PATH)/../../libxhook/jni
 include $(PREBUILT_SHARED_LIBRARY)
 
+include $(CLEAR_VARS)
+LOCAL_MODULE            := loglimit
+LOCAL_SRC_FILES         := $(LOCAL_PATH)/../../libloglimit/libs/$(TARGET_ARCH_ABI)/libloglimit.so
+LOCAL_EXPORT_C_INCLUDES := $(LOCAL_PATH)/../../libloglimit/jni
+include $(PREBUILT_SHARED_LIBRARY)
+
 include $(CLEAR_VARS)
 LOCAL_MODULE            := biz
 LOCAL_SRC_FILES         := biz.c
-LOCAL_SHARED_LIBRARIES  := xhook
+LOCAL_SHARED_LIBRARIES  := xhook loglimit
 LOCAL_CFLAGS            := -Wall -Wextra -Werror
 LOCAL_CONLYFLAGS        := -std=c11
 LOCAL_LDLIBS            := -llog
@@ -4,6 +4,7 @@
 #include <jni.h>
 #include <android/log.h>
 #include "xhook.h"
+#include "loglimit.h"
 
 static int my_system_log_print(int prio, const char* tag, const char* fmt, ...)
 {
@@ -33,15 +34,24 @@ static int my_libtest_log_print(int prio, const char* tag, const char* fmt, ...)
     return r;
 }
 
+static const loglimit_policy_t vendor_log_policy = {
+    .rate      = 20,
+    .burst     = 100,
+    .sample    = 0,
+    .pass_prio = ANDROID_LOG_ERROR
+};
+
 void Java_com_qiyi_biz_NativeHandler_start(JNIEnv* env, jobject obj)
 {
     (void)env;
     (void)obj;
 
     xhook_register("^/system/.*\\.so$",  "__android_log_print", my_system_log_print,  NULL);
-    xhook_register("^/vendor/.*\\.so$",  "__android_log_print", my_system_log_print,  NULL);
     xhook_register(".*/libtest\\.so$", "__android_log_print", my_libtest_log_print, NULL);
 
+    //vendor libraries: at most 20 lines per second per (library, tag, priority), errors always pass
+    loglimit_register("^/vendor/.*\\.so$", &vendor_log_policy);
+
     //just for testing
     xhook_ignore(".*/liblog\\.so$", "__android_log_print"); //ignore __android_log_print in liblog.so
     xhook_ignore(".*/libjavacore\\.so$", NULL); //ignore all hooks in libjavacore.so
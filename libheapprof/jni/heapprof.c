@@ -0,0 +1,469 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <malloc.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include "xhook.h"
+#include "heapprof.h"
+
+#define HEAPPROF_LIBS_MAX         256
+#define HEAPPROF_PATHNAME_MAX     256
+#define HEAPPROF_LIB_UNKNOWN      0
+
+#define HEAPPROF_KEY_EMPTY        ((uintptr_t)0)
+#define HEAPPROF_KEY_TOMBSTONE    ((uintptr_t)1)
+#define HEAPPROF_KEY_BUSY         ((uintptr_t)2)
+
+//caller library (interned, never removed)
+typedef struct
+{
+    uintptr_t base;
+    char      pathname[HEAPPROF_PATHNAME_MAX];
+    int64_t   sampled_bytes;
+    int64_t   sampled_count;
+    int64_t   est_bytes;
+    int64_t   est_count_milli;
+} heapprof_lib_info_t;
+
+//live sampled allocation
+typedef struct
+{
+    uintptr_t key; //allocated pointer, or one of HEAPPROF_KEY_*
+    size_t    size;
+    int64_t   est_bytes;
+    int64_t   est_count_milli;
+    uint32_t  lib_idx;
+} heapprof_entry_t;
+
+//per-thread sampling state
+typedef struct
+{
+    int64_t  bytes_left;
+    uint64_t rnd;
+} heapprof_tls_t;
+
+static int                  heapprof_inited = 0;
+static double               heapprof_interval;
+static pthread_key_t        heapprof_tls_key;
+static heapprof_entry_t    *heapprof_entries;
+static size_t               heapprof_entries_mask;
+static uint32_t            *heapprof_filter;
+static size_t               heapprof_filter_mask;
+static size_t               heapprof_live_cnt = 0;
+static size_t               heapprof_dropped_cnt = 0;
+static heapprof_lib_info_t  heapprof_libs[HEAPPROF_LIBS_MAX];
+static size_t               heapprof_libs_cnt = 1; //0 is reserved for unknown
+static pthread_mutex_t      heapprof_libs_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t      heapprof_ignore_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int                  heapprof_ignored = 0;
+
+static uint64_t heapprof_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+//xorshift64*
+static uint64_t heapprof_rand(heapprof_tls_t *tls)
+{
+    tls->rnd ^= tls->rnd >> 12;
+    tls->rnd ^= tls->rnd << 25;
+    tls->rnd ^= tls->rnd >> 27;
+    return tls->rnd * 2685821657736338717ULL;
+}
+
+//exponentially distributed distance to the next sample (Poisson process over bytes)
+static int64_t heapprof_next_distance(heapprof_tls_t *tls)
+{
+    double u = ((double)(heapprof_rand(tls) >> 11) + 1.0) / 9007199254740993.0; //(0, 1]
+    return (int64_t)(-log(u) * heapprof_interval) + 1;
+}
+
+static void heapprof_tls_free(void *arg)
+{
+    free(arg);
+}
+
+//We use pthread key instead of __thread, because the emulated TLS of old NDKs
+//allocates memory on first access, which is not allowed inside an allocator hook.
+static heapprof_tls_t *heapprof_tls_get()
+{
+    heapprof_tls_t *tls = (heapprof_tls_t *)pthread_getspecific(heapprof_tls_key);
+    if(__builtin_expect(NULL != tls, 1)) return tls;
+
+    if(NULL == (tls = malloc(sizeof(heapprof_tls_t)))) return NULL;
+    tls->rnd = (heapprof_now_ns() ^ (uint64_t)(uintptr_t)tls) | 1;
+    tls->bytes_left = heapprof_next_distance(tls);
+    if(0 != pthread_setspecific(heapprof_tls_key, tls))
+    {
+        free(tls);
+        return NULL;
+    }
+    return tls;
+}
+
+static uint32_t heapprof_lib_idx(void *caller)
+{
+    Dl_info   info;
+    uintptr_t base;
+    size_t    i, cnt;
+
+    if(0 == dladdr(caller, &info) || NULL == info.dli_fbase || NULL == info.dli_fname)
+        return HEAPPROF_LIB_UNKNOWN;
+    base = (uintptr_t)info.dli_fbase;
+
+    cnt = __atomic_load_n(&heapprof_libs_cnt, __ATOMIC_ACQUIRE);
+    for(i = 1; i < cnt; i++)
+        if(heapprof_libs[i].base == base) return (uint32_t)i;
+
+    pthread_mutex_lock(&heapprof_libs_mutex);
+    cnt = heapprof_libs_cnt;
+    for(i = 1; i < cnt; i++)
+        if(heapprof_libs[i].base == base) goto end;
+    if(cnt >= HEAPPROF_LIBS_MAX)
+    {
+        i = HEAPPROF_LIB_UNKNOWN;
+        goto end;
+    }
+    heapprof_libs[i].base = base;
+    strncpy(heapprof_libs[i].pathname, info.dli_fname, HEAPPROF_PATHNAME_MAX - 1);
+    __atomic_store_n(&heapprof_libs_cnt, cnt + 1, __ATOMIC_RELEASE);
+ end:
+    pthread_mutex_unlock(&heapprof_libs_mutex);
+    return (uint32_t)i;
+}
+
+static size_t heapprof_hash(uintptr_t p)
+{
+    uint64_t h = (uint64_t)p;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (size_t)h;
+}
+
+static void heapprof_lib_add(heapprof_entry_t *e, int64_t sign)
+{
+    heapprof_lib_info_t *lib = &heapprof_libs[e->lib_idx];
+
+    __atomic_add_fetch(&lib->sampled_bytes,   sign * (int64_t)e->size,   __ATOMIC_RELAXED);
+    __atomic_add_fetch(&lib->sampled_count,   sign,                      __ATOMIC_RELAXED);
+    __atomic_add_fetch(&lib->est_bytes,       sign * e->est_bytes,       __ATOMIC_RELAXED);
+    __atomic_add_fetch(&lib->est_count_milli, sign * e->est_count_milli, __ATOMIC_RELAXED);
+}
+
+//counter of the live samples per filter bucket, so the free() of an unsampled block
+//(almost all of them) costs one load instead of a probe through the live table
+static __inline__ uint32_t *heapprof_filter_bucket(size_t h)
+{
+    return &heapprof_filter[h & heapprof_filter_mask];
+}
+
+static int heapprof_insert(void *p, const heapprof_entry_t *src)
+{
+    heapprof_entry_t *e;
+    uintptr_t         key;
+    size_t            h, i;
+
+    h = heapprof_hash((uintptr_t)p);
+    for(i = 0; i <= heapprof_entries_mask; i++)
+    {
+        e = &heapprof_entries[(h + i) & heapprof_entries_mask];
+        key = __atomic_load_n(&e->key, __ATOMIC_RELAXED);
+        if(HEAPPROF_KEY_EMPTY != key && HEAPPROF_KEY_TOMBSTONE != key) continue;
+        if(!__atomic_compare_exchange_n(&e->key, &key, HEAPPROF_KEY_BUSY, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) continue;
+
+        e->size            = src->size;
+        e->est_bytes       = src->est_bytes;
+        e->est_count_milli = src->est_count_milli;
+        e->lib_idx         = src->lib_idx;
+        heapprof_lib_add(e, 1);
+        __atomic_add_fetch(&heapprof_live_cnt, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(heapprof_filter_bucket(h), 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&e->key, (uintptr_t)p, __ATOMIC_RELEASE);
+        return 1;
+    }
+
+    __atomic_add_fetch(&heapprof_dropped_cnt, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static void heapprof_record(heapprof_tls_t *tls, void *p, size_t size, void *caller)
+{
+    heapprof_entry_t e;
+    double           prob;
+
+    tls->bytes_left = heapprof_next_distance(tls);
+
+    //unbias: an allocation of "size" bytes is sampled with probability 1-exp(-size/interval)
+    prob = 1.0 - exp(-(double)size / heapprof_interval);
+    if(prob <= 0.0) prob = 1.0;
+    e.size            = size;
+    e.est_bytes       = (int64_t)((double)size / prob);
+    e.est_count_milli = (int64_t)(1000.0 / prob);
+    e.lib_idx         = heapprof_lib_idx(caller);
+    heapprof_insert(p, &e);
+}
+
+static __inline__ void heapprof_account(void *p, size_t size, void *caller)
+{
+    heapprof_tls_t *tls;
+
+    if(NULL == p) return;
+    if(NULL == (tls = heapprof_tls_get())) return;
+
+    //fast path: pthread_getspecific() and one decrement
+    if(__builtin_expect((tls->bytes_left -= (int64_t)size) > 0, 1)) return;
+
+    heapprof_record(tls, p, size, caller);
+}
+
+//remove the sample of p, copied to *saved if not NULL
+//return 1 if p was sampled
+static __inline__ int heapprof_forget(void *p, heapprof_entry_t *saved)
+{
+    heapprof_entry_t *e;
+    uintptr_t         key;
+    size_t            h, i;
+
+    if(NULL == p) return 0;
+    if(__builtin_expect(0 == __atomic_load_n(&heapprof_live_cnt, __ATOMIC_RELAXED), 1)) return 0;
+
+    h = heapprof_hash((uintptr_t)p);
+    if(__builtin_expect(0 == __atomic_load_n(heapprof_filter_bucket(h), __ATOMIC_RELAXED), 1)) return 0;
+
+    for(i = 0; i <= heapprof_entries_mask; i++)
+    {
+        e = &heapprof_entries[(h + i) & heapprof_entries_mask];
+        key = __atomic_load_n(&e->key, __ATOMIC_ACQUIRE);
+        if(HEAPPROF_KEY_EMPTY == key) return 0; //not sampled
+        if((uintptr_t)p != key) continue;
+
+        //only our own p can be in flight here (a racing free of the same block is a double free),
+        //retry until we own the entry instead of leaking it
+        while(!__atomic_compare_exchange_n(&e->key, &key, HEAPPROF_KEY_BUSY, 0,
+                                           __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            if((uintptr_t)p != key && HEAPPROF_KEY_BUSY != key) return 0;
+            key = (uintptr_t)p;
+        }
+        if(NULL != saved) *saved = *e;
+        heapprof_lib_add(e, -1);
+        __atomic_sub_fetch(&heapprof_live_cnt, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(heapprof_filter_bucket(h), 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&e->key, HEAPPROF_KEY_TOMBSTONE, __ATOMIC_RELEASE);
+        return 1;
+    }
+    return 0;
+}
+
+static void *heapprof_malloc(size_t size)
+{
+    void *p = malloc(size);
+    heapprof_account(p, size, __builtin_return_address(0));
+    return p;
+}
+
+static void *heapprof_calloc(size_t nmemb, size_t size)
+{
+    void *p = calloc(nmemb, size);
+    heapprof_account(p, nmemb * size, __builtin_return_address(0));
+    return p;
+}
+
+static void *heapprof_realloc(void *ptr, size_t size)
+{
+    heapprof_entry_t saved;
+    int              sampled;
+    void            *p;
+
+    //take the sample out before realloc(): once ptr is released, another thread may get
+    //the same address and sample it; put it back if ptr is still live after a failure
+    sampled = heapprof_forget(ptr, &saved);
+    p = realloc(ptr, size);
+    if(NULL == p && 0 != size && sampled) heapprof_insert(ptr, &saved);
+    heapprof_account(p, size, __builtin_return_address(0));
+    return p;
+}
+
+static void heapprof_free_hook(void *ptr)
+{
+    heapprof_forget(ptr, NULL);
+    free(ptr);
+}
+
+static int heapprof_posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    int r = posix_memalign(memptr, alignment, size);
+    if(0 == r) heapprof_account(*memptr, size, __builtin_return_address(0));
+    return r;
+}
+
+static void *heapprof_memalign(size_t alignment, size_t size)
+{
+    void *p = memalign(alignment, size);
+    heapprof_account(p, size, __builtin_return_address(0));
+    return p;
+}
+
+int heapprof_init(size_t sample_interval, size_t max_live_samples)
+{
+    size_t cap = 1024;
+    void  *entries, *filter;
+
+    if(heapprof_inited) return 0;
+    if(0 == sample_interval || 0 == max_live_samples) return EINVAL;
+
+    //keep the load factor under 0.5
+    while(cap < max_live_samples * 2) cap <<= 1;
+    entries = mmap(NULL, cap * sizeof(heapprof_entry_t), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(MAP_FAILED == entries) return ENOMEM;
+    filter = mmap(NULL, cap * 2 * sizeof(uint32_t), PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(MAP_FAILED == filter)
+    {
+        munmap(entries, cap * sizeof(heapprof_entry_t));
+        return ENOMEM;
+    }
+
+    if(0 != pthread_key_create(&heapprof_tls_key, heapprof_tls_free))
+    {
+        munmap(entries, cap * sizeof(heapprof_entry_t));
+        munmap(filter, cap * 2 * sizeof(uint32_t));
+        return EAGAIN;
+    }
+
+    strcpy(heapprof_libs[HEAPPROF_LIB_UNKNOWN].pathname, "unknown");
+    heapprof_interval     = (double)sample_interval;
+    heapprof_entries      = (heapprof_entry_t *)entries;
+    heapprof_entries_mask = cap - 1;
+    heapprof_filter       = (uint32_t *)filter;
+    heapprof_filter_mask  = cap * 2 - 1;
+    __atomic_store_n(&heapprof_inited, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int heapprof_register(const char *pathname_regex_str)
+{
+    int r;
+
+    if(!heapprof_inited || NULL == pathname_regex_str) return EINVAL;
+
+    //our own allocations must never be accounted
+    pthread_mutex_lock(&heapprof_ignore_mutex);
+    if(!heapprof_ignored)
+    {
+        if(0 != (r = xhook_ignore(".*/libheapprof\\.so$", NULL))) goto end;
+        heapprof_ignored = 1;
+    }
+    pthread_mutex_unlock(&heapprof_ignore_mutex);
+
+    if(0 != (r = xhook_register(pathname_regex_str, "malloc",         heapprof_malloc,         NULL))) return r;
+    if(0 != (r = xhook_register(pathname_regex_str, "calloc",         heapprof_calloc,         NULL))) return r;
+    if(0 != (r = xhook_register(pathname_regex_str, "realloc",        heapprof_realloc,        NULL))) return r;
+    if(0 != (r = xhook_register(pathname_regex_str, "free",           heapprof_free_hook,      NULL))) return r;
+    if(0 != (r = xhook_register(pathname_regex_str, "posix_memalign", heapprof_posix_memalign, NULL))) return r;
+    if(0 != (r = xhook_register(pathname_regex_str, "memalign",       heapprof_memalign,       NULL))) return r;
+    return 0;
+
+ end:
+    pthread_mutex_unlock(&heapprof_ignore_mutex);
+    return r;
+}
+
+static heapprof_snapshot_t *heapprof_snapshot_alloc(size_t lib_cnt)
+{
+    heapprof_snapshot_t *s;
+
+    if(NULL == (s = malloc(sizeof(heapprof_snapshot_t) + lib_cnt * sizeof(heapprof_lib_t)))) return NULL;
+    s->timestamp_ns = heapprof_now_ns();
+    s->lib_cnt = lib_cnt;
+    return s;
+}
+
+heapprof_snapshot_t *heapprof_snapshot()
+{
+    heapprof_snapshot_t *s;
+    heapprof_lib_info_t *lib;
+    size_t               i, cnt;
+
+    if(!heapprof_inited) return NULL;
+
+    cnt = __atomic_load_n(&heapprof_libs_cnt, __ATOMIC_ACQUIRE);
+    if(NULL == (s = heapprof_snapshot_alloc(cnt))) return NULL;
+
+    for(i = 0; i < cnt; i++)
+    {
+        lib = &heapprof_libs[i];
+        s->libs[i].pathname      = lib->pathname;
+        s->libs[i].live_bytes    = __atomic_load_n(&lib->est_bytes,       __ATOMIC_RELAXED);
+        s->libs[i].live_count    = __atomic_load_n(&lib->est_count_milli, __ATOMIC_RELAXED) / 1000;
+        s->libs[i].sampled_bytes = __atomic_load_n(&lib->sampled_bytes,   __ATOMIC_RELAXED);
+        s->libs[i].sampled_count = __atomic_load_n(&lib->sampled_count,   __ATOMIC_RELAXED);
+    }
+    return s;
+}
+
+//Libraries are interned and never removed, so "from" is always a prefix of "to".
+heapprof_snapshot_t *heapprof_diff(const heapprof_snapshot_t *from, const heapprof_snapshot_t *to)
+{
+    heapprof_snapshot_t *s;
+    size_t               i;
+
+    if(NULL == from || NULL == to || from->lib_cnt > to->lib_cnt) return NULL;
+    if(NULL == (s = heapprof_snapshot_alloc(to->lib_cnt))) return NULL;
+
+    s->timestamp_ns = to->timestamp_ns;
+    for(i = 0; i < to->lib_cnt; i++)
+    {
+        s->libs[i] = to->libs[i];
+        if(i < from->lib_cnt)
+        {
+            s->libs[i].live_bytes    -= from->libs[i].live_bytes;
+            s->libs[i].live_count    -= from->libs[i].live_count;
+            s->libs[i].sampled_bytes -= from->libs[i].sampled_bytes;
+            s->libs[i].sampled_count -= from->libs[i].sampled_count;
+        }
+    }
+    return s;
+}
+
+void heapprof_free(heapprof_snapshot_t *snapshot)
+{
+    free(snapshot);
+}
+
+size_t heapprof_dropped()
+{
+    return __atomic_load_n(&heapprof_dropped_cnt, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,69 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#ifndef HEAPPROF_H
+#define HEAPPROF_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HEAPPROF_EXPORT __attribute__((visibility("default")))
+
+//live heap of one library, estimated from the sampled allocations
+typedef struct
+{
+    const char *pathname;
+    int64_t     live_bytes;     //estimated (unbiased) live bytes
+    int64_t     live_count;     //estimated live allocation count
+    int64_t     sampled_bytes;  //raw bytes of the sampled allocations
+    int64_t     sampled_count;  //raw count of the sampled allocations
+} heapprof_lib_t;
+
+typedef struct
+{
+    uint64_t       timestamp_ns; //CLOCK_MONOTONIC
+    size_t         lib_cnt;
+    heapprof_lib_t libs[];
+} heapprof_snapshot_t;
+
+int heapprof_init(size_t sample_interval, size_t max_live_samples) HEAPPROF_EXPORT;
+
+int heapprof_register(const char *pathname_regex_str) HEAPPROF_EXPORT;
+
+heapprof_snapshot_t *heapprof_snapshot() HEAPPROF_EXPORT;
+
+heapprof_snapshot_t *heapprof_diff(const heapprof_snapshot_t *from,
+                                   const heapprof_snapshot_t *to) HEAPPROF_EXPORT;
+
+void heapprof_free(heapprof_snapshot_t *snapshot) HEAPPROF_EXPORT;
+
+size_t heapprof_dropped() HEAPPROF_EXPORT;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,376 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <regex.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <sys/syscall.h>
+#include "xhook.h"
+#include "loadprof.h"
+
+#ifdef __ANDROID__
+#include <android/dlext.h>
+#endif
+
+//Android 8.0+: libdl's dlopen/android_dlopen_ext only forward to the linker's
+//__loader_dlopen/__loader_android_dlopen_ext with their caller address, so these two
+//imports of libdl.so are hooked: every load of the process is seen, the nested ones made
+//by the constructors of a library still being loaded included, and the real caller is
+//passed on, so the linker namespace of the load doesn't change.
+//
+//Otherwise dlopen/android_dlopen_ext are hooked in the matched libraries, and a nested
+//load is seen only when the library making it was hooked before (a constructor calling
+//a helper library). There the load runs with our library as the caller: on Android 7.x
+//it's searched in our namespace, with glibc in our RUNPATH.
+//
+//A load is recorded when its caller matches (always, when it came through a hooked slot
+//of a matched library), or when it's nested in a recorded load of the same thread.
+//Besides the two clock reads a load costs a few stores, the caller's pathname is resolved
+//when the loads are read (or before the first clock read, when the caller must match).
+
+#define LOADPROF_LOADS_MAX      2048
+#define LOADPROF_PATHNAME_MAX   256
+#define LOADPROF_POLICIES_MAX   32
+
+typedef struct
+{
+    char     pathname[LOADPROF_PATHNAME_MAX];
+    char     caller[LOADPROF_PATHNAME_MAX]; //resolved from caller_addr by the first reader, if empty
+    void    *caller_addr;
+    uint32_t parent;
+    uint32_t depth;
+    int      tid;
+    int      ok;
+    int      done; //written last
+    uint64_t start_ns;
+    uint64_t total_ns;
+    uint64_t nested_ns;
+} loadprof_rec_t;
+
+#ifdef __ANDROID__
+typedef void *(*loadprof_loader_dlopen_t)(const char *filename, int flags, const void *caller_addr);
+typedef void *(*loadprof_loader_dlopen_ext_t)(const char *filename, int flags, const void *extinfo,
+                                              const void *caller_addr);
+typedef void *(*loadprof_dlopen_ext_t)(const char *filename, int flags, const void *extinfo);
+#endif
+
+static loadprof_rec_t                loadprof_recs[LOADPROF_LOADS_MAX];
+static uint32_t                      loadprof_recs_cnt = 0; //reserved, may exceed LOADPROF_LOADS_MAX
+static uint64_t                      loadprof_dropped_cnt = 0;
+static regex_t                       loadprof_rules[LOADPROF_POLICIES_MAX];
+static size_t                        loadprof_rules_cnt = 0;
+static pthread_mutex_t               loadprof_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t                 loadprof_key; //index + 1 of the thread's running load
+static pthread_key_t                 loadprof_tid_key; //the thread's tid, cached
+static int                           loadprof_inited = 0;
+#ifdef __ANDROID__
+static loadprof_loader_dlopen_t      loadprof_loader_dlopen_func = NULL;
+static loadprof_loader_dlopen_ext_t  loadprof_loader_dlopen_ext_func = NULL;
+static loadprof_dlopen_ext_t         loadprof_dlopen_ext_func = NULL;
+#endif
+
+static uint64_t loadprof_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+//lock free, the rules are never changed once counted
+static int loadprof_match(const char *pathname)
+{
+    size_t i, cnt = __atomic_load_n(&loadprof_rules_cnt, __ATOMIC_ACQUIRE);
+
+    for(i = 0; i < cnt; i++)
+        if(0 == regexec(&loadprof_rules[i], pathname, 0, NULL, 0)) return 1;
+    return 0;
+}
+
+//NULL: not recorded
+//matched: the call came through a slot of a matched library, caller may be the caller's
+//caller then (tail calls)
+static loadprof_rec_t *loadprof_begin(const char *filename, const void *caller, int matched)
+{
+    uintptr_t       parent = (uintptr_t)pthread_getspecific(loadprof_key);
+    uintptr_t       tid;
+    Dl_info         info;
+    const char     *caller_pathname = NULL;
+    loadprof_rec_t *rec;
+    uint32_t        idx;
+
+    if(0 == parent && !matched)
+    {
+        if(0 == dladdr(caller, &info) || NULL == info.dli_fname || !loadprof_match(info.dli_fname)) return NULL;
+        caller_pathname = info.dli_fname;
+    }
+
+    if((idx = __atomic_fetch_add(&loadprof_recs_cnt, 1, __ATOMIC_RELAXED)) >= LOADPROF_LOADS_MAX)
+    {
+        __atomic_add_fetch(&loadprof_dropped_cnt, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    rec = &loadprof_recs[idx];
+    strncpy(rec->pathname, (NULL == filename ? "(main)" : filename), LOADPROF_PATHNAME_MAX - 1);
+    if(NULL != caller_pathname) strncpy(rec->caller, caller_pathname, LOADPROF_PATHNAME_MAX - 1);
+    rec->caller_addr = (void *)caller;
+    rec->parent = (0 == parent ? LOADPROF_PARENT_NONE : (uint32_t)(parent - 1));
+    rec->depth = (0 == parent ? 0 : loadprof_recs[parent - 1].depth + 1);
+    if(0 == (tid = (uintptr_t)pthread_getspecific(loadprof_tid_key)))
+    {
+        tid = (uintptr_t)syscall(SYS_gettid);
+        pthread_setspecific(loadprof_tid_key, (void *)tid);
+    }
+    rec->tid = (int)tid;
+    pthread_setspecific(loadprof_key, (void *)((uintptr_t)idx + 1));
+
+    rec->start_ns = loadprof_now_ns();
+    return rec;
+}
+
+static void loadprof_end(loadprof_rec_t *rec, void *handle)
+{
+    uint64_t end_ns = loadprof_now_ns();
+
+    rec->total_ns = end_ns - rec->start_ns;
+    rec->ok = (NULL != handle);
+
+    //only this thread writes the running loads
+    if(LOADPROF_PARENT_NONE == rec->parent)
+        pthread_setspecific(loadprof_key, NULL);
+    else
+    {
+        loadprof_recs[rec->parent].nested_ns += rec->total_ns;
+        pthread_setspecific(loadprof_key, (void *)((uintptr_t)rec->parent + 1));
+    }
+    __atomic_store_n(&rec->done, 1, __ATOMIC_RELEASE);
+}
+
+#ifdef __ANDROID__
+static void *loadprof_loader_dlopen(const char *filename, int flags, const void *caller_addr)
+{
+    loadprof_rec_t *rec = loadprof_begin(filename, caller_addr, 0);
+    void           *handle = loadprof_loader_dlopen_func(filename, flags, caller_addr);
+
+    if(NULL != rec) loadprof_end(rec, handle);
+    return handle;
+}
+
+static void *loadprof_loader_dlopen_ext(const char *filename, int flags, const void *extinfo,
+                                        const void *caller_addr)
+{
+    loadprof_rec_t *rec = loadprof_begin(filename, caller_addr, 0);
+    void           *handle = loadprof_loader_dlopen_ext_func(filename, flags, extinfo, caller_addr);
+
+    if(NULL != rec) loadprof_end(rec, handle);
+    return handle;
+}
+
+#endif
+
+static void *loadprof_dlopen(const char *filename, int flags)
+{
+    loadprof_rec_t *rec = loadprof_begin(filename, __builtin_return_address(0), 1);
+    void           *handle = dlopen(filename, flags);
+
+    if(NULL != rec) loadprof_end(rec, handle);
+    return handle;
+}
+
+#ifdef __ANDROID__
+static void *loadprof_dlopen_ext(const char *filename, int flags, const void *extinfo)
+{
+    loadprof_rec_t *rec = loadprof_begin(filename, __builtin_return_address(0), 1);
+    void           *handle = loadprof_dlopen_ext_func(filename, flags, extinfo);
+
+    if(NULL != rec) loadprof_end(rec, handle);
+    return handle;
+}
+#endif
+
+//called with the mutex held
+static int loadprof_init_locked()
+{
+    int r;
+
+    if(loadprof_inited) return 0;
+
+    if(0 != pthread_key_create(&loadprof_key, NULL)) return EAGAIN;
+    if(0 != pthread_key_create(&loadprof_tid_key, NULL))
+    {
+        pthread_key_delete(loadprof_key);
+        return EAGAIN;
+    }
+    if(0 != (r = xhook_ignore(".*/libloadprof\\.so$", NULL))) goto err;
+
+#ifdef __ANDROID__
+    loadprof_loader_dlopen_func = (loadprof_loader_dlopen_t)dlsym(RTLD_DEFAULT, "__loader_dlopen");
+    loadprof_loader_dlopen_ext_func = (loadprof_loader_dlopen_ext_t)dlsym(RTLD_DEFAULT, "__loader_android_dlopen_ext");
+    if(NULL != loadprof_loader_dlopen_func && NULL != loadprof_loader_dlopen_ext_func)
+    {
+        if(0 != (r = xhook_register(".*/libdl\\.so$", "__loader_dlopen", loadprof_loader_dlopen, NULL))) goto err;
+        if(0 != (r = xhook_register(".*/libdl\\.so$", "__loader_android_dlopen_ext",
+                                    loadprof_loader_dlopen_ext, NULL))) goto err;
+    }
+    else
+    {
+        loadprof_loader_dlopen_func = NULL;
+        loadprof_dlopen_ext_func = (loadprof_dlopen_ext_t)dlsym(RTLD_DEFAULT, "android_dlopen_ext");
+    }
+#endif
+
+    loadprof_inited = 1;
+    return 0;
+
+ err:
+    //the next call creates them again
+    pthread_key_delete(loadprof_tid_key);
+    pthread_key_delete(loadprof_key);
+    return r;
+}
+
+int loadprof_register(const char *pathname_regex_str)
+{
+    regex_t regex;
+    int     r;
+
+    if(NULL == pathname_regex_str) return EINVAL;
+
+    pthread_mutex_lock(&loadprof_mutex);
+
+    if(0 != (r = loadprof_init_locked())) goto end;
+    if(loadprof_rules_cnt >= LOADPROF_POLICIES_MAX)
+    {
+        r = ENOSPC;
+        goto end;
+    }
+    if(0 != regcomp(&regex, pathname_regex_str, REG_NOSUB))
+    {
+        r = EINVAL;
+        goto end;
+    }
+
+#ifdef __ANDROID__
+    //libdl is hooked once for all the callers
+    if(NULL == loadprof_loader_dlopen_func)
+    {
+        if(0 == (r = xhook_register(pathname_regex_str, "dlopen", loadprof_dlopen, NULL)) &&
+           NULL != loadprof_dlopen_ext_func)
+            r = xhook_register(pathname_regex_str, "android_dlopen_ext", loadprof_dlopen_ext, NULL);
+    }
+#else
+    r = xhook_register(pathname_regex_str, "dlopen", loadprof_dlopen, NULL);
+#endif
+    if(0 != r)
+    {
+        regfree(&regex);
+        goto end;
+    }
+
+    loadprof_rules[loadprof_rules_cnt] = regex;
+    __atomic_store_n(&loadprof_rules_cnt, loadprof_rules_cnt + 1, __ATOMIC_RELEASE);
+
+ end:
+    pthread_mutex_unlock(&loadprof_mutex);
+    return r;
+}
+
+size_t loadprof_get_loads(loadprof_load_t *loads, size_t loads_cnt)
+{
+    size_t          i, cnt = __atomic_load_n(&loadprof_recs_cnt, __ATOMIC_RELAXED);
+    loadprof_rec_t *rec;
+    Dl_info         info;
+    int             done;
+
+    if(cnt > LOADPROF_LOADS_MAX) cnt = LOADPROF_LOADS_MAX;
+    for(i = 0; i < cnt && i < loads_cnt; i++)
+    {
+        rec = &loadprof_recs[i];
+        done = __atomic_load_n(&rec->done, __ATOMIC_ACQUIRE);
+        if(done && '\0' == rec->caller[0])
+        {
+            pthread_mutex_lock(&loadprof_mutex);
+            if('\0' == rec->caller[0])
+                strncpy(rec->caller, (0 != dladdr(rec->caller_addr, &info) && NULL != info.dli_fname ?
+                                      info.dli_fname : "unknown"), LOADPROF_PATHNAME_MAX - 1);
+            pthread_mutex_unlock(&loadprof_mutex);
+        }
+        loads[i].pathname = rec->pathname;
+        loads[i].caller   = rec->caller;
+        loads[i].parent   = rec->parent;
+        loads[i].depth    = rec->depth;
+        loads[i].tid      = rec->tid;
+        loads[i].ok       = (done ? rec->ok : 0);
+        loads[i].start_ns = rec->start_ns;
+        loads[i].total_ns = (done ? rec->total_ns : 0);
+        loads[i].self_ns  = (done ? rec->total_ns - rec->nested_ns : 0);
+    }
+    return cnt;
+}
+
+size_t loadprof_dropped()
+{
+    return (size_t)__atomic_load_n(&loadprof_dropped_cnt, __ATOMIC_RELAXED);
+}
+
+static void loadprof_dump_tree(FILE *fp, const loadprof_load_t *loads, size_t cnt, uint32_t parent)
+{
+    size_t i;
+
+    for(i = 0; i < cnt; i++)
+    {
+        if(loads[i].parent != parent) continue;
+        fprintf(fp, "%*s%10.3f ms (self %10.3f ms) %s <- %s%s\n", (int)loads[i].depth * 2, "",
+                (double)loads[i].total_ns / 1e6, (double)loads[i].self_ns / 1e6,
+                loads[i].pathname, loads[i].caller, (loads[i].ok ? "" : " [failed]"));
+        loadprof_dump_tree(fp, loads, cnt, (uint32_t)i);
+    }
+}
+
+int loadprof_dump(int fd)
+{
+    loadprof_load_t *loads;
+    size_t           cnt;
+    FILE            *fp;
+    int              dup_fd;
+
+    if(NULL == (loads = malloc(sizeof(loadprof_load_t) * LOADPROF_LOADS_MAX))) return ENOMEM;
+    cnt = loadprof_get_loads(loads, LOADPROF_LOADS_MAX);
+
+    if((dup_fd = dup(fd)) < 0 || NULL == (fp = fdopen(dup_fd, "w")))
+    {
+        if(dup_fd >= 0) close(dup_fd);
+        free(loads);
+        return EIO;
+    }
+    loadprof_dump_tree(fp, loads, cnt, LOADPROF_PARENT_NONE);
+    fprintf(fp, "%zu loads, %zu dropped\n", cnt, loadprof_dropped());
+    fclose(fp);
+    free(loads);
+    return 0;
+}
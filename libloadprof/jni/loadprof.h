@@ -0,0 +1,66 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#ifndef LOADPROF_H
+#define LOADPROF_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOADPROF_EXPORT __attribute__((visibility("default")))
+
+#define LOADPROF_PARENT_NONE UINT32_MAX
+
+//one dlopen/android_dlopen_ext, in call order
+typedef struct
+{
+    const char *pathname;   //as requested
+    const char *caller;     //library which called dlopen
+    uint32_t    parent;     //index of the load this one is nested in (constructors), or LOADPROF_PARENT_NONE
+    uint32_t    depth;
+    int         tid;
+    int         ok;         //0: failed, or still running
+    uint64_t    start_ns;   //CLOCK_MONOTONIC
+    uint64_t    total_ns;   //nested loads included
+    uint64_t    self_ns;    //nested loads excluded
+} loadprof_load_t;
+
+//the loads requested by the matched libraries, and the loads nested in them
+int loadprof_register(const char *pathname_regex_str) LOADPROF_EXPORT;
+
+//returns the number of loads, at most loads_cnt are copied
+size_t loadprof_get_loads(loadprof_load_t *loads, size_t loads_cnt) LOADPROF_EXPORT;
+
+size_t loadprof_dropped() LOADPROF_EXPORT;
+
+//the load tree as text, one load per line, indented by depth
+int loadprof_dump(int fd) LOADPROF_EXPORT;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,335 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include "xhook.h"
+#include "lockprof.h"
+
+//The lock hooks try the lock first, the clock is only read when that fails. So an uncontended
+//lock costs one trylock instead of one lock, plus the hook: glibc's trylock is slower than its
+//lock fast path, lockprof_bench measures ~8 -> ~20 ns per uncontended mutex lock+unlock.
+//
+//A condition wait is mostly idle, not contention: it is timed as a whole (the wait and the
+//mutex re-acquire can't be told apart from outside) and ranked by lockprof_top_cond() only.
+//
+//Each thread owns a table of sites keyed by (lock, kind, caller address), only the owner
+//writes it, and lockprof_top() reads all the tables without stopping anyone. The caller
+//addresses are resolved to libraries by lockprof_top(), so no dladdr() (which takes the
+//loader lock) is ever called while holding or waiting for an app lock.
+//Tables of exited threads are reused by the new threads, their sites are kept.
+
+typedef struct
+{
+    uintptr_t lock;   //0: empty, published last
+    uintptr_t caller;
+    uint32_t  kind;
+    uint64_t  contended;
+    uint64_t  wait_ns;
+    uint64_t  max_wait_ns;
+    uint64_t  try_failed;
+} lockprof_entry_t;
+
+typedef struct lockprof_table
+{
+    struct lockprof_table *next;
+    int                    owned;
+    lockprof_entry_t       entries[];
+} lockprof_table_t;
+
+static int                lockprof_inited = 0;
+static size_t             lockprof_entries_mask;
+static pthread_key_t      lockprof_tls_key;
+static lockprof_table_t  *lockprof_tables = NULL;
+static size_t             lockprof_dropped_cnt = 0;
+static pthread_mutex_t    lockprof_ignore_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int                lockprof_ignored = 0;
+
+static uint64_t lockprof_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void lockprof_tls_free(void *arg)
+{
+    __atomic_store_n(&((lockprof_table_t *)arg)->owned, 0, __ATOMIC_RELEASE);
+}
+
+//adopt the table of an exited thread, or add a new one
+static lockprof_table_t *lockprof_table_get()
+{
+    lockprof_table_t *t = (lockprof_table_t *)pthread_getspecific(lockprof_tls_key);
+    int               owned;
+
+    if(__builtin_expect(NULL != t, 1)) return t;
+
+    for(t = __atomic_load_n(&lockprof_tables, __ATOMIC_ACQUIRE); NULL != t; t = t->next)
+    {
+        owned = 0;
+        if(__atomic_compare_exchange_n(&t->owned, &owned, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) break;
+    }
+    if(NULL == t)
+    {
+        if(NULL == (t = calloc(1, sizeof(lockprof_table_t) + (lockprof_entries_mask + 1) * sizeof(lockprof_entry_t))))
+            return NULL;
+        t->owned = 1;
+        t->next = __atomic_load_n(&lockprof_tables, __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(&lockprof_tables, &t->next, t, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+    if(0 != pthread_setspecific(lockprof_tls_key, t))
+    {
+        __atomic_store_n(&t->owned, 0, __ATOMIC_RELEASE);
+        return NULL;
+    }
+    return t;
+}
+
+static size_t lockprof_hash(uintptr_t lock, uintptr_t caller, uint32_t kind)
+{
+    uint64_t h = (uint64_t)lock ^ ((uint64_t)caller * 31) ^ kind;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (size_t)h;
+}
+
+//only the owner thread writes its table, the readers see each field atomically
+static void lockprof_record(void *lock, void *caller, uint32_t kind, uint64_t wait_ns, int try_failed)
+{
+    lockprof_table_t *t;
+    lockprof_entry_t *e;
+    size_t            h, i;
+
+    if(NULL == (t = lockprof_table_get())) return;
+
+    h = lockprof_hash((uintptr_t)lock, (uintptr_t)caller, kind);
+    for(i = 0; i <= lockprof_entries_mask; i++)
+    {
+        e = &t->entries[(h + i) & lockprof_entries_mask];
+        if(0 == e->lock)
+        {
+            e->caller = (uintptr_t)caller;
+            e->kind = kind;
+            __atomic_store_n(&e->lock, (uintptr_t)lock, __ATOMIC_RELEASE);
+        }
+        else if(e->lock != (uintptr_t)lock || e->caller != (uintptr_t)caller || e->kind != kind)
+            continue;
+
+        if(try_failed)
+        {
+            __atomic_store_n(&e->try_failed, e->try_failed + 1, __ATOMIC_RELAXED);
+            return;
+        }
+        __atomic_store_n(&e->contended, e->contended + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&e->wait_ns, e->wait_ns + wait_ns, __ATOMIC_RELAXED);
+        if(wait_ns > e->max_wait_ns) __atomic_store_n(&e->max_wait_ns, wait_ns, __ATOMIC_RELAXED);
+        return;
+    }
+
+    __atomic_add_fetch(&lockprof_dropped_cnt, 1, __ATOMIC_RELAXED);
+}
+
+#define LOCKPROF_WRAP(name, type, kind, try_func)                       \
+    static int lockprof_##name(type *lock)                              \
+    {                                                                   \
+        uint64_t start;                                                 \
+        int      r;                                                     \
+                                                                        \
+        if(__builtin_expect(0 == (r = try_func(lock)), 1)) return 0;    \
+        if(EOWNERDEAD == r) return r; /* acquired, robust mutex */      \
+        if(EBUSY != r) return name(lock);                               \
+        start = lockprof_now_ns();                                      \
+        r = name(lock);                                                 \
+        lockprof_record(lock, __builtin_return_address(0), kind,        \
+                        lockprof_now_ns() - start, 0);                  \
+        return r;                                                       \
+    }
+
+LOCKPROF_WRAP(pthread_mutex_lock,    pthread_mutex_t,  LOCKPROF_KIND_MUTEX,     pthread_mutex_trylock)
+LOCKPROF_WRAP(pthread_rwlock_rdlock, pthread_rwlock_t, LOCKPROF_KIND_RWLOCK_RD, pthread_rwlock_tryrdlock)
+LOCKPROF_WRAP(pthread_rwlock_wrlock, pthread_rwlock_t, LOCKPROF_KIND_RWLOCK_WR, pthread_rwlock_trywrlock)
+
+#define LOCKPROF_WRAP_TRY(name, type, kind)                             \
+    static int lockprof_##name(type *lock)                              \
+    {                                                                   \
+        int r = name(lock);                                             \
+        if(__builtin_expect(EBUSY == r, 0))                             \
+            lockprof_record(lock, __builtin_return_address(0), kind, 0, 1); \
+        return r;                                                       \
+    }
+
+LOCKPROF_WRAP_TRY(pthread_mutex_trylock,    pthread_mutex_t,  LOCKPROF_KIND_MUTEX)
+LOCKPROF_WRAP_TRY(pthread_rwlock_tryrdlock, pthread_rwlock_t, LOCKPROF_KIND_RWLOCK_RD)
+LOCKPROF_WRAP_TRY(pthread_rwlock_trywrlock, pthread_rwlock_t, LOCKPROF_KIND_RWLOCK_WR)
+
+//a wait always blocks, there is no fast path to keep
+static int lockprof_pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+{
+    uint64_t start = lockprof_now_ns();
+    int      r = pthread_cond_wait(cond, mutex);
+
+    lockprof_record(cond, __builtin_return_address(0), LOCKPROF_KIND_COND, lockprof_now_ns() - start, 0);
+    return r;
+}
+
+static int lockprof_pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                                           const struct timespec *abstime)
+{
+    uint64_t start = lockprof_now_ns();
+    int      r = pthread_cond_timedwait(cond, mutex, abstime);
+
+    lockprof_record(cond, __builtin_return_address(0), LOCKPROF_KIND_COND, lockprof_now_ns() - start, 0);
+    return r;
+}
+
+int lockprof_init(size_t max_sites_per_thread)
+{
+    size_t cap = 64;
+
+    if(lockprof_inited) return 0;
+    if(0 == max_sites_per_thread) return EINVAL;
+
+    //keep the load factor under 0.5
+    while(cap < max_sites_per_thread * 2) cap <<= 1;
+    if(0 != pthread_key_create(&lockprof_tls_key, lockprof_tls_free)) return EAGAIN;
+
+    lockprof_entries_mask = cap - 1;
+    __atomic_store_n(&lockprof_inited, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int lockprof_register(const char *pathname_regex_str)
+{
+    int r;
+
+    if(!lockprof_inited || NULL == pathname_regex_str) return EINVAL;
+
+    //the locks taken by ourselves and by xhook must never be hooked
+    pthread_mutex_lock(&lockprof_ignore_mutex);
+    if(!lockprof_ignored)
+    {
+        if(0 != (r = xhook_ignore(".*/liblockprof\\.so$", NULL))) goto end;
+        lockprof_ignored = 1;
+    }
+    pthread_mutex_unlock(&lockprof_ignore_mutex);
+
+    if(0 != (r = xhook_register(pathname_regex_str, "pthread_mutex_lock",       lockprof_pthread_mutex_lock,       NULL))) return r;
+    if(0 != (r = xhook_register(pathname_regex_str, "pthread_mutex_trylock",    lockprof_pthread_mutex_trylock,    NULL))) return r;
+    if(0 != (r = xhook_register(pathname_regex_str, "pthread_rwlock_rdlock",    lockprof_pthread_rwlock_rdlock,    NULL))) return r;
+    if(0 != (r = xhook_register(pathname_regex_str, "pthread_rwlock_wrlock",    lockprof_pthread_rwlock_wrlock,    NULL))) return r;
+    if(0 != (r = xhook_register(pathname_regex_str, "pthread_rwlock_tryrdlock", lockprof_pthread_rwlock_tryrdlock, NULL))) return r;
+    if(0 != (r = xhook_register(pathname_regex_str, "pthread_rwlock_trywrlock", lockprof_pthread_rwlock_trywrlock, NULL))) return r;
+    if(0 != (r = xhook_register(pathname_regex_str, "pthread_cond_wait",        lockprof_pthread_cond_wait,        NULL))) return r;
+    if(0 != (r = xhook_register(pathname_regex_str, "pthread_cond_timedwait",   lockprof_pthread_cond_timedwait,   NULL))) return r;
+    return 0;
+
+ end:
+    pthread_mutex_unlock(&lockprof_ignore_mutex);
+    return r;
+}
+
+static int lockprof_site_cmp(const void *a, const void *b)
+{
+    uint64_t x = ((const lockprof_site_t *)a)->wait_ns, y = ((const lockprof_site_t *)b)->wait_ns;
+    return (x < y) - (x > y); //descending
+}
+
+//merge the sites of all the tables by (caller library, lock, kind), sorted by wait time
+static size_t lockprof_top_impl(lockprof_site_t *sites, size_t sites_cnt, int cond)
+{
+    lockprof_table_t *t;
+    lockprof_entry_t *e;
+    lockprof_site_t  *all = NULL, *s;
+    size_t            all_cnt = 0, all_cap = 0, i, j;
+    uintptr_t         lock;
+    uint64_t          max_wait_ns;
+    Dl_info           info;
+    const char       *pathname;
+    void             *p;
+
+    if(!lockprof_inited || (NULL == sites && sites_cnt > 0)) return 0;
+
+    for(t = __atomic_load_n(&lockprof_tables, __ATOMIC_ACQUIRE); NULL != t; t = t->next)
+    {
+        for(i = 0; i <= lockprof_entries_mask; i++)
+        {
+            e = &t->entries[i];
+            if(0 == (lock = __atomic_load_n(&e->lock, __ATOMIC_ACQUIRE))) continue;
+            if(cond != (LOCKPROF_KIND_COND == e->kind)) continue;
+
+            pathname = "unknown";
+            if(0 != dladdr((void *)e->caller, &info) && NULL != info.dli_fname) pathname = info.dli_fname;
+
+            for(j = 0; j < all_cnt; j++)
+                if(all[j].lock == (void *)lock && all[j].kind == (int)e->kind && 0 == strcmp(all[j].pathname, pathname))
+                    break;
+            if(j == all_cnt)
+            {
+                if(all_cnt == all_cap)
+                {
+                    if(NULL == (p = realloc(all, (all_cap + 256) * sizeof(lockprof_site_t)))) break;
+                    all = (lockprof_site_t *)p;
+                    all_cap += 256;
+                }
+                memset(&all[j], 0, sizeof(lockprof_site_t));
+                all[j].pathname = pathname;
+                all[j].lock = (void *)lock;
+                all[j].kind = (int)e->kind;
+                all_cnt++;
+            }
+            s = &all[j];
+            s->contended  += __atomic_load_n(&e->contended,  __ATOMIC_RELAXED);
+            s->wait_ns    += __atomic_load_n(&e->wait_ns,    __ATOMIC_RELAXED);
+            s->try_failed += __atomic_load_n(&e->try_failed, __ATOMIC_RELAXED);
+            max_wait_ns = __atomic_load_n(&e->max_wait_ns, __ATOMIC_RELAXED);
+            if(max_wait_ns > s->max_wait_ns) s->max_wait_ns = max_wait_ns;
+        }
+    }
+
+    if(all_cnt > 0) qsort(all, all_cnt, sizeof(lockprof_site_t), lockprof_site_cmp);
+    if(sites_cnt > all_cnt) sites_cnt = all_cnt;
+    if(sites_cnt > 0) memcpy(sites, all, sites_cnt * sizeof(lockprof_site_t));
+    free(all);
+    return sites_cnt;
+}
+
+size_t lockprof_top(lockprof_site_t *sites, size_t sites_cnt)
+{
+    return lockprof_top_impl(sites, sites_cnt, 0);
+}
+
+size_t lockprof_top_cond(lockprof_site_t *sites, size_t sites_cnt)
+{
+    return lockprof_top_impl(sites, sites_cnt, 1);
+}
+
+size_t lockprof_dropped()
+{
+    return __atomic_load_n(&lockprof_dropped_cnt, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,68 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#ifndef LOCKPROF_H
+#define LOCKPROF_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOCKPROF_EXPORT __attribute__((visibility("default")))
+
+#define LOCKPROF_KIND_MUTEX     0 //pthread_mutex_lock
+#define LOCKPROF_KIND_RWLOCK_RD 1 //pthread_rwlock_rdlock
+#define LOCKPROF_KIND_RWLOCK_WR 2 //pthread_rwlock_wrlock
+#define LOCKPROF_KIND_COND      3 //pthread_cond_wait / pthread_cond_timedwait (the whole wait)
+
+//contention on one lock, from one caller library
+typedef struct
+{
+    const char *pathname;    //caller library
+    void       *lock;
+    int         kind;        //LOCKPROF_KIND_*
+    uint64_t    contended;   //calls which had to wait
+    uint64_t    wait_ns;     //total wait time
+    uint64_t    max_wait_ns;
+    uint64_t    try_failed;  //failed trylock calls
+} lockprof_site_t;
+
+int lockprof_init(size_t max_sites_per_thread) LOCKPROF_EXPORT;
+
+int lockprof_register(const char *pathname_regex_str) LOCKPROF_EXPORT;
+
+//lock contention (mutex and rwlock), sorted by wait time
+size_t lockprof_top(lockprof_site_t *sites, size_t sites_cnt) LOCKPROF_EXPORT;
+
+//condition waits (LOCKPROF_KIND_COND), sorted by wait time, mostly idle time
+size_t lockprof_top_cond(lockprof_site_t *sites, size_t sites_cnt) LOCKPROF_EXPORT;
+
+size_t lockprof_dropped() LOCKPROF_EXPORT;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,514 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <regex.h>
+#include <time.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include "xhook.h"
+#include "loglimit.h"
+
+#ifdef __ANDROID__
+#include <android/log.h>
+#else
+#include <syslog.h>
+#endif
+
+//The log functions of the matched libraries are hooked. Each line is charged to a token
+//bucket keyed by (caller library, tag, priority), and a line without a token returns
+//before its format string is looked at, so the dropped lines cost no formatting and no
+//logger IPC.
+//
+//The bucket is kept as its "theoretical arrival time" (GCRA), one 64-bit word updated
+//with a CAS, it behaves as a token bucket of size burst refilled at rate per second.
+//
+//The caller library is resolved by dladdr() once per call site, and the tags longer than
+//LOGLIMIT_TAG_MAX - 1 share the bucket of their prefix. When a table is full the lines
+//are not limited. The entries are never removed, so a full probe window stays full: it is
+//seen without the mutex, and an overflowing app doesn't serialize its logging on it.
+
+#define LOGLIMIT_POLICIES_MAX     32
+#define LOGLIMIT_LIBS_MAX         256
+#define LOGLIMIT_PATHNAME_MAX     256
+#define LOGLIMIT_SITES_MAX        1024 //power of 2
+#define LOGLIMIT_BUCKETS_MAX      4096 //power of 2
+#define LOGLIMIT_PROBE_MAX        16
+#define LOGLIMIT_TAG_MAX          32
+
+typedef struct
+{
+    regex_t           regex;
+    loglimit_policy_t policy;
+} loglimit_rule_t;
+
+//caller library (interned, never removed)
+typedef struct
+{
+    uintptr_t                base;
+    char                     pathname[LOGLIMIT_PATHNAME_MAX];
+    const loglimit_policy_t *policy; //NULL: not limited
+} loglimit_lib_t;
+
+//call site -> caller library
+typedef struct
+{
+    uintptr_t       caller; //0: empty, written last
+    loglimit_lib_t *lib;
+} loglimit_site_t;
+
+typedef struct
+{
+    int             used; //written last
+    uint32_t        hash;
+    loglimit_lib_t *lib;
+    int             prio;
+    char            tag[LOGLIMIT_TAG_MAX];
+    uint64_t        tat;  //when the bucket will be full again, ns
+    uint64_t        denied; //lines without a token, sampled ones included
+    uint64_t        passed;
+    uint64_t        suppressed;
+} loglimit_bucket_t;
+
+static loglimit_rule_t    loglimit_rules[LOGLIMIT_POLICIES_MAX];
+static size_t             loglimit_rules_cnt = 0;
+static loglimit_lib_t     loglimit_libs[LOGLIMIT_LIBS_MAX] = {{.pathname = "unknown"}};
+static size_t             loglimit_libs_cnt = 1; //0 is reserved for unknown
+static loglimit_site_t    loglimit_sites[LOGLIMIT_SITES_MAX];
+static loglimit_bucket_t  loglimit_buckets[LOGLIMIT_BUCKETS_MAX];
+static uint64_t           loglimit_suppressed = 0;
+static pthread_mutex_t    loglimit_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int                loglimit_ignored = 0;
+
+static uint64_t loglimit_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+//called with the mutex held
+static const loglimit_policy_t *loglimit_find_policy(const char *pathname)
+{
+    size_t i;
+
+    for(i = 0; i < loglimit_rules_cnt; i++)
+        if(0 == regexec(&loglimit_rules[i].regex, pathname, 0, NULL, 0)) return &loglimit_rules[i].policy;
+    return NULL;
+}
+
+//called with the mutex held
+static loglimit_lib_t *loglimit_lib_get_locked(void *caller)
+{
+    Dl_info   info;
+    uintptr_t base;
+    size_t    i;
+
+    if(0 == dladdr(caller, &info) || NULL == info.dli_fbase || NULL == info.dli_fname)
+        return &loglimit_libs[0];
+    base = (uintptr_t)info.dli_fbase;
+
+    for(i = 1; i < loglimit_libs_cnt; i++)
+        if(loglimit_libs[i].base == base) return &loglimit_libs[i];
+    if(loglimit_libs_cnt >= LOGLIMIT_LIBS_MAX) return &loglimit_libs[0];
+
+    loglimit_libs[i].base = base;
+    strncpy(loglimit_libs[i].pathname, info.dli_fname, LOGLIMIT_PATHNAME_MAX - 1);
+    __atomic_store_n(&loglimit_libs[i].policy, loglimit_find_policy(info.dli_fname), __ATOMIC_RELEASE);
+    __atomic_store_n(&loglimit_libs_cnt, i + 1, __ATOMIC_RELEASE);
+    return &loglimit_libs[i];
+}
+
+static loglimit_lib_t *loglimit_site_get(void *caller)
+{
+    uintptr_t        c = (uintptr_t)caller, cur;
+    size_t           h = (size_t)((c >> 2) * 0x9E3779B97F4A7C15ULL >> 32);
+    size_t           i;
+    loglimit_site_t *site;
+    loglimit_lib_t  *lib;
+
+    for(i = 0; i < LOGLIMIT_PROBE_MAX; i++)
+    {
+        site = &loglimit_sites[(h + i) & (LOGLIMIT_SITES_MAX - 1)];
+        if(c == (cur = __atomic_load_n(&site->caller, __ATOMIC_ACQUIRE))) return site->lib;
+        if(0 == cur) break;
+    }
+    if(LOGLIMIT_PROBE_MAX == i) return &loglimit_libs[0]; //full, not limited
+
+    pthread_mutex_lock(&loglimit_mutex);
+    lib = loglimit_lib_get_locked(caller);
+    for(i = 0; i < LOGLIMIT_PROBE_MAX; i++)
+    {
+        site = &loglimit_sites[(h + i) & (LOGLIMIT_SITES_MAX - 1)];
+        if(c == site->caller) break;
+        if(0 == site->caller)
+        {
+            site->lib = lib;
+            __atomic_store_n(&site->caller, c, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&loglimit_mutex);
+    return lib;
+}
+
+static uint32_t loglimit_hash(loglimit_lib_t *lib, const char *tag, int prio)
+{
+    uint32_t h = 2166136261u;
+    size_t   i;
+
+    for(i = 0; i < LOGLIMIT_TAG_MAX - 1 && '\0' != tag[i]; i++)
+        h = (h ^ (uint8_t)tag[i]) * 16777619u;
+    h = (h ^ (uint32_t)(lib - loglimit_libs)) * 16777619u;
+    h = (h ^ (uint32_t)prio) * 16777619u;
+    return h;
+}
+
+static int loglimit_bucket_match(loglimit_bucket_t *b, uint32_t hash, loglimit_lib_t *lib,
+                                 const char *tag, int prio)
+{
+    return b->hash == hash && b->lib == lib && b->prio == prio &&
+        0 == strncmp(b->tag, tag, LOGLIMIT_TAG_MAX - 1);
+}
+
+static loglimit_bucket_t *loglimit_bucket_get(loglimit_lib_t *lib, const char *tag, int prio)
+{
+    uint32_t           hash = loglimit_hash(lib, tag, prio);
+    size_t             i;
+    loglimit_bucket_t *b, *r = NULL;
+
+    for(i = 0; i < LOGLIMIT_PROBE_MAX; i++)
+    {
+        b = &loglimit_buckets[(hash + i) & (LOGLIMIT_BUCKETS_MAX - 1)];
+        if(!__atomic_load_n(&b->used, __ATOMIC_ACQUIRE)) break;
+        if(loglimit_bucket_match(b, hash, lib, tag, prio)) return b;
+    }
+    if(LOGLIMIT_PROBE_MAX == i) return NULL; //full, not limited
+
+    pthread_mutex_lock(&loglimit_mutex);
+    for(i = 0; i < LOGLIMIT_PROBE_MAX; i++)
+    {
+        b = &loglimit_buckets[(hash + i) & (LOGLIMIT_BUCKETS_MAX - 1)];
+        if(!b->used)
+        {
+            b->hash = hash;
+            b->lib  = lib;
+            b->prio = prio;
+            strncpy(b->tag, tag, LOGLIMIT_TAG_MAX - 1);
+            __atomic_store_n(&b->used, 1, __ATOMIC_RELEASE);
+            r = b;
+            break;
+        }
+        if(loglimit_bucket_match(b, hash, lib, tag, prio))
+        {
+            r = b;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&loglimit_mutex);
+    return r;
+}
+
+//0: drop the line
+static int loglimit_allow(void *caller, const char *tag, int prio)
+{
+    loglimit_lib_t          *lib = loglimit_site_get(caller);
+    const loglimit_policy_t *policy = __atomic_load_n(&lib->policy, __ATOMIC_ACQUIRE);
+    loglimit_bucket_t       *b;
+    uint64_t                 now, tat, new_tat, interval, limit, n;
+
+    if(NULL == policy || (0 != policy->pass_prio && prio >= policy->pass_prio)) return 1;
+    if(NULL == (b = loglimit_bucket_get(lib, (NULL == tag ? "" : tag), prio))) return 1;
+
+    if(0 != policy->rate)
+    {
+        now = loglimit_now_ns();
+        interval = 1000000000ULL / policy->rate;
+        limit = interval * (0 != policy->burst ? policy->burst : policy->rate);
+        tat = __atomic_load_n(&b->tat, __ATOMIC_RELAXED);
+        do
+        {
+            new_tat = (tat > now ? tat : now) + interval;
+            if(new_tat - now > limit) goto suppress;
+        } while(!__atomic_compare_exchange_n(&b->tat, &tat, new_tat, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+        __atomic_add_fetch(&b->passed, 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+
+ suppress:
+    n = __atomic_add_fetch(&b->denied, 1, __ATOMIC_RELAXED);
+    if(0 != policy->sample && 0 == n % policy->sample)
+    {
+        __atomic_add_fetch(&b->passed, 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+    __atomic_add_fetch(&b->suppressed, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&loglimit_suppressed, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+#ifdef __ANDROID__
+
+//a dropped line is reported as written
+
+static int loglimit_android_log_write(int prio, const char *tag, const char *text)
+{
+    if(!loglimit_allow(__builtin_return_address(0), tag, prio)) return 1;
+    return __android_log_write(prio, tag, text);
+}
+
+static int loglimit_android_log_vprint(int prio, const char *tag, const char *fmt, va_list ap)
+{
+    if(!loglimit_allow(__builtin_return_address(0), tag, prio)) return 1;
+    return __android_log_vprint(prio, tag, fmt, ap);
+}
+
+static int loglimit_android_log_print(int prio, const char *tag, const char *fmt, ...)
+{
+    va_list ap;
+    int     r;
+
+    if(!loglimit_allow(__builtin_return_address(0), tag, prio)) return 1;
+    va_start(ap, fmt);
+    r = __android_log_vprint(prio, tag, fmt, ap);
+    va_end(ap);
+    return r;
+}
+
+static const char *loglimit_symbols[] = {"__android_log_write", "__android_log_print", "__android_log_vprint"};
+static void       *loglimit_funcs[]   = {(void *)loglimit_android_log_write,
+                                         (void *)loglimit_android_log_print,
+                                         (void *)loglimit_android_log_vprint};
+
+#else
+
+#define LOGLIMIT_TAG_SYSLOG "syslog"
+#define LOGLIMIT_TAG_STDERR "stderr"
+
+#ifdef __GLIBC__
+//the _FORTIFY_SOURCE variants, which the callers built with it import instead
+extern int  __fprintf_chk(FILE *stream, int flag, const char *fmt, ...);
+extern int  __vfprintf_chk(FILE *stream, int flag, const char *fmt, va_list ap);
+extern void __syslog_chk(int pri, int flag, const char *fmt, ...);
+extern void __vsyslog_chk(int pri, int flag, const char *fmt, va_list ap);
+#endif
+
+static int loglimit_syslog_prio(int pri)
+{
+    switch(LOG_PRI(pri))
+    {
+    case LOG_DEBUG:   return LOGLIMIT_PRIO_DEBUG;
+    case LOG_INFO:
+    case LOG_NOTICE:  return LOGLIMIT_PRIO_INFO;
+    case LOG_WARNING: return LOGLIMIT_PRIO_WARN;
+    case LOG_ERR:     return LOGLIMIT_PRIO_ERROR;
+    default:          return LOGLIMIT_PRIO_FATAL;
+    }
+}
+
+static void loglimit_vsyslog(int pri, const char *fmt, va_list ap)
+{
+    if(!loglimit_allow(__builtin_return_address(0), LOGLIMIT_TAG_SYSLOG, loglimit_syslog_prio(pri))) return;
+    vsyslog(pri, fmt, ap);
+}
+
+static void loglimit_syslog(int pri, const char *fmt, ...)
+{
+    va_list ap;
+
+    if(!loglimit_allow(__builtin_return_address(0), LOGLIMIT_TAG_SYSLOG, loglimit_syslog_prio(pri))) return;
+    va_start(ap, fmt);
+    vsyslog(pri, fmt, ap);
+    va_end(ap);
+}
+
+//a dropped line is reported as written, with 0 characters
+
+static int loglimit_vfprintf(FILE *stream, const char *fmt, va_list ap)
+{
+    if(stderr == stream && !loglimit_allow(__builtin_return_address(0), LOGLIMIT_TAG_STDERR, LOGLIMIT_PRIO_INFO))
+        return 0;
+    return vfprintf(stream, fmt, ap);
+}
+
+static int loglimit_fprintf(FILE *stream, const char *fmt, ...)
+{
+    va_list ap;
+    int     r;
+
+    if(stderr == stream && !loglimit_allow(__builtin_return_address(0), LOGLIMIT_TAG_STDERR, LOGLIMIT_PRIO_INFO))
+        return 0;
+    va_start(ap, fmt);
+    r = vfprintf(stream, fmt, ap);
+    va_end(ap);
+    return r;
+}
+
+//the compilers turn fprintf() without conversions into these two
+static int loglimit_fputs(const char *s, FILE *stream)
+{
+    if(stderr == stream && !loglimit_allow(__builtin_return_address(0), LOGLIMIT_TAG_STDERR, LOGLIMIT_PRIO_INFO))
+        return 0;
+    return fputs(s, stream);
+}
+
+static size_t loglimit_fwrite(const void *ptr, size_t size, size_t nmemb, FILE *stream)
+{
+    if(stderr == stream && !loglimit_allow(__builtin_return_address(0), LOGLIMIT_TAG_STDERR, LOGLIMIT_PRIO_INFO))
+        return nmemb;
+    return fwrite(ptr, size, nmemb, stream);
+}
+
+#ifdef __GLIBC__
+static void loglimit_vsyslog_chk(int pri, int flag, const char *fmt, va_list ap)
+{
+    if(!loglimit_allow(__builtin_return_address(0), LOGLIMIT_TAG_SYSLOG, loglimit_syslog_prio(pri))) return;
+    __vsyslog_chk(pri, flag, fmt, ap);
+}
+
+static void loglimit_syslog_chk(int pri, int flag, const char *fmt, ...)
+{
+    va_list ap;
+
+    if(!loglimit_allow(__builtin_return_address(0), LOGLIMIT_TAG_SYSLOG, loglimit_syslog_prio(pri))) return;
+    va_start(ap, fmt);
+    __vsyslog_chk(pri, flag, fmt, ap);
+    va_end(ap);
+}
+
+static int loglimit_vfprintf_chk(FILE *stream, int flag, const char *fmt, va_list ap)
+{
+    if(stderr == stream && !loglimit_allow(__builtin_return_address(0), LOGLIMIT_TAG_STDERR, LOGLIMIT_PRIO_INFO))
+        return 0;
+    return __vfprintf_chk(stream, flag, fmt, ap);
+}
+
+static int loglimit_fprintf_chk(FILE *stream, int flag, const char *fmt, ...)
+{
+    va_list ap;
+    int     r;
+
+    if(stderr == stream && !loglimit_allow(__builtin_return_address(0), LOGLIMIT_TAG_STDERR, LOGLIMIT_PRIO_INFO))
+        return 0;
+    va_start(ap, fmt);
+    r = __vfprintf_chk(stream, flag, fmt, ap);
+    va_end(ap);
+    return r;
+}
+#endif
+
+static const char *loglimit_symbols[] = {"syslog", "vsyslog", "fprintf", "vfprintf", "fputs", "fwrite",
+#ifdef __GLIBC__
+                                         "__syslog_chk", "__vsyslog_chk", "__fprintf_chk", "__vfprintf_chk",
+#endif
+};
+static void       *loglimit_funcs[]   = {(void *)loglimit_syslog, (void *)loglimit_vsyslog,
+                                         (void *)loglimit_fprintf, (void *)loglimit_vfprintf,
+                                         (void *)loglimit_fputs, (void *)loglimit_fwrite,
+#ifdef __GLIBC__
+                                         (void *)loglimit_syslog_chk, (void *)loglimit_vsyslog_chk,
+                                         (void *)loglimit_fprintf_chk, (void *)loglimit_vfprintf_chk,
+#endif
+};
+
+#endif
+
+int loglimit_register(const char *pathname_regex_str, const loglimit_policy_t *policy)
+{
+    loglimit_rule_t *rule;
+    size_t           i;
+    int              r = 0;
+
+    if(NULL == pathname_regex_str || NULL == policy) return EINVAL;
+
+    pthread_mutex_lock(&loglimit_mutex);
+
+    //our own output is never limited
+    if(!loglimit_ignored)
+    {
+        if(0 != (r = xhook_ignore(".*/libloglimit\\.so$", NULL))) goto end;
+        loglimit_ignored = 1;
+    }
+
+    if(loglimit_rules_cnt >= LOGLIMIT_POLICIES_MAX)
+    {
+        r = ENOSPC;
+        goto end;
+    }
+    rule = &loglimit_rules[loglimit_rules_cnt];
+    if(0 != regcomp(&rule->regex, pathname_regex_str, REG_NOSUB))
+    {
+        r = EINVAL;
+        goto end;
+    }
+    rule->policy = *policy;
+    for(i = 0; i < sizeof(loglimit_symbols) / sizeof(loglimit_symbols[0]); i++)
+        if(0 != (r = xhook_register(pathname_regex_str, loglimit_symbols[i], loglimit_funcs[i], NULL))) break;
+    if(0 != r)
+    {
+        regfree(&rule->regex);
+        goto end;
+    }
+    loglimit_rules_cnt++;
+
+    //the libraries which have logged before
+    for(i = 1; i < loglimit_libs_cnt; i++)
+        if(NULL == loglimit_libs[i].policy)
+            __atomic_store_n(&loglimit_libs[i].policy, loglimit_find_policy(loglimit_libs[i].pathname),
+                             __ATOMIC_RELEASE);
+
+ end:
+    pthread_mutex_unlock(&loglimit_mutex);
+    return r;
+}
+
+size_t loglimit_get_entries(loglimit_entry_t *entries, size_t entries_cnt)
+{
+    loglimit_bucket_t *b;
+    size_t             i, cnt = 0;
+
+    for(i = 0; i < LOGLIMIT_BUCKETS_MAX; i++)
+    {
+        b = &loglimit_buckets[i];
+        if(!__atomic_load_n(&b->used, __ATOMIC_ACQUIRE)) continue;
+        if(cnt < entries_cnt)
+        {
+            entries[cnt].pathname   = b->lib->pathname;
+            entries[cnt].tag        = b->tag;
+            entries[cnt].prio       = b->prio;
+            entries[cnt].passed     = __atomic_load_n(&b->passed,     __ATOMIC_RELAXED);
+            entries[cnt].suppressed = __atomic_load_n(&b->suppressed, __ATOMIC_RELAXED);
+        }
+        cnt++;
+    }
+    return cnt;
+}
+
+uint64_t loglimit_get_suppressed()
+{
+    return __atomic_load_n(&loglimit_suppressed, __ATOMIC_RELAXED);
+}
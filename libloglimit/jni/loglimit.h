@@ -0,0 +1,76 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#ifndef LOGLIMIT_H
+#define LOGLIMIT_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOGLIMIT_EXPORT __attribute__((visibility("default")))
+
+//priorities, the same values as android_LogPriority
+//syslog() levels are mapped to them, fprintf(stderr) lines are LOGLIMIT_PRIO_INFO
+#define LOGLIMIT_PRIO_VERBOSE 2
+#define LOGLIMIT_PRIO_DEBUG   3
+#define LOGLIMIT_PRIO_INFO    4
+#define LOGLIMIT_PRIO_WARN    5
+#define LOGLIMIT_PRIO_ERROR   6
+#define LOGLIMIT_PRIO_FATAL   7
+
+//one token bucket per (library, tag, priority)
+typedef struct
+{
+    uint32_t rate;      //lines per second
+    uint32_t burst;     //bucket size, 0: same as rate
+    uint32_t sample;    //when the bucket is empty, still pass 1 of every N lines, 0: none
+    int      pass_prio; //lines of this priority or higher are never limited, 0: none
+} loglimit_policy_t;
+
+//lines of one (library, tag, priority)
+typedef struct
+{
+    const char *pathname;
+    const char *tag;        //"syslog" / "stderr" for the Linux outputs
+    int         prio;
+    uint64_t    passed;
+    uint64_t    suppressed;
+} loglimit_entry_t;
+
+//__android_log_write/print/vprint on Android,
+//syslog/vsyslog and fprintf/vfprintf/fputs/fwrite to stderr on Linux
+int loglimit_register(const char *pathname_regex_str, const loglimit_policy_t *policy) LOGLIMIT_EXPORT;
+
+//returns the number of entries, at most entries_cnt are copied
+size_t loglimit_get_entries(loglimit_entry_t *entries, size_t entries_cnt) LOGLIMIT_EXPORT;
+
+uint64_t loglimit_get_suppressed() LOGLIMIT_EXPORT;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,308 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <regex.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "xhook.h"
+#include "threadgov.h"
+
+//pthread_create() of the matched libraries is hooked, the start routine is wrapped, and
+//the policy of the first matching regex is applied in the new thread before it runs.
+//The policy of a caller library is looked up once, when it creates its first thread.
+
+#define THREADGOV_POLICIES_MAX    32
+#define THREADGOV_LIBS_MAX        256
+#define THREADGOV_PATHNAME_MAX    256
+#define THREADGOV_NAME_MAX        16  //including the NUL, see PR_SET_NAME
+
+typedef struct
+{
+    regex_t            regex;
+    threadgov_policy_t policy;
+} threadgov_rule_t;
+
+//caller library (interned, never removed)
+typedef struct
+{
+    uintptr_t                 base;
+    char                      pathname[THREADGOV_PATHNAME_MAX];
+    const threadgov_policy_t *policy; //NULL: not governed
+    uint64_t                  created;
+    uint64_t                  running;
+    uint64_t                  failed;
+    uint64_t                  seq;
+} threadgov_lib_info_t;
+
+typedef struct
+{
+    void                 *(*start_routine)(void *);
+    void                  *arg;
+    threadgov_lib_info_t  *lib;
+} threadgov_start_t;
+
+static threadgov_rule_t      threadgov_rules[THREADGOV_POLICIES_MAX];
+static size_t                threadgov_rules_cnt = 0;
+static threadgov_lib_info_t  threadgov_libs[THREADGOV_LIBS_MAX] = {{.pathname = "unknown"}};
+static size_t                threadgov_libs_cnt = 1; //0 is reserved for unknown
+static pthread_mutex_t       threadgov_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int                   threadgov_ignored = 0;
+
+//called with the mutex held
+static const threadgov_policy_t *threadgov_find_policy(const char *pathname)
+{
+    size_t i;
+
+    for(i = 0; i < threadgov_rules_cnt; i++)
+        if(0 == regexec(&threadgov_rules[i].regex, pathname, 0, NULL, 0)) return &threadgov_rules[i].policy;
+    return NULL;
+}
+
+static threadgov_lib_info_t *threadgov_lib_get(void *caller)
+{
+    Dl_info   info;
+    uintptr_t base;
+    size_t    i, cnt;
+
+    if(0 == dladdr(caller, &info) || NULL == info.dli_fbase || NULL == info.dli_fname)
+        return &threadgov_libs[0];
+    base = (uintptr_t)info.dli_fbase;
+
+    cnt = __atomic_load_n(&threadgov_libs_cnt, __ATOMIC_ACQUIRE);
+    for(i = 1; i < cnt; i++)
+        if(threadgov_libs[i].base == base) return &threadgov_libs[i];
+
+    pthread_mutex_lock(&threadgov_mutex);
+    cnt = threadgov_libs_cnt;
+    for(i = 1; i < cnt; i++)
+        if(threadgov_libs[i].base == base) goto end;
+    if(cnt >= THREADGOV_LIBS_MAX)
+    {
+        i = 0;
+        goto end;
+    }
+    threadgov_libs[i].base = base;
+    strncpy(threadgov_libs[i].pathname, info.dli_fname, THREADGOV_PATHNAME_MAX - 1);
+    threadgov_libs[i].policy = threadgov_find_policy(info.dli_fname);
+    __atomic_store_n(&threadgov_libs_cnt, cnt + 1, __ATOMIC_RELEASE);
+ end:
+    pthread_mutex_unlock(&threadgov_mutex);
+    return &threadgov_libs[i];
+}
+
+static void threadgov_apply(threadgov_lib_info_t *lib)
+{
+    const threadgov_policy_t *policy = lib->policy;
+    pid_t                     tid = (pid_t)syscall(SYS_gettid);
+    cpu_set_t                 cpus;
+    char                      name[THREADGOV_NAME_MAX];
+    size_t                    i;
+
+    if(0 != policy->cpu_mask)
+    {
+        CPU_ZERO(&cpus);
+        for(i = 0; i < 64 && i < CPU_SETSIZE; i++)
+            if(policy->cpu_mask & ((uint64_t)1 << i)) CPU_SET(i, &cpus);
+        sched_setaffinity(tid, sizeof(cpus), &cpus);
+    }
+
+    //linux: the nice value is per thread
+    if(THREADGOV_NICE_KEEP != policy->nice)
+        setpriority(PRIO_PROCESS, (id_t)tid, policy->nice);
+
+    if(NULL != policy->name_prefix)
+    {
+        snprintf(name, sizeof(name), "%s%llu", policy->name_prefix,
+                 (unsigned long long)__atomic_add_fetch(&lib->seq, 1, __ATOMIC_RELAXED));
+        prctl(PR_SET_NAME, name, 0, 0, 0);
+    }
+}
+
+static void threadgov_exit(void *arg)
+{
+    __atomic_sub_fetch(&((threadgov_lib_info_t *)arg)->running, 1, __ATOMIC_RELAXED);
+}
+
+static void *threadgov_start_routine(void *arg)
+{
+    threadgov_start_t      start = *(threadgov_start_t *)arg;
+    void                  *r;
+
+    free(arg);
+    if(NULL != start.lib->policy) threadgov_apply(start.lib);
+
+    //also on pthread_exit() and cancellation
+    pthread_cleanup_push(threadgov_exit, start.lib);
+    r = start.start_routine(start.arg);
+    pthread_cleanup_pop(1);
+    return r;
+}
+
+//pthread_attr_t can't be copied by value, copy the portable attributes one by one
+//(the np extensions of glibc, CPU affinity and signal mask, are lost)
+static int threadgov_attr_copy(pthread_attr_t *dst, const pthread_attr_t *src)
+{
+    struct sched_param param;
+    size_t             guard_size;
+    int                v;
+
+    if(0 != pthread_attr_getdetachstate(src, &v) || 0 != pthread_attr_setdetachstate(dst, v)) return EINVAL;
+    if(0 != pthread_attr_getguardsize(src, &guard_size) || 0 != pthread_attr_setguardsize(dst, guard_size)) return EINVAL;
+    if(0 != pthread_attr_getscope(src, &v) || 0 != pthread_attr_setscope(dst, v)) return EINVAL;
+    if(0 != pthread_attr_getschedpolicy(src, &v) || 0 != pthread_attr_setschedpolicy(dst, v)) return EINVAL;
+    if(0 != pthread_attr_getschedparam(src, &param) || 0 != pthread_attr_setschedparam(dst, &param)) return EINVAL;
+#if !defined(__ANDROID__) || __ANDROID_API__ >= 28
+    if(0 != pthread_attr_getinheritsched(src, &v) || 0 != pthread_attr_setinheritsched(dst, v)) return EINVAL;
+#endif
+    return 0;
+}
+
+static int threadgov_pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+                                    void *(*start_routine)(void *), void *arg)
+{
+    threadgov_lib_info_t *lib = threadgov_lib_get(__builtin_return_address(0));
+    threadgov_start_t    *start;
+    pthread_attr_t        new_attr;
+    void                 *stack_addr = NULL;
+    size_t                stack_size = 0;
+    int                   new_attr_inited = 0;
+    int                   r;
+
+    if(NULL == (start = malloc(sizeof(threadgov_start_t)))) return EAGAIN;
+    start->start_routine = start_routine;
+    start->arg = arg;
+    start->lib = lib;
+
+    if(NULL != lib->policy && 0 != lib->policy->stack_size)
+    {
+        if(NULL == attr)
+        {
+            if(0 == pthread_attr_init(&new_attr))
+            {
+                new_attr_inited = 1;
+                if(0 == pthread_attr_setstacksize(&new_attr, lib->policy->stack_size)) attr = &new_attr;
+            }
+        }
+        else if(0 != pthread_attr_getstack(attr, &stack_addr, &stack_size) || NULL == stack_addr)
+        {
+            //the caller's attr with our stack size, or the caller's attr unchanged
+            if(0 == pthread_attr_init(&new_attr))
+            {
+                new_attr_inited = 1;
+                if(0 == threadgov_attr_copy(&new_attr, attr) &&
+                   0 == pthread_attr_setstacksize(&new_attr, lib->policy->stack_size)) attr = &new_attr;
+            }
+        }
+    }
+
+    __atomic_add_fetch(&lib->running, 1, __ATOMIC_RELAXED);
+    if(0 != (r = pthread_create(thread, attr, threadgov_start_routine, start)))
+    {
+        __atomic_sub_fetch(&lib->running, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&lib->failed, 1, __ATOMIC_RELAXED);
+        free(start);
+    }
+    else
+        __atomic_add_fetch(&lib->created, 1, __ATOMIC_RELAXED);
+
+    if(new_attr_inited) pthread_attr_destroy(&new_attr);
+    return r;
+}
+
+int threadgov_register(const char *pathname_regex_str, const threadgov_policy_t *policy)
+{
+    threadgov_rule_t *rule;
+    size_t            i;
+    int               r = 0;
+
+    if(NULL == pathname_regex_str || NULL == policy) return EINVAL;
+    if(NULL != policy->name_prefix && strlen(policy->name_prefix) >= THREADGOV_NAME_MAX) return EINVAL;
+
+    pthread_mutex_lock(&threadgov_mutex);
+
+    //our own threads are never governed
+    if(!threadgov_ignored)
+    {
+        if(0 != (r = xhook_ignore(".*/libthreadgov\\.so$", "pthread_create"))) goto end;
+        threadgov_ignored = 1;
+    }
+
+    if(threadgov_rules_cnt >= THREADGOV_POLICIES_MAX)
+    {
+        r = ENOSPC;
+        goto end;
+    }
+    rule = &threadgov_rules[threadgov_rules_cnt];
+    if(0 != regcomp(&rule->regex, pathname_regex_str, REG_NOSUB))
+    {
+        r = EINVAL;
+        goto end;
+    }
+    rule->policy = *policy;
+    if(NULL != policy->name_prefix && NULL == (rule->policy.name_prefix = strdup(policy->name_prefix)))
+    {
+        regfree(&rule->regex);
+        r = ENOMEM;
+        goto end;
+    }
+    if(0 != (r = xhook_register(pathname_regex_str, "pthread_create", threadgov_pthread_create, NULL)))
+    {
+        free((void *)rule->policy.name_prefix);
+        regfree(&rule->regex);
+        goto end;
+    }
+    threadgov_rules_cnt++;
+
+    //the libraries which have created threads before
+    for(i = 1; i < threadgov_libs_cnt; i++)
+        if(NULL == threadgov_libs[i].policy)
+            threadgov_libs[i].policy = threadgov_find_policy(threadgov_libs[i].pathname);
+
+ end:
+    pthread_mutex_unlock(&threadgov_mutex);
+    return r;
+}
+
+size_t threadgov_get_libs(threadgov_lib_t *libs, size_t libs_cnt)
+{
+    size_t i, cnt = __atomic_load_n(&threadgov_libs_cnt, __ATOMIC_ACQUIRE);
+
+    for(i = 0; i < cnt && i < libs_cnt; i++)
+    {
+        libs[i].pathname = threadgov_libs[i].pathname;
+        libs[i].governed = (NULL != threadgov_libs[i].policy);
+        libs[i].created  = __atomic_load_n(&threadgov_libs[i].created, __ATOMIC_RELAXED);
+        libs[i].running  = __atomic_load_n(&threadgov_libs[i].running, __ATOMIC_RELAXED);
+        libs[i].failed   = __atomic_load_n(&threadgov_libs[i].failed,  __ATOMIC_RELAXED);
+    }
+    return cnt;
+}
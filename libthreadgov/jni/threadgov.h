@@ -0,0 +1,64 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#ifndef THREADGOV_H
+#define THREADGOV_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define THREADGOV_EXPORT __attribute__((visibility("default")))
+
+#define THREADGOV_NICE_KEEP INT32_MIN
+
+//applied to the threads created by the matched libraries, before the start routine runs
+typedef struct
+{
+    uint64_t    cpu_mask;    //bit N: CPU N, 0: keep
+    int32_t     nice;        //THREADGOV_NICE_KEEP: keep
+    const char *name_prefix; //"<prefix><sequence>", NULL: keep
+    size_t      stack_size;  //0: keep, ignored if the caller gives its own stack
+} threadgov_policy_t;
+
+//threads of one caller library
+typedef struct
+{
+    const char *pathname;
+    int         governed;    //a policy is applied
+    uint64_t    created;
+    uint64_t    running;
+    uint64_t    failed;      //pthread_create failed
+} threadgov_lib_t;
+
+int threadgov_register(const char *pathname_regex_str, const threadgov_policy_t *policy) THREADGOV_EXPORT;
+
+size_t threadgov_get_libs(threadgov_lib_t *libs, size_t libs_cnt) THREADGOV_EXPORT;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,2 @@
+APP_ABI      := armeabi armeabi-v7a arm64-v8a x86 x86_64
+APP_PLATFORM := android-14
@@ -0,0 +1,376 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "xhook.h"
+#include "writecoal.h"
+
+//Small writes of the matched libraries to regular files opened with O_APPEND are
+//copied to a buffer per fd, and written with one syscall when the buffer is full,
+//when the oldest byte has waited max_delay_ms, on fsync/fdatasync/close/dup2/dup3 of
+//the fd, and at exit. A larger write flushes the buffer and goes straight through.
+//
+//The buffer is per fd (with a lock), not per thread: the writes of all threads to one
+//fd stay in call order, which per-thread buffers can't keep.
+//
+//write/writev/fsync/fdatasync are hooked in the matched libraries. close/dup2/dup3 are
+//hooked in all libraries, so a buffered fd is flushed before anyone else closes it.
+//A buffered fd must only be closed or replaced through the hooked GOT slots (see
+//writecoal.h), that's how it is forgotten: a buffered write costs no syscall. Before each
+//flush the file identity is checked with fstat(), the bytes of a file closed without us
+//(e.g. by libc internally) are dropped instead of being written to another file which
+//got the same fd. Until that flush, the writes to the other file go to the stale buffer
+//and are dropped with it.
+//
+//Errors of the buffered writes can't be reported to the caller, the bytes are counted
+//as dropped.
+
+#define WRITECOAL_FDS_MAX          1024
+#define WRITECOAL_STATE_UNKNOWN    0
+#define WRITECOAL_STATE_PASS       1 //not a regular file in append mode
+#define WRITECOAL_STATE_BUFFER     2
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    int             state;
+    dev_t           dev;
+    ino_t           ino;
+    char           *buf;
+    size_t          len;
+    uint64_t        first_ns; //when the oldest buffered byte was written
+} writecoal_fd_t;
+
+static int               writecoal_inited = 0;
+static size_t            writecoal_buffer_size;
+static uint64_t          writecoal_max_delay_ns;
+static writecoal_fd_t    writecoal_fds[WRITECOAL_FDS_MAX];
+static int               writecoal_fds_max = -1; //the highest fd ever buffered
+static writecoal_stats_t writecoal_stats;
+static pthread_mutex_t   writecoal_global_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int               writecoal_global_hooked = 0;
+
+static uint64_t writecoal_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+//called with the lock held
+static void writecoal_flush_locked(int fd, writecoal_fd_t *f)
+{
+    struct stat st;
+    size_t      off = 0;
+    ssize_t     n;
+
+    if(0 == f->len) return;
+
+    if(0 != fstat(fd, &st) || st.st_dev != f->dev || st.st_ino != f->ino)
+    {
+        __atomic_add_fetch(&writecoal_stats.dropped_bytes, f->len, __ATOMIC_RELAXED);
+        f->len = 0;
+        f->state = WRITECOAL_STATE_UNKNOWN;
+        return;
+    }
+
+    while(off < f->len)
+    {
+        if((n = write(fd, f->buf + off, f->len - off)) < 0)
+        {
+            if(EINTR == errno) continue;
+            __atomic_add_fetch(&writecoal_stats.dropped_bytes, f->len - off, __ATOMIC_RELAXED);
+            break;
+        }
+        off += (size_t)n;
+        __atomic_add_fetch(&writecoal_stats.flushes, 1, __ATOMIC_RELAXED);
+    }
+    f->len = 0;
+}
+
+//called with the lock held
+static void writecoal_check_locked(int fd, writecoal_fd_t *f)
+{
+    struct stat st;
+    int         flags;
+    int         fds_max;
+
+    f->state = WRITECOAL_STATE_PASS;
+    if((flags = fcntl(fd, F_GETFL)) < 0 || 0 == (flags & O_APPEND)) return;
+    if(0 != fstat(fd, &st) || !S_ISREG(st.st_mode)) return;
+    if(NULL == f->buf && NULL == (f->buf = malloc(writecoal_buffer_size))) return;
+
+    f->dev = st.st_dev;
+    f->ino = st.st_ino;
+    f->state = WRITECOAL_STATE_BUFFER;
+
+    fds_max = __atomic_load_n(&writecoal_fds_max, __ATOMIC_RELAXED);
+    while(fd > fds_max && !__atomic_compare_exchange_n(&writecoal_fds_max, &fds_max, fd, 1,
+                                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+//lock the fd if its writes are buffered, return NULL otherwise
+static writecoal_fd_t *writecoal_lock(int fd)
+{
+    writecoal_fd_t *f;
+
+    if(fd < 0 || fd >= WRITECOAL_FDS_MAX) return NULL;
+    f = &writecoal_fds[fd];
+    if(WRITECOAL_STATE_PASS == __atomic_load_n(&f->state, __ATOMIC_RELAXED)) return NULL;
+
+    pthread_mutex_lock(&f->lock);
+    if(WRITECOAL_STATE_UNKNOWN == f->state) writecoal_check_locked(fd, f);
+    if(WRITECOAL_STATE_BUFFER != f->state)
+    {
+        pthread_mutex_unlock(&f->lock);
+        return NULL;
+    }
+    return f;
+}
+
+//flush and forget the fd, before it's closed or replaced
+static void writecoal_forget(int fd)
+{
+    writecoal_fd_t *f;
+
+    if(fd < 0 || fd >= WRITECOAL_FDS_MAX) return;
+    f = &writecoal_fds[fd];
+    if(WRITECOAL_STATE_UNKNOWN == __atomic_load_n(&f->state, __ATOMIC_RELAXED)) return;
+
+    pthread_mutex_lock(&f->lock);
+    if(WRITECOAL_STATE_BUFFER == f->state) writecoal_flush_locked(fd, f);
+    __atomic_store_n(&f->state, WRITECOAL_STATE_UNKNOWN, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&f->lock);
+}
+
+static void writecoal_append_locked(writecoal_fd_t *f, const void *buf, size_t len)
+{
+    if(0 == f->len) f->first_ns = writecoal_now_ns();
+    memcpy(f->buf + f->len, buf, len);
+    f->len += len;
+    __atomic_add_fetch(&writecoal_stats.bytes, len, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&writecoal_stats.writes, 1, __ATOMIC_RELAXED);
+}
+
+static ssize_t writecoal_write(int fd, const void *buf, size_t count)
+{
+    writecoal_fd_t *f;
+    ssize_t         r;
+
+    if(NULL == (f = writecoal_lock(fd))) return write(fd, buf, count);
+
+    if(count * 2 > writecoal_buffer_size)
+    {
+        //too large to be worth copying, after the buffered bytes
+        writecoal_flush_locked(fd, f);
+        r = write(fd, buf, count);
+        pthread_mutex_unlock(&f->lock);
+        return r;
+    }
+    if(f->len + count > writecoal_buffer_size) writecoal_flush_locked(fd, f);
+    writecoal_append_locked(f, buf, count);
+    pthread_mutex_unlock(&f->lock);
+    return (ssize_t)count;
+}
+
+static ssize_t writecoal_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+    writecoal_fd_t *f;
+    size_t          count = 0;
+    ssize_t         r;
+    int             i;
+
+    if(NULL == (f = writecoal_lock(fd))) return writev(fd, iov, iovcnt);
+
+    for(i = 0; i < iovcnt; i++)
+        count += iov[i].iov_len;
+    if(count * 2 > writecoal_buffer_size)
+    {
+        writecoal_flush_locked(fd, f);
+        r = writev(fd, iov, iovcnt);
+        pthread_mutex_unlock(&f->lock);
+        return r;
+    }
+    if(f->len + count > writecoal_buffer_size) writecoal_flush_locked(fd, f);
+    if(0 == f->len) f->first_ns = writecoal_now_ns();
+    for(i = 0; i < iovcnt; i++)
+    {
+        memcpy(f->buf + f->len, iov[i].iov_base, iov[i].iov_len);
+        f->len += iov[i].iov_len;
+    }
+    __atomic_add_fetch(&writecoal_stats.bytes, count, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&writecoal_stats.writes, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&f->lock);
+    return (ssize_t)count;
+}
+
+static void writecoal_flush_fd(int fd)
+{
+    writecoal_fd_t *f;
+
+    if(NULL == (f = writecoal_lock(fd))) return;
+    writecoal_flush_locked(fd, f);
+    pthread_mutex_unlock(&f->lock);
+}
+
+static int writecoal_fsync(int fd)
+{
+    writecoal_flush_fd(fd);
+    return fsync(fd);
+}
+
+static int writecoal_fdatasync(int fd)
+{
+    writecoal_flush_fd(fd);
+    return fdatasync(fd);
+}
+
+static int writecoal_close(int fd)
+{
+    writecoal_forget(fd);
+    return close(fd);
+}
+
+static int writecoal_dup2(int oldfd, int newfd)
+{
+    if(oldfd != newfd) writecoal_forget(newfd);
+    return dup2(oldfd, newfd);
+}
+
+#if !defined(__ANDROID__) || __ANDROID_API__ >= 21
+static int writecoal_dup3(int oldfd, int newfd, int flags)
+{
+    if(oldfd != newfd) writecoal_forget(newfd);
+    return dup3(oldfd, newfd, flags);
+}
+#endif
+
+void writecoal_flush()
+{
+    int fd, fds_max = __atomic_load_n(&writecoal_fds_max, __ATOMIC_RELAXED);
+
+    for(fd = 0; fd <= fds_max; fd++)
+    {
+        if(WRITECOAL_STATE_BUFFER != __atomic_load_n(&writecoal_fds[fd].state, __ATOMIC_RELAXED)) continue;
+        writecoal_flush_fd(fd);
+    }
+}
+
+//flush the buffers whose oldest byte has waited too long
+static void *writecoal_timer_func(void *arg)
+{
+    struct timespec ts;
+    writecoal_fd_t *f;
+    uint64_t        now;
+    int             fd, fds_max;
+
+    (void)arg;
+    ts.tv_sec = (time_t)(writecoal_max_delay_ns / 2 / 1000000000ULL);
+    ts.tv_nsec = (long)(writecoal_max_delay_ns / 2 % 1000000000ULL);
+
+    while(1)
+    {
+        nanosleep(&ts, NULL);
+        now = writecoal_now_ns();
+        fds_max = __atomic_load_n(&writecoal_fds_max, __ATOMIC_RELAXED);
+        for(fd = 0; fd <= fds_max; fd++)
+        {
+            f = &writecoal_fds[fd];
+            if(WRITECOAL_STATE_BUFFER != __atomic_load_n(&f->state, __ATOMIC_RELAXED)) continue;
+            if(0 != pthread_mutex_trylock(&f->lock)) continue; //busy, check it next time
+            if(WRITECOAL_STATE_BUFFER == f->state && f->len > 0 && now - f->first_ns >= writecoal_max_delay_ns)
+                writecoal_flush_locked(fd, f);
+            pthread_mutex_unlock(&f->lock);
+        }
+    }
+    return NULL;
+}
+
+int writecoal_init(size_t buffer_size, unsigned int max_delay_ms)
+{
+    pthread_t thread;
+    int       fd;
+
+    if(writecoal_inited) return 0;
+    if(buffer_size < 64 || 0 == max_delay_ms) return EINVAL;
+
+    for(fd = 0; fd < WRITECOAL_FDS_MAX; fd++)
+        pthread_mutex_init(&writecoal_fds[fd].lock, NULL);
+    writecoal_buffer_size = buffer_size;
+    writecoal_max_delay_ns = (uint64_t)max_delay_ms * 1000000ULL;
+
+    if(0 != pthread_create(&thread, NULL, writecoal_timer_func, NULL)) return EAGAIN;
+    pthread_detach(thread);
+    atexit(writecoal_flush);
+
+    __atomic_store_n(&writecoal_inited, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int writecoal_register(const char *pathname_regex_str)
+{
+    int r;
+
+    if(!writecoal_inited || NULL == pathname_regex_str) return EINVAL;
+
+    //our own writes are never buffered, every close is seen
+    pthread_mutex_lock(&writecoal_global_mutex);
+    if(!writecoal_global_hooked)
+    {
+        if(0 != (r = xhook_ignore(".*/libwritecoal\\.so$", NULL))) goto end;
+        if(0 != (r = xhook_register(".*", "close", writecoal_close, NULL))) goto end;
+        if(0 != (r = xhook_register(".*", "dup2",  writecoal_dup2,  NULL))) goto end;
+#if !defined(__ANDROID__) || __ANDROID_API__ >= 21
+        if(0 != (r = xhook_register(".*", "dup3",  writecoal_dup3,  NULL))) goto end;
+#endif
+        writecoal_global_hooked = 1;
+    }
+    pthread_mutex_unlock(&writecoal_global_mutex);
+
+    if(0 != (r = xhook_register(pathname_regex_str, "write",     writecoal_write,     NULL))) return r;
+    if(0 != (r = xhook_register(pathname_regex_str, "writev",    writecoal_writev,    NULL))) return r;
+    if(0 != (r = xhook_register(pathname_regex_str, "fsync",     writecoal_fsync,     NULL))) return r;
+    if(0 != (r = xhook_register(pathname_regex_str, "fdatasync", writecoal_fdatasync, NULL))) return r;
+    return 0;
+
+ end:
+    pthread_mutex_unlock(&writecoal_global_mutex);
+    return r;
+}
+
+void writecoal_get_stats(writecoal_stats_t *stats)
+{
+    if(NULL == stats) return;
+    stats->writes        = __atomic_load_n(&writecoal_stats.writes,        __ATOMIC_RELAXED);
+    stats->flushes       = __atomic_load_n(&writecoal_stats.flushes,       __ATOMIC_RELAXED);
+    stats->bytes         = __atomic_load_n(&writecoal_stats.bytes,         __ATOMIC_RELAXED);
+    stats->dropped_bytes = __atomic_load_n(&writecoal_stats.dropped_bytes, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,63 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#ifndef WRITECOAL_H
+#define WRITECOAL_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WRITECOAL_EXPORT __attribute__((visibility("default")))
+
+typedef struct
+{
+    uint64_t writes;        //write/writev calls buffered
+    uint64_t flushes;       //write syscalls made for them
+    uint64_t bytes;         //bytes buffered
+    uint64_t dropped_bytes; //buffered bytes lost: write error, or the fd was closed behind our back
+} writecoal_stats_t;
+
+int writecoal_init(size_t buffer_size, unsigned int max_delay_ms) WRITECOAL_EXPORT;
+
+//the small O_APPEND writes of each matched library are buffered
+//
+//A buffered fd is forgotten when it's closed or replaced through the hooked GOT slots
+//(close, dup2 and dup3 are hooked in all libraries). Call xhook_refresh() after dlopen(),
+//or enable the discovery, before a new library can close a buffered fd. An fd closed
+//behind our back (by libc internally, or with a raw syscall) and reused for another file
+//keeps its buffer until the next flush: the bytes buffered for both files are dropped
+//then, and counted in dropped_bytes.
+int writecoal_register(const char *pathname_regex_str) WRITECOAL_EXPORT;
+
+void writecoal_flush() WRITECOAL_EXPORT;
+
+void writecoal_get_stats(writecoal_stats_t *stats) WRITECOAL_EXPORT;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,16 +1,35 @@
 LOCAL_PATH := $(call my-dir)
 
-include $(CLEAR_VARS)
-LOCAL_MODULE     := xhook
-LOCAL_SRC_FILES  := xhook.c \
+XHOOK_SRC_FILES  := xhook.c \
                     xh_core.c \
+                    xh_discovery.c \
                     xh_elf.c \
+                    xh_governor.c \
                     xh_jni.c \
                     xh_log.c \
+                    xh_manifest.c \
+                    xh_oneshot.c \
+                    xh_stats.c \
+                    xh_stub.c \
+                    xh_trace.c \
                     xh_util.c \
                     xh_version.c
+
+include $(CLEAR_VARS)
+LOCAL_MODULE     := xhook
+LOCAL_SRC_FILES  := $(XHOOK_SRC_FILES)
+LOCAL_C_INCLUDES := $(LOCAL_PATH)
+LOCAL_CFLAGS     := -Wall -Wextra -Werror -fvisibility=hidden
+LOCAL_CONLYFLAGS := -std=c11
+LOCAL_LDLIBS     := -llog -ldl
+include $(BUILD_SHARED_LIBRARY)
+
+# libxhook with the agent constructor, for LD_PRELOAD / wrap.sh only
+include $(CLEAR_VARS)
+LOCAL_MODULE     := xhook_agent
+LOCAL_SRC_FILES  := $(XHOOK_SRC_FILES) xh_agent.c
 LOCAL_C_INCLUDES := $(LOCAL_PATH)
 LOCAL_CFLAGS     := -Wall -Wextra -Werror -fvisibility=hidden
 LOCAL_CONLYFLAGS := -std=c11
-LOCAL_LDLIBS     := -llog
+LOCAL_LDLIBS     := -llog -ldl
 include $(BUILD_SHARED_LIBRARY)
@@ -0,0 +1,205 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <sys/stat.h>
+#if !defined(__ANDROID__) || __ANDROID_API__ >= 18
+#include <sys/auxv.h>
+#endif
+#include "xh_errno.h"
+#include "xh_log.h"
+#include "xh_util.h"
+#include "xh_core.h"
+#include "xh_manifest.h"
+#include "xh_discovery.h"
+
+//Agent mode: with libxhook_agent loaded by LD_PRELOAD (or as an early DT_NEEDED), the rules
+//are applied by a constructor, before main() and before any app code. This file is only
+//built into libxhook_agent, a plain libxhook has no constructor.
+//
+//  XHOOK_AGENT_CONFIG  path of a config file
+//  XHOOK_AGENT_RULES   config text, ';' separates the lines
+//
+//The config is a manifest (see xh_manifest.c) with a few more lines:
+//
+//  load      <library>   dlopen a handler library, its constructor may call xhook_add_handlers()
+//  discovery <ms>        hook the libraries loaded later (see xh_discovery.c), 0 to disable
+//  debug                 enable the debug log, to stderr / logcat
+//
+//A handler name which is not in the handler table is looked up with dlsym(), and
+//the original function is saved to the exported "void *<handler>_old" if any.
+//Without both environment variables, the constructor does nothing. So it does in setuid,
+//setgid or file capability processes: the environment comes from a less privileged user,
+//who must not get a library of their choice loaded there.
+
+#define XH_AGENT_DISCOVERY_MS 1000
+
+static void xh_agent_add_dlsym_handler(const char *name)
+{
+    xhook_handler_t h;
+    char            old_name[256];
+
+    if(xh_manifest_has_handler(name)) return;
+    if(NULL == (h.new_func = dlsym(RTLD_DEFAULT, name)))
+    {
+        XH_LOG_ERROR("agent: handler not found: %s", name);
+        return; //reported again by the manifest
+    }
+    if(strlen(name) + sizeof("_old") > sizeof(old_name)) return;
+    strcpy(old_name, name);
+    strcat(old_name, "_old");
+    h.old_func = (void **)dlsym(RTLD_DEFAULT, old_name);
+    h.name = name;
+    xh_manifest_add_handlers(&h, 1);
+}
+
+static char *xh_agent_read_file(const char *path, size_t *len)
+{
+    struct stat  st;
+    char        *buf;
+    ssize_t      n;
+    size_t       off = 0;
+    int          fd;
+
+    if((fd = xh_util_open(path, O_RDONLY)) < 0)
+    {
+        XH_LOG_ERROR("agent: open config failed: %s, errno: %d", path, errno);
+        return NULL;
+    }
+    if(0 != fstat(fd, &st) || NULL == (buf = malloc((size_t)st.st_size + 1)))
+    {
+        xh_util_close(fd);
+        return NULL;
+    }
+    while(off < (size_t)st.st_size && (n = xh_util_read(fd, buf + off, (size_t)st.st_size - off)) > 0)
+        off += (size_t)n;
+    xh_util_close(fd);
+    buf[off] = '\0';
+    *len = off;
+    return buf;
+}
+
+//handle the agent lines, keep the manifest lines in place, return the new length
+static size_t xh_agent_parse(char *config, size_t len, unsigned int *discovery_ms)
+{
+    char   *line, *next, *p, *name, *end, *save;
+    char    hook[512], *tokens[4];
+    size_t  out = 0, n, tokens_cnt;
+
+    for(line = config; line < config + len; line = next)
+    {
+        if(NULL == (next = memchr(line, '\n', (size_t)(config + len - line)))) next = config + len;
+        else next++;
+        n = (size_t)(next - line);
+
+        for(p = line; p < next && (' ' == *p || '\t' == *p); p++);
+        if(0 == strncmp(p, "load", 4) && (' ' == p[4] || '\t' == p[4]))
+        {
+            for(name = p + 5; ' ' == *name || '\t' == *name; name++);
+            for(end = name; end < next && '\n' != *end && '\r' != *end && ' ' != *end && '\t' != *end; end++);
+            *end = '\0';
+            if(NULL == dlopen(name, RTLD_NOW | RTLD_GLOBAL))
+                XH_LOG_ERROR("agent: load %s failed: %s", name, dlerror());
+            continue;
+        }
+        if(0 == strncmp(p, "discovery", 9) && (' ' == p[9] || '\t' == p[9]))
+        {
+            *discovery_ms = (unsigned int)strtoul(p + 10, NULL, 10);
+            continue;
+        }
+        if(0 == strncmp(p, "debug", 5) && (next == p + 5 || '\n' == p[5] || '\r' == p[5] || ' ' == p[5]))
+        {
+            xh_core_enable_debug(1);
+            xh_log_sink = xh_log_sink_logcat;
+            continue;
+        }
+
+        //the handler of a hook line: "hook <regex> <symbol> <handler>"
+        if(0 == strncmp(p, "hook", 4) && (' ' == p[4] || '\t' == p[4]) && n < sizeof(hook))
+        {
+            memcpy(hook, p, (size_t)(next - p));
+            hook[next - p] = '\0';
+            save = NULL;
+            tokens_cnt = 0;
+            for(name = strtok_r(hook, " \t\r\n", &save); NULL != name && tokens_cnt < 4; name = strtok_r(NULL, " \t\r\n", &save))
+                tokens[tokens_cnt++] = name;
+            if(4 == tokens_cnt) xh_agent_add_dlsym_handler(tokens[3]);
+        }
+
+        memmove(config + out, line, n);
+        out += n;
+    }
+    return out;
+}
+
+static int xh_agent_is_secure()
+{
+#if defined(__ANDROID__) && __ANDROID_API__ < 18
+    return getuid() != geteuid() || getgid() != getegid(); //no getauxval()
+#else
+    return 0 != getauxval(AT_SECURE);
+#endif
+}
+
+__attribute__((constructor)) static void xh_agent_init()
+{
+    const char   *path;
+    const char   *rules;
+    char         *config;
+    size_t        len = 0, i;
+    unsigned int  discovery_ms = XH_AGENT_DISCOVERY_MS;
+    int           r;
+
+    if(xh_agent_is_secure()) return;
+
+    path = getenv("XHOOK_AGENT_CONFIG");
+    rules = getenv("XHOOK_AGENT_RULES");
+    if(NULL == path && NULL == rules) return;
+
+    if(NULL != path)
+    {
+        if(NULL == (config = xh_agent_read_file(path, &len))) return;
+    }
+    else
+    {
+        if(NULL == (config = strdup(rules))) return;
+        len = strlen(config);
+        for(i = 0; i < len; i++)
+            if(';' == config[i]) config[i] = '\n';
+    }
+
+    len = xh_agent_parse(config, len, &discovery_ms);
+    if(0 != (r = xh_manifest_register(NULL, config, len)))
+        XH_LOG_ERROR("agent: bad config, ret: %d", r);
+    else if(0 != (r = xh_core_refresh(NULL, 0)))
+        XH_LOG_ERROR("agent: refresh failed, ret: %d", r);
+    else if(discovery_ms > 0)
+        xh_discovery_enable(discovery_ms, NULL);
+    free(config);
+
+    XH_LOG_INFO("agent: started, ret: %d", r);
+}
@@ -30,13 +30,24 @@
 #include <pthread.h>
 #include <regex.h>
 #include <setjmp.h>
+#include <signal.h>
 #include <errno.h>
+#include <time.h>
+#include <stddef.h>
+#include <dlfcn.h>
+#include <sys/auxv.h>
 #include "queue.h"
 #include "tree.h"
 #include "xh_errno.h"
 #include "xh_log.h"
+#include "xh_util.h"
 #include "xh_elf.h"
 #include "xh_version.h"
+#include "xh_trace.h"
+#include "xh_stats.h"
+#include "xh_governor.h"
+#include "xh_oneshot.h"
+#include "xh_discovery.h"
 #include "xh_core.h"
 
 #define XH_CORE_DEBUG 0
@@ -51,6 +62,9 @@ typedef struct xh_core_hook_info
     char     *symbol;
     void     *new_func;
     void    **old_func;
+    xh_elf_slot_func_t slot_func; //one new function per slot, instead of new_func
+    void              *slot_func_arg;
+    void             (*slot_func_arg_free)(void *);
     TAILQ_ENTRY(xh_core_hook_info,) link;
 } xh_core_hook_info_t;
 typedef TAILQ_HEAD(xh_core_hook_info_queue, xh_core_hook_info,) xh_core_hook_info_queue_t;
@@ -67,12 +81,25 @@ typedef struct xh_core_ignore_info
 } xh_core_ignore_info_t;
 typedef TAILQ_HEAD(xh_core_ignore_info_queue, xh_core_ignore_info,) xh_core_ignore_info_queue_t;
 
+//rules of one xhook_ctx_t, all the started contexts share the maps scan and the ELF parsing
+struct xhook_ctx
+{
+    xh_core_hook_info_queue_t    hook_info;
+    xh_core_ignore_info_queue_t  ignore_info;
+    unsigned int                 seq; //start order, 0 means not started (rules can be registered)
+    TAILQ_ENTRY(xhook_ctx,)      link;
+};
+typedef struct xhook_ctx xh_core_ctx_t;
+typedef TAILQ_HEAD(xh_core_ctx_queue, xhook_ctx,) xh_core_ctx_queue_t;
+
 //required info from /proc/self/maps
 typedef struct xh_core_map_info
 {
     char      *pathname;
     uintptr_t  base_addr;
     xh_elf_t   elf;
+    int        need_hook; //XH_CORE_HOOK_*
+    unsigned int applied_seq; //rules of the contexts started after it are not applied yet
     RB_ENTRY(xh_core_map_info) link;
 } xh_core_map_info_t;
 static __inline__ int xh_core_map_info_cmp(xh_core_map_info_t *a, xh_core_map_info_t *b)
@@ -81,6 +108,80 @@ static __inline__ int xh_core_map_info_cmp(xh_core_map_info_t *a, xh_core_map_in
 }
 typedef RB_HEAD(xh_core_map_info_tree, xh_core_map_info) xh_core_map_info_tree_t;
 RB_GENERATE_STATIC(xh_core_map_info_tree, xh_core_map_info, link, xh_core_map_info_cmp)
+static void xh_core_map_info_free(xh_core_map_info_t *mi)
+{
+    xh_elf_fini(&(mi->elf));
+    if(mi->pathname) free(mi->pathname);
+    free(mi);
+}
+
+#define XH_CORE_HOOK_NONE   0
+#define XH_CORE_HOOK_NEW    1
+#define XH_CORE_HOOK_REHOOK 2
+#define XH_CORE_HOOK_UPDATE 3 //apply the rules of newly started contexts only
+
+//library lifecycle event callbacks
+#define XH_CORE_LIB_EVENT_CB_MAX 16
+typedef struct
+{
+    xhook_lib_event_cb_t  cb;
+    void                 *arg;
+    uint64_t              id; //unique per add, to skip the callbacks deleted during a dispatch
+} xh_core_lib_event_cb_t;
+
+//library lifecycle events collected by one refresh
+typedef struct
+{
+    int        event;
+    size_t     pathname_off;
+    uintptr_t  base_addr;
+    size_t     slots_patched;
+} xh_core_lib_event_t;
+typedef struct
+{
+    xh_core_lib_event_t *events;
+    size_t               cnt;
+    size_t               cap;
+    char                *pathnames;
+    size_t               pathnames_len;
+    size_t               pathnames_cap;
+} xh_core_lib_events_t;
+
+//result of hooking one library
+typedef struct
+{
+    int                 status;
+    uint32_t            elf_flags;
+    size_t              relplt_cnt;
+    size_t              reldyn_cnt;
+    size_t              relandroid_cnt;
+    xh_elf_hook_stat_t  stat;
+} xh_core_hook_result_t;
+
+//report buffer built by one refresh, see xhook_report_header_t
+typedef struct
+{
+    char    *buf;
+    size_t   len;
+    size_t   cap;
+} xh_core_report_t;
+
+//state of one refresh
+typedef struct
+{
+    int                    dry_run;
+    xh_core_lib_events_t  *events;
+    xh_core_report_t      *report; //NULL if not requested
+    const xh_core_lib_t   *libs;   //only these libraries (the others are kept), NULL for all
+    size_t                 libs_cnt;
+} xh_core_refresh_ctx_t;
+
+//ELF candidate from /proc/self/maps
+typedef struct
+{
+    uintptr_t  base_addr;
+    size_t     pathname_off;
+} xh_core_maps_entry_t;
 
 //signal handler for SIGSEGV
 //for xh_elf_init(), xh_elf_hook(), xh_elf_check_elfheader()
@@ -119,8 +220,11 @@ static void xh_core_del_sigsegv_handler()
 }
 
 
-static xh_core_hook_info_queue_t   xh_core_hook_info   = TAILQ_HEAD_INITIALIZER(xh_core_hook_info);
-static xh_core_ignore_info_queue_t xh_core_ignore_info = TAILQ_HEAD_INITIALIZER(xh_core_ignore_info);
+static xh_core_ctx_t               xh_core_ctx_default = {TAILQ_HEAD_INITIALIZER(xh_core_ctx_default.hook_info),
+                                                          TAILQ_HEAD_INITIALIZER(xh_core_ctx_default.ignore_info),
+                                                          0, {NULL, NULL}};
+static xh_core_ctx_queue_t         xh_core_ctxs        = TAILQ_HEAD_INITIALIZER(xh_core_ctxs); //started, in start order
+static unsigned int                xh_core_ctx_seq     = 0;
 static xh_core_map_info_tree_t     xh_core_map_info    = RB_INITIALIZER(&xh_core_map_info);
 static pthread_mutex_t             xh_core_mutex       = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t              xh_core_cond        = PTHREAD_COND_INITIALIZER;
@@ -132,71 +236,88 @@ static pthread_mutex_t             xh_core_refresh_mutex = PTHREAD_MUTEX_INITIAL
 static pthread_t                   xh_core_refresh_thread_tid;
 static volatile int                xh_core_refresh_thread_running = 0;
 static volatile int                xh_core_refresh_thread_do = 0;
-
-
-int xh_core_register(const char *pathname_regex_str, const char *symbol,
-                     void *new_func, void **old_func)
+static volatile unsigned int       xh_core_watchdog_interval_ms = 0;
+static xh_core_lib_event_cb_t      xh_core_lib_event_cbs[XH_CORE_LIB_EVENT_CB_MAX];
+static uint64_t                    xh_core_lib_event_cbs_id = 0;
+static volatile size_t             xh_core_lib_event_cbs_cnt = 0;
+static pthread_mutex_t             xh_core_lib_event_cbs_mutex = PTHREAD_MUTEX_INITIALIZER;
+static xh_core_maps_entry_t       *xh_core_maps = NULL;
+static size_t                      xh_core_maps_cnt = 0;
+static size_t                      xh_core_maps_cap = 0;
+static char                       *xh_core_maps_pathnames = NULL;
+static size_t                      xh_core_maps_pathnames_len = 0;
+static size_t                      xh_core_maps_pathnames_cap = 0;
+
+
+static int xh_core_hook_info_create(const char *pathname_regex_str, const char *symbol,
+                                    void *new_func, void **old_func,
+                                    xh_elf_slot_func_t slot_func, void *slot_func_arg,
+                                    void (*slot_func_arg_free)(void *), xh_core_hook_info_t **out)
 {
     xh_core_hook_info_t *hi;
     regex_t              regex;
 
-    if(NULL == pathname_regex_str || NULL == symbol || NULL == new_func) return XH_ERRNO_INVAL;
-
-    if(xh_core_inited)
-    {
-        XH_LOG_ERROR("do not register hook after refresh(): %s, %s", pathname_regex_str, symbol);
-        return XH_ERRNO_INVAL;
-    }
+    if(NULL == pathname_regex_str || NULL == symbol || (NULL == new_func && NULL == slot_func)) return XH_ERRNO_INVAL;
 
     if(0 != regcomp(&regex, pathname_regex_str, REG_NOSUB)) return XH_ERRNO_INVAL;
 
-    if(NULL == (hi = malloc(sizeof(xh_core_hook_info_t)))) return XH_ERRNO_NOMEM;
+    if(NULL == (hi = malloc(sizeof(xh_core_hook_info_t)))) goto err;
     if(NULL == (hi->symbol = strdup(symbol)))
     {
         free(hi);
-        return XH_ERRNO_NOMEM;
+        goto err;
     }
 #if XH_CORE_DEBUG
     if(NULL == (hi->pathname_regex_str = strdup(pathname_regex_str)))
     {
         free(hi->symbol);
         free(hi);
-        return XH_ERRNO_NOMEM;
+        goto err;
     }
 #endif
     hi->pathname_regex = regex;
     hi->new_func = new_func;
     hi->old_func = old_func;
-    
-    pthread_mutex_lock(&xh_core_mutex);
-    TAILQ_INSERT_TAIL(&xh_core_hook_info, hi, link);
-    pthread_mutex_unlock(&xh_core_mutex);
+    hi->slot_func = slot_func;
+    hi->slot_func_arg = slot_func_arg;
+    hi->slot_func_arg_free = slot_func_arg_free;
 
+    *out = hi;
     return 0;
+
+ err:
+    regfree(&regex);
+    return XH_ERRNO_NOMEM;
+}
+
+static void xh_core_hook_info_destroy(xh_core_hook_info_t *hi)
+{
+#if XH_CORE_DEBUG
+    free(hi->pathname_regex_str);
+#endif
+    regfree(&(hi->pathname_regex));
+    if(NULL != hi->slot_func_arg_free) hi->slot_func_arg_free(hi->slot_func_arg);
+    free(hi->symbol);
+    free(hi);
 }
 
-int xh_core_ignore(const char *pathname_regex_str, const char *symbol)
+static int xh_core_ignore_info_create(const char *pathname_regex_str, const char *symbol,
+                                      xh_core_ignore_info_t **out)
 {
     xh_core_ignore_info_t *ii;
     regex_t                regex;
 
     if(NULL == pathname_regex_str) return XH_ERRNO_INVAL;
 
-    if(xh_core_inited)
-    {
-        XH_LOG_ERROR("do not ignore hook after refresh(): %s, %s", pathname_regex_str, symbol ? symbol : "ALL");
-        return XH_ERRNO_INVAL;
-    }
-
     if(0 != regcomp(&regex, pathname_regex_str, REG_NOSUB)) return XH_ERRNO_INVAL;
 
-    if(NULL == (ii = malloc(sizeof(xh_core_ignore_info_t)))) return XH_ERRNO_NOMEM;
+    if(NULL == (ii = malloc(sizeof(xh_core_ignore_info_t)))) goto err;
     if(NULL != symbol)
     {
         if(NULL == (ii->symbol = strdup(symbol)))
         {
             free(ii);
-            return XH_ERRNO_NOMEM;
+            goto err;
         }
     }
     else
@@ -208,18 +329,158 @@ int xh_core_ignore(const char *pathname_regex_str, const char *symbol)
     {
         free(ii->symbol);
         free(ii);
-        return XH_ERRNO_NOMEM;
+        goto err;
     }
 #endif
     ii->pathname_regex = regex;
 
+    *out = ii;
+    return 0;
+
+ err:
+    regfree(&regex);
+    return XH_ERRNO_NOMEM;
+}
+
+static void xh_core_ignore_info_destroy(xh_core_ignore_info_t *ii)
+{
+#if XH_CORE_DEBUG
+    free(ii->pathname_regex_str);
+#endif
+    regfree(&(ii->pathname_regex));
+    free(ii->symbol);
+    free(ii);
+}
+
+static int xh_core_register_impl(xh_core_ctx_t *ctx, const char *pathname_regex_str, const char *symbol,
+                                 void *new_func, void **old_func,
+                                 xh_elf_slot_func_t slot_func, void *slot_func_arg,
+                                 void (*slot_func_arg_free)(void *))
+{
+    xh_core_hook_info_t *hi;
+    int                  r;
+
+    if(NULL == ctx) ctx = &xh_core_ctx_default;
+
+    if(0 != (r = xh_core_hook_info_create(pathname_regex_str, symbol, new_func, old_func,
+                                          slot_func, slot_func_arg, slot_func_arg_free, &hi)))
+    {
+        if(NULL != slot_func_arg_free) slot_func_arg_free(slot_func_arg);
+        return r;
+    }
+    
     pthread_mutex_lock(&xh_core_mutex);
-    TAILQ_INSERT_TAIL(&xh_core_ignore_info, ii, link);
+    if(0 != ctx->seq)
+    {
+        pthread_mutex_unlock(&xh_core_mutex);
+        XH_LOG_ERROR("do not register hook after refresh(): %s, %s", pathname_regex_str, symbol);
+        xh_core_hook_info_destroy(hi);
+        return XH_ERRNO_INVAL;
+    }
+    TAILQ_INSERT_TAIL(&(ctx->hook_info), hi, link);
     pthread_mutex_unlock(&xh_core_mutex);
 
     return 0;
 }
 
+int xh_core_register(xh_core_ctx_t *ctx, const char *pathname_regex_str, const char *symbol,
+                     void *new_func, void **old_func)
+{
+    if(NULL == new_func) return XH_ERRNO_INVAL;
+    return xh_core_register_impl(ctx, pathname_regex_str, symbol, new_func, old_func, NULL, NULL, NULL);
+}
+
+int xh_core_register_slots(xh_core_ctx_t *ctx, const char *pathname_regex_str, const char *symbol,
+                           xh_elf_slot_func_t slot_func, void *slot_func_arg,
+                           void (*slot_func_arg_free)(void *))
+{
+    if(NULL == slot_func)
+    {
+        if(NULL != slot_func_arg_free) slot_func_arg_free(slot_func_arg);
+        return XH_ERRNO_INVAL;
+    }
+    return xh_core_register_impl(ctx, pathname_regex_str, symbol, NULL, NULL, slot_func, slot_func_arg,
+                                 slot_func_arg_free);
+}
+
+int xh_core_ignore(xh_core_ctx_t *ctx, const char *pathname_regex_str, const char *symbol)
+{
+    xh_core_ignore_info_t *ii;
+    int                    r;
+
+    if(NULL == ctx) ctx = &xh_core_ctx_default;
+    if(NULL == pathname_regex_str) return XH_ERRNO_INVAL;
+
+    if(0 != (r = xh_core_ignore_info_create(pathname_regex_str, symbol, &ii))) return r;
+
+    pthread_mutex_lock(&xh_core_mutex);
+    if(0 != ctx->seq)
+    {
+        pthread_mutex_unlock(&xh_core_mutex);
+        XH_LOG_ERROR("do not ignore hook after refresh(): %s, %s", pathname_regex_str, symbol ? symbol : "ALL");
+        xh_core_ignore_info_destroy(ii);
+        return XH_ERRNO_INVAL;
+    }
+    TAILQ_INSERT_TAIL(&(ctx->ignore_info), ii, link);
+    pthread_mutex_unlock(&xh_core_mutex);
+
+    return 0;
+}
+
+//all or nothing, the rules are inserted in one pass under the lock
+int xh_core_register_batch(xh_core_ctx_t *ctx, const xhook_rule_t *rules, size_t rules_cnt)
+{
+    xh_core_hook_info_queue_t    hook_info = TAILQ_HEAD_INITIALIZER(hook_info);
+    xh_core_ignore_info_queue_t  ignore_info = TAILQ_HEAD_INITIALIZER(ignore_info);
+    xh_core_hook_info_t         *hi, *hi_tmp;
+    xh_core_ignore_info_t       *ii, *ii_tmp;
+    size_t                       i;
+    int                          r = 0;
+
+    if(NULL == ctx) ctx = &xh_core_ctx_default;
+    if(NULL == rules && rules_cnt > 0) return XH_ERRNO_INVAL;
+
+    for(i = 0; i < rules_cnt; i++)
+    {
+        if(NULL != rules[i].new_func)
+        {
+            if(0 != (r = xh_core_hook_info_create(rules[i].pathname_regex_str, rules[i].symbol,
+                                                  rules[i].new_func, rules[i].old_func, NULL, NULL, NULL, &hi))) goto err;
+            TAILQ_INSERT_TAIL(&hook_info, hi, link);
+        }
+        else
+        {
+            if(0 != (r = xh_core_ignore_info_create(rules[i].pathname_regex_str, rules[i].symbol, &ii))) goto err;
+            TAILQ_INSERT_TAIL(&ignore_info, ii, link);
+        }
+    }
+
+    pthread_mutex_lock(&xh_core_mutex);
+    if(0 != ctx->seq)
+    {
+        pthread_mutex_unlock(&xh_core_mutex);
+        XH_LOG_ERROR("do not register hook after refresh(): batch of %zu rules", rules_cnt);
+        r = XH_ERRNO_INVAL;
+        goto clean;
+    }
+    TAILQ_CONCAT(&(ctx->hook_info), &hook_info, link);
+    TAILQ_CONCAT(&(ctx->ignore_info), &ignore_info, link);
+    pthread_mutex_unlock(&xh_core_mutex);
+
+    return 0;
+
+ err:
+    XH_LOG_ERROR("register batch failed at rule %zu: %s, %s. ret: %d", i,
+                 rules[i].pathname_regex_str ? rules[i].pathname_regex_str : "NULL",
+                 rules[i].symbol ? rules[i].symbol : "ALL", r);
+ clean:
+    TAILQ_FOREACH_SAFE(hi, &hook_info, link, hi_tmp)
+        xh_core_hook_info_destroy(hi);
+    TAILQ_FOREACH_SAFE(ii, &ignore_info, link, ii_tmp)
+        xh_core_ignore_info_destroy(ii);
+    return r;
+}
+
 static int xh_core_check_elf_header(uintptr_t base_addr, const char *pathname)
 {
     if(!xh_core_sigsegv_enable)
@@ -245,26 +506,26 @@ static int xh_core_check_elf_header(uintptr_t base_addr, const char *pathname)
     }
 }
 
-static void xh_core_hook_impl(xh_core_map_info_t *mi)
+//apply the rules of one context
+static int xh_core_hook_ctx(xh_core_map_info_t *mi, xh_core_ctx_t *ctx, int dry_run, xh_core_hook_result_t *res)
 {
-    //init
-    if(0 != xh_elf_init(&(mi->elf), mi->base_addr, mi->pathname)) return;
-    
-    //hook
     xh_core_hook_info_t   *hi;
     xh_core_ignore_info_t *ii;
     int ignore;
-    TAILQ_FOREACH(hi, &xh_core_hook_info, link) //find hook info
+    int traced;
+    int r, ret = 0;
+    
+    TAILQ_FOREACH(hi, &(ctx->hook_info), link) //find hook info
     {
         if(0 == regexec(&(hi->pathname_regex), mi->pathname, 0, NULL, 0))
         {
             ignore = 0;
-            TAILQ_FOREACH(ii, &xh_core_ignore_info, link) //find ignore info
+            TAILQ_FOREACH(ii, &(ctx->ignore_info), link) //find ignore info
             {
                 if(0 == regexec(&(ii->pathname_regex), mi->pathname, 0, NULL, 0))
                 {
                     if(NULL == ii->symbol) //ignore all symbols
-                        return;
+                        return ret;
 
                     if(0 == strcmp(ii->symbol, hi->symbol)) //ignore the current symbol
                     {
@@ -275,62 +536,166 @@ static void xh_core_hook_impl(xh_core_map_info_t *mi)
             }
 
             if(0 == ignore)
-                xh_elf_hook(&(mi->elf), hi->symbol, hi->new_func, hi->old_func);
+            {
+                traced = XH_TRACE_BEGIN("xh_elf_hook %s", hi->symbol);
+                if(NULL != hi->slot_func)
+                    r = xh_elf_hook_slots(&(mi->elf), hi->symbol, hi->slot_func, hi->slot_func_arg, dry_run, &(res->stat));
+                else
+                    r = xh_elf_hook(&(mi->elf), hi->symbol, hi->new_func, hi->old_func, dry_run, &(res->stat));
+                XH_TRACE_END(traced);
+                if(0 != r && 0 == ret) ret = r; //keep the first failure
+            }
         }
     }
+    return ret;
+}
+
+static int xh_core_hook_impl(xh_core_map_info_t *mi, int dry_run, xh_core_hook_result_t *res)
+{
+    xh_core_ctx_t *ctx;
+    unsigned int   applied_seq = 0;
+    int            traced;
+    int            r, ret = 0;
+
+    if(XH_CORE_HOOK_UPDATE == mi->need_hook)
+    {
+        //already parsed, only the newly started contexts
+        applied_seq = mi->applied_seq;
+    }
+    else
+    {
+        //forget the slots patched at the old base address
+        xh_elf_fini(&(mi->elf));
+
+        //init
+        traced = XH_TRACE_BEGIN("xh_elf_init %s", mi->pathname);
+        r = xh_elf_init(&(mi->elf), mi->base_addr, mi->pathname);
+        XH_TRACE_END(traced);
+        if(0 != r)
+        {
+            memset(&(mi->elf), 0, sizeof(xh_elf_t)); //not inited, for the later XH_CORE_HOOK_UPDATE
+            return r;
+        }
+    }
+
+    res->elf_flags = (mi->elf.is_use_rela ? XHOOK_REPORT_ELF_RELA : 0) |
+        (mi->elf.is_use_gnu_hash ? XHOOK_REPORT_ELF_GNU_HASH : 0);
+    xh_elf_get_reloc_cnt(&(mi->elf), &(res->relplt_cnt), &(res->reldyn_cnt), &(res->relandroid_cnt));
+    
+    //hook, the rules of all contexts in one pass
+    TAILQ_FOREACH(ctx, &xh_core_ctxs, link)
+    {
+        if(ctx->seq <= applied_seq) continue;
+        r = xh_core_hook_ctx(mi, ctx, dry_run, res);
+        if(0 != r && 0 == ret) ret = r;
+    }
+
+    //write the slots queued by the batched patch backend
+    r = xh_elf_hook_flush(&(mi->elf), &(res->stat));
+    if(0 != r && 0 == ret) ret = r;
+    return ret;
 }
 
-static void xh_core_hook(xh_core_map_info_t *mi)
+static void xh_core_hook(xh_core_map_info_t *mi, int dry_run, xh_core_hook_result_t *res)
 {
     if(!xh_core_sigsegv_enable)
     {
-        xh_core_hook_impl(mi);
+        res->status = xh_core_hook_impl(mi, dry_run, res);
     }
     else
     {    
+        int trace_depth = xh_trace_depth();
+
         xh_core_sigsegv_flag = 1;
         if(0 == sigsetjmp(xh_core_sigsegv_env, 1))
         {
-            xh_core_hook_impl(mi);
+            res->status = xh_core_hook_impl(mi, dry_run, res);
         }
         else
         {
+            xh_trace_unwind(trace_depth);
+            xh_elf_hook_discard(&(mi->elf));
+            res->status = XH_ERRNO_SEGVERR;
             XH_LOG_WARN("catch SIGSEGV when init or hook: %s", mi->pathname);
         }
         xh_core_sigsegv_flag = 0;
     }
 }
 
-static void xh_core_refresh_impl()
+//libxhook's own image is never a candidate: patching its imports would route the refresh
+//itself (maps reading, mprotect, malloc) through the proxy functions
+//(not when it is linked statically into the executable, which remains hookable)
+static uintptr_t xh_core_self_base = 0;
+static int       xh_core_self_base_inited = 0;
+
+static uintptr_t xh_core_get_self_base()
+{
+    Dl_info info, exe_info;
+
+    if(!xh_core_self_base_inited)
+    {
+        if(0 != dladdr((void *)xh_core_get_self_base, &info) &&
+           !(0 != dladdr((void *)getauxval(AT_PHDR), &exe_info) && exe_info.dli_fbase == info.dli_fbase))
+            xh_core_self_base = (uintptr_t)info.dli_fbase;
+        xh_core_self_base_inited = 1;
+    }
+    return xh_core_self_base;
+}
+
+//save the candidate, these buffers are reused by the next refresh
+static void xh_core_maps_add(uintptr_t base_addr, const char *pathname, size_t pathname_len)
+{
+    void *p;
+
+    if(base_addr == xh_core_get_self_base()) return;
+
+    if(xh_core_maps_cnt == xh_core_maps_cap)
+    {
+        if(NULL == (p = realloc(xh_core_maps, sizeof(xh_core_maps_entry_t) * (xh_core_maps_cap + 64)))) return;
+        xh_core_maps = (xh_core_maps_entry_t *)p;
+        xh_core_maps_cap += 64;
+    }
+    if(xh_core_maps_pathnames_len + pathname_len + 1 > xh_core_maps_pathnames_cap)
+    {
+        if(NULL == (p = realloc(xh_core_maps_pathnames, xh_core_maps_pathnames_cap + 8192 + pathname_len))) return;
+        xh_core_maps_pathnames = (char *)p;
+        xh_core_maps_pathnames_cap += 8192 + pathname_len;
+    }
+    memcpy(xh_core_maps_pathnames + xh_core_maps_pathnames_len, pathname, pathname_len + 1);
+    xh_core_maps[xh_core_maps_cnt].base_addr = base_addr;
+    xh_core_maps[xh_core_maps_cnt].pathname_off = xh_core_maps_pathnames_len;
+    xh_core_maps_cnt++;
+    xh_core_maps_pathnames_len += pathname_len + 1;
+}
+
+//parse /proc/self/maps, save the base address and pathname of all ELF candidates
+static int xh_core_maps_parse()
 {
     char                     line[512];
-    FILE                    *fp;
+    xh_util_reader_t         reader;
     uintptr_t                base_addr;
+    uintptr_t                end_addr;
     uintptr_t                prev_base_addr = 0;
     char                     perm[5];
     char                     prev_perm[5] = "---p";
     unsigned long            offset;
     unsigned long            prev_offset = 0;
-    int                      pathname_pos;
     char                    *pathname;
     char                     prev_pathname[512] = {0};
     size_t                   pathname_len;
-    xh_core_map_info_t      *mi, *mi_tmp;
-    xh_core_map_info_t       mi_key;
-    xh_core_hook_info_t     *hi;
-    xh_core_ignore_info_t   *ii;
-    int                      match;
-    xh_core_map_info_tree_t  map_info_refreshed = RB_INITIALIZER(&map_info_refreshed);
 
-    if(NULL == (fp = fopen("/proc/self/maps", "r")))
+    xh_core_maps_cnt = 0;
+    xh_core_maps_pathnames_len = 0;
+
+    if(0 != xh_util_reader_open(&reader, xh_util_get_maps_path()))
     {
-        XH_LOG_ERROR("fopen /proc/self/maps failed");
-        return;
+        XH_LOG_ERROR("open %s failed", xh_util_get_maps_path());
+        return XH_ERRNO_BADMAPS;
     }
 
-    while(fgets(line, sizeof(line), fp))
+    while(xh_util_reader_next(&reader, line, sizeof(line)))
     {
-        if(sscanf(line, "%"PRIxPTR"-%*lx %4s %lx %*x:%*x %*d%n", &base_addr, perm, &offset, &pathname_pos) != 3) continue;
+        if(0 != xh_util_parse_maps_line(line, &base_addr, &end_addr, perm, &offset, &pathname)) continue;
 
          // do not touch the shared memory
         if (perm[3] != 'p') continue;
@@ -340,18 +705,8 @@ static void xh_core_refresh_impl()
             continue;
 
         //get pathname
-        while(isspace(line[pathname_pos]) && pathname_pos < (int)(sizeof(line) - 1))
-            pathname_pos += 1;
-        if(pathname_pos >= (int)(sizeof(line) - 1)) continue;
-        pathname = line + pathname_pos;
         pathname_len = strlen(pathname);
         if(0 == pathname_len) continue;
-        if(pathname[pathname_len - 1] == '\n')
-        {
-            pathname[pathname_len - 1] = '\0';
-            pathname_len -= 1;
-        }
-        if(0 == pathname_len) continue;
         if('[' == pathname[0]) continue;
 
         // Find non-executable map, we need record it. Because so maps can begin with
@@ -374,40 +729,267 @@ static void xh_core_refresh_impl()
             base_addr = prev_base_addr;
         }
 
-        //check pathname
-        //if we need to hook this elf?
-        match = 0;
-        TAILQ_FOREACH(hi, &xh_core_hook_info, link) //find hook info
+        xh_core_maps_add(base_addr, pathname, pathname_len);
+    }
+    xh_util_reader_close(&reader);
+
+    return 0;
+}
+
+//the candidates of a partial refresh, instead of parsing /proc/self/maps
+static void xh_core_maps_set(const xh_core_lib_t *libs, size_t libs_cnt)
+{
+    size_t i;
+
+    xh_core_maps_cnt = 0;
+    xh_core_maps_pathnames_len = 0;
+    for(i = 0; i < libs_cnt; i++)
+        xh_core_maps_add(libs[i].base_addr, libs[i].pathname, strlen(libs[i].pathname));
+}
+
+//check pathname
+//if we need to hook this elf?
+static int xh_core_match_ctx(xh_core_ctx_t *ctx, const char *pathname)
+{
+    xh_core_hook_info_t     *hi;
+    xh_core_ignore_info_t   *ii;
+
+    TAILQ_FOREACH(hi, &(ctx->hook_info), link) //find hook info
+    {
+        if(0 == regexec(&(hi->pathname_regex), pathname, 0, NULL, 0))
         {
-            if(0 == regexec(&(hi->pathname_regex), pathname, 0, NULL, 0))
+            TAILQ_FOREACH(ii, &(ctx->ignore_info), link) //find ignore info
             {
-                TAILQ_FOREACH(ii, &xh_core_ignore_info, link) //find ignore info
+                if(0 == regexec(&(ii->pathname_regex), pathname, 0, NULL, 0))
                 {
-                    if(0 == regexec(&(ii->pathname_regex), pathname, 0, NULL, 0))
-                    {
-                        if(NULL == ii->symbol)
-                            goto check_finished;
+                    if(NULL == ii->symbol)
+                        return 0;
 
-                        if(0 == strcmp(ii->symbol, hi->symbol))
-                            goto check_continue;
-                    }
+                    if(0 == strcmp(ii->symbol, hi->symbol))
+                        goto check_continue;
                 }
-
-                match = 1;
-            check_continue:
-                break;
             }
+
+            return 1;
+        check_continue:
+            break;
         }
-    check_finished:
-        if(0 == match) continue;
+    }
+    return 0;
+}
+
+static int xh_core_match(const char *pathname)
+{
+    xh_core_ctx_t *ctx;
+
+    TAILQ_FOREACH(ctx, &xh_core_ctxs, link)
+        if(xh_core_match_ctx(ctx, pathname)) return 1;
+    return 0;
+}
+
+static void xh_core_lib_events_add(xh_core_lib_events_t *self, int event, const char *pathname,
+                                   uintptr_t base_addr, size_t slots_patched)
+{
+    size_t  pathname_len = strlen(pathname);
+    void   *p;
+
+    if(self->cnt == self->cap)
+    {
+        if(NULL == (p = realloc(self->events, sizeof(xh_core_lib_event_t) * (self->cap + 16)))) return;
+        self->events = (xh_core_lib_event_t *)p;
+        self->cap += 16;
+    }
+    if(self->pathnames_len + pathname_len + 1 > self->pathnames_cap)
+    {
+        if(NULL == (p = realloc(self->pathnames, self->pathnames_cap + pathname_len + 1 + 1024))) return;
+        self->pathnames = (char *)p;
+        self->pathnames_cap += pathname_len + 1 + 1024;
+    }
+    memcpy(self->pathnames + self->pathnames_len, pathname, pathname_len + 1);
+    self->events[self->cnt].event = event;
+    self->events[self->cnt].pathname_off = self->pathnames_len;
+    self->events[self->cnt].base_addr = base_addr;
+    self->events[self->cnt].slots_patched = slots_patched;
+    self->cnt++;
+    self->pathnames_len += pathname_len + 1;
+}
+
+static int xh_core_lib_event_cb_alive(uint64_t id)
+{
+    size_t i;
+    int    alive = 0;
+
+    pthread_mutex_lock(&xh_core_lib_event_cbs_mutex);
+    for(i = 0; i < xh_core_lib_event_cbs_cnt; i++)
+    {
+        if(xh_core_lib_event_cbs[i].id == id)
+        {
+            alive = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&xh_core_lib_event_cbs_mutex);
+    return alive;
+}
+
+//called without holding the refresh mutex, so the callbacks can call xhook APIs
+static void xh_core_lib_events_dispatch(xh_core_lib_events_t *self)
+{
+    xh_core_lib_event_cb_t  cbs[XH_CORE_LIB_EVENT_CB_MAX];
+    size_t                  cbs_cnt, i, j;
+    xh_core_lib_event_t    *e;
+
+    if(0 == self->cnt) goto end;
+
+    pthread_mutex_lock(&xh_core_lib_event_cbs_mutex);
+    cbs_cnt = xh_core_lib_event_cbs_cnt;
+    memcpy(cbs, xh_core_lib_event_cbs, sizeof(xh_core_lib_event_cb_t) * cbs_cnt);
+    pthread_mutex_unlock(&xh_core_lib_event_cbs_mutex);
+
+    for(i = 0; i < self->cnt; i++)
+    {
+        e = &(self->events[i]);
+        for(j = 0; j < cbs_cnt; j++)
+        {
+            //a callback may delete itself or another one
+            if(!xh_core_lib_event_cb_alive(cbs[j].id)) continue;
+            cbs[j].cb(e->event, self->pathnames + e->pathname_off, e->base_addr, e->slots_patched, cbs[j].arg);
+        }
+    }
+
+ end:
+    free(self->events);
+    free(self->pathnames);
+    memset(self, 0, sizeof(xh_core_lib_events_t));
+}
+
+static uint64_t xh_core_now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int xh_core_report_init(xh_core_report_t *self, int flags)
+{
+    xhook_report_header_t *header;
+
+    self->cap = 4096;
+    if(NULL == (self->buf = malloc(self->cap))) return XH_ERRNO_NOMEM;
+    self->len = sizeof(xhook_report_header_t);
+
+    header = (xhook_report_header_t *)self->buf;
+    memset(header, 0, sizeof(xhook_report_header_t));
+    header->magic = XHOOK_REPORT_MAGIC;
+    header->version = XHOOK_REPORT_VERSION;
+    header->flags = (uint32_t)flags;
+    return 0;
+}
+
+static void xh_core_report_add(xh_core_report_t *self, int event, const char *pathname, uintptr_t base_addr,
+                               xh_core_hook_result_t *res, uint64_t duration_ns)
+{
+    size_t              pathname_len = strlen(pathname);
+    size_t              record_len = (offsetof(xhook_report_lib_t, pathname) + pathname_len + 1 + 7) & ~(size_t)7;
+    xhook_report_lib_t *rec;
+    void               *p;
+
+    if(NULL == self->buf) return;
+    if(self->len + record_len > self->cap)
+    {
+        if(NULL == (p = realloc(self->buf, self->cap + record_len + 4096))) return;
+        self->buf = (char *)p;
+        self->cap += record_len + 4096;
+    }
+
+    rec = (xhook_report_lib_t *)(self->buf + self->len);
+    memset(rec, 0, record_len);
+    rec->record_len = (uint32_t)record_len;
+    rec->base_addr = (uint64_t)base_addr;
+    rec->event = (uint32_t)event;
+    rec->duration_ns = duration_ns;
+    rec->pathname_len = (uint32_t)pathname_len;
+    memcpy(rec->pathname, pathname, pathname_len + 1);
+    if(NULL != res)
+    {
+        rec->status = (int32_t)res->status;
+        rec->elf_flags = res->elf_flags;
+        rec->relplt_cnt = (uint32_t)res->relplt_cnt;
+        rec->reldyn_cnt = (uint32_t)res->reldyn_cnt;
+        rec->relandroid_cnt = (uint32_t)res->relandroid_cnt;
+        rec->symbols_found = (uint32_t)res->stat.symbols_found;
+        rec->symbols_not_found = (uint32_t)res->stat.symbols_not_found;
+        rec->slots_patched = (uint32_t)res->stat.slots_patched;
+    }
+
+    self->len += record_len;
+    ((xhook_report_header_t *)self->buf)->lib_cnt += 1;
+}
+
+static void xh_core_refresh_impl(xh_core_refresh_ctx_t *rctx)
+{
+    uintptr_t                base_addr;
+    char                    *pathname;
+    xh_core_map_info_t      *mi, *mi_tmp;
+    xh_core_map_info_t       mi_key;
+    size_t                   i;
+    size_t                   libs_cnt = 0;
+    size_t                   symbols_cnt = 0;
+    size_t                   slots_cnt = 0;
+    size_t                   failures_cnt = 0;
+    size_t                   sigsegv_cnt = 0;
+    xh_core_hook_result_t    res;
+    uint64_t                 start_ns = 0, lib_start_ns = 0;
+    int                      event;
+    xh_core_lib_events_t    *events = ((!rctx->dry_run && xh_core_lib_event_cbs_cnt > 0) ? rctx->events : NULL);
+    xh_core_report_t        *report = rctx->report;
+    xh_core_map_info_tree_t  map_info_refreshed = RB_INITIALIZER(&map_info_refreshed);
+    int                      traced, traced_step;
+    int                      r;
+
+    traced = XH_TRACE_BEGIN("xh_refresh");
+    if(NULL != report || NULL != xh_stats_page) start_ns = xh_core_now_ns();
+
+    if(!rctx->dry_run) xh_oneshot_reap();
+
+    traced_step = XH_TRACE_BEGIN("xh_maps_parse");
+    if(NULL != rctx->libs)
+    {
+        xh_core_maps_set(rctx->libs, rctx->libs_cnt);
+        r = 0;
+    }
+    else
+        r = xh_core_maps_parse();
+    XH_TRACE_END(traced_step);
+    if(0 != r)
+    {
+        XH_TRACE_END(traced);
+        return;
+    }
+    XH_TRACE_COUNTER("xh_maps_elfs", xh_core_maps_cnt);
+
+    traced_step = XH_TRACE_BEGIN("xh_match");
+    for(i = 0; i < xh_core_maps_cnt; i++)
+    {
+        base_addr = xh_core_maps[i].base_addr;
+        pathname = xh_core_maps_pathnames + xh_core_maps[i].pathname_off;
+
+        //the existed map item is kept even if no rule matches it any more (context destroyed)
+        mi_key.pathname = pathname;
+        mi = RB_FIND(xh_core_map_info_tree, &xh_core_map_info, &mi_key);
+        if(NULL == mi && 0 == xh_core_match(pathname)) continue;
 
         //check elf header format
         //We are trying to do ELF header checking as late as possible.
-        if(0 != xh_core_check_elf_header(base_addr, pathname)) continue;
+        if(0 != (r = xh_core_check_elf_header(base_addr, pathname)))
+        {
+            if(XH_ERRNO_SEGVERR == r) sigsegv_cnt++;
+            continue;
+        }
         
         //check existed map item
-        mi_key.pathname = pathname;
-        if(NULL != (mi = RB_FIND(xh_core_map_info_tree, &xh_core_map_info, &mi_key)))
+        if(NULL != mi && !rctx->dry_run)
         {
             //exist
             RB_REMOVE(xh_core_map_info_tree, &xh_core_map_info, mi);
@@ -417,10 +999,9 @@ static void xh_core_refresh_impl()
             if(NULL != RB_INSERT(xh_core_map_info_tree, &map_info_refreshed, mi))
             {
 #if XH_CORE_DEBUG
-                XH_LOG_DEBUG("repeated map info when update: %s", line);
+                XH_LOG_DEBUG("repeated map info when update: %s", pathname);
 #endif
-                free(mi->pathname);
-                free(mi);
+                xh_core_map_info_free(mi);
                 continue;
             }
 
@@ -428,37 +1009,123 @@ static void xh_core_refresh_impl()
             if(mi->base_addr != base_addr)
             {
                 mi->base_addr = base_addr;
-                xh_core_hook(mi);
+                mi->need_hook = XH_CORE_HOOK_REHOOK;
+            }
+            else if(mi->applied_seq < xh_core_ctx_seq)
+            {
+                mi->need_hook = XH_CORE_HOOK_UPDATE;
             }
         }
         else
         {
-            //not exist, create a new map info
-            if(NULL == (mi = (xh_core_map_info_t *)malloc(sizeof(xh_core_map_info_t)))) continue;
-            if(NULL == (mi->pathname = strdup(pathname)))
+            //not exist (or dry run), create a new map info
+            //in dry run, the existed map item is left in place and a copy is planned instead
+            if(NULL == (mi_tmp = (xh_core_map_info_t *)malloc(sizeof(xh_core_map_info_t)))) continue;
+            if(NULL == (mi_tmp->pathname = strdup(pathname)))
             {
-                free(mi);
+                free(mi_tmp);
                 continue;
             }
-            mi->base_addr = base_addr;
+            memset(&(mi_tmp->elf), 0, sizeof(xh_elf_t));
+            mi_tmp->base_addr = base_addr;
+            mi_tmp->applied_seq = 0;
+            if(NULL == mi)
+            {
+                mi_tmp->need_hook = XH_CORE_HOOK_NEW;
+            }
+            else if(mi->base_addr != base_addr)
+            {
+                mi_tmp->need_hook = XH_CORE_HOOK_REHOOK;
+            }
+            else
+            {
+                //reuse the parsed ELF, without the slot records
+                mi_tmp->elf = mi->elf;
+                mi_tmp->elf.pathname = mi_tmp->pathname;
+                mi_tmp->elf.patches = NULL;
+                mi_tmp->elf.patches_cnt = 0;
+                mi_tmp->elf.patches_cap = 0;
+                mi_tmp->elf.slots = NULL;
+                mi_tmp->elf.slots_cnt = 0;
+                mi_tmp->elf.slots_cap = 0;
+                mi_tmp->applied_seq = mi->applied_seq;
+                mi_tmp->need_hook = (mi->applied_seq < xh_core_ctx_seq ? XH_CORE_HOOK_UPDATE : XH_CORE_HOOK_NONE);
+            }
+            mi = mi_tmp;
 
             //repeated?
             //We only keep the first one, that is the real base address
             if(NULL != RB_INSERT(xh_core_map_info_tree, &map_info_refreshed, mi))
             {
 #if XH_CORE_DEBUG
-                XH_LOG_DEBUG("repeated map info when create: %s", line);
+                XH_LOG_DEBUG("repeated map info when create: %s", pathname);
 #endif
-                free(mi->pathname);
-                free(mi);
+                xh_core_map_info_free(mi);
                 continue;
             }
+        }
+    }
+    XH_TRACE_END(traced_step);
+
+    //hook
+    traced_step = XH_TRACE_BEGIN("xh_hook");
+    RB_FOREACH(mi, xh_core_map_info_tree, &map_info_refreshed)
+    {
+        if(XH_CORE_HOOK_NONE == mi->need_hook) continue;
+        if(XH_CORE_HOOK_NEW == mi->need_hook)
+            event = XHOOK_LIB_EVENT_ADDED;
+        else if(XH_CORE_HOOK_REHOOK == mi->need_hook)
+            event = XHOOK_LIB_EVENT_REHOOKED;
+        else
+            event = XHOOK_LIB_EVENT_UPDATED;
+        memset(&res, 0, sizeof(res));
+        if(NULL != report) lib_start_ns = xh_core_now_ns();
+        xh_core_hook(mi, rctx->dry_run, &res);
+        libs_cnt++;
+        symbols_cnt += res.stat.symbols_found;
+        slots_cnt += res.stat.slots_patched;
+        if(0 != res.status) failures_cnt++;
+        if(XH_ERRNO_SEGVERR == res.status) sigsegv_cnt++;
+        if(NULL != events)
+            xh_core_lib_events_add(events, event, mi->pathname, mi->base_addr, res.stat.slots_patched);
+        if(NULL != report)
+            xh_core_report_add(report, event, mi->pathname, mi->base_addr, &res, xh_core_now_ns() - lib_start_ns);
+        mi->need_hook = XH_CORE_HOOK_NONE;
+        mi->applied_seq = xh_core_ctx_seq;
+    }
+    XH_TRACE_END(traced_step);
+    XH_TRACE_COUNTER("xh_libs_hooked", libs_cnt);
+    XH_TRACE_COUNTER("xh_symbols_hooked", symbols_cnt);
+
+    if(rctx->dry_run)
+    {
+        //report the missing map items, but keep everything in place
+        RB_FOREACH(mi, xh_core_map_info_tree, &xh_core_map_info)
+        {
+            if(NULL != report && NULL == RB_FIND(xh_core_map_info_tree, &map_info_refreshed, mi))
+                xh_core_report_add(report, XHOOK_LIB_EVENT_REMOVED, mi->pathname, mi->base_addr, NULL, 0);
+        }
+
+        //drop the planned map info tree
+        RB_FOREACH_SAFE(mi, xh_core_map_info_tree, &map_info_refreshed, mi_tmp)
+        {
+            RB_REMOVE(xh_core_map_info_tree, &map_info_refreshed, mi);
+            xh_core_map_info_free(mi);
+        }
+
+        XH_LOG_INFO("map refresh planned (dry run)");
+        goto end;
+    }
 
-            //hook
-            xh_core_hook(mi); //hook
+    //partial refresh, keep the map items which were not looked at
+    if(NULL != rctx->libs)
+    {
+        RB_FOREACH_SAFE(mi, xh_core_map_info_tree, &xh_core_map_info, mi_tmp)
+        {
+            RB_REMOVE(xh_core_map_info_tree, &xh_core_map_info, mi);
+            if(NULL != RB_INSERT(xh_core_map_info_tree, &map_info_refreshed, mi)) xh_core_map_info_free(mi);
         }
     }
-    fclose(fp);
 
     //free all missing map item, maybe dlclosed?
     RB_FOREACH_SAFE(mi, xh_core_map_info_tree, &xh_core_map_info, mi_tmp)
@@ -466,48 +1133,176 @@ static void xh_core_refresh_impl()
 #if XH_CORE_DEBUG
         XH_LOG_DEBUG("remove missing map info: %s", mi->pathname);
 #endif
+        if(NULL != events)
+            xh_core_lib_events_add(events, XHOOK_LIB_EVENT_REMOVED, mi->pathname, mi->base_addr, 0);
+        if(NULL != report)
+            xh_core_report_add(report, XHOOK_LIB_EVENT_REMOVED, mi->pathname, mi->base_addr, NULL, 0);
         RB_REMOVE(xh_core_map_info_tree, &xh_core_map_info, mi);
-        if(mi->pathname) free(mi->pathname);
-        free(mi);
+        xh_core_map_info_free(mi);
     }
 
     //save the new refreshed map info tree
     xh_core_map_info = map_info_refreshed;
 
     XH_LOG_INFO("map refreshed");
+
+    if(NULL != xh_stats_page)
+    {
+        libs_cnt = 0;
+        RB_FOREACH(mi, xh_core_map_info_tree, &xh_core_map_info)
+            libs_cnt++;
+        xh_stats_refresh(xh_core_now_ns() - start_ns, libs_cnt, slots_cnt, failures_cnt, sigsegv_cnt);
+    }
     
 #if XH_CORE_DEBUG
     RB_FOREACH(mi, xh_core_map_info_tree, &xh_core_map_info)
         XH_LOG_DEBUG("  %"PRIxPTR" %s\n", mi->base_addr, mi->pathname);
 #endif
+
+ end:
+    if(NULL != report && NULL != report->buf)
+        ((xhook_report_header_t *)report->buf)->duration_ns = xh_core_now_ns() - start_ns;
+    XH_TRACE_END(traced);
+}
+
+static int xh_core_verify_lib(xh_core_map_info_t *mi, size_t *repaired_cnt)
+{
+    if(!xh_core_sigsegv_enable)
+    {
+        return xh_elf_verify(&(mi->elf), repaired_cnt);
+    }
+    else
+    {
+        int ret = XH_ERRNO_UNKNOWN;
+        
+        xh_core_sigsegv_flag = 1;
+        if(0 == sigsetjmp(xh_core_sigsegv_env, 1))
+        {
+            ret = xh_elf_verify(&(mi->elf), repaired_cnt);
+        }
+        else
+        {
+            xh_elf_hook_discard(&(mi->elf));
+            ret = XH_ERRNO_SEGVERR;
+            XH_LOG_WARN("catch SIGSEGV when verify: %s", mi->pathname);
+        }
+        xh_core_sigsegv_flag = 0;
+        return ret;
+    }
+}
+
+//called with the refresh mutex held
+static size_t xh_core_verify_impl()
+{
+    xh_core_map_info_t *mi;
+    size_t              repaired_cnt = 0;
+    int                 traced;
+
+    traced = XH_TRACE_BEGIN("xh_verify");
+    RB_FOREACH(mi, xh_core_map_info_tree, &xh_core_map_info)
+    {
+        if(0 == mi->elf.slots_cnt) continue;
+        if(0 != xh_core_verify_lib(mi, &repaired_cnt))
+            xh_elf_fini(&(mi->elf)); //unloaded or broken, stop verifying it until the next refresh
+    }
+    XH_TRACE_END(traced);
+    XH_TRACE_COUNTER("xh_slots_repaired", repaired_cnt);
+
+    if(repaired_cnt > 0) XH_LOG_WARN("verify repaired %zu slots", repaired_cnt);
+    return repaired_cnt;
+}
+
+//the shorter of the watchdog interval and the governor tick, 0 for none
+static unsigned int xh_core_timer_interval_ms()
+{
+    unsigned int interval_ms = xh_core_watchdog_interval_ms;
+
+    if(xh_governor_active() && (0 == interval_ms || interval_ms > XH_GOVERNOR_TICK_MS))
+        interval_ms = XH_GOVERNOR_TICK_MS;
+    return interval_ms;
 }
 
 static void *xh_core_refresh_thread_func(void *arg)
 {
+    xh_core_lib_events_t  events;
+    xh_core_refresh_ctx_t rctx = {0, &events, NULL, NULL, 0};
+    struct timespec       deadline;
+    int                   deadline_set;
+    unsigned int          interval_ms;
+    int                   timer;
+    uint64_t              verify_ns = xh_core_now_ns();
+
     (void)arg;
+
+    memset(&events, 0, sizeof(events));
     
     pthread_setname_np(pthread_self(), "xh_refresh_loop");
 
     while(xh_core_refresh_thread_running)
     {
-        //waiting for a refresh task or exit
+        //waiting for a refresh task, the timer (watchdog and governor) or exit
         pthread_mutex_lock(&xh_core_mutex);
-        while(!xh_core_refresh_thread_do && xh_core_refresh_thread_running)
+        timer = 0;
+        deadline_set = 0;
+        while(!xh_core_refresh_thread_do && xh_core_refresh_thread_running && !timer)
         {
-            pthread_cond_wait(&xh_core_cond, &xh_core_mutex);
+            if(0 == (interval_ms = xh_core_timer_interval_ms()))
+            {
+                pthread_cond_wait(&xh_core_cond, &xh_core_mutex);
+                deadline_set = 0;
+                continue;
+            }
+            if(!deadline_set)
+            {
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                deadline.tv_sec += (time_t)(interval_ms / 1000);
+                deadline.tv_nsec += (long)(interval_ms % 1000) * 1000000L;
+                if(deadline.tv_nsec >= 1000000000L)
+                {
+                    deadline.tv_sec += 1;
+                    deadline.tv_nsec -= 1000000000L;
+                }
+                deadline_set = 1;
+            }
+            if(ETIMEDOUT == pthread_cond_timedwait(&xh_core_cond, &xh_core_mutex, &deadline))
+                timer = 1;
         }
         if(!xh_core_refresh_thread_running)
         {
             pthread_mutex_unlock(&xh_core_mutex);
             break;
         }
+        if(!xh_core_refresh_thread_do && timer)
+        {
+            interval_ms = xh_core_watchdog_interval_ms;
+            pthread_mutex_unlock(&xh_core_mutex);
+
+            //governor
+            if(xh_governor_active()) xh_governor_tick();
+
+            //one-shot slots the first calls could not restore
+            pthread_mutex_lock(&xh_core_refresh_mutex);
+            xh_oneshot_reap();
+            pthread_mutex_unlock(&xh_core_refresh_mutex);
+
+            //watchdog
+            if(interval_ms > 0 && xh_core_now_ns() - verify_ns >= (uint64_t)interval_ms * 1000000ULL)
+            {
+                pthread_mutex_lock(&xh_core_refresh_mutex);
+                xh_core_verify_impl();
+                pthread_mutex_unlock(&xh_core_refresh_mutex);
+                verify_ns = xh_core_now_ns();
+            }
+            continue;
+        }
         xh_core_refresh_thread_do = 0;
         pthread_mutex_unlock(&xh_core_mutex);
 
         //refresh
         pthread_mutex_lock(&xh_core_refresh_mutex);
-        xh_core_refresh_impl();
+        xh_core_refresh_impl(&rctx);
         pthread_mutex_unlock(&xh_core_refresh_mutex);
+        xh_core_lib_events_dispatch(&events);
     }
 
     return NULL;
@@ -527,11 +1322,11 @@ static void xh_core_init_once()
     XH_LOG_INFO("%s\n", xh_version_str_full());
 #if XH_CORE_DEBUG
     xh_core_hook_info_t *hi;
-    TAILQ_FOREACH(hi, &xh_core_hook_info, link)
+    TAILQ_FOREACH(hi, &xh_core_ctx_default.hook_info, link)
         XH_LOG_INFO("  hook: %s @ %s, (%p, %p)\n", hi->symbol, hi->pathname_regex_str,
                     hi->new_func, hi->old_func);
     xh_core_ignore_info_t *ii;
-    TAILQ_FOREACH(ii, &xh_core_ignore_info, link)
+    TAILQ_FOREACH(ii, &xh_core_ctx_default.ignore_info, link)
         XH_LOG_INFO("  ignore: %s @ %s\n", ii->symbol ? ii->symbol : "ALL ",
                     ii->pathname_regex_str);
 #endif
@@ -571,11 +1366,32 @@ static void xh_core_init_async_once()
     pthread_mutex_unlock(&xh_core_mutex);
 }
 
-int xh_core_refresh(int async)
+//freeze the rules of the instance, every refresh applies them from now on
+static void xh_core_ctx_start(xh_core_ctx_t *ctx)
+{
+    pthread_mutex_lock(&xh_core_mutex);
+    if(0 == ctx->seq)
+    {
+        pthread_mutex_lock(&xh_core_refresh_mutex);
+        ctx->seq = ++xh_core_ctx_seq;
+        TAILQ_INSERT_TAIL(&xh_core_ctxs, ctx, link);
+        pthread_mutex_unlock(&xh_core_refresh_mutex);
+        pthread_cond_signal(&xh_core_cond); //its governed hooks may need the timer
+    }
+    pthread_mutex_unlock(&xh_core_mutex);
+}
+
+int xh_core_refresh(xh_core_ctx_t *ctx, int async)
 {
+    if(NULL == ctx) ctx = &xh_core_ctx_default;
+
     //init
     xh_core_init_once();
     if(!xh_core_init_ok) return XH_ERRNO_UNKNOWN;
+    xh_core_ctx_start(ctx);
+
+    //the watchdog and the governor run on the async thread
+    if(xh_core_watchdog_interval_ms > 0 || xh_governor_active()) xh_core_init_async_once();
 
     if(async)
     {
@@ -592,16 +1408,69 @@ int xh_core_refresh(int async)
     else
     {
         //refresh sync
+        xh_core_lib_events_t  events;
+        xh_core_refresh_ctx_t rctx = {0, &events, NULL, NULL, 0};
+        memset(&events, 0, sizeof(events));
         pthread_mutex_lock(&xh_core_refresh_mutex);
-        xh_core_refresh_impl();
+        xh_core_refresh_impl(&rctx);
         pthread_mutex_unlock(&xh_core_refresh_mutex);
+        xh_core_lib_events_dispatch(&events);
     }
     
     return 0;
 }
 
-void xh_core_clear()
+void xh_core_refresh_libs(const xh_core_lib_t *libs, size_t libs_cnt)
+{
+    xh_core_lib_events_t  events;
+    xh_core_refresh_ctx_t rctx = {0, &events, NULL, libs, libs_cnt};
+
+    //nothing to apply before the first refresh
+    if(!xh_core_init_ok) return;
+
+    memset(&events, 0, sizeof(events));
+    pthread_mutex_lock(&xh_core_refresh_mutex);
+    xh_core_refresh_impl(&rctx);
+    pthread_mutex_unlock(&xh_core_refresh_mutex);
+    xh_core_lib_events_dispatch(&events);
+}
+
+//always sync, the caller should free() the report
+int xh_core_refresh_report(xh_core_ctx_t *ctx, int flags, void **report, size_t *report_len)
 {
+    xh_core_lib_events_t  events;
+    xh_core_report_t      rpt;
+    xh_core_refresh_ctx_t rctx = {(flags & XHOOK_REFRESH_FLAG_DRY_RUN) ? 1 : 0, &events, &rpt, NULL, 0};
+    int                   r;
+
+    if(NULL == report || NULL == report_len) return XH_ERRNO_INVAL;
+    *report = NULL;
+    *report_len = 0;
+
+    //init
+    xh_core_init_once();
+    if(!xh_core_init_ok) return XH_ERRNO_UNKNOWN;
+    xh_core_ctx_start(NULL == ctx ? &xh_core_ctx_default : ctx);
+
+    if(0 != (r = xh_core_report_init(&rpt, flags))) return r;
+
+    memset(&events, 0, sizeof(events));
+    pthread_mutex_lock(&xh_core_refresh_mutex);
+    xh_core_refresh_impl(&rctx);
+    pthread_mutex_unlock(&xh_core_refresh_mutex);
+    xh_core_lib_events_dispatch(&events);
+
+    *report = rpt.buf;
+    *report_len = rpt.len;
+    return 0;
+}
+
+//stop the engine once the last instance is gone
+static void xh_core_shutdown()
+{
+    //stop the discovery thread, it refreshes through us
+    xh_discovery_enable(0, NULL);
+
     //stop the async refresh thread
     if(xh_core_async_init_ok)
     {
@@ -610,10 +1479,15 @@ void xh_core_clear()
         pthread_cond_signal(&xh_core_cond);
         pthread_mutex_unlock(&xh_core_mutex);
         
-        pthread_join(xh_core_refresh_thread_tid, NULL);
+        //xhook_clear() from a lib event callback on the async thread: it exits by itself
+        if(pthread_equal(pthread_self(), xh_core_refresh_thread_tid))
+            pthread_detach(xh_core_refresh_thread_tid);
+        else
+            pthread_join(xh_core_refresh_thread_tid, NULL);
         xh_core_async_init_ok = 0;
     }
     xh_core_async_inited = 0;
+    xh_core_watchdog_interval_ms = 0;
 
     //unregister the sig handler
     if(xh_core_init_ok)
@@ -631,38 +1505,85 @@ void xh_core_clear()
     RB_FOREACH_SAFE(mi, xh_core_map_info_tree, &xh_core_map_info, mi_tmp)
     {
         RB_REMOVE(xh_core_map_info_tree, &xh_core_map_info, mi);
-        if(mi->pathname) free(mi->pathname);
-        free(mi);
+        xh_core_map_info_free(mi);
+    }
+
+    //free the maps buffers
+    free(xh_core_maps);
+    xh_core_maps = NULL;
+    xh_core_maps_cnt = 0;
+    xh_core_maps_cap = 0;
+    free(xh_core_maps_pathnames);
+    xh_core_maps_pathnames = NULL;
+    xh_core_maps_pathnames_len = 0;
+    xh_core_maps_pathnames_cap = 0;
+
+    pthread_mutex_unlock(&xh_core_refresh_mutex);
+    pthread_mutex_unlock(&xh_core_mutex);
+
+    //remove all library event callbacks
+    pthread_mutex_lock(&xh_core_lib_event_cbs_mutex);
+    xh_core_lib_event_cbs_cnt = 0;
+    pthread_mutex_unlock(&xh_core_lib_event_cbs_mutex);
+}
+
+void xh_core_clear(xh_core_ctx_t *ctx)
+{
+    int last;
+
+    if(NULL == ctx) ctx = &xh_core_ctx_default;
+
+    pthread_mutex_lock(&xh_core_mutex);
+    pthread_mutex_lock(&xh_core_refresh_mutex);
+
+    //slots already patched stay patched, the rules are just not applied any more
+    //(except the governed slots, restored by xh_governor_release() below)
+    if(0 != ctx->seq)
+    {
+        TAILQ_REMOVE(&xh_core_ctxs, ctx, link);
+        ctx->seq = 0;
     }
 
     //free all hook info
     xh_core_hook_info_t *hi, *hi_tmp;
-    TAILQ_FOREACH_SAFE(hi, &xh_core_hook_info, link, hi_tmp)
+    TAILQ_FOREACH_SAFE(hi, &ctx->hook_info, link, hi_tmp)
     {
-        TAILQ_REMOVE(&xh_core_hook_info, hi, link);
-#if XH_CORE_DEBUG
-        free(hi->pathname_regex_str);
-#endif
-        regfree(&(hi->pathname_regex));
-        free(hi->symbol);
-        free(hi);
+        TAILQ_REMOVE(&ctx->hook_info, hi, link);
+        xh_core_hook_info_destroy(hi);
     }
 
     //free all ignore info
     xh_core_ignore_info_t *ii, *ii_tmp;
-    TAILQ_FOREACH_SAFE(ii, &xh_core_ignore_info, link, ii_tmp)
+    TAILQ_FOREACH_SAFE(ii, &ctx->ignore_info, link, ii_tmp)
     {
-        TAILQ_REMOVE(&xh_core_ignore_info, ii, link);
-#if XH_CORE_DEBUG
-        free(ii->pathname_regex_str);
-#endif
-        regfree(&(ii->pathname_regex));
-        free(ii->symbol);
-        free(ii);
+        TAILQ_REMOVE(&ctx->ignore_info, ii, link);
+        xh_core_ignore_info_destroy(ii);
     }
 
+    last = TAILQ_EMPTY(&xh_core_ctxs);
+
     pthread_mutex_unlock(&xh_core_refresh_mutex);
     pthread_mutex_unlock(&xh_core_mutex);
+
+    if(last) xh_core_shutdown();
+}
+
+xh_core_ctx_t *xh_core_ctx_create()
+{
+    xh_core_ctx_t *ctx;
+
+    if(NULL == (ctx = calloc(1, sizeof(xh_core_ctx_t)))) return NULL;
+    TAILQ_INIT(&ctx->hook_info);
+    TAILQ_INIT(&ctx->ignore_info);
+    return ctx;
+}
+
+void xh_core_ctx_destroy(xh_core_ctx_t *ctx)
+{
+    if(NULL == ctx || &xh_core_ctx_default == ctx) return;
+
+    xh_core_clear(ctx);
+    free(ctx);
 }
 
 void xh_core_enable_debug(int flag)
@@ -674,3 +1595,176 @@ void xh_core_enable_sigsegv_protection(int flag)
 {
     xh_core_sigsegv_enable = (flag ? 1 : 0);
 }
+
+int xh_core_add_lib_event_callback(xhook_lib_event_cb_t cb, void *arg)
+{
+    int r = 0;
+
+    if(NULL == cb) return XH_ERRNO_INVAL;
+
+    pthread_mutex_lock(&xh_core_lib_event_cbs_mutex);
+    if(xh_core_lib_event_cbs_cnt >= XH_CORE_LIB_EVENT_CB_MAX)
+    {
+        r = XH_ERRNO_NOMEM;
+        goto end;
+    }
+    xh_core_lib_event_cbs[xh_core_lib_event_cbs_cnt].cb = cb;
+    xh_core_lib_event_cbs[xh_core_lib_event_cbs_cnt].arg = arg;
+    xh_core_lib_event_cbs[xh_core_lib_event_cbs_cnt].id = ++xh_core_lib_event_cbs_id;
+    xh_core_lib_event_cbs_cnt++;
+ end:
+    pthread_mutex_unlock(&xh_core_lib_event_cbs_mutex);
+    return r;
+}
+
+int xh_core_del_lib_event_callback(xhook_lib_event_cb_t cb, void *arg)
+{
+    size_t i;
+    int    r = XH_ERRNO_NOTFND;
+
+    pthread_mutex_lock(&xh_core_lib_event_cbs_mutex);
+    for(i = 0; i < xh_core_lib_event_cbs_cnt; i++)
+    {
+        if(xh_core_lib_event_cbs[i].cb == cb && xh_core_lib_event_cbs[i].arg == arg)
+        {
+            memmove(&(xh_core_lib_event_cbs[i]), &(xh_core_lib_event_cbs[i + 1]),
+                    sizeof(xh_core_lib_event_cb_t) * (xh_core_lib_event_cbs_cnt - i - 1));
+            xh_core_lib_event_cbs_cnt--;
+            r = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&xh_core_lib_event_cbs_mutex);
+    return r;
+}
+
+int xh_core_import_iter_init(xh_elf_import_iter_t *iter, uintptr_t base_addr, const char *pathname)
+{
+    int r;
+
+    xh_core_init_once();
+    if(!xh_core_init_ok) return XH_ERRNO_UNKNOWN;
+
+    pthread_mutex_lock(&xh_core_refresh_mutex);
+    if(!xh_core_sigsegv_enable)
+    {
+        r = xh_elf_import_iter_init(iter, base_addr, pathname);
+    }
+    else
+    {
+        xh_core_sigsegv_flag = 1;
+        if(0 == sigsetjmp(xh_core_sigsegv_env, 1))
+        {
+            r = xh_elf_import_iter_init(iter, base_addr, pathname);
+        }
+        else
+        {
+            r = XH_ERRNO_SEGVERR;
+            XH_LOG_WARN("catch SIGSEGV when init import iterator: %s", pathname);
+        }
+        xh_core_sigsegv_flag = 0;
+    }
+    pthread_mutex_unlock(&xh_core_refresh_mutex);
+    return r;
+}
+
+//a SIGSEGV (the ELF was unmapped) ends the iteration
+int xh_core_import_iter_next(xh_elf_import_iter_t *iter, xhook_import_t *import)
+{
+    int r;
+
+    pthread_mutex_lock(&xh_core_refresh_mutex);
+    if(!xh_core_sigsegv_enable)
+    {
+        r = xh_elf_import_iter_next(iter, import);
+    }
+    else
+    {
+        xh_core_sigsegv_flag = 1;
+        if(0 == sigsetjmp(xh_core_sigsegv_env, 1))
+        {
+            r = xh_elf_import_iter_next(iter, import);
+        }
+        else
+        {
+            r = 0;
+            XH_LOG_WARN("catch SIGSEGV when iterate imports: %s", iter->elf.pathname);
+        }
+        xh_core_sigsegv_flag = 0;
+    }
+    pthread_mutex_unlock(&xh_core_refresh_mutex);
+    return r;
+}
+
+int xh_core_verify(size_t *repaired_cnt)
+{
+    size_t cnt;
+
+    if(!xh_core_init_ok) return XH_ERRNO_UNKNOWN;
+    
+    pthread_mutex_lock(&xh_core_refresh_mutex);
+    cnt = xh_core_verify_impl();
+    pthread_mutex_unlock(&xh_core_refresh_mutex);
+
+    if(NULL != repaired_cnt) *repaired_cnt = cnt;
+    return 0;
+}
+
+int xh_core_enable_watchdog(unsigned int interval_ms)
+{
+    pthread_mutex_lock(&xh_core_mutex);
+    xh_core_watchdog_interval_ms = interval_ms;
+    pthread_cond_signal(&xh_core_cond); //restart the timer
+    pthread_mutex_unlock(&xh_core_mutex);
+
+    //started by the next refresh if not inited
+    if(interval_ms > 0 && xh_core_init_ok)
+    {
+        xh_core_init_async_once();
+        if(!xh_core_async_init_ok) return XH_ERRNO_UNKNOWN;
+    }
+    return 0;
+}
+
+int xh_core_set_patch_backend(int backend)
+{
+    switch(backend)
+    {
+    case XHOOK_PATCH_BACKEND_MPROTECT:
+        xh_elf_set_patch_backend(XH_ELF_PATCH_MPROTECT);
+        return 0;
+    case XHOOK_PATCH_BACKEND_BATCH:
+        xh_elf_set_patch_backend(XH_ELF_PATCH_BATCH);
+        return 0;
+    case XHOOK_PATCH_BACKEND_PROC_MEM:
+        xh_elf_set_patch_backend(XH_ELF_PATCH_PROC_MEM);
+        return 0;
+    default:
+        return XH_ERRNO_INVAL;
+    }
+}
+
+int xh_core_enable_trace(int flag)
+{
+    return xh_trace_enable(flag);
+}
+
+int xh_core_set_log_sink(int sink)
+{
+    switch(sink)
+    {
+    case XHOOK_LOG_SINK_RING:
+        xh_log_sink = xh_log_sink_ring;
+        return 0;
+    case XHOOK_LOG_SINK_LOGCAT:
+        xh_log_sink = xh_log_sink_logcat;
+        return 0;
+    default:
+        return XH_ERRNO_INVAL;
+    }
+}
+
+void xh_core_dump_log(xhook_log_cb_t cb, void *arg)
+{
+    xh_log_dump(cb, arg);
+}
@@ -24,23 +24,72 @@
 #ifndef XH_CORE_H
 #define XH_CORE_H 1
 
+#include "xhook.h"
+#include "xh_elf.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-int xh_core_register(const char *pathname_regex_str, const char *symbol,
+//ctx == NULL means the default instance
+
+xhook_ctx_t *xh_core_ctx_create();
+
+void xh_core_ctx_destroy(xhook_ctx_t *ctx);
+
+int xh_core_register(xhook_ctx_t *ctx, const char *pathname_regex_str, const char *symbol,
                      void *new_func, void **old_func);
 
-int xh_core_ignore(const char *pathname_regex_str, const char *symbol);
+//a new function made for every matched slot by slot_func
+//slot_func_arg_free (may be NULL) releases slot_func_arg when the rule is removed or fails to register
+int xh_core_register_slots(xhook_ctx_t *ctx, const char *pathname_regex_str, const char *symbol,
+                           xh_elf_slot_func_t slot_func, void *slot_func_arg,
+                           void (*slot_func_arg_free)(void *));
+
+int xh_core_ignore(xhook_ctx_t *ctx, const char *pathname_regex_str, const char *symbol);
 
-int xh_core_refresh(int async);
+int xh_core_register_batch(xhook_ctx_t *ctx, const xhook_rule_t *rules, size_t rules_cnt);
 
-void xh_core_clear();
+int xh_core_refresh(xhook_ctx_t *ctx, int async);
+
+typedef struct
+{
+    uintptr_t   base_addr;
+    const char *pathname;
+} xh_core_lib_t;
+
+//sync refresh of the started instances, only for the given libraries (NULL for all)
+void xh_core_refresh_libs(const xh_core_lib_t *libs, size_t libs_cnt);
+
+int xh_core_refresh_report(xhook_ctx_t *ctx, int flags, void **report, size_t *report_len);
+
+void xh_core_clear(xhook_ctx_t *ctx);
 
 void xh_core_enable_debug(int flag);
 
 void xh_core_enable_sigsegv_protection(int flag);
 
+int xh_core_add_lib_event_callback(xhook_lib_event_cb_t cb, void *arg);
+
+int xh_core_del_lib_event_callback(xhook_lib_event_cb_t cb, void *arg);
+
+int xh_core_verify(size_t *repaired_cnt);
+
+//the import iterator reads the mapped ELF, guarded by SFP like the hook path
+int xh_core_import_iter_init(xh_elf_import_iter_t *iter, uintptr_t base_addr, const char *pathname);
+
+int xh_core_import_iter_next(xh_elf_import_iter_t *iter, xhook_import_t *import);
+
+int xh_core_enable_watchdog(unsigned int interval_ms);
+
+int xh_core_set_patch_backend(int backend);
+
+int xh_core_enable_trace(int flag);
+
+int xh_core_set_log_sink(int sink);
+
+void xh_core_dump_log(xhook_log_cb_t cb, void *arg);
+
 #ifdef __cplusplus
 }
 #endif
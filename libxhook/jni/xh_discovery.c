@@ -0,0 +1,521 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "xh_errno.h"
+#include "xh_log.h"
+#include "xh_core.h"
+#include "xh_discovery.h"
+
+#ifndef PERF_FLAG_FD_CLOEXEC
+#define PERF_FLAG_FD_CLOEXEC (1UL << 3)
+#endif
+#ifndef PERF_COUNT_SW_DUMMY
+#define PERF_COUNT_SW_DUMMY 9
+#endif
+
+#define XH_DISCOVERY_DEBOUNCE_MS  10  //wait for the other mappings of the same dlopen()
+#define XH_DISCOVERY_MAX_DELAY_MS 100 //the longest a library waits, even if the mmap()s go on
+#define XH_DISCOVERY_VERIFY_MS    200 //repair the slots overwritten by the linker's relocation
+#define XH_DISCOVERY_DATA_PAGES   2   //power of 2
+
+//A dummy software perf event with "mmap" records is opened for every thread. The kernel
+//writes a record into the ring buffer for every new executable mapping, the discovery
+//thread wakes up, waits a little for dlopen() to finish, then refreshes only the new
+//libraries: no /proc/self/maps parsing. The linker may still be relocating when we hook,
+//so a verify pass follows to repair the slots.
+//
+//The kernel refuses to mmap an inherited per-thread event, so the threads created later
+//are not covered by themselves: /proc/self/task is rescanned every poll_interval_ms, and
+//a full refresh is done when new threads are found (they may have called dlopen() before
+//we watched them). The rings of the exited threads are closed on POLLHUP.
+//
+//perf_event_open() is restricted on most Android devices (perf_event_paranoid 3) and by
+//some seccomp policies, then we fall back to a full refresh every poll_interval_ms.
+//
+//The refreshes run the lib event callbacks on the discovery thread, which may stop the
+//discovery (xhook_clear(), xhook_enable_discovery()): the thread is detached instead of
+//joined, and it exits without touching the shared state once the callbacks return.
+//Another thread joins it without holding xh_discovery_mutex, so such a callback can still
+//get the mutex: its request is then left to the joiner, which applies it after the join.
+
+typedef struct
+{
+    pid_t                         tid;
+    int                           fd;
+    struct perf_event_mmap_page  *meta;
+    uint8_t                      *data;
+} xh_discovery_ring_t;
+
+typedef struct
+{
+    uintptr_t  addr;
+    char      *pathname;
+} xh_discovery_map_t;
+
+static pthread_mutex_t      xh_discovery_mutex      = PTHREAD_MUTEX_INITIALIZER;
+static int                  xh_discovery_backend    = XHOOK_DISCOVERY_OFF;
+static unsigned int         xh_discovery_poll_ms    = 0;
+static pthread_t            xh_discovery_tid;
+static uintptr_t            xh_discovery_gen        = 0; //bumped by every stop
+static pthread_cond_t       xh_discovery_cond       = PTHREAD_COND_INITIALIZER; //signaled when a join is done
+static int                  xh_discovery_joining    = 0;
+static pthread_t            xh_discovery_joining_tid;
+static unsigned int         xh_discovery_deferred_ms = 0; //asked by a callback during the join
+static int                  xh_discovery_wake[2]    = {-1, -1}; //wakes up poll() to exit
+static xh_discovery_ring_t *xh_discovery_rings      = NULL;
+static size_t               xh_discovery_rings_cnt  = 0;
+static size_t               xh_discovery_rings_cap  = 0;
+static xh_discovery_map_t  *xh_discovery_maps       = NULL; //waiting for the debounce
+static size_t               xh_discovery_maps_cnt   = 0;
+static size_t               xh_discovery_maps_cap   = 0;
+static int                  xh_discovery_lost       = 0;
+static int                  xh_discovery_forked     = 0;
+
+static uint64_t xh_discovery_now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static size_t xh_discovery_ring_size()
+{
+    return (size_t)(1 + XH_DISCOVERY_DATA_PAGES) * (size_t)getpagesize();
+}
+
+static int xh_discovery_ring_open(pid_t tid, xh_discovery_ring_t *ring)
+{
+    struct perf_event_attr attr;
+    void                  *p;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type             = PERF_TYPE_SOFTWARE;
+    attr.size             = sizeof(attr);
+    attr.config           = PERF_COUNT_SW_DUMMY;
+    attr.mmap             = 1; //executable mappings only (no mmap_data)
+    attr.task             = 1; //fork records, to watch the new threads
+    attr.exclude_kernel   = 1;
+    attr.exclude_hv       = 1;
+    attr.watermark        = 1; //wake up for every record, mmap records are not samples
+    attr.wakeup_watermark = 1;
+
+    if((ring->fd = (int)syscall(__NR_perf_event_open, &attr, tid, -1, -1, PERF_FLAG_FD_CLOEXEC)) < 0)
+        return 0 == errno ? XH_ERRNO_UNKNOWN : errno;
+
+    if(MAP_FAILED == (p = mmap(NULL, xh_discovery_ring_size(), PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0)))
+    {
+        int r = (0 == errno ? XH_ERRNO_UNKNOWN : errno);
+        close(ring->fd);
+        return r;
+    }
+    ring->tid = tid;
+    ring->meta = (struct perf_event_mmap_page *)p;
+    ring->data = (uint8_t *)p + getpagesize();
+    return 0;
+}
+
+static void xh_discovery_ring_close(xh_discovery_ring_t *ring)
+{
+    munmap(ring->meta, xh_discovery_ring_size());
+    close(ring->fd);
+}
+
+static void xh_discovery_rings_close()
+{
+    size_t i;
+
+    for(i = 0; i < xh_discovery_rings_cnt; i++)
+        xh_discovery_ring_close(&xh_discovery_rings[i]);
+    free(xh_discovery_rings);
+    xh_discovery_rings = NULL;
+    xh_discovery_rings_cnt = 0;
+    xh_discovery_rings_cap = 0;
+}
+
+//open a ring for every thread not watched yet, return the number of new rings or an error
+static int xh_discovery_rings_scan()
+{
+    DIR                 *dir;
+    struct dirent       *ent;
+    xh_discovery_ring_t  ring;
+    pid_t                tid;
+    void                *p;
+    size_t               i;
+    int                  opened = 0;
+    int                  r = 0;
+
+    if(NULL == (dir = opendir("/proc/self/task"))) return -XH_ERRNO_NOTSUPP;
+    while(NULL != (ent = readdir(dir)))
+    {
+        if('.' == ent->d_name[0]) continue;
+        tid = (pid_t)atoi(ent->d_name);
+        for(i = 0; i < xh_discovery_rings_cnt; i++)
+            if(xh_discovery_rings[i].tid == tid) break;
+        if(i < xh_discovery_rings_cnt) continue;
+
+        if(0 != (r = xh_discovery_ring_open(tid, &ring)))
+        {
+            //denied for all the threads, or the thread has exited
+            if(0 == xh_discovery_rings_cnt && ESRCH != r) break;
+            continue;
+        }
+        if(xh_discovery_rings_cnt == xh_discovery_rings_cap)
+        {
+            size_t cap = (0 == xh_discovery_rings_cap ? 32 : xh_discovery_rings_cap * 2);
+            if(NULL == (p = realloc(xh_discovery_rings, cap * sizeof(xh_discovery_ring_t))))
+            {
+                xh_discovery_ring_close(&ring);
+                break;
+            }
+            xh_discovery_rings = (xh_discovery_ring_t *)p;
+            xh_discovery_rings_cap = cap;
+        }
+        xh_discovery_rings[xh_discovery_rings_cnt++] = ring;
+        opened++;
+    }
+    closedir(dir);
+
+    if(0 == xh_discovery_rings_cnt)
+    {
+        XH_LOG_WARN("perf_event_open failed, ret: %d, fallback to polling", r);
+        return -XH_ERRNO_NOTSUPP;
+    }
+    return opened;
+}
+
+static void xh_discovery_maps_add(uintptr_t addr, const char *pathname)
+{
+    size_t  i;
+    void   *p;
+
+    if('/' != pathname[0]) return; //[vdso], //anon, ...
+
+    for(i = 0; i < xh_discovery_maps_cnt; i++)
+        if(0 == strcmp(xh_discovery_maps[i].pathname, pathname)) return;
+
+    if(xh_discovery_maps_cnt == xh_discovery_maps_cap)
+    {
+        if(NULL == (p = realloc(xh_discovery_maps, (xh_discovery_maps_cap + 16) * sizeof(xh_discovery_map_t))))
+        {
+            xh_discovery_lost = 1;
+            return;
+        }
+        xh_discovery_maps = (xh_discovery_map_t *)p;
+        xh_discovery_maps_cap += 16;
+    }
+    if(NULL == (xh_discovery_maps[xh_discovery_maps_cnt].pathname = strdup(pathname)))
+    {
+        xh_discovery_lost = 1;
+        return;
+    }
+    xh_discovery_maps[xh_discovery_maps_cnt++].addr = addr;
+}
+
+//read the new records, return the number of them
+static size_t xh_discovery_ring_drain(xh_discovery_ring_t *ring)
+{
+    size_t                     data_size = (size_t)XH_DISCOVERY_DATA_PAGES * (size_t)getpagesize();
+    uint64_t                   head = __atomic_load_n(&(ring->meta->data_head), __ATOMIC_ACQUIRE);
+    uint64_t                   tail = ring->meta->data_tail;
+    struct perf_event_header  *hdr;
+    uint8_t                    rec[sizeof(struct perf_event_header) + 32 + 4096 + 8];
+    size_t                     off, len, i;
+    size_t                     cnt = 0;
+
+    while(tail < head)
+    {
+        //copy the record out, it may wrap around the end of the ring
+        off = (size_t)(tail % data_size);
+        for(i = 0; i < sizeof(struct perf_event_header); i++)
+            rec[i] = ring->data[(off + i) % data_size];
+        hdr = (struct perf_event_header *)rec;
+        if(hdr->size < sizeof(struct perf_event_header)) break; //corrupted
+        len = (hdr->size < sizeof(rec) ? hdr->size : sizeof(rec) - 1);
+        for(i = sizeof(struct perf_event_header); i < len; i++)
+            rec[i] = ring->data[(off + i) % data_size];
+        rec[len] = '\0';
+
+        //u32 pid, tid; u64 addr, len, pgoff; char filename[]
+        if(PERF_RECORD_MMAP == hdr->type && len > sizeof(struct perf_event_header) + 32)
+            xh_discovery_maps_add(*(uint64_t *)(rec + sizeof(struct perf_event_header) + 8),
+                                  (const char *)(rec + sizeof(struct perf_event_header) + 32));
+        else if(PERF_RECORD_LOST == hdr->type)
+            xh_discovery_lost = 1;
+        else if(PERF_RECORD_FORK == hdr->type)
+            xh_discovery_forked = 1; //a new thread, watch it now
+
+        tail += hdr->size;
+        cnt++;
+    }
+    __atomic_store_n(&(ring->meta->data_tail), tail, __ATOMIC_RELEASE);
+    return cnt;
+}
+
+//the thread of this generation has been stopped (maybe by a callback on it)
+static int xh_discovery_stopped(uintptr_t gen)
+{
+    return gen != __atomic_load_n(&xh_discovery_gen, __ATOMIC_ACQUIRE);
+}
+
+//hook the new libraries only, or everything if we can't tell which they are
+static void xh_discovery_refresh(uintptr_t gen)
+{
+    xh_core_lib_t *libs = NULL;
+    size_t         libs_cnt = 0, i;
+    Dl_info        info;
+
+    if(!xh_discovery_lost && NULL != (libs = malloc(sizeof(xh_core_lib_t) * (xh_discovery_maps_cnt + 1))))
+    {
+        for(i = 0; i < xh_discovery_maps_cnt; i++)
+        {
+            //not known by the linker yet (or dlopen failed)
+            if(0 == dladdr((void *)xh_discovery_maps[i].addr, &info) || NULL == info.dli_fbase) break;
+            libs[libs_cnt].base_addr = (uintptr_t)info.dli_fbase;
+            libs[libs_cnt].pathname = xh_discovery_maps[i].pathname;
+            libs_cnt++;
+        }
+        if(libs_cnt < xh_discovery_maps_cnt)
+        {
+            free(libs);
+            libs = NULL;
+        }
+    }
+
+    XH_LOG_INFO("discovery: %zu new libraries%s", xh_discovery_maps_cnt, NULL == libs ? ", full refresh" : "");
+    xh_core_refresh_libs(libs, libs_cnt);
+    free(libs);
+
+    //the maps have been freed by the stop
+    if(xh_discovery_stopped(gen)) return;
+
+    for(i = 0; i < xh_discovery_maps_cnt; i++)
+        free(xh_discovery_maps[i].pathname);
+    xh_discovery_maps_cnt = 0;
+    xh_discovery_lost = 0;
+}
+
+static void *xh_discovery_thread_func(void *arg)
+{
+    struct pollfd *fds = NULL;
+    size_t         fds_cap = 0;
+    size_t         i, j, records;
+    uint64_t       now, pending_ms = 0, last_ms = 0, verify_ms = 0;
+    uint64_t       scan_ms = xh_discovery_now_ms() + xh_discovery_poll_ms;
+    uint64_t       deadline;
+    void          *p;
+    int            pending = 0;
+    uintptr_t      gen = (uintptr_t)arg;
+
+    pthread_setname_np(pthread_self(), "xh_discovery");
+
+    while(1)
+    {
+        //polling backend
+        if(XHOOK_DISCOVERY_POLL == xh_discovery_backend)
+        {
+            struct pollfd wake = {xh_discovery_wake[0], POLLIN, 0};
+            if(0 != poll(&wake, 1, (int)xh_discovery_poll_ms)) break;
+            xh_core_refresh_libs(NULL, 0);
+            if(xh_discovery_stopped(gen)) break;
+            continue;
+        }
+
+        //perf backend, the rings change with the threads
+        if(fds_cap < 1 + xh_discovery_rings_cnt)
+        {
+            if(NULL == (p = realloc(fds, (1 + xh_discovery_rings_cnt) * sizeof(struct pollfd)))) break;
+            fds = (struct pollfd *)p;
+            fds_cap = 1 + xh_discovery_rings_cnt;
+        }
+        fds[0].fd = xh_discovery_wake[0];
+        fds[0].events = POLLIN;
+        for(i = 0; i < xh_discovery_rings_cnt; i++)
+        {
+            fds[i + 1].fd = xh_discovery_rings[i].fd;
+            fds[i + 1].events = POLLIN;
+        }
+
+        //the nearest of: debounce, verify, thread scan
+        now = xh_discovery_now_ms();
+        deadline = scan_ms;
+        if(pending && last_ms + XH_DISCOVERY_DEBOUNCE_MS < deadline) deadline = last_ms + XH_DISCOVERY_DEBOUNCE_MS;
+        if(verify_ms > 0 && verify_ms < deadline) deadline = verify_ms;
+
+        if(poll(fds, (nfds_t)(1 + xh_discovery_rings_cnt), (int)(deadline > now ? deadline - now : 0)) < 0 && EINTR != errno) break;
+        if(0 != fds[0].revents) break;
+
+        //read the records, close the rings of the exited threads
+        records = 0;
+        for(i = 0, j = 0; i < xh_discovery_rings_cnt; i++)
+        {
+            //the last records of an exited thread may come with POLLHUP only
+            if(0 != fds[i + 1].revents) records += xh_discovery_ring_drain(&xh_discovery_rings[i]);
+            if(0 != (fds[i + 1].revents & (POLLHUP | POLLERR)))
+                xh_discovery_ring_close(&xh_discovery_rings[i]);
+            else
+                xh_discovery_rings[j++] = xh_discovery_rings[i];
+        }
+        xh_discovery_rings_cnt = j;
+
+        //the new threads may have loaded something before we watched them
+        now = xh_discovery_now_ms();
+        if(now >= scan_ms || xh_discovery_forked)
+        {
+            xh_discovery_forked = 0;
+            if(xh_discovery_rings_scan() > 0)
+            {
+                xh_discovery_lost = 1;
+                records++;
+            }
+            scan_ms = now + xh_discovery_poll_ms;
+        }
+
+        if(records > 0)
+        {
+            if(!pending) pending_ms = now;
+            pending = 1;
+            last_ms = now;
+        }
+
+        //quiet for a while, or waited too long
+        if(pending && (now - last_ms >= XH_DISCOVERY_DEBOUNCE_MS || now - pending_ms >= XH_DISCOVERY_MAX_DELAY_MS))
+        {
+            pending = 0;
+            if(xh_discovery_maps_cnt > 0 || xh_discovery_lost) xh_discovery_refresh(gen);
+            verify_ms = now + XH_DISCOVERY_VERIFY_MS;
+        }
+        else if(verify_ms > 0 && now >= verify_ms)
+        {
+            verify_ms = 0;
+            xh_core_verify(NULL);
+        }
+        if(xh_discovery_stopped(gen)) break;
+    }
+
+    free(fds);
+    return NULL;
+}
+
+//the thread has exited, or it won't touch the shared state any more
+static void xh_discovery_cleanup_locked()
+{
+    size_t i;
+
+    close(xh_discovery_wake[0]);
+    close(xh_discovery_wake[1]);
+    xh_discovery_wake[0] = xh_discovery_wake[1] = -1;
+    xh_discovery_rings_close();
+    for(i = 0; i < xh_discovery_maps_cnt; i++)
+        free(xh_discovery_maps[i].pathname);
+    xh_discovery_maps_cnt = 0;
+    xh_discovery_lost = 0;
+    xh_discovery_forked = 0;
+    xh_discovery_backend = XHOOK_DISCOVERY_OFF;
+}
+
+//returns the poll interval a callback asked for during the join, or 0
+static unsigned int xh_discovery_stop_locked()
+{
+    pthread_t tid = xh_discovery_tid;
+
+    if(XHOOK_DISCOVERY_OFF == xh_discovery_backend) return 0;
+
+    __atomic_store_n(&xh_discovery_gen, xh_discovery_gen + 1, __ATOMIC_RELEASE);
+    if(pthread_equal(pthread_self(), tid))
+    {
+        //called from a callback on the discovery thread, it can't be joined
+        pthread_detach(tid);
+        xh_discovery_cleanup_locked();
+        return 0;
+    }
+
+    if(1 != write(xh_discovery_wake[1], "x", 1))
+        XH_LOG_WARN("wake up discovery thread failed, errno: %d", errno);
+
+    //the callbacks on the discovery thread may need the mutex
+    xh_discovery_joining = 1;
+    xh_discovery_joining_tid = tid;
+    xh_discovery_deferred_ms = 0;
+    pthread_mutex_unlock(&xh_discovery_mutex);
+    pthread_join(tid, NULL);
+    pthread_mutex_lock(&xh_discovery_mutex);
+    xh_discovery_joining = 0;
+    pthread_cond_broadcast(&xh_discovery_cond);
+
+    xh_discovery_cleanup_locked();
+    return xh_discovery_deferred_ms;
+}
+
+int xh_discovery_enable(unsigned int poll_interval_ms, int *backend)
+{
+    unsigned int deferred_ms;
+    int          r = 0;
+
+    pthread_mutex_lock(&xh_discovery_mutex);
+
+    if(xh_discovery_joining)
+    {
+        //a callback on the thread being joined, the joiner can't finish before it returns
+        if(pthread_equal(pthread_self(), xh_discovery_joining_tid))
+        {
+            xh_discovery_deferred_ms = poll_interval_ms;
+            if(NULL != backend) *backend = XHOOK_DISCOVERY_OFF;
+            pthread_mutex_unlock(&xh_discovery_mutex);
+            return 0;
+        }
+        while(xh_discovery_joining) pthread_cond_wait(&xh_discovery_cond, &xh_discovery_mutex);
+    }
+
+    //a restart asked during the join follows our stop, a start of ours overrides it
+    deferred_ms = xh_discovery_stop_locked();
+    if(0 == poll_interval_ms) poll_interval_ms = deferred_ms;
+    if(0 == poll_interval_ms) goto end;
+
+    if(0 != pipe2(xh_discovery_wake, O_CLOEXEC))
+    {
+        r = (0 == errno ? XH_ERRNO_UNKNOWN : errno);
+        goto end;
+    }
+    xh_discovery_poll_ms = poll_interval_ms;
+    xh_discovery_backend = (xh_discovery_rings_scan() >= 0 ? XHOOK_DISCOVERY_PERF : XHOOK_DISCOVERY_POLL);
+
+    if(0 != (r = pthread_create(&xh_discovery_tid, NULL, &xh_discovery_thread_func, (void *)xh_discovery_gen)))
+        xh_discovery_cleanup_locked();
+
+ end:
+    if(NULL != backend) *backend = xh_discovery_backend;
+    pthread_mutex_unlock(&xh_discovery_mutex);
+    return r;
+}
@@ -26,8 +26,10 @@
 #include <inttypes.h>
 #include <elf.h>
 #include <link.h>
+#include <dlfcn.h>
 #include <string.h>
 #include <errno.h>
+#include <stdlib.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -35,6 +37,7 @@
 #include "xh_errno.h"
 #include "xh_log.h"
 #include "xh_util.h"
+#include "xh_trace.h"
 #include "xh_elf.h"
 
 #define XH_ELF_DEBUG 0
@@ -43,6 +46,20 @@
 #define EI_ABIVERSION 8
 #endif
 
+#ifndef DT_ANDROID_REL
+#define DT_ANDROID_REL    (DT_LOOS + 2)
+#define DT_ANDROID_RELSZ  (DT_LOOS + 3)
+#define DT_ANDROID_RELA   (DT_LOOS + 4)
+#define DT_ANDROID_RELASZ (DT_LOOS + 5)
+#endif
+
+//glibc's ld.so relocates the d_ptr values of .dynamic in place, the android linker does not
+#if defined(__ANDROID__)
+#define XH_ELF_DYN_PTR(self, ptr) ((self)->bias_addr + (ptr))
+#else
+#define XH_ELF_DYN_PTR(self, ptr) ((ptr) >= (self)->bias_addr ? (ptr) : (self)->bias_addr + (ptr))
+#endif
+
 #if defined(__arm__)
 #define XH_ELF_R_GENERIC_JUMP_SLOT R_ARM_JUMP_SLOT      //.rel.plt
 #define XH_ELF_R_GENERIC_GLOB_DAT  R_ARM_GLOB_DAT       //.rel.dyn
@@ -69,14 +86,6 @@
 #define XH_ELF_R_TYPE(info) ELF32_R_TYPE(info)
 #endif
 
-//iterator for plain PLT
-typedef struct
-{
-    uint8_t  *cur;
-    uint8_t  *end;
-    int       is_use_rela;
-} xh_elf_plain_reloc_iterator_t;
-
 static void xh_elf_plain_reloc_iterator_init(xh_elf_plain_reloc_iterator_t *self,
                                              ElfW(Addr) rel, ElfW(Word) rel_sz, int is_use_rela)
 {
@@ -94,13 +103,6 @@ static void *xh_elf_plain_reloc_iterator_next(xh_elf_plain_reloc_iterator_t *sel
     return ret;
 }
 
-//sleb128 decoder
-typedef struct
-{
-    uint8_t  *cur;
-    uint8_t  *end;
-} xh_elf_sleb128_decoder_t;
-
 static void xh_elf_sleb128_decoder_init(xh_elf_sleb128_decoder_t *self,
                                         ElfW(Addr) rel, ElfW(Word) rel_sz)
 {
@@ -134,24 +136,6 @@ static int xh_elf_sleb128_decoder_next(xh_elf_sleb128_decoder_t *self, size_t *r
     return 0;
 }
 
-//iterator for sleb128 decoded packed PLT
-typedef struct
-{
-    xh_elf_sleb128_decoder_t decoder;
-    size_t                   relocation_count;
-    size_t                   group_size;
-    size_t                   group_flags;
-    size_t                   group_r_offset_delta;
-    size_t                   relocation_index;
-    size_t                   relocation_group_index;
-    ElfW(Rela)               rela;
-    ElfW(Rel)                rel;
-    ElfW(Addr)               r_offset;
-    size_t                   r_info;
-    ssize_t                  r_addend;
-    int                      is_use_rela;
-} xh_elf_packed_reloc_iterator_t;
-
 const size_t RELOCATION_GROUPED_BY_INFO_FLAG         = 1;
 const size_t RELOCATION_GROUPED_BY_OFFSET_DELTA_FLAG = 2;
 const size_t RELOCATION_GROUPED_BY_ADDEND_FLAG       = 4;
@@ -445,20 +429,110 @@ static int xh_elf_find_symidx_by_name(xh_elf_t *self, const char *symbol, uint32
         return xh_elf_hash_lookup(self, symbol, symidx);
 }
 
-static int xh_elf_replace_function(xh_elf_t *self, const char *symbol, ElfW(Addr) addr, void *new_func, void **old_func)
+static int xh_elf_patch_backend = XH_ELF_PATCH_MPROTECT;
+
+//remember the patched slot for xh_elf_verify(), best effort
+static void xh_elf_slot_record(xh_elf_t *self, const char *symbol, ElfW(Addr) addr, void *new_func)
+{
+    size_t  i;
+    void   *p;
+
+    if(NULL != self->slot_func) return;
+
+    for(i = 0; i < self->slots_cnt; i++)
+        if(self->slots[i].addr == addr) break;
+    if(i == self->slots_cnt)
+    {
+        if(self->slots_cnt == self->slots_cap)
+        {
+            if(NULL == (p = realloc(self->slots, sizeof(xh_elf_slot_t) * (self->slots_cap + 16)))) return;
+            self->slots = (xh_elf_slot_t *)p;
+            self->slots_cap += 16;
+        }
+        self->slots_cnt++;
+    }
+    self->slots[i].addr = addr;
+    self->slots[i].new_func = new_func;
+    self->slots[i].symbol = symbol;
+}
+
+void xh_elf_set_patch_backend(int backend)
+{
+    xh_elf_patch_backend = backend;
+}
+
+static int xh_elf_replace_function(xh_elf_t *self, const char *symbol, ElfW(Addr) addr, void *new_func, void **old_func,
+                                   int dry_run, xh_elf_hook_stat_t *stat)
 {
     void         *old_addr;
     unsigned int  old_prot = 0;
     unsigned int  need_prot = PROT_READ | PROT_WRITE;
+    int           traced;
     int           r;
 
+    //one function per slot, the slots patched by xh_elf_hook_slots() are not recorded for verify
+    if(NULL != self->slot_func && !dry_run)
+    {
+        if(0 != (r = self->slot_func(self->slot_func_arg, self->pathname, symbol, addr, &new_func))) return r;
+        if(NULL == new_func) return 0;
+    }
+
     //already replaced?
     //here we assume that we always have read permission, is this a problem?
-    if(*(void **)addr == new_func) return 0;
+    if(*(void **)addr == new_func)
+    {
+        if(!dry_run) xh_elf_slot_record(self, symbol, addr, new_func);
+        return 0;
+    }
+
+    //only count it when planning
+    if(dry_run)
+    {
+        if(NULL != stat) stat->slots_patched += 1;
+        XH_LOG_INFO("XH_HK_PLAN %p: %p -> %p %s %s\n", (void *)addr, *(void **)addr, new_func, symbol, self->pathname);
+        return 0;
+    }
+
+    //queue it, written by xh_elf_hook_flush()
+    if(XH_ELF_PATCH_BATCH == xh_elf_patch_backend && NULL == self->slot_func)
+    {
+        if(self->patches_cnt == self->patches_cap)
+        {
+            void *p = realloc(self->patches, sizeof(xh_elf_patch_t) * (self->patches_cap + 32));
+            if(NULL == p) return XH_ERRNO_NOMEM;
+            self->patches = (xh_elf_patch_t *)p;
+            self->patches_cap += 32;
+        }
+        self->patches[self->patches_cnt].addr = addr;
+        self->patches[self->patches_cnt].new_func = new_func;
+        self->patches[self->patches_cnt].old_func = old_func;
+        self->patches[self->patches_cnt].symbol = symbol;
+        self->patches_cnt++;
+        return 0;
+    }
+
+    traced = XH_TRACE_BEGIN("xh_patch %s", symbol);
+
+    if(XH_ELF_PATCH_PROC_MEM == xh_elf_patch_backend)
+    {
+        old_addr = *(void **)addr;
+        if(NULL != old_func) *old_func = old_addr;
+        if(0 == (r = xh_util_write_proc_mem(addr, &new_func, sizeof(new_func))))
+        {
+            xh_util_flush_instruction_cache(addr);
+            XH_TRACE_END(traced);
+            xh_elf_slot_record(self, symbol, addr, new_func);
+            if(NULL != stat) stat->slots_patched += 1;
+            XH_LOG_INFO("XH_HK_OK %p: %p -> %p %s %s\n", (void *)addr, old_addr, new_func, symbol, self->pathname);
+            return 0;
+        }
+        XH_LOG_WARN("write /proc/self/mem failed, fallback to mprotect. ret: %d", r);
+    }
 
     //get old prot
     if(0 != (r = xh_util_get_addr_protect(addr, self->pathname, &old_prot)))
     {
+        XH_TRACE_END(traced);
         XH_LOG_ERROR("get addr prot failed. ret: %d", r);
         return r;
     }
@@ -468,6 +542,7 @@ static int xh_elf_replace_function(xh_elf_t *self, const char *symbol, ElfW(Addr
         //set new prot
         if(0 != (r = xh_util_set_addr_protect(addr, need_prot)))
         {
+            XH_TRACE_END(traced);
             XH_LOG_ERROR("set addr prot failed. ret: %d", r);
             return r;
         }
@@ -492,6 +567,11 @@ static int xh_elf_replace_function(xh_elf_t *self, const char *symbol, ElfW(Addr
     //clear cache
     xh_util_flush_instruction_cache(addr);
 
+    XH_TRACE_END(traced);
+
+    xh_elf_slot_record(self, symbol, addr, new_func);
+    if(NULL != stat) stat->slots_patched += 1;
+
     XH_LOG_INFO("XH_HK_OK %p: %p -> %p %s %s\n", (void *)addr, old_addr, new_func, symbol, self->pathname);
     return 0;
 }
@@ -811,13 +891,13 @@ int xh_elf_init(xh_elf_t *self, uintptr_t base_addr, const char *pathname)
             break;
         case DT_STRTAB:
             {
-                self->strtab = (const char *)(self->bias_addr + dyn->d_un.d_ptr);
+                self->strtab = (const char *)XH_ELF_DYN_PTR(self, dyn->d_un.d_ptr);
                 if((ElfW(Addr))(self->strtab) < self->base_addr) return XH_ERRNO_FORMAT;
                 break;
             }
         case DT_SYMTAB:
             {
-                self->symtab = (ElfW(Sym) *)(self->bias_addr + dyn->d_un.d_ptr);
+                self->symtab = (ElfW(Sym) *)XH_ELF_DYN_PTR(self, dyn->d_un.d_ptr);
                 if((ElfW(Addr))(self->symtab) < self->base_addr) return XH_ERRNO_FORMAT;
                 break;
             }
@@ -827,7 +907,7 @@ int xh_elf_init(xh_elf_t *self, uintptr_t base_addr, const char *pathname)
             break;
         case DT_JMPREL:
             {
-                self->relplt = (ElfW(Addr))(self->bias_addr + dyn->d_un.d_ptr);
+                self->relplt = (ElfW(Addr))XH_ELF_DYN_PTR(self, dyn->d_un.d_ptr);
                 if((ElfW(Addr))(self->relplt) < self->base_addr) return XH_ERRNO_FORMAT;
                 break;
             }
@@ -837,7 +917,7 @@ int xh_elf_init(xh_elf_t *self, uintptr_t base_addr, const char *pathname)
         case DT_REL:
         case DT_RELA:
             {
-                self->reldyn = (ElfW(Addr))(self->bias_addr + dyn->d_un.d_ptr);
+                self->reldyn = (ElfW(Addr))XH_ELF_DYN_PTR(self, dyn->d_un.d_ptr);
                 if((ElfW(Addr))(self->reldyn) < self->base_addr) return XH_ERRNO_FORMAT;
                 break;
             }
@@ -848,7 +928,7 @@ int xh_elf_init(xh_elf_t *self, uintptr_t base_addr, const char *pathname)
         case DT_ANDROID_REL:
         case DT_ANDROID_RELA:
             {
-                self->relandroid = (ElfW(Addr))(self->bias_addr + dyn->d_un.d_ptr);
+                self->relandroid = (ElfW(Addr))XH_ELF_DYN_PTR(self, dyn->d_un.d_ptr);
                 if((ElfW(Addr))(self->relandroid) < self->base_addr) return XH_ERRNO_FORMAT;
                 break;
             }
@@ -861,7 +941,7 @@ int xh_elf_init(xh_elf_t *self, uintptr_t base_addr, const char *pathname)
                 //ignore DT_HASH when ELF contains DT_GNU_HASH hash table
                 if(1 == self->is_use_gnu_hash) continue;
 
-                raw = (uint32_t *)(self->bias_addr + dyn->d_un.d_ptr);
+                raw = (uint32_t *)XH_ELF_DYN_PTR(self, dyn->d_un.d_ptr);
                 if((ElfW(Addr))raw < self->base_addr) return XH_ERRNO_FORMAT;
                 self->bucket_cnt  = raw[0];
                 self->chain_cnt   = raw[1];
@@ -871,7 +951,7 @@ int xh_elf_init(xh_elf_t *self, uintptr_t base_addr, const char *pathname)
             }
         case DT_GNU_HASH:
             {
-                raw = (uint32_t *)(self->bias_addr + dyn->d_un.d_ptr);
+                raw = (uint32_t *)XH_ELF_DYN_PTR(self, dyn->d_un.d_ptr);
                 if((ElfW(Addr))raw < self->base_addr) return XH_ERRNO_FORMAT;
                 self->bucket_cnt  = raw[0];
                 self->symoffset   = raw[1];
@@ -929,7 +1009,7 @@ static int xh_elf_find_and_replace_func(xh_elf_t *self, const char *section,
                                         int is_plt, const char *symbol,
                                         void *new_func, void **old_func,
                                         uint32_t symidx, void *rel_common,
-                                        int *found)
+                                        int *found, int dry_run, xh_elf_hook_stat_t *stat)
 {
     ElfW(Rela)    *rela;
     ElfW(Rel)     *rel;
@@ -971,7 +1051,9 @@ static int xh_elf_find_and_replace_func(xh_elf_t *self, const char *section,
     //do replace
     addr = self->bias_addr + r_offset;
     if(addr < self->base_addr) return XH_ERRNO_FORMAT;
-    if(0 != (r = xh_elf_replace_function(self, symbol, addr, new_func, old_func)))
+    //pass the name in .dynstr, which lives as long as the ELF (the slot records keep it)
+    if(0 != (r = xh_elf_replace_function(self, self->strtab + self->symtab[symidx].st_name, addr,
+                                         new_func, old_func, dry_run, stat)))
     {
         XH_LOG_ERROR("replace function failed: %s at %s\n", symbol, section);
         return r;
@@ -980,7 +1062,8 @@ static int xh_elf_find_and_replace_func(xh_elf_t *self, const char *section,
     return 0;
 }
 
-int xh_elf_hook(xh_elf_t *self, const char *symbol, void *new_func, void **old_func)
+int xh_elf_hook(xh_elf_t *self, const char *symbol, void *new_func, void **old_func,
+                int dry_run, xh_elf_hook_stat_t *stat)
 {
     uint32_t                        symidx;
     void                           *rel_common;
@@ -995,12 +1078,17 @@ int xh_elf_hook(xh_elf_t *self, const char *symbol, void *new_func, void **old_f
         return XH_ERRNO_ELFINIT; //not inited?
     }
 
-    if(NULL == symbol || NULL == new_func) return XH_ERRNO_INVAL;
+    if(NULL == symbol || (NULL == new_func && NULL == self->slot_func)) return XH_ERRNO_INVAL;
 
     XH_LOG_INFO("hooking %s in %s\n", symbol, self->pathname);
     
     //find symbol index by symbol name
-    if(0 != (r = xh_elf_find_symidx_by_name(self, symbol, &symidx))) return 0;
+    if(0 != (r = xh_elf_find_symidx_by_name(self, symbol, &symidx)))
+    {
+        if(NULL != stat) stat->symbols_not_found += 1;
+        return 0;
+    }
+    if(NULL != stat) stat->symbols_found += 1;
     
     //replace for .rel(a).plt
     if(0 != self->relplt)
@@ -1011,7 +1099,7 @@ int xh_elf_hook(xh_elf_t *self, const char *symbol, void *new_func, void **old_f
             if(0 != (r = xh_elf_find_and_replace_func(self,
                                                       (self->is_use_rela ? ".rela.plt" : ".rel.plt"), 1,
                                                       symbol, new_func, old_func,
-                                                      symidx, rel_common, &found))) return r;
+                                                      symidx, rel_common, &found, dry_run, stat))) return r;
             if(found) break;
         }
     }
@@ -1025,7 +1113,7 @@ int xh_elf_hook(xh_elf_t *self, const char *symbol, void *new_func, void **old_f
             if(0 != (r = xh_elf_find_and_replace_func(self,
                                                       (self->is_use_rela ? ".rela.dyn" : ".rel.dyn"), 0,
                                                       symbol, new_func, old_func,
-                                                      symidx, rel_common, NULL))) return r;
+                                                      symidx, rel_common, NULL, dry_run, stat))) return r;
         }
     }
 
@@ -1038,9 +1126,283 @@ int xh_elf_hook(xh_elf_t *self, const char *symbol, void *new_func, void **old_f
             if(0 != (r = xh_elf_find_and_replace_func(self,
                                                       (self->is_use_rela ? ".rela.android" : ".rel.android"), 0,
                                                       symbol, new_func, old_func,
-                                                      symidx, rel_common, NULL))) return r;
+                                                      symidx, rel_common, NULL, dry_run, stat))) return r;
         }
     }
     
     return 0;
 }
+
+int xh_elf_hook_slots(xh_elf_t *self, const char *symbol, xh_elf_slot_func_t slot_func, void *arg,
+                      int dry_run, xh_elf_hook_stat_t *stat)
+{
+    int r;
+
+    if(NULL == slot_func) return XH_ERRNO_INVAL;
+
+    self->slot_func = slot_func;
+    self->slot_func_arg = arg;
+    r = xh_elf_hook(self, symbol, NULL, NULL, dry_run, stat);
+    self->slot_func = NULL;
+    self->slot_func_arg = NULL;
+    return r;
+}
+
+//write the queued slots, one mprotect pair per page instead of per slot
+int xh_elf_hook_flush(xh_elf_t *self, xh_elf_hook_stat_t *stat)
+{
+    xh_elf_patch_t *patches = self->patches;
+    xh_elf_patch_t  tmp;
+    uintptr_t       page_size = (uintptr_t)getpagesize();
+    uintptr_t       page;
+    size_t          i, j, k;
+    unsigned int    old_prot;
+    unsigned int    need_prot = PROT_READ | PROT_WRITE;
+    void           *old_addr;
+    int             traced;
+    int             r, ret = 0;
+
+    if(0 == self->patches_cnt) goto end;
+
+    traced = XH_TRACE_BEGIN("xh_patch_batch %zu", self->patches_cnt);
+    
+    //stable sort by page, keep the order of writes to the same slot
+    for(i = 1; i < self->patches_cnt; i++)
+    {
+        tmp = patches[i];
+        for(j = i; j > 0 && patches[j - 1].addr / page_size > tmp.addr / page_size; j--)
+            patches[j] = patches[j - 1];
+        patches[j] = tmp;
+    }
+
+    for(i = 0; i < self->patches_cnt; i = k)
+    {
+        page = patches[i].addr / page_size;
+        for(k = i + 1; k < self->patches_cnt && patches[k].addr / page_size == page; k++);
+
+        //get old prot
+        if(0 != (r = xh_util_get_addr_protect(patches[i].addr, self->pathname, &old_prot)))
+        {
+            XH_LOG_ERROR("get addr prot failed. ret: %d", r);
+            if(0 == ret) ret = r;
+            continue;
+        }
+
+        if(old_prot != need_prot)
+        {
+            //set new prot
+            if(0 != (r = xh_util_set_addr_protect(patches[i].addr, need_prot)))
+            {
+                XH_LOG_ERROR("set addr prot failed. ret: %d", r);
+                if(0 == ret) ret = r;
+                continue;
+            }
+        }
+
+        for(j = i; j < k; j++)
+        {
+            //save old func
+            old_addr = *(void **)patches[j].addr;
+            if(NULL != patches[j].old_func) *(patches[j].old_func) = old_addr;
+
+            //replace func
+            *(void **)patches[j].addr = patches[j].new_func;
+
+            xh_elf_slot_record(self, patches[j].symbol, patches[j].addr, patches[j].new_func);
+            if(NULL != stat) stat->slots_patched += 1;
+            XH_LOG_INFO("XH_HK_OK %p: %p -> %p %s %s\n", (void *)patches[j].addr, old_addr, patches[j].new_func,
+                        patches[j].symbol, self->pathname);
+        }
+        
+        if(old_prot != need_prot)
+        {
+            //restore the old prot
+            if(0 != (r = xh_util_set_addr_protect(patches[i].addr, old_prot)))
+            {
+                XH_LOG_WARN("restore addr prot failed. ret: %d", r);
+            }
+        }
+
+        //clear cache
+        xh_util_flush_instruction_cache(patches[i].addr);
+    }
+
+    XH_TRACE_END(traced);
+
+ end:
+    xh_elf_hook_discard(self);
+    return ret;
+}
+
+void xh_elf_hook_discard(xh_elf_t *self)
+{
+    self->slot_func = NULL; //may be interrupted by SIGSEGV
+    self->slot_func_arg = NULL;
+
+    if(NULL != self->patches) free(self->patches);
+    self->patches = NULL;
+    self->patches_cnt = 0;
+    self->patches_cap = 0;
+}
+
+//is the ELF still loaded at the same base? (it may be dlclosed since the last refresh)
+static int xh_elf_is_loaded(xh_elf_t *self, ElfW(Addr) addr)
+{
+    Dl_info     info;
+    const char *a, *b;
+
+    if(0 == dladdr((void *)addr, &info)) return 0;
+    if((ElfW(Addr))info.dli_fbase != self->base_addr) return 0;
+    if(NULL == info.dli_fname || '\0' == info.dli_fname[0]) return 1; //the main executable in glibc
+
+    //compare the basename only, the linker and maps may show different paths
+    a = strrchr(info.dli_fname, '/');
+    b = strrchr(self->pathname, '/');
+    return 0 == strcmp(NULL == a ? info.dli_fname : a + 1, NULL == b ? self->pathname : b + 1);
+}
+
+//re-patch the recorded slots which have been overwritten by others
+//only read the slots, no maps parsing and no ELF walking, old_func is not touched
+int xh_elf_verify(xh_elf_t *self, size_t *repaired_cnt)
+{
+    xh_elf_hook_stat_t  stat;
+    xh_elf_slot_t      *slot;
+    size_t              i;
+    int                 r, ret = 0;
+
+    memset(&stat, 0, sizeof(stat));
+    for(i = 0; i < self->slots_cnt; i++)
+    {
+        slot = &(self->slots[i]);
+        if(*(void **)(slot->addr) == slot->new_func) continue;
+
+        if(!xh_elf_is_loaded(self, slot->addr))
+        {
+            XH_LOG_WARN("skip verifying unloaded ELF: %s", self->pathname);
+            return XH_ERRNO_NOTFND;
+        }
+
+        XH_LOG_WARN("XH_HK_DRIFT %p: %p != %p %s %s\n", (void *)slot->addr, *(void **)(slot->addr),
+                    slot->new_func, slot->symbol, self->pathname);
+        if(0 != (r = xh_elf_replace_function(self, slot->symbol, slot->addr, slot->new_func, NULL, 0, &stat)))
+            if(0 == ret) ret = r;
+    }
+    if(0 != (r = xh_elf_hook_flush(self, &stat)))
+        if(0 == ret) ret = r;
+
+    if(NULL != repaired_cnt) *repaired_cnt += stat.slots_patched;
+    return ret;
+}
+
+void xh_elf_fini(xh_elf_t *self)
+{
+    xh_elf_hook_discard(self);
+    if(NULL != self->slots) free(self->slots);
+    self->slots = NULL;
+    self->slots_cnt = 0;
+    self->slots_cap = 0;
+}
+
+void xh_elf_get_reloc_cnt(xh_elf_t *self, size_t *plt_cnt, size_t *dyn_cnt, size_t *android_cnt)
+{
+    size_t                         entsize = (self->is_use_rela ? sizeof(ElfW(Rela)) : sizeof(ElfW(Rel)));
+    xh_elf_packed_reloc_iterator_t packed_iter;
+
+    *plt_cnt = self->relplt_sz / entsize;
+    *dyn_cnt = self->reldyn_sz / entsize;
+    *android_cnt = 0;
+    if(0 != self->relandroid &&
+       0 == xh_elf_packed_reloc_iterator_init(&packed_iter, self->relandroid, self->relandroid_sz, self->is_use_rela))
+        *android_cnt = packed_iter.relocation_count;
+}
+
+int xh_elf_import_iter_init(xh_elf_import_iter_t *self, uintptr_t base_addr, const char *pathname)
+{
+    int r;
+
+    if(NULL == self || 0 == base_addr || NULL == pathname) return XH_ERRNO_INVAL;
+
+    if(0 != (r = xh_elf_check_elfheader(base_addr))) return r;
+    if(0 != (r = xh_elf_init(&(self->elf), base_addr, pathname))) return r;
+
+    self->section = XHOOK_IMPORT_SECTION_PLT;
+    self->section_inited = 0;
+    return 0;
+}
+
+//return 1 if an import is found, 0 when finished
+int xh_elf_import_iter_next(xh_elf_import_iter_t *self, xhook_import_t *import)
+{
+    xh_elf_t   *elf = &(self->elf);
+    void       *rel_common;
+    ElfW(Addr)  r_offset;
+    size_t      r_info;
+    size_t      r_sym;
+    size_t      r_type;
+    ElfW(Addr)  addr;
+
+    while(1)
+    {
+        if(!self->section_inited)
+        {
+            switch(self->section)
+            {
+            case XHOOK_IMPORT_SECTION_PLT:
+                if(0 == elf->relplt) goto next_section;
+                xh_elf_plain_reloc_iterator_init(&(self->plain_iter), elf->relplt, elf->relplt_sz, elf->is_use_rela);
+                break;
+            case XHOOK_IMPORT_SECTION_DYN:
+                if(0 == elf->reldyn) goto next_section;
+                xh_elf_plain_reloc_iterator_init(&(self->plain_iter), elf->reldyn, elf->reldyn_sz, elf->is_use_rela);
+                break;
+            case XHOOK_IMPORT_SECTION_ANDROID:
+                if(0 == elf->relandroid) goto next_section;
+                if(0 != xh_elf_packed_reloc_iterator_init(&(self->packed_iter), elf->relandroid,
+                                                          elf->relandroid_sz, elf->is_use_rela)) goto next_section;
+                break;
+            default:
+                return 0; //finished
+            }
+            self->section_inited = 1;
+        }
+
+        if(XHOOK_IMPORT_SECTION_ANDROID == self->section)
+            rel_common = xh_elf_packed_reloc_iterator_next(&(self->packed_iter));
+        else
+            rel_common = xh_elf_plain_reloc_iterator_next(&(self->plain_iter));
+        if(NULL == rel_common) goto next_section;
+
+        if(elf->is_use_rela)
+        {
+            r_info = ((ElfW(Rela) *)rel_common)->r_info;
+            r_offset = ((ElfW(Rela) *)rel_common)->r_offset;
+        }
+        else
+        {
+            r_info = ((ElfW(Rel) *)rel_common)->r_info;
+            r_offset = ((ElfW(Rel) *)rel_common)->r_offset;
+        }
+
+        //same filter as xh_elf_find_and_replace_func()
+        r_sym = XH_ELF_R_SYM(r_info);
+        if(0 == r_sym) continue;
+        r_type = XH_ELF_R_TYPE(r_info);
+        if(XHOOK_IMPORT_SECTION_PLT == self->section && r_type != XH_ELF_R_GENERIC_JUMP_SLOT) continue;
+        if(XHOOK_IMPORT_SECTION_PLT != self->section &&
+           r_type != XH_ELF_R_GENERIC_GLOB_DAT && r_type != XH_ELF_R_GENERIC_ABS) continue;
+        addr = elf->bias_addr + r_offset;
+        if(addr < elf->base_addr) continue;
+
+        import->symbol     = elf->strtab + elf->symtab[r_sym].st_name;
+        import->symidx     = (uint32_t)r_sym;
+        import->reloc_type = (uint32_t)r_type;
+        import->section    = self->section;
+        import->slot       = (void **)addr;
+        import->target     = *(void **)addr;
+        return 1;
+
+    next_section:
+        self->section++;
+        self->section_inited = 0;
+    }
+}
@@ -27,11 +27,68 @@
 #include <stdint.h>
 #include <elf.h>
 #include <link.h>
+#include <sys/types.h>
+#include "xhook.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+//iterator for plain PLT
+typedef struct
+{
+    uint8_t  *cur;
+    uint8_t  *end;
+    int       is_use_rela;
+} xh_elf_plain_reloc_iterator_t;
+
+//sleb128 decoder
+typedef struct
+{
+    uint8_t  *cur;
+    uint8_t  *end;
+} xh_elf_sleb128_decoder_t;
+
+//iterator for sleb128 decoded packed PLT
+typedef struct
+{
+    xh_elf_sleb128_decoder_t decoder;
+    size_t                   relocation_count;
+    size_t                   group_size;
+    size_t                   group_flags;
+    size_t                   group_r_offset_delta;
+    size_t                   relocation_index;
+    size_t                   relocation_group_index;
+    ElfW(Rela)               rela;
+    ElfW(Rel)                rel;
+    ElfW(Addr)               r_offset;
+    size_t                   r_info;
+    ssize_t                  r_addend;
+    int                      is_use_rela;
+} xh_elf_packed_reloc_iterator_t;
+
+//pending slot write, for the batched patch backend
+typedef struct
+{
+    ElfW(Addr)   addr;
+    void        *new_func;
+    void       **old_func;
+    const char  *symbol;
+} xh_elf_patch_t;
+
+//patched slot, for xh_elf_verify()
+typedef struct
+{
+    ElfW(Addr)   addr;
+    void        *new_func;
+    const char  *symbol;
+} xh_elf_slot_t;
+
+//makes the function written to one slot, for the rules which need a different one per slot
+//*new_func == NULL to skip the slot
+typedef int (*xh_elf_slot_func_t)(void *arg, const char *pathname, const char *symbol,
+                                  ElfW(Addr) addr, void **new_func);
+
 typedef struct
 {
     const char *pathname;
@@ -71,13 +128,57 @@ typedef struct
     
     int         is_use_rela;
     int         is_use_gnu_hash;
+
+    xh_elf_patch_t *patches;
+    size_t          patches_cnt;
+    size_t          patches_cap;
+
+    xh_elf_slot_t  *slots;
+    size_t          slots_cnt;
+    size_t          slots_cap;
+
+    xh_elf_slot_func_t slot_func; //only during xh_elf_hook_slots()
+    void              *slot_func_arg;
 } xh_elf_t;
 
+#define XH_ELF_PATCH_MPROTECT 0 //mprotect around every slot
+#define XH_ELF_PATCH_BATCH    1 //queue the slots, mprotect once per page in xh_elf_hook_flush()
+#define XH_ELF_PATCH_PROC_MEM 2 //write through /proc/self/mem, fallback to mprotect
+
+typedef struct
+{
+    size_t symbols_found;
+    size_t symbols_not_found;
+    size_t slots_patched; //or to be patched, in dry run
+} xh_elf_hook_stat_t;
+
 int xh_elf_init(xh_elf_t *self, uintptr_t base_addr, const char *pathname);
-int xh_elf_hook(xh_elf_t *self, const char *symbol, void *new_func, void **old_func);
+int xh_elf_hook(xh_elf_t *self, const char *symbol, void *new_func, void **old_func,
+                int dry_run, xh_elf_hook_stat_t *stat);
+int xh_elf_hook_slots(xh_elf_t *self, const char *symbol, xh_elf_slot_func_t slot_func, void *arg,
+                      int dry_run, xh_elf_hook_stat_t *stat);
+int xh_elf_hook_flush(xh_elf_t *self, xh_elf_hook_stat_t *stat);
+void xh_elf_hook_discard(xh_elf_t *self);
+void xh_elf_set_patch_backend(int backend);
+int xh_elf_verify(xh_elf_t *self, size_t *repaired_cnt);
+void xh_elf_fini(xh_elf_t *self);
+void xh_elf_get_reloc_cnt(xh_elf_t *self, size_t *plt_cnt, size_t *dyn_cnt, size_t *android_cnt);
 
 int xh_elf_check_elfheader(uintptr_t base_addr);
 
+//zero-copy iterator over the imports (PLT and GOT slots) of a loaded ELF
+typedef struct
+{
+    xh_elf_t                        elf;
+    int                             section; //XHOOK_IMPORT_SECTION_*
+    int                             section_inited;
+    xh_elf_plain_reloc_iterator_t   plain_iter;
+    xh_elf_packed_reloc_iterator_t  packed_iter;
+} xh_elf_import_iter_t;
+
+int xh_elf_import_iter_init(xh_elf_import_iter_t *self, uintptr_t base_addr, const char *pathname);
+int xh_elf_import_iter_next(xh_elf_import_iter_t *self, xhook_import_t *import);
+
 #ifdef __cplusplus
 }
 #endif
@@ -33,5 +33,6 @@
 #define XH_ERRNO_FORMAT  1007
 #define XH_ERRNO_ELFINIT 1008
 #define XH_ERRNO_SEGVERR 1009
+#define XH_ERRNO_NOTSUPP 1010
 
 #endif
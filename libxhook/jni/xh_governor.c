@@ -0,0 +1,463 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "xh_errno.h"
+#include "xh_log.h"
+#include "xh_util.h"
+#include "xh_stub.h"
+#include "xh_governor.h"
+
+#define XH_GOVERNOR_GRACE_NS (1000 * 1000 * 1000ULL) //a released governor is freed after this
+
+//Every slot of a governed rule points to its own count jump stub: one increment of the
+//slot's counter, then an indirect jump to the stub's target. The increment is atomic, so
+//concurrent calls through the same slot are all counted. Each slot has its own cache line,
+//the counters of different slots don't bounce between cores. The target follows the
+//mode of the governor: the wrapper (full), the original function (pass-through), or a
+//dispatch stub which picks one of them for every call (sampled). Switching the mode
+//rewrites the targets in the stubs, the GOT slots are never rewritten. So the calls made
+//under the budget cost one increment and one indirect jump, the register-saving dispatch
+//thunk is only used while sampling.
+//
+//When the rule is removed (xhook_clear()), the targets are set to the original functions
+//and the slots still holding our stubs are restored. A slot which can't be restored (another
+//hook was layered on top of it, with our stub as its old_func) keeps its stub forever, the
+//stub just jumps to the original function. The other stubs and the governor are freed after
+//XH_GOVERNOR_GRACE_NS, for the threads still running in them.
+
+typedef struct xh_governor xh_governor_t;
+
+typedef struct
+{
+    uint64_t       calls; //first, the count jump stub increments it atomically
+    xh_governor_t *gov;
+    uintptr_t      addr;  //the GOT slot
+    char          *pathname;
+    void          *orig;
+    void          *stub;     //count jump, written to the slot
+    void          *dispatch; //target of the stub in sampled mode
+    int            kept;     //still reachable after the release
+} __attribute__((aligned(64))) xh_governor_slot_t;
+
+struct xh_governor
+{
+    char                *symbol;
+    void                *new_func;
+    void               **old_func;
+    xhook_governor_t     config;
+    uint64_t             budget; //calls per second
+    int                  mode;
+    uint32_t             sample_n;
+    uint64_t             last_calls;
+    uint64_t             last_ns;
+    uint64_t             calls_per_sec;
+    uint64_t             switches;
+    xh_governor_slot_t **slots;
+    size_t               slots_cnt;
+    size_t               slots_cap;
+    int                  released;
+    uint64_t             released_ns;
+};
+
+typedef struct
+{
+    xh_governor_t **govs;
+    size_t          cnt;
+    size_t          cap;
+} xh_governor_list_t;
+
+static pthread_mutex_t    xh_governor_mutex   = PTHREAD_MUTEX_INITIALIZER;
+static xh_governor_list_t xh_governor_govs    = {NULL, 0, 0}; //ticking
+static xh_governor_list_t xh_governor_retired = {NULL, 0, 0}; //released, with stubs which may still run
+
+static uint64_t xh_governor_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int xh_governor_list_add(xh_governor_list_t *list, xh_governor_t *gov)
+{
+    xh_governor_t **new_govs;
+    size_t          cap;
+
+    if(list->cnt == list->cap)
+    {
+        cap = (0 == list->cap ? 8 : list->cap * 2);
+        if(NULL == (new_govs = realloc(list->govs, cap * sizeof(xh_governor_t *)))) return XH_ERRNO_NOMEM;
+        list->govs = new_govs;
+        list->cap = cap;
+    }
+    list->govs[list->cnt++] = gov;
+    return 0;
+}
+
+static void xh_governor_list_del(xh_governor_list_t *list, size_t i)
+{
+    memmove(&list->govs[i], &list->govs[i + 1], (list->cnt - i - 1) * sizeof(xh_governor_t *));
+    list->cnt--;
+}
+
+//the slot is still used by the sampled mode
+static void *xh_governor_dispatch(void *arg, void *ret_addr)
+{
+    xh_governor_slot_t *slot = (xh_governor_slot_t *)arg;
+    xh_governor_t      *gov = slot->gov;
+    uint64_t            c;
+
+    (void)ret_addr;
+
+    //counted by the count jump stub already
+    c = __atomic_load_n(&(slot->calls), __ATOMIC_RELAXED);
+
+    switch(__atomic_load_n(&(gov->mode), __ATOMIC_RELAXED))
+    {
+    case XHOOK_GOVERNOR_MODE_FULL:
+        return gov->new_func;
+    case XHOOK_GOVERNOR_MODE_SAMPLED:
+        return 0 == c % __atomic_load_n(&(gov->sample_n), __ATOMIC_RELAXED) ? gov->new_func : slot->orig;
+    default:
+        return slot->orig;
+    }
+}
+
+static void *xh_governor_target(xh_governor_slot_t *slot, int mode)
+{
+    switch(mode)
+    {
+    case XHOOK_GOVERNOR_MODE_FULL:
+        return slot->gov->new_func;
+    case XHOOK_GOVERNOR_MODE_SAMPLED:
+        return slot->dispatch;
+    default:
+        return slot->orig;
+    }
+}
+
+static void xh_governor_slot_free(xh_governor_slot_t *slot)
+{
+    xh_stub_free(slot->stub);
+    xh_stub_free(slot->dispatch);
+    free(slot->pathname);
+    free(slot);
+}
+
+static void xh_governor_free(xh_governor_t *gov)
+{
+    size_t i;
+
+    for(i = 0; i < gov->slots_cnt; i++)
+        xh_governor_slot_free(gov->slots[i]);
+    free(gov->slots);
+    free(gov->symbol);
+    free(gov);
+}
+
+//free the released governors whose stubs can't be reached any more
+static void xh_governor_reap_locked(uint64_t now)
+{
+    xh_governor_t *gov;
+    size_t         i, j;
+    int            kept;
+
+    for(i = 0; i < xh_governor_retired.cnt;)
+    {
+        gov = xh_governor_retired.govs[i];
+        if(now - gov->released_ns < XH_GOVERNOR_GRACE_NS)
+        {
+            i++;
+            continue;
+        }
+
+        for(kept = 0, j = 0; j < gov->slots_cnt; j++)
+            if(gov->slots[j]->kept) kept = 1;
+        if(kept)
+        {
+            //the layered hooks still jump to some of the stubs, free the others
+            for(j = 0; j < gov->slots_cnt;)
+            {
+                if(gov->slots[j]->kept)
+                {
+                    j++;
+                    continue;
+                }
+                xh_governor_slot_free(gov->slots[j]);
+                gov->slots[j] = gov->slots[--gov->slots_cnt];
+            }
+            i++;
+            continue;
+        }
+
+        xh_governor_list_del(&xh_governor_retired, i);
+        xh_governor_free(gov);
+    }
+}
+
+//the governor slot whose stub is fn, in all governors (released ones included)
+static xh_governor_slot_t *xh_governor_find_slot_locked(void *fn)
+{
+    xh_governor_list_t *lists[2] = {&xh_governor_govs, &xh_governor_retired};
+    xh_governor_t      *gov;
+    size_t              i, j, k;
+
+    for(k = 0; k < 2; k++)
+    {
+        for(i = 0; i < lists[k]->cnt; i++)
+        {
+            gov = lists[k]->govs[i];
+            for(j = 0; j < gov->slots_cnt; j++)
+                if(gov->slots[j]->stub == fn) return gov->slots[j];
+        }
+    }
+    return NULL;
+}
+
+int xh_governor_create(const char *symbol, void *new_func, void **old_func,
+                       const xhook_governor_t *config, void **governor)
+{
+    xh_governor_t *gov;
+    uint64_t       budget = 0;
+    int            r;
+
+    if(NULL == symbol || NULL == new_func || NULL == config || NULL == governor) return XH_ERRNO_INVAL;
+    if(XHOOK_GOVERNOR_POLICY_SAMPLE != config->policy && XHOOK_GOVERNOR_POLICY_PASSTHROUGH != config->policy)
+        return XH_ERRNO_INVAL;
+
+    //the tighter of the two budgets
+    if(config->max_ns_per_sec > 0)
+    {
+        if(0 == config->ns_per_call) return XH_ERRNO_INVAL;
+        budget = config->max_ns_per_sec / config->ns_per_call;
+    }
+    if(config->max_calls_per_sec > 0 && (0 == budget || config->max_calls_per_sec < budget))
+        budget = config->max_calls_per_sec;
+    if(0 == budget) return XH_ERRNO_INVAL;
+
+    if(NULL == (gov = calloc(1, sizeof(xh_governor_t)))) return XH_ERRNO_NOMEM;
+    if(NULL == (gov->symbol = strdup(symbol)))
+    {
+        free(gov);
+        return XH_ERRNO_NOMEM;
+    }
+    gov->new_func = new_func;
+    gov->old_func = old_func;
+    gov->config = *config;
+    gov->budget = budget;
+    gov->mode = XHOOK_GOVERNOR_MODE_FULL;
+    gov->sample_n = 1;
+
+    pthread_mutex_lock(&xh_governor_mutex);
+    xh_governor_reap_locked(xh_governor_now_ns());
+    gov->last_ns = xh_governor_now_ns();
+    r = xh_governor_list_add(&xh_governor_govs, gov);
+    pthread_mutex_unlock(&xh_governor_mutex);
+    if(0 != r)
+    {
+        free(gov->symbol);
+        free(gov);
+        return r;
+    }
+
+    *governor = gov;
+    return 0;
+}
+
+void xh_governor_release(void *governor)
+{
+    xh_governor_t      *gov = (xh_governor_t *)governor;
+    xh_governor_slot_t *slot;
+    uint64_t            now = xh_governor_now_ns();
+    size_t              i;
+    int                 r;
+
+    pthread_mutex_lock(&xh_governor_mutex);
+
+    for(i = 0; i < xh_governor_govs.cnt; i++)
+    {
+        if(xh_governor_govs.govs[i] == gov)
+        {
+            xh_governor_list_del(&xh_governor_govs, i);
+            break;
+        }
+    }
+    gov->released = 1;
+    gov->released_ns = now;
+
+    for(i = 0; i < gov->slots_cnt; i++)
+    {
+        slot = gov->slots[i];
+
+        //the threads which loaded the slot already go straight to the original function
+        xh_stub_set_target(slot->stub, slot->orig);
+
+        r = xh_util_replace_slot(slot->addr, slot->pathname, slot->stub, slot->orig);
+        if(0 != r && XH_ERRNO_NOTFND != r)
+        {
+            XH_LOG_WARN("governor: keep the stub of %s in %s, ret: %d", gov->symbol, slot->pathname, r);
+            slot->kept = 1;
+        }
+    }
+
+    //never hooked: free it now
+    //no memory to retire it: leak it, the stubs may still run
+    if(0 == gov->slots_cnt)
+        xh_governor_free(gov);
+    else
+        (void)xh_governor_list_add(&xh_governor_retired, gov);
+    xh_governor_reap_locked(now);
+
+    pthread_mutex_unlock(&xh_governor_mutex);
+}
+
+int xh_governor_make(void *arg, const char *pathname, const char *symbol, ElfW(Addr) addr, void **new_func)
+{
+    xh_governor_t      *gov = (xh_governor_t *)arg;
+    xh_governor_slot_t *slot, *prev, **new_slots;
+    void               *orig = *(void **)addr;
+    size_t              cap;
+    int                 r = XH_ERRNO_NOMEM;
+
+    (void)symbol;
+
+    *new_func = NULL;
+
+    pthread_mutex_lock(&xh_governor_mutex);
+
+    //the slot holds a stub of this governor (re-hooked), or of a released one: chain to its
+    //original function, the stub would call the wrapper, which would call the stub again
+    if(NULL != (prev = xh_governor_find_slot_locked(orig)) && (prev->gov == gov || prev->gov->released))
+        orig = prev->orig;
+
+    if(gov->slots_cnt == gov->slots_cap)
+    {
+        cap = (0 == gov->slots_cap ? 8 : gov->slots_cap * 2);
+        if(NULL == (new_slots = realloc(gov->slots, cap * sizeof(xh_governor_slot_t *)))) goto end;
+        gov->slots = new_slots;
+        gov->slots_cap = cap;
+    }
+
+    if(0 != posix_memalign((void **)&slot, 64, sizeof(xh_governor_slot_t))) goto end;
+    memset(slot, 0, sizeof(xh_governor_slot_t));
+    slot->gov = gov;
+    slot->addr = (uintptr_t)addr;
+    slot->orig = orig;
+    if(NULL == (slot->pathname = strdup(pathname))) goto err;
+    if(0 != (r = xh_stub_make_dispatch(xh_governor_dispatch, slot, &slot->dispatch))) goto err;
+    if(0 != (r = xh_stub_make_count_jump(xh_governor_target(slot, gov->mode), &slot->calls, &slot->stub))) goto err;
+    gov->slots[gov->slots_cnt++] = slot;
+
+    //like xhook_register(), the original function of the last hooked slot
+    if(NULL != gov->old_func) *(gov->old_func) = orig;
+    *new_func = slot->stub;
+    r = 0;
+    goto end;
+
+ err:
+    xh_governor_slot_free(slot);
+ end:
+    pthread_mutex_unlock(&xh_governor_mutex);
+    return r;
+}
+
+int xh_governor_active()
+{
+    return __atomic_load_n(&xh_governor_govs.cnt, __ATOMIC_RELAXED) > 0;
+}
+
+void xh_governor_tick()
+{
+    xh_governor_t *gov;
+    uint64_t       now = xh_governor_now_ns();
+    uint64_t       calls, rate, n;
+    size_t         i, j;
+    int            mode;
+
+    pthread_mutex_lock(&xh_governor_mutex);
+    for(i = 0; i < xh_governor_govs.cnt; i++)
+    {
+        gov = xh_governor_govs.govs[i];
+        if(now <= gov->last_ns) continue;
+
+        calls = 0;
+        for(j = 0; j < gov->slots_cnt; j++)
+            calls += __atomic_load_n(&(gov->slots[j]->calls), __ATOMIC_RELAXED);
+        rate = (calls - gov->last_calls) * 1000000000ULL / (now - gov->last_ns);
+        gov->last_calls = calls;
+        gov->last_ns = now;
+        gov->calls_per_sec = rate;
+
+        //over budget: throttle, below half of it: back to full (hysteresis)
+        mode = gov->mode;
+        if(rate > gov->budget)
+        {
+            if(XHOOK_GOVERNOR_POLICY_SAMPLE == gov->config.policy)
+            {
+                mode = XHOOK_GOVERNOR_MODE_SAMPLED;
+                n = (rate + gov->budget - 1) / gov->budget;
+                __atomic_store_n(&(gov->sample_n), (uint32_t)(n > UINT32_MAX ? UINT32_MAX : n), __ATOMIC_RELAXED);
+            }
+            else
+                mode = XHOOK_GOVERNOR_MODE_PASSTHROUGH;
+        }
+        else if(rate * 2 < gov->budget)
+        {
+            mode = XHOOK_GOVERNOR_MODE_FULL;
+        }
+
+        if(mode != gov->mode)
+        {
+            XH_LOG_INFO("governor: %s mode %d -> %d, %llu calls/s, sample 1/%u", gov->symbol, gov->mode, mode,
+                        (unsigned long long)rate, gov->sample_n);
+            __atomic_store_n(&(gov->mode), mode, __ATOMIC_RELAXED);
+            for(j = 0; j < gov->slots_cnt; j++)
+                xh_stub_set_target(gov->slots[j]->stub, xh_governor_target(gov->slots[j], mode));
+            gov->switches++;
+        }
+    }
+    xh_governor_reap_locked(now);
+    pthread_mutex_unlock(&xh_governor_mutex);
+}
+
+size_t xh_governor_get_states(xhook_governor_state_t *states, size_t states_cnt)
+{
+    xh_governor_t *gov;
+    size_t         i, cnt;
+
+    pthread_mutex_lock(&xh_governor_mutex);
+    cnt = xh_governor_govs.cnt;
+    for(i = 0; i < cnt && i < states_cnt; i++)
+    {
+        gov = xh_governor_govs.govs[i];
+        states[i].symbol        = gov->symbol;
+        states[i].mode          = gov->mode;
+        states[i].sample_n      = gov->sample_n;
+        states[i].calls_per_sec = gov->calls_per_sec;
+        states[i].switches      = gov->switches;
+    }
+    pthread_mutex_unlock(&xh_governor_mutex);
+    return cnt;
+}
@@ -0,0 +1,58 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#ifndef XH_GOVERNOR_H
+#define XH_GOVERNOR_H 1
+
+#include <stdint.h>
+#include "xhook.h"
+#include "xh_elf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define XH_GOVERNOR_TICK_MS 100
+
+//the slot_func_arg of the rule, for xh_governor_make()
+int xh_governor_create(const char *symbol, void *new_func, void **old_func,
+                       const xhook_governor_t *config, void **governor);
+
+//when the rule is removed: restore the slots still holding its stubs, free it after a grace period
+//called with the refresh lock held, the slot writes must not race with a refresh
+void xh_governor_release(void *governor);
+
+//xh_elf_slot_func_t, arg is from xh_governor_create()
+int xh_governor_make(void *arg, const char *pathname, const char *symbol, ElfW(Addr) addr, void **new_func);
+
+int xh_governor_active();
+
+//called by the async refresh thread every XH_GOVERNOR_TICK_MS
+void xh_governor_tick();
+
+size_t xh_governor_get_states(xhook_governor_state_t *states, size_t states_cnt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
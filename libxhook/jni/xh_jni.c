@@ -26,6 +26,24 @@
 
 #define JNI_API_DEF(f) Java_com_qiyi_xhook_NativeHandler_##f
 
+JNIEXPORT jint JNI_API_DEF(registerManifest)(JNIEnv *env, jobject obj, jstring manifest)
+{
+    const char *str;
+    jsize       len;
+    jint        r;
+    
+    (void)obj;
+
+    if(NULL == manifest) return xhook_register_manifest(NULL, 0);
+    if(NULL == (str = (*env)->GetStringUTFChars(env, manifest, NULL))) return xhook_register_manifest(NULL, 0);
+    len = (*env)->GetStringUTFLength(env, manifest);
+
+    r = xhook_register_manifest(str, (size_t)len);
+
+    (*env)->ReleaseStringUTFChars(env, manifest, str);
+    return r;
+}
+
 JNIEXPORT jint JNI_API_DEF(refresh)(JNIEnv *env, jobject obj, jboolean async)
 {
     (void)env;
@@ -57,3 +75,11 @@ JNIEXPORT void JNI_API_DEF(enableSigSegvProtection)(JNIEnv *env, jobject obj, jb
 
     xhook_enable_sigsegv_protection(flag ? 1 : 0);
 }
+
+JNIEXPORT void JNI_API_DEF(dumpLog)(JNIEnv *env, jobject obj)
+{
+    (void)env;
+    (void)obj;
+
+    xhook_dump_log(NULL, NULL);
+}
@@ -21,7 +21,307 @@
 
 // Created by caikelun on 2018-04-11.
 
-#include <android/log.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
 #include "xh_log.h"
 
+#define XH_LOG_RING_CAP     512 //must be power of 2
+#define XH_LOG_RING_ARGS    8
+#define XH_LOG_RING_STR_SZ  128
+#define XH_LOG_MSG_SZ       512
+
 android_LogPriority xh_log_priority = ANDROID_LOG_WARN;
+xh_log_sink_t       xh_log_sink     = xh_log_sink_ring;
+
+//binary log record
+//The format string (always a literal) is the event id, the arguments are kept raw.
+//Strings are copied, because they may be freed before the ring is dumped.
+typedef struct
+{
+    uint64_t             seq; //index + 1 when the record is complete, 0 when it's being written
+    uint64_t             timestamp_ns;
+    const char          *fmt;
+    android_LogPriority  prio;
+    int                  truncated;
+    uint64_t             args[XH_LOG_RING_ARGS];
+    char                 str[XH_LOG_RING_STR_SZ];
+} xh_log_record_t;
+
+static xh_log_record_t xh_log_ring[XH_LOG_RING_CAP];
+static uint64_t        xh_log_ring_head = 0;
+
+//conversion spec in printf format string
+typedef struct
+{
+    const char *start;
+    size_t      len;
+    char        length[3];
+    char        conv;
+    int         width_star;
+    int         precision_star;
+} xh_log_spec_t;
+
+//parse one conversion spec, fmt points to the char after '%'
+static const char *xh_log_parse_spec(const char *fmt, xh_log_spec_t *spec)
+{
+    size_t n = 0;
+
+    memset(spec, 0, sizeof(xh_log_spec_t));
+    spec->start = fmt - 1;
+
+    while(NULL != strchr("-+ #0", *fmt)) fmt++;
+    if('*' == *fmt)
+    {
+        spec->width_star = 1;
+        fmt++;
+    }
+    else while(*fmt >= '0' && *fmt <= '9') fmt++;
+    if('.' == *fmt)
+    {
+        fmt++;
+        if('*' == *fmt)
+        {
+            spec->precision_star = 1;
+            fmt++;
+        }
+        else while(*fmt >= '0' && *fmt <= '9') fmt++;
+    }
+    while('\0' != *fmt && NULL != strchr("hlzjtL", *fmt))
+    {
+        if(n < sizeof(spec->length) - 1) spec->length[n++] = *fmt;
+        fmt++;
+    }
+    spec->conv = *fmt;
+    if('\0' != *fmt) fmt++;
+    spec->len = (size_t)(fmt - spec->start);
+    return fmt;
+}
+
+static uint64_t xh_log_va_int(const xh_log_spec_t *spec, va_list *ap)
+{
+    if(0 == strcmp(spec->length, "l"))  return (uint64_t)va_arg(*ap, long);
+    if(0 == strcmp(spec->length, "ll")) return (uint64_t)va_arg(*ap, long long);
+    if(0 == strcmp(spec->length, "z"))  return (uint64_t)va_arg(*ap, size_t);
+    if(0 == strcmp(spec->length, "j"))  return (uint64_t)va_arg(*ap, intmax_t);
+    if(0 == strcmp(spec->length, "t"))  return (uint64_t)va_arg(*ap, ptrdiff_t);
+    return (uint64_t)va_arg(*ap, int);
+}
+
+void xh_log_sink_ring(android_LogPriority prio, const char *fmt, va_list ap)
+{
+    uint64_t         idx = __atomic_fetch_add(&xh_log_ring_head, 1, __ATOMIC_RELAXED);
+    xh_log_record_t *r = &(xh_log_ring[idx & (XH_LOG_RING_CAP - 1)]);
+    struct timespec  ts;
+    xh_log_spec_t    spec;
+    va_list          ap2;
+    size_t           nargs = 0, str_used = 0, len;
+    const char      *s;
+    double           d;
+
+    __atomic_store_n(&(r->seq), 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    r->timestamp_ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    r->fmt = fmt;
+    r->prio = prio;
+    r->truncated = 0;
+
+    va_copy(ap2, ap);
+    while('\0' != *fmt)
+    {
+        if('%' != *fmt++) continue;
+        if('%' == *fmt)
+        {
+            fmt++;
+            continue;
+        }
+        fmt = xh_log_parse_spec(fmt, &spec);
+        if(nargs + (size_t)spec.width_star + (size_t)spec.precision_star + 1 > XH_LOG_RING_ARGS)
+        {
+            r->truncated = 1;
+            break;
+        }
+        if(spec.width_star)     r->args[nargs++] = (uint64_t)va_arg(ap2, int);
+        if(spec.precision_star) r->args[nargs++] = (uint64_t)va_arg(ap2, int);
+        switch(spec.conv)
+        {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+            r->args[nargs++] = xh_log_va_int(&spec, &ap2);
+            break;
+        case 'p':
+            r->args[nargs++] = (uint64_t)(uintptr_t)va_arg(ap2, void *);
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            d = va_arg(ap2, double);
+            memcpy(&(r->args[nargs++]), &d, sizeof(d));
+            break;
+        case 's':
+            if(NULL == (s = va_arg(ap2, const char *))) s = "(null)";
+            if(str_used >= XH_LOG_RING_STR_SZ - 1)
+            {
+                //no room left, point at the last '\0' (an empty string)
+                r->str[XH_LOG_RING_STR_SZ - 1] = '\0';
+                r->args[nargs++] = XH_LOG_RING_STR_SZ - 1;
+                r->truncated = 1;
+                break;
+            }
+            len = strlen(s);
+            if(str_used + len + 1 > XH_LOG_RING_STR_SZ)
+            {
+                len = XH_LOG_RING_STR_SZ - str_used - 1; //keep the tail, it's more useful for pathnames
+                s += strlen(s) - len;
+                r->truncated = 1;
+            }
+            memcpy(r->str + str_used, s, len);
+            r->str[str_used + len] = '\0';
+            r->args[nargs++] = str_used;
+            str_used += len + 1;
+            break;
+        default:
+            r->truncated = 1;
+            goto end;
+        }
+    }
+ end:
+    va_end(ap2);
+
+    __atomic_store_n(&(r->seq), idx + 1, __ATOMIC_RELEASE);
+
+    //warnings and errors are rare, keep them visible in logcat
+    if(prio >= ANDROID_LOG_WARN)
+        xh_log_sink_logcat(prio, r->fmt, ap);
+}
+
+void xh_log_sink_logcat(android_LogPriority prio, const char *fmt, va_list ap)
+{
+#if defined(__ANDROID__)
+    __android_log_vprint(prio, XH_LOG_TAG, fmt, ap);
+#else
+    (void)prio;
+    fprintf(stderr, XH_LOG_TAG": ");
+    vfprintf(stderr, fmt, ap);
+    if('\0' == fmt[0] || '\n' != fmt[strlen(fmt) - 1]) fputc('\n', stderr);
+#endif
+}
+
+void xh_log_print(android_LogPriority prio, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    xh_log_sink(prio, fmt, ap);
+    va_end(ap);
+}
+
+static void xh_log_format(const xh_log_record_t *r, char *buf, size_t buf_sz)
+{
+    const char    *fmt = r->fmt;
+    xh_log_spec_t  spec;
+    size_t         used = 0, nargs = 0, n;
+    char           spec_str[32];
+    int            width = 0, precision = 0, len;
+    double         d;
+
+    buf[0] = '\0';
+    while('\0' != *fmt && used < buf_sz - 1)
+    {
+        if('%' != *fmt || '%' == fmt[1])
+        {
+            buf[used++] = *fmt;
+            fmt += ('%' == *fmt ? 2 : 1);
+            continue;
+        }
+        fmt = xh_log_parse_spec(fmt + 1, &spec);
+        if(nargs + (size_t)spec.width_star + (size_t)spec.precision_star + 1 > XH_LOG_RING_ARGS) break;
+        if(spec.len >= sizeof(spec_str)) break;
+        memcpy(spec_str, spec.start, spec.len);
+        spec_str[spec.len] = '\0';
+        if(spec.width_star)     width     = (int)r->args[nargs++];
+        if(spec.precision_star) precision = (int)r->args[nargs++];
+
+        n = buf_sz - used;
+#define XH_LOG_FORMAT_ARG(v) \
+        (spec.width_star && spec.precision_star ? snprintf(buf + used, n, spec_str, width, precision, v) : \
+         spec.width_star ? snprintf(buf + used, n, spec_str, width, v) : \
+         spec.precision_star ? snprintf(buf + used, n, spec_str, precision, v) : \
+         snprintf(buf + used, n, spec_str, v))
+        switch(spec.conv)
+        {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+            if(0 == strcmp(spec.length, "l"))       len = XH_LOG_FORMAT_ARG((long)r->args[nargs]);
+            else if(0 == strcmp(spec.length, "ll")) len = XH_LOG_FORMAT_ARG((long long)r->args[nargs]);
+            else if(0 == strcmp(spec.length, "z"))  len = XH_LOG_FORMAT_ARG((size_t)r->args[nargs]);
+            else if(0 == strcmp(spec.length, "j"))  len = XH_LOG_FORMAT_ARG((intmax_t)r->args[nargs]);
+            else if(0 == strcmp(spec.length, "t"))  len = XH_LOG_FORMAT_ARG((ptrdiff_t)r->args[nargs]);
+            else                                    len = XH_LOG_FORMAT_ARG((int)r->args[nargs]);
+            break;
+        case 'p':
+            len = XH_LOG_FORMAT_ARG((void *)(uintptr_t)r->args[nargs]);
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            memcpy(&d, &(r->args[nargs]), sizeof(d));
+            len = XH_LOG_FORMAT_ARG(d);
+            break;
+        case 's':
+            len = XH_LOG_FORMAT_ARG(r->str + r->args[nargs]);
+            break;
+        default:
+            len = -1;
+            break;
+        }
+#undef XH_LOG_FORMAT_ARG
+        if(len < 0) break;
+        nargs++;
+        used += ((size_t)len < n ? (size_t)len : n - 1);
+    }
+    buf[used] = '\0';
+
+    //strip the trailing newline
+    while(used > 0 && '\n' == buf[used - 1]) buf[--used] = '\0';
+
+    if(r->truncated && used + 4 < buf_sz) strcat(buf, " ...");
+}
+
+static void xh_log_dump_logcat(int prio, uint64_t timestamp_ns, const char *msg, void *arg)
+{
+    (void)arg;
+
+#if defined(__ANDROID__)
+    __android_log_print(prio, XH_LOG_TAG, "[%"PRIu64".%06"PRIu64"] %s",
+                        timestamp_ns / 1000000000, (timestamp_ns % 1000000000) / 1000, msg);
+#else
+    (void)prio;
+    fprintf(stderr, XH_LOG_TAG": [%"PRIu64".%06"PRIu64"] %s\n",
+            timestamp_ns / 1000000000, (timestamp_ns % 1000000000) / 1000, msg);
+#endif
+}
+
+void xh_log_dump(xh_log_dump_cb_t cb, void *arg)
+{
+    xh_log_record_t  r;
+    uint64_t         head = __atomic_load_n(&xh_log_ring_head, __ATOMIC_ACQUIRE);
+    uint64_t         idx;
+    char             msg[XH_LOG_MSG_SZ];
+
+    if(NULL == cb) cb = xh_log_dump_logcat;
+
+    for(idx = (head > XH_LOG_RING_CAP ? head - XH_LOG_RING_CAP : 0); idx < head; idx++)
+    {
+        const xh_log_record_t *cur = &(xh_log_ring[idx & (XH_LOG_RING_CAP - 1)]);
+
+        //seqlock style read, skip the record being (over)written
+        if(idx + 1 != __atomic_load_n(&(cur->seq), __ATOMIC_ACQUIRE)) continue;
+        memcpy(&r, cur, sizeof(xh_log_record_t));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(idx + 1 != __atomic_load_n(&(cur->seq), __ATOMIC_RELAXED)) continue;
+
+        xh_log_format(&r, msg, sizeof(msg));
+        cb(r.prio, r.timestamp_ns, msg, arg);
+    }
+}
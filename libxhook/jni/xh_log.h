@@ -24,19 +24,54 @@
 #ifndef XH_LOG_H
 #define XH_LOG_H 1
 
+#include <stdint.h>
+#include <stdarg.h>
+#if defined(__ANDROID__)
 #include <android/log.h>
+#endif
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#if !defined(__ANDROID__)
+//for building and benchmarking on Linux host
+typedef enum android_LogPriority
+{
+    ANDROID_LOG_UNKNOWN = 0,
+    ANDROID_LOG_DEFAULT,
+    ANDROID_LOG_VERBOSE,
+    ANDROID_LOG_DEBUG,
+    ANDROID_LOG_INFO,
+    ANDROID_LOG_WARN,
+    ANDROID_LOG_ERROR,
+    ANDROID_LOG_FATAL,
+    ANDROID_LOG_SILENT,
+} android_LogPriority;
+#endif
+
 extern android_LogPriority xh_log_priority;
 
+//log sink, the default one is an in-memory ring
+typedef void (*xh_log_sink_t)(android_LogPriority prio, const char *fmt, va_list ap);
+extern xh_log_sink_t xh_log_sink;
+
+//keep the binary records, format them only when dumping
+void xh_log_sink_ring(android_LogPriority prio, const char *fmt, va_list ap);
+
+//format and write to logcat (stderr on Linux host) immediately
+void xh_log_sink_logcat(android_LogPriority prio, const char *fmt, va_list ap);
+
+void xh_log_print(android_LogPriority prio, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+typedef void (*xh_log_dump_cb_t)(int prio, uint64_t timestamp_ns, const char *msg, void *arg);
+void xh_log_dump(xh_log_dump_cb_t cb, void *arg);
+
 #define XH_LOG_TAG "xhook"
-#define XH_LOG_DEBUG(fmt, ...) do{if(xh_log_priority <= ANDROID_LOG_DEBUG) __android_log_print(ANDROID_LOG_DEBUG, XH_LOG_TAG, fmt, ##__VA_ARGS__);}while(0)
-#define XH_LOG_INFO(fmt, ...)  do{if(xh_log_priority <= ANDROID_LOG_INFO)  __android_log_print(ANDROID_LOG_INFO,  XH_LOG_TAG, fmt, ##__VA_ARGS__);}while(0)
-#define XH_LOG_WARN(fmt, ...)  do{if(xh_log_priority <= ANDROID_LOG_WARN)  __android_log_print(ANDROID_LOG_WARN,  XH_LOG_TAG, fmt, ##__VA_ARGS__);}while(0)
-#define XH_LOG_ERROR(fmt, ...) do{if(xh_log_priority <= ANDROID_LOG_ERROR) __android_log_print(ANDROID_LOG_ERROR, XH_LOG_TAG, fmt, ##__VA_ARGS__);}while(0)
+#define XH_LOG_DEBUG(fmt, ...) do{if(xh_log_priority <= ANDROID_LOG_DEBUG) xh_log_print(ANDROID_LOG_DEBUG, fmt, ##__VA_ARGS__);}while(0)
+#define XH_LOG_INFO(fmt, ...)  do{if(xh_log_priority <= ANDROID_LOG_INFO)  xh_log_print(ANDROID_LOG_INFO,  fmt, ##__VA_ARGS__);}while(0)
+#define XH_LOG_WARN(fmt, ...)  do{if(xh_log_priority <= ANDROID_LOG_WARN)  xh_log_print(ANDROID_LOG_WARN,  fmt, ##__VA_ARGS__);}while(0)
+#define XH_LOG_ERROR(fmt, ...) do{if(xh_log_priority <= ANDROID_LOG_ERROR) xh_log_print(ANDROID_LOG_ERROR, fmt, ##__VA_ARGS__);}while(0)
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,249 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "xh_errno.h"
+#include "xh_log.h"
+#include "xh_util.h"
+#include "xh_core.h"
+#include "xh_manifest.h"
+
+//Manifest, one rule per line, tokens are separated by spaces or tabs:
+//
+//  # comment
+//  hook   <pathname_regex> <symbol> <handler_name>
+//  ignore <pathname_regex> [symbol]
+//
+//Handler names are resolved from the table filled by xh_manifest_add_handlers().
+
+#define XH_MANIFEST_TOKENS_MAX 4
+
+//named handlers, kept across xhook_clear()
+static xhook_handler_t *xh_manifest_handlers     = NULL;
+static size_t           xh_manifest_handlers_cnt = 0;
+static size_t           xh_manifest_handlers_cap = 0;
+static pthread_mutex_t  xh_manifest_mutex        = PTHREAD_MUTEX_INITIALIZER;
+
+int xh_manifest_add_handlers(const xhook_handler_t *handlers, size_t handlers_cnt)
+{
+    xhook_handler_t *h;
+    size_t           i, j;
+    void            *p;
+    int              r = 0;
+
+    if(NULL == handlers && handlers_cnt > 0) return XH_ERRNO_INVAL;
+    for(i = 0; i < handlers_cnt; i++)
+        if(NULL == handlers[i].name || NULL == handlers[i].new_func) return XH_ERRNO_INVAL;
+
+    pthread_mutex_lock(&xh_manifest_mutex);
+    
+    if(xh_manifest_handlers_cnt + handlers_cnt > xh_manifest_handlers_cap)
+    {
+        if(NULL == (p = realloc(xh_manifest_handlers, sizeof(xhook_handler_t) * (xh_manifest_handlers_cnt + handlers_cnt + 16))))
+        {
+            r = XH_ERRNO_NOMEM;
+            goto end;
+        }
+        xh_manifest_handlers = (xhook_handler_t *)p;
+        xh_manifest_handlers_cap = xh_manifest_handlers_cnt + handlers_cnt + 16;
+    }
+
+    for(i = 0; i < handlers_cnt; i++)
+    {
+        //replace the handler with the same name
+        for(j = 0; j < xh_manifest_handlers_cnt; j++)
+            if(0 == strcmp(xh_manifest_handlers[j].name, handlers[i].name)) break;
+        h = &(xh_manifest_handlers[j]);
+        if(j == xh_manifest_handlers_cnt)
+        {
+            if(NULL == (h->name = strdup(handlers[i].name)))
+            {
+                r = XH_ERRNO_NOMEM;
+                goto end;
+            }
+            xh_manifest_handlers_cnt++;
+        }
+        h->new_func = handlers[i].new_func;
+        h->old_func = handlers[i].old_func;
+    }
+
+ end:
+    pthread_mutex_unlock(&xh_manifest_mutex);
+    return r;
+}
+
+//called with the mutex held
+static xhook_handler_t *xh_manifest_find_handler(const char *name)
+{
+    size_t i;
+
+    for(i = 0; i < xh_manifest_handlers_cnt; i++)
+        if(0 == strcmp(xh_manifest_handlers[i].name, name)) return &(xh_manifest_handlers[i]);
+    return NULL;
+}
+
+int xh_manifest_has_handler(const char *name)
+{
+    int r;
+
+    pthread_mutex_lock(&xh_manifest_mutex);
+    r = (NULL != xh_manifest_find_handler(name));
+    pthread_mutex_unlock(&xh_manifest_mutex);
+    return r;
+}
+
+//split the line in place, return the number of tokens
+static size_t xh_manifest_split(char *line, char **tokens)
+{
+    size_t cnt = 0;
+
+    while('\0' != *line)
+    {
+        while(' ' == *line || '\t' == *line || '\r' == *line) *line++ = '\0';
+        if('\0' == *line) break;
+        if(cnt == XH_MANIFEST_TOKENS_MAX) return XH_MANIFEST_TOKENS_MAX + 1; //too many
+        tokens[cnt++] = line;
+        while('\0' != *line && ' ' != *line && '\t' != *line && '\r' != *line) line++;
+    }
+    return cnt;
+}
+
+int xh_manifest_register(xhook_ctx_t *ctx, const char *manifest, size_t manifest_len)
+{
+    char            *buf = NULL;
+    char            *line, *next;
+    char            *tokens[XH_MANIFEST_TOKENS_MAX];
+    size_t           tokens_cnt;
+    size_t           lines_cnt = 0, line_no = 0;
+    xhook_rule_t    *rules = NULL;
+    size_t           rules_cnt = 0;
+    xhook_handler_t *h;
+    size_t           i;
+    int              r = 0;
+
+    if(NULL == manifest) return XH_ERRNO_INVAL;
+    if(0 == manifest_len) return 0;
+
+    //the manifest may be a mmapped file without the terminating NUL
+    if(NULL == (buf = malloc(manifest_len + 1))) return XH_ERRNO_NOMEM;
+    memcpy(buf, manifest, manifest_len);
+    buf[manifest_len] = '\0';
+
+    for(i = 0; i < manifest_len; i++)
+        if('\n' == buf[i]) lines_cnt++;
+    if(NULL == (rules = malloc(sizeof(xhook_rule_t) * (lines_cnt + 1))))
+    {
+        r = XH_ERRNO_NOMEM;
+        goto end;
+    }
+
+    pthread_mutex_lock(&xh_manifest_mutex);
+    for(line = buf; NULL != line; line = next)
+    {
+        line_no++;
+        if(NULL != (next = strchr(line, '\n'))) *next++ = '\0';
+
+        tokens_cnt = xh_manifest_split(line, tokens);
+        if(0 == tokens_cnt || '#' == tokens[0][0]) continue;
+
+        if(0 == strcmp(tokens[0], "hook") && 4 == tokens_cnt)
+        {
+            if(NULL == (h = xh_manifest_find_handler(tokens[3])))
+            {
+                XH_LOG_ERROR("manifest line %zu: unknown handler %s", line_no, tokens[3]);
+                r = XH_ERRNO_NOTFND;
+                break;
+            }
+            rules[rules_cnt].pathname_regex_str = tokens[1];
+            rules[rules_cnt].symbol = tokens[2];
+            rules[rules_cnt].new_func = h->new_func;
+            rules[rules_cnt].old_func = h->old_func;
+            rules_cnt++;
+        }
+        else if(0 == strcmp(tokens[0], "ignore") && (2 == tokens_cnt || 3 == tokens_cnt))
+        {
+            rules[rules_cnt].pathname_regex_str = tokens[1];
+            rules[rules_cnt].symbol = (3 == tokens_cnt ? tokens[2] : NULL);
+            rules[rules_cnt].new_func = NULL;
+            rules[rules_cnt].old_func = NULL;
+            rules_cnt++;
+        }
+        else
+        {
+            XH_LOG_ERROR("manifest line %zu: bad rule", line_no);
+            r = XH_ERRNO_FORMAT;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&xh_manifest_mutex);
+    if(0 != r) goto end;
+
+    r = xh_core_register_batch(ctx, rules, rules_cnt);
+
+ end:
+    if(NULL != rules) free(rules);
+    free(buf);
+    return r;
+}
+
+int xh_manifest_register_file(xhook_ctx_t *ctx, const char *path)
+{
+    int          fd;
+    struct stat  st;
+    void        *p;
+    int          r;
+
+    if(NULL == path) return XH_ERRNO_INVAL;
+
+    if((fd = xh_util_open(path, O_RDONLY)) < 0)
+    {
+        XH_LOG_ERROR("open manifest failed: %s, errno: %d", path, errno);
+        return 0 == errno ? XH_ERRNO_UNKNOWN : errno;
+    }
+    if(0 != fstat(fd, &st))
+    {
+        r = (0 == errno ? XH_ERRNO_UNKNOWN : errno);
+        xh_util_close(fd);
+        return r;
+    }
+    if(0 == st.st_size)
+    {
+        xh_util_close(fd);
+        return 0;
+    }
+
+    p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    xh_util_close(fd);
+    if(MAP_FAILED == p) return 0 == errno ? XH_ERRNO_UNKNOWN : errno;
+
+    r = xh_manifest_register(ctx, (const char *)p, (size_t)st.st_size);
+    
+    munmap(p, (size_t)st.st_size);
+    return r;
+}
@@ -0,0 +1,43 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#ifndef XH_MANIFEST_H
+#define XH_MANIFEST_H 1
+
+#include <stddef.h>
+#include "xhook.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int xh_manifest_add_handlers(const xhook_handler_t *handlers, size_t handlers_cnt);
+int xh_manifest_has_handler(const char *name);
+
+int xh_manifest_register(xhook_ctx_t *ctx, const char *manifest, size_t manifest_len);
+int xh_manifest_register_file(xhook_ctx_t *ctx, const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,271 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "xh_errno.h"
+#include "xh_log.h"
+#include "xh_util.h"
+#include "xh_stub.h"
+#include "xh_oneshot.h"
+
+#define XH_ONESHOT_ARMED  0
+#define XH_ONESHOT_FIRING 1
+#define XH_ONESHOT_FIRED  2
+
+#define XH_ONESHOT_SLOT_HOOKED   0 //armed, or fired and waiting for the refresh thread to restore it
+#define XH_ONESHOT_SLOT_RESTORED 1 //the stub is freed by the refresh thread
+#define XH_ONESHOT_SLOT_DONE     2 //nothing left to do, the stub was freed or must stay
+
+//Every matched slot gets its own dispatch stub and record. The first call through the
+//slot wins the state CAS, records the time and the caller, then writes the original
+//function back to the slot: later calls never reach xhook. Calls racing with the first
+//one just jump to the original function.
+//
+//The first call takes no lock: a constructor running inside dlopen() holds the loader
+//lock, which a refresh may be waiting for. A writable slot is restored with a CAS, a
+//read-only one through /proc/self/mem. If that fails, the slot keeps the stub (which now
+//jumps to the original function) until xh_oneshot_reap() restores it on the refresh thread.
+//
+//Records are never freed, the timeline survives xhook_clear() and dlclose(). A record
+//whose library is gone stays armed and is never called. The stub of a fired record is
+//freed by xh_oneshot_reap() once the original function is back in the slot.
+
+typedef struct
+{
+    uintptr_t  addr; //the GOT slot
+    void      *orig;
+    void      *stub;
+    char      *pathname;
+    char      *symbol;
+    int        state;
+    int        slot_state;
+    uint32_t   seq;
+    uint64_t   timestamp_ns;
+    void      *caller;
+    pid_t      tid;
+} xh_oneshot_rec_t;
+
+static pthread_mutex_t    xh_oneshot_mutex    = PTHREAD_MUTEX_INITIALIZER;
+static xh_oneshot_rec_t **xh_oneshot_recs     = NULL;
+static size_t             xh_oneshot_recs_cnt = 0;
+static size_t             xh_oneshot_recs_cap = 0;
+static uint32_t           xh_oneshot_seq      = 0;
+static int                xh_oneshot_pending  = 0; //some fired records wait for xh_oneshot_reap()
+
+//write the original function back, only if the slot still holds our stub: another hook
+//may have been layered on top of it (its old_func is the stub then, which must stay)
+static int xh_oneshot_restore(xh_oneshot_rec_t *rec)
+{
+    unsigned int  prot;
+    void         *expected = rec->stub;
+    int           r;
+
+    if(0 != xh_util_get_addr_protect(rec->addr, rec->pathname, &prot) || 0 == (prot & PROT_READ))
+        return XH_ERRNO_NOTFND;
+
+    if(prot & PROT_WRITE)
+    {
+        if(!__atomic_compare_exchange_n((void **)rec->addr, &expected, rec->orig, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return XH_ERRNO_REPEAT;
+    }
+    else
+    {
+        if(expected != __atomic_load_n((void **)rec->addr, __ATOMIC_ACQUIRE)) return XH_ERRNO_REPEAT;
+        if(0 != (r = xh_util_write_proc_mem(rec->addr, &rec->orig, sizeof(void *)))) return r;
+    }
+    xh_util_flush_instruction_cache(rec->addr);
+    return 0;
+}
+
+static void *xh_oneshot_dispatch(void *arg, void *ret_addr)
+{
+    xh_oneshot_rec_t *rec = (xh_oneshot_rec_t *)arg;
+    struct timespec   ts;
+    int               expected = XH_ONESHOT_ARMED;
+
+    if(__atomic_compare_exchange_n(&rec->state, &expected, XH_ONESHOT_FIRING, 0,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+    {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        rec->timestamp_ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+        rec->caller = ret_addr;
+        rec->tid = (pid_t)syscall(SYS_gettid);
+        rec->seq = __atomic_fetch_add(&xh_oneshot_seq, 1, __ATOMIC_RELAXED);
+        switch(xh_oneshot_restore(rec))
+        {
+        case 0:
+            rec->slot_state = XH_ONESHOT_SLOT_RESTORED;
+            break;
+        case XH_ERRNO_REPEAT:
+            rec->slot_state = XH_ONESHOT_SLOT_DONE; //layered, the stub stays
+            break;
+        default:
+            break;
+        }
+        __atomic_store_n(&rec->state, XH_ONESHOT_FIRED, __ATOMIC_RELEASE);
+        if(XH_ONESHOT_SLOT_DONE != rec->slot_state) __atomic_store_n(&xh_oneshot_pending, 1, __ATOMIC_RELEASE);
+    }
+    return rec->orig;
+}
+
+int xh_oneshot_make(void *arg, const char *pathname, const char *symbol, ElfW(Addr) addr, void **new_func)
+{
+    xh_oneshot_rec_t  *rec;
+    xh_oneshot_rec_t **new_recs;
+    void              *orig = *(void **)addr;
+    size_t             i;
+    int                r = XH_ERRNO_NOMEM;
+
+    (void)arg;
+    *new_func = NULL;
+
+    pthread_mutex_lock(&xh_oneshot_mutex);
+
+    //armed by another one-shot rule already
+    for(i = 0; i < xh_oneshot_recs_cnt; i++)
+    {
+        if(xh_oneshot_recs[i]->stub == orig)
+        {
+            pthread_mutex_unlock(&xh_oneshot_mutex);
+            return 0;
+        }
+    }
+
+    if(xh_oneshot_recs_cnt == xh_oneshot_recs_cap)
+    {
+        size_t cap = (0 == xh_oneshot_recs_cap ? 64 : xh_oneshot_recs_cap * 2);
+        if(NULL == (new_recs = realloc(xh_oneshot_recs, cap * sizeof(xh_oneshot_rec_t *)))) goto end;
+        xh_oneshot_recs = new_recs;
+        xh_oneshot_recs_cap = cap;
+    }
+
+    if(NULL == (rec = calloc(1, sizeof(xh_oneshot_rec_t)))) goto end;
+    rec->addr = (uintptr_t)addr;
+    rec->orig = orig;
+    rec->state = XH_ONESHOT_ARMED;
+    if(NULL == (rec->pathname = strdup(pathname)) || NULL == (rec->symbol = strdup(symbol))) goto err;
+    if(0 != (r = xh_stub_make_dispatch(xh_oneshot_dispatch, rec, &rec->stub))) goto err;
+
+    xh_oneshot_recs[xh_oneshot_recs_cnt++] = rec;
+    *new_func = rec->stub;
+    r = 0;
+    goto end;
+
+ err:
+    free(rec->pathname);
+    free(rec->symbol);
+    free(rec);
+ end:
+    pthread_mutex_unlock(&xh_oneshot_mutex);
+    return r;
+}
+
+//called with the refresh mutex held, so no hook is being written to the slots meanwhile
+void xh_oneshot_reap()
+{
+    xh_oneshot_rec_t *rec;
+    unsigned int      prot;
+    size_t            i;
+    int               r;
+
+    if(!__atomic_exchange_n(&xh_oneshot_pending, 0, __ATOMIC_ACQ_REL)) return;
+
+    pthread_mutex_lock(&xh_oneshot_mutex);
+    for(i = 0; i < xh_oneshot_recs_cnt; i++)
+    {
+        rec = xh_oneshot_recs[i];
+        if(XH_ONESHOT_FIRED != __atomic_load_n(&rec->state, __ATOMIC_ACQUIRE)) continue;
+
+        if(XH_ONESHOT_SLOT_HOOKED == rec->slot_state)
+        {
+            r = xh_util_replace_slot(rec->addr, rec->pathname, rec->stub, rec->orig);
+            if(0 == r)
+                rec->slot_state = XH_ONESHOT_SLOT_RESTORED;
+            else if(XH_ERRNO_REPEAT == r || XH_ERRNO_NOTFND == r)
+                rec->slot_state = XH_ONESHOT_SLOT_DONE; //layered or unloaded, the stub stays
+            else
+            {
+                XH_LOG_WARN("oneshot: restore failed: %s %s, ret: %d", rec->symbol, rec->pathname, r);
+                __atomic_store_n(&xh_oneshot_pending, 1, __ATOMIC_RELEASE); //try again next time
+                continue;
+            }
+        }
+
+        if(XH_ONESHOT_SLOT_RESTORED == rec->slot_state)
+        {
+            //a hook written while the first call restored the slot may have taken the stub
+            //as its old_func, the slot holds that hook then and the stub must stay
+            if(0 == xh_util_get_addr_protect(rec->addr, rec->pathname, &prot) && 0 != (prot & PROT_READ) &&
+               rec->orig == __atomic_load_n((void **)rec->addr, __ATOMIC_ACQUIRE))
+            {
+                //the threads still running in the stub are covered by the grace period of the stub arena
+                xh_stub_free(rec->stub);
+                rec->stub = NULL;
+            }
+            rec->slot_state = XH_ONESHOT_SLOT_DONE;
+        }
+    }
+    pthread_mutex_unlock(&xh_oneshot_mutex);
+}
+
+static int xh_oneshot_cmp(const void *a, const void *b)
+{
+    uint32_t sa = (*(xh_oneshot_rec_t *const *)a)->seq;
+    uint32_t sb = (*(xh_oneshot_rec_t *const *)b)->seq;
+    return sa < sb ? -1 : (sa > sb ? 1 : 0);
+}
+
+size_t xh_oneshot_get_first_calls(xhook_first_call_t *calls, size_t calls_cnt)
+{
+    xh_oneshot_rec_t **fired;
+    size_t             fired_cnt = 0, i;
+
+    pthread_mutex_lock(&xh_oneshot_mutex);
+
+    if(NULL == (fired = malloc(sizeof(xh_oneshot_rec_t *) * (xh_oneshot_recs_cnt + 1)))) goto end;
+    for(i = 0; i < xh_oneshot_recs_cnt; i++)
+        if(XH_ONESHOT_FIRED == __atomic_load_n(&xh_oneshot_recs[i]->state, __ATOMIC_ACQUIRE))
+            fired[fired_cnt++] = xh_oneshot_recs[i];
+    qsort(fired, fired_cnt, sizeof(xh_oneshot_rec_t *), xh_oneshot_cmp);
+
+    for(i = 0; i < fired_cnt && i < calls_cnt; i++)
+    {
+        calls[i].timestamp_ns = fired[i]->timestamp_ns;
+        calls[i].pathname     = fired[i]->pathname;
+        calls[i].symbol       = fired[i]->symbol;
+        calls[i].caller       = fired[i]->caller;
+        calls[i].slot         = (void *)fired[i]->addr;
+        calls[i].tid          = (int)fired[i]->tid;
+    }
+    free(fired);
+
+ end:
+    pthread_mutex_unlock(&xh_oneshot_mutex);
+    return fired_cnt;
+}
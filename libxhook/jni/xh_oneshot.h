@@ -0,0 +1,45 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#ifndef XH_ONESHOT_H
+#define XH_ONESHOT_H 1
+
+#include "xhook.h"
+#include "xh_elf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//xh_elf_slot_func_t for xhook_register_oneshot()
+int xh_oneshot_make(void *arg, const char *pathname, const char *symbol, ElfW(Addr) addr, void **new_func);
+
+//restore the slots the first calls could not, free the stubs of the restored ones
+void xh_oneshot_reap();
+
+size_t xh_oneshot_get_first_calls(xhook_first_call_t *calls, size_t calls_cnt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
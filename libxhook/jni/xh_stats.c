@@ -0,0 +1,214 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "xh_errno.h"
+#include "xh_log.h"
+#include "xh_stats.h"
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC       0x0001U
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS  (1024 + 9)
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW   0x0004
+#endif
+
+//The page is written by the refresh thread (one writer at a time, serialized by the
+//mutex) and read by other processes without any lock. Readers retry when "seq" is odd
+//or changed while they were copying. The user counters are single atomic words, they
+//are updated without the seqlock so that the hot path never waits.
+
+xhook_stats_page_t *volatile xh_stats_page  = NULL;
+static pthread_mutex_t       xh_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int xh_stats_memfd()
+{
+#if defined(__NR_memfd_create)
+    return (int)syscall(__NR_memfd_create, "xhook_stats", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int xh_stats_enable(const char *path, int *fd)
+{
+    xhook_stats_page_t *page;
+    int                 f;
+    int                 r = 0;
+
+    pthread_mutex_lock(&xh_stats_mutex);
+    
+    if(NULL != xh_stats_page)
+    {
+        XH_LOG_ERROR("stats page is already enabled");
+        r = XH_ERRNO_REPEAT;
+        goto end;
+    }
+
+    if(NULL == path)
+        f = xh_stats_memfd();
+    else
+        f = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(f < 0)
+    {
+        r = (0 == errno ? XH_ERRNO_UNKNOWN : errno);
+        XH_LOG_ERROR("create stats page failed: %s, errno: %d", path ? path : "memfd", r);
+        goto end;
+    }
+    if(NULL != path) fchmod(f, 0644); //read-only to other processes, regardless of umask
+
+    if(0 != ftruncate(f, sizeof(xhook_stats_page_t)))
+    {
+        r = (0 == errno ? XH_ERRNO_UNKNOWN : errno);
+        close(f);
+        goto end;
+    }
+    if(NULL == path) fcntl(f, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW); //mapped readers never get SIGBUS
+
+    page = (xhook_stats_page_t *)mmap(NULL, sizeof(xhook_stats_page_t), PROT_READ | PROT_WRITE, MAP_SHARED, f, 0);
+    if(MAP_FAILED == page)
+    {
+        r = (0 == errno ? XH_ERRNO_UNKNOWN : errno);
+        close(f);
+        goto end;
+    }
+
+    //the file is filled by zero
+    page->version = XHOOK_STATS_VERSION;
+    page->pid = (uint32_t)getpid();
+    __atomic_store_n(&(page->magic), XHOOK_STATS_MAGIC, __ATOMIC_RELEASE);
+    __atomic_store_n(&xh_stats_page, page, __ATOMIC_RELEASE);
+
+    //keep the memfd opened, the readers find it in /proc/<pid>/fd
+    if(NULL != fd)
+        *fd = f;
+    else if(NULL != path)
+        close(f);
+
+ end:
+    pthread_mutex_unlock(&xh_stats_mutex);
+    return r;
+}
+
+static void xh_stats_write_begin(xhook_stats_page_t *page)
+{
+    __atomic_store_n(&(page->seq), page->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void xh_stats_write_end(xhook_stats_page_t *page)
+{
+    __atomic_store_n(&(page->seq), page->seq + 1, __ATOMIC_RELEASE);
+}
+
+void xh_stats_refresh(uint64_t duration_ns, size_t libs_hooked, size_t slots_patched,
+                      size_t failures, size_t sigsegv_recoveries)
+{
+    xhook_stats_page_t *page = __atomic_load_n(&xh_stats_page, __ATOMIC_ACQUIRE);
+
+    if(NULL == page) return;
+    
+    pthread_mutex_lock(&xh_stats_mutex);
+    xh_stats_write_begin(page);
+    page->refresh_cnt += 1;
+    page->last_refresh_ns = duration_ns;
+    page->libs_hooked = libs_hooked;
+    page->slots_patched += slots_patched;
+    page->failures += failures;
+    page->sigsegv_recoveries += sigsegv_recoveries;
+    xh_stats_write_end(page);
+    pthread_mutex_unlock(&xh_stats_mutex);
+}
+
+int xh_stats_counter_register(const char *name)
+{
+    xhook_stats_page_t *page = __atomic_load_n(&xh_stats_page, __ATOMIC_ACQUIRE);
+    uint32_t            i;
+    int                 id = -1;
+
+    if(NULL == page || NULL == name) return -1;
+    
+    pthread_mutex_lock(&xh_stats_mutex);
+
+    //the same name gets the same counter
+    for(i = 0; i < page->counters_cnt; i++)
+        if(0 == strncmp(page->counters[i].name, name, sizeof(page->counters[i].name) - 1))
+        {
+            id = (int)i;
+            goto end;
+        }
+    if(page->counters_cnt >= XHOOK_STATS_COUNTERS_MAX) goto end;
+
+    xh_stats_write_begin(page);
+    strncpy(page->counters[page->counters_cnt].name, name, sizeof(page->counters[0].name) - 1);
+    id = (int)(page->counters_cnt);
+    page->counters_cnt += 1;
+    xh_stats_write_end(page);
+
+ end:
+    pthread_mutex_unlock(&xh_stats_mutex);
+    return id;
+}
+
+void xh_stats_counter_add(int id, uint64_t delta)
+{
+    xhook_stats_page_t *page = xh_stats_page;
+
+    if(NULL == page || id < 0 || id >= XHOOK_STATS_COUNTERS_MAX) return;
+    __atomic_fetch_add(&(page->counters[id].value), delta, __ATOMIC_RELAXED);
+}
+
+int xh_stats_read(const xhook_stats_page_t *page, xhook_stats_page_t *snapshot)
+{
+    uint32_t seq0, seq1;
+    int      i;
+
+    if(NULL == page || NULL == snapshot) return XH_ERRNO_INVAL;
+    if(XHOOK_STATS_MAGIC != __atomic_load_n(&(page->magic), __ATOMIC_ACQUIRE)) return XH_ERRNO_FORMAT;
+
+    for(i = 0; i < 1000; i++)
+    {
+        if((seq0 = __atomic_load_n(&(page->seq), __ATOMIC_ACQUIRE)) & 1)
+        {
+            sched_yield();
+            continue;
+        }
+        memcpy(snapshot, (const void *)page, sizeof(xhook_stats_page_t));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq1 = __atomic_load_n(&(page->seq), __ATOMIC_RELAXED);
+        if(seq0 == seq1) return 0;
+    }
+    return XH_ERRNO_UNKNOWN;
+}
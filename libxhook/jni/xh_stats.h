@@ -0,0 +1,50 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#ifndef XH_STATS_H
+#define XH_STATS_H 1
+
+#include <stdint.h>
+#include "xhook.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//NULL if the stats page is not enabled, the only cost when it's off
+extern xhook_stats_page_t *volatile xh_stats_page;
+
+int xh_stats_enable(const char *path, int *fd);
+
+void xh_stats_refresh(uint64_t duration_ns, size_t libs_hooked, size_t slots_patched,
+                      size_t failures, size_t sigsegv_recoveries);
+
+int xh_stats_counter_register(const char *name);
+void xh_stats_counter_add(int id, uint64_t delta);
+
+int xh_stats_read(const xhook_stats_page_t *page, xhook_stats_page_t *snapshot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,467 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include "xh_errno.h"
+#include "xh_log.h"
+#include "xh_stub.h"
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+#define XH_STUB_SIZE       64
+#define XH_STUB_CHUNK_SIZE (64 * 1024)
+#define XH_STUB_THUNK_CNT  4  //slots taken by the shared dispatch thunk in the first chunk
+#define XH_STUB_GRACE_NS   (1000 * 1000 * 1000ULL) //a freed stub is reused only after this
+
+//Pages are never writable and executable at the same time: each chunk is one shared
+//memory object mapped twice, RW for writing the code and RX for running it. A chunk
+//holds 1024 stubs, so thousands of stubs cost a few mappings.
+//
+//A thread may still be running in a stub when it's freed (the slot was restored but the
+//old value had been loaded already). Freed stubs go to a FIFO queue with the time they
+//were freed, and are only reused after XH_STUB_GRACE_NS, like the released governors.
+
+typedef struct
+{
+    uint8_t *rw;
+    uint8_t *rx;
+} xh_stub_chunk_t;
+
+typedef struct
+{
+    void     *stub;
+    uint64_t  freed_ns;
+} xh_stub_freed_t;
+
+static pthread_mutex_t  xh_stub_mutex       = PTHREAD_MUTEX_INITIALIZER;
+static xh_stub_chunk_t *xh_stub_chunks      = NULL;
+static size_t           xh_stub_chunks_cnt  = 0;
+static size_t           xh_stub_chunks_cap  = 0;
+static xh_stub_freed_t *xh_stub_freeq       = NULL; //ring buffer of freed RX stubs
+static size_t           xh_stub_freeq_head  = 0;
+static size_t           xh_stub_freeq_len   = 0;
+static size_t           xh_stub_freeq_cap   = 0;
+
+static uint64_t xh_stub_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint8_t *xh_stub_rw(void *stub)
+{
+    size_t i;
+
+    for(i = 0; i < xh_stub_chunks_cnt; i++)
+        if((uint8_t *)stub >= xh_stub_chunks[i].rx && (uint8_t *)stub < xh_stub_chunks[i].rx + XH_STUB_CHUNK_SIZE)
+            return xh_stub_chunks[i].rw + ((uint8_t *)stub - xh_stub_chunks[i].rx);
+    return NULL;
+}
+
+#if defined(__x86_64__) || defined(__aarch64__)
+
+static size_t xh_stub_bump  = 0; //stubs handed out from the last chunk
+static void  *xh_stub_thunk = NULL;
+
+static int xh_stub_shm_open()
+{
+    int fd = -1;
+
+#if defined(__NR_memfd_create)
+    fd = (int)syscall(__NR_memfd_create, "xhook_stub", MFD_CLOEXEC);
+#endif
+
+#if defined(__ANDROID__)
+    //ashmem for the kernels without memfd (before 3.17)
+    if(fd < 0)
+    {
+        char name[256] = "xhook_stub";
+        if((fd = open("/dev/ashmem", O_RDWR | O_CLOEXEC)) >= 0)
+        {
+            if(0 != ioctl(fd, _IOW(0x77, 1, char[256]), name) ||
+               0 != ioctl(fd, _IOW(0x77, 3, size_t), (size_t)XH_STUB_CHUNK_SIZE))
+            {
+                close(fd);
+                fd = -1;
+            }
+            return fd;
+        }
+    }
+#endif
+
+    if(fd >= 0 && 0 != ftruncate(fd, XH_STUB_CHUNK_SIZE))
+    {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+static int xh_stub_chunk_new()
+{
+    xh_stub_chunk_t *new_chunks;
+    void            *rw, *rx;
+    int              fd;
+
+    if(xh_stub_chunks_cnt == xh_stub_chunks_cap)
+    {
+        size_t cap = (0 == xh_stub_chunks_cap ? 4 : xh_stub_chunks_cap * 2);
+        if(NULL == (new_chunks = realloc(xh_stub_chunks, cap * sizeof(xh_stub_chunk_t)))) return XH_ERRNO_NOMEM;
+        xh_stub_chunks = new_chunks;
+        xh_stub_chunks_cap = cap;
+    }
+
+    if((fd = xh_stub_shm_open()) < 0)
+    {
+        XH_LOG_ERROR("create stub memory failed, errno: %d", errno);
+        return XH_ERRNO_NOTSUPP;
+    }
+    rw = mmap(NULL, XH_STUB_CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    rx = mmap(NULL, XH_STUB_CHUNK_SIZE, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+    close(fd);
+    if(MAP_FAILED == rw || MAP_FAILED == rx)
+    {
+        //an executable shared mapping may be denied by the policy (SELinux execmem)
+        XH_LOG_ERROR("map stub memory failed, errno: %d", errno);
+        if(MAP_FAILED != rw) munmap(rw, XH_STUB_CHUNK_SIZE);
+        if(MAP_FAILED != rx) munmap(rx, XH_STUB_CHUNK_SIZE);
+        return XH_ERRNO_NOTSUPP;
+    }
+
+    xh_stub_chunks[xh_stub_chunks_cnt].rw = (uint8_t *)rw;
+    xh_stub_chunks[xh_stub_chunks_cnt].rx = (uint8_t *)rx;
+    xh_stub_chunks_cnt++;
+    xh_stub_bump = 0;
+    return 0;
+}
+
+//bump allocate cnt contiguous stubs, or reuse a freed one (cnt == 1 only)
+static void *xh_stub_alloc_locked(size_t cnt)
+{
+    void *stub;
+    int   r;
+
+    if(1 == cnt && xh_stub_freeq_len > 0 &&
+       xh_stub_now_ns() - xh_stub_freeq[xh_stub_freeq_head].freed_ns >= XH_STUB_GRACE_NS)
+    {
+        stub = xh_stub_freeq[xh_stub_freeq_head].stub;
+        xh_stub_freeq_head = (xh_stub_freeq_head + 1) % xh_stub_freeq_cap;
+        xh_stub_freeq_len--;
+        return stub;
+    }
+
+    if(0 == xh_stub_chunks_cnt || xh_stub_bump + cnt > XH_STUB_CHUNK_SIZE / XH_STUB_SIZE)
+        if(0 != (r = xh_stub_chunk_new())) return NULL;
+
+    stub = xh_stub_chunks[xh_stub_chunks_cnt - 1].rx + xh_stub_bump * XH_STUB_SIZE;
+    xh_stub_bump += cnt;
+    return stub;
+}
+
+//copy the code to the RW view, then make it visible to the instruction fetch of the RX view
+static void xh_stub_write(void *stub, const void *code, size_t len)
+{
+    memcpy(xh_stub_rw(stub), code, len);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    __builtin___clear_cache((char *)stub, (char *)stub + len);
+}
+
+#if defined(__x86_64__)
+
+//Entry: r10 -> {arg, dispatch}. Saves the argument registers (rdi, rsi, rdx, rcx, r8, r9,
+//xmm0-7), rax (vector count of varargs) and r10 (static chain), calls dispatch(arg, [rbp + 8]),
+//restores them and jumps to the returned function with r11. The return address is untouched.
+static const uint8_t xh_stub_thunk_code[] = {
+    0x55,                                     //push rbp
+    0x48, 0x89, 0xe5,                         //mov rbp, rsp
+    0x57, 0x56, 0x52, 0x51,                   //push rdi, rsi, rdx, rcx
+    0x41, 0x50, 0x41, 0x51, 0x50, 0x41, 0x52, //push r8, r9, rax, r10
+    0x48, 0x81, 0xec, 0x80, 0x00, 0x00, 0x00, //sub rsp, 128
+    0xf3, 0x0f, 0x7f, 0x04, 0x24,             //movdqu [rsp], xmm0
+    0xf3, 0x0f, 0x7f, 0x4c, 0x24, 0x10,       //movdqu [rsp + 16], xmm1
+    0xf3, 0x0f, 0x7f, 0x54, 0x24, 0x20,       //...
+    0xf3, 0x0f, 0x7f, 0x5c, 0x24, 0x30,
+    0xf3, 0x0f, 0x7f, 0x64, 0x24, 0x40,
+    0xf3, 0x0f, 0x7f, 0x6c, 0x24, 0x50,
+    0xf3, 0x0f, 0x7f, 0x74, 0x24, 0x60,
+    0xf3, 0x0f, 0x7f, 0x7c, 0x24, 0x70,       //movdqu [rsp + 112], xmm7
+    0x49, 0x8b, 0x3a,                         //mov rdi, [r10]
+    0x48, 0x8b, 0x75, 0x08,                   //mov rsi, [rbp + 8]
+    0x41, 0xff, 0x52, 0x08,                   //call [r10 + 8]
+    0x49, 0x89, 0xc3,                         //mov r11, rax
+    0xf3, 0x0f, 0x6f, 0x04, 0x24,             //movdqu xmm0, [rsp]
+    0xf3, 0x0f, 0x6f, 0x4c, 0x24, 0x10,
+    0xf3, 0x0f, 0x6f, 0x54, 0x24, 0x20,
+    0xf3, 0x0f, 0x6f, 0x5c, 0x24, 0x30,
+    0xf3, 0x0f, 0x6f, 0x64, 0x24, 0x40,
+    0xf3, 0x0f, 0x6f, 0x6c, 0x24, 0x50,
+    0xf3, 0x0f, 0x6f, 0x74, 0x24, 0x60,
+    0xf3, 0x0f, 0x6f, 0x7c, 0x24, 0x70,       //movdqu xmm7, [rsp + 112]
+    0x48, 0x81, 0xc4, 0x80, 0x00, 0x00, 0x00, //add rsp, 128
+    0x41, 0x5a, 0x58, 0x41, 0x59, 0x41, 0x58, //pop r10, rax, r9, r8
+    0x59, 0x5a, 0x5e, 0x5f,                   //pop rcx, rdx, rsi, rdi
+    0x5d,                                     //pop rbp
+    0x41, 0xff, 0xe3                          //jmp r11
+};
+
+//movabs r11, counter / lock inc qword [r11] / jmp [rip + 4] / int3 x4 / .quad target
+//the target is 8-byte aligned, so xh_stub_set_target() replaces it with one store
+#define XH_STUB_COUNT_JUMP_TARGET_OFF 24
+static size_t xh_stub_gen_count_jump(uint8_t *buf, void *target, uint64_t *counter)
+{
+    static const uint8_t code[] = {
+        0xf0, 0x49, 0xff, 0x03,             //lock inc qword [r11]
+        0xff, 0x25, 0x04, 0x00, 0x00, 0x00, //jmp [rip + 4]
+        0xcc, 0xcc, 0xcc, 0xcc              //int3
+    };
+    buf[0] = 0x49;                          //movabs r11, imm64
+    buf[1] = 0xbb;
+    memcpy(buf + 2, &counter, 8);
+    memcpy(buf + 10, code, sizeof(code));
+    memcpy(buf + XH_STUB_COUNT_JUMP_TARGET_OFF, &target, 8);
+    return XH_STUB_COUNT_JUMP_TARGET_OFF + 8;
+}
+
+//{arg, dispatch, thunk} at +16
+static size_t xh_stub_gen_dispatch(uint8_t *buf, void *data[3])
+{
+    static const uint8_t code[16] = {
+        0x4c, 0x8d, 0x15, 0x09, 0x00, 0x00, 0x00, //lea r10, [rip + 9]
+        0x41, 0xff, 0x62, 0x10,                   //jmp [r10 + 16]
+        0xcc, 0xcc, 0xcc, 0xcc, 0xcc              //int3
+    };
+    memcpy(buf, code, sizeof(code));
+    memcpy(buf + 16, data, 24);
+    return 40;
+}
+
+#elif defined(__aarch64__)
+
+#define XH_STUB_A64_STP(rt, rt2, imm)  (0xa9000000u | ((uint32_t)((imm) / 8) << 15) | ((rt2) << 10) | (31u << 5) | (rt))
+#define XH_STUB_A64_LDP(rt, rt2, imm)  (0xa9400000u | ((uint32_t)((imm) / 8) << 15) | ((rt2) << 10) | (31u << 5) | (rt))
+#define XH_STUB_A64_STPQ(rt, rt2, imm) (0xad000000u | ((uint32_t)((imm) / 16) << 15) | ((rt2) << 10) | (31u << 5) | (rt))
+#define XH_STUB_A64_LDPQ(rt, rt2, imm) (0xad400000u | ((uint32_t)((imm) / 16) << 15) | ((rt2) << 10) | (31u << 5) | (rt))
+#define XH_STUB_A64_LDR_LIT(rt, off)   (0x58000000u | ((uint32_t)((off) / 4) << 5) | (rt))
+#define XH_STUB_A64_BR_X16             0xd61f0200u
+#define XH_STUB_A64_BR_X17             0xd61f0220u
+#define XH_STUB_A64_BRK                0xd4200000u
+
+//Entry: x16 -> {arg, dispatch}. Saves x0-x8 (x8: indirect result), q0-q7 and the frame,
+//calls dispatch(arg, x30), restores them and jumps to the returned function with x16. x30
+//(the return address) is restored, so the target returns directly to the original caller.
+static const uint32_t xh_stub_thunk_code[] = {
+    0xa9b27bfd,                      //stp x29, x30, [sp, #-224]!
+    0x910003fd,                      //mov x29, sp
+    XH_STUB_A64_STP(0, 1, 16),       //stp x0, x1, [sp, #16]
+    XH_STUB_A64_STP(2, 3, 32),
+    XH_STUB_A64_STP(4, 5, 48),
+    XH_STUB_A64_STP(6, 7, 64),
+    XH_STUB_A64_STP(8, 16, 80),      //stp x8, x16, [sp, #80]
+    XH_STUB_A64_STPQ(0, 1, 96),      //stp q0, q1, [sp, #96]
+    XH_STUB_A64_STPQ(2, 3, 128),
+    XH_STUB_A64_STPQ(4, 5, 160),
+    XH_STUB_A64_STPQ(6, 7, 192),
+    0xf9400200,                      //ldr x0, [x16]
+    0xaa1e03e1,                      //mov x1, x30
+    0xf9400611,                      //ldr x17, [x16, #8]
+    0xd63f0220,                      //blr x17
+    0xaa0003f0,                      //mov x16, x0
+    XH_STUB_A64_LDPQ(6, 7, 192),     //ldp q6, q7, [sp, #192]
+    XH_STUB_A64_LDPQ(4, 5, 160),
+    XH_STUB_A64_LDPQ(2, 3, 128),
+    XH_STUB_A64_LDPQ(0, 1, 96),
+    XH_STUB_A64_LDP(8, 17, 80),      //ldp x8, x17, [sp, #80]
+    XH_STUB_A64_LDP(6, 7, 64),
+    XH_STUB_A64_LDP(4, 5, 48),
+    XH_STUB_A64_LDP(2, 3, 32),
+    XH_STUB_A64_LDP(0, 1, 16),       //ldp x0, x1, [sp, #16]
+    0xa8ce7bfd,                      //ldp x29, x30, [sp], #224
+    XH_STUB_A64_BR_X16               //br x16
+};
+
+//the target is loaded on every call, so xh_stub_set_target() replaces it with one store
+#define XH_STUB_COUNT_JUMP_TARGET_OFF 40
+static size_t xh_stub_gen_count_jump(uint8_t *buf, void *target, uint64_t *counter)
+{
+    const uint32_t code[8] = {
+        XH_STUB_A64_LDR_LIT(16, 32), //ldr x16, #32 (counter)
+        0xc85f7e11,                  //1: ldxr x17, [x16]
+        0x91000631,                  //add x17, x17, #1
+        0xc8097e11,                  //stxr w9, x17, [x16]
+        0x35ffffa9,                  //cbnz w9, 1b
+        XH_STUB_A64_LDR_LIT(16, 20), //ldr x16, #20 (target)
+        XH_STUB_A64_BR_X16,          //br x16
+        XH_STUB_A64_BRK
+    };
+    memcpy(buf, code, sizeof(code));
+    memcpy(buf + 32, &counter, 8);
+    memcpy(buf + XH_STUB_COUNT_JUMP_TARGET_OFF, &target, 8);
+    return XH_STUB_COUNT_JUMP_TARGET_OFF + 8;
+}
+
+//{arg, dispatch, thunk} at +16
+static size_t xh_stub_gen_dispatch(uint8_t *buf, void *data[3])
+{
+    const uint32_t code[4] = {
+        0x10000090,                  //adr x16, #16
+        0xf9400a11,                  //ldr x17, [x16, #16]
+        XH_STUB_A64_BR_X17,          //br x17
+        XH_STUB_A64_BRK
+    };
+    memcpy(buf, code, sizeof(code));
+    memcpy(buf + 16, data, 24);
+    return 40;
+}
+
+#endif
+
+int xh_stub_make_dispatch(xh_stub_dispatch_t dispatch, void *arg, void **stub)
+{
+    uint8_t  buf[XH_STUB_SIZE];
+    size_t   len;
+    void    *data[3];
+    void    *s;
+
+    if(NULL == dispatch || NULL == stub) return XH_ERRNO_INVAL;
+
+    pthread_mutex_lock(&xh_stub_mutex);
+
+    //the shared dispatch thunk takes the first slots of the first chunk
+    if(NULL == xh_stub_thunk)
+    {
+        if(NULL == (s = xh_stub_alloc_locked(XH_STUB_THUNK_CNT))) goto err;
+        xh_stub_write(s, xh_stub_thunk_code, sizeof(xh_stub_thunk_code));
+        xh_stub_thunk = s;
+    }
+
+    if(NULL == (s = xh_stub_alloc_locked(1))) goto err;
+    data[0] = arg;
+    data[1] = (void *)dispatch;
+    data[2] = xh_stub_thunk;
+    len = xh_stub_gen_dispatch(buf, data);
+    xh_stub_write(s, buf, len);
+
+    pthread_mutex_unlock(&xh_stub_mutex);
+    *stub = s;
+    return 0;
+
+ err:
+    pthread_mutex_unlock(&xh_stub_mutex);
+    return 0 == xh_stub_chunks_cnt ? XH_ERRNO_NOTSUPP : XH_ERRNO_NOMEM;
+}
+
+int xh_stub_make_count_jump(void *target, uint64_t *counter, void **stub)
+{
+    uint8_t  buf[XH_STUB_SIZE];
+    size_t   len;
+    void    *s;
+
+    if(NULL == target || NULL == counter || NULL == stub) return XH_ERRNO_INVAL;
+
+    pthread_mutex_lock(&xh_stub_mutex);
+    if(NULL == (s = xh_stub_alloc_locked(1)))
+    {
+        pthread_mutex_unlock(&xh_stub_mutex);
+        return 0 == xh_stub_chunks_cnt ? XH_ERRNO_NOTSUPP : XH_ERRNO_NOMEM;
+    }
+    len = xh_stub_gen_count_jump(buf, target, counter);
+    xh_stub_write(s, buf, len);
+    pthread_mutex_unlock(&xh_stub_mutex);
+
+    *stub = s;
+    return 0;
+}
+
+void xh_stub_set_target(void *stub, void *target)
+{
+    uint8_t *rw;
+
+    pthread_mutex_lock(&xh_stub_mutex);
+    if(NULL != (rw = xh_stub_rw(stub)))
+        __atomic_store_n((void **)(rw + XH_STUB_COUNT_JUMP_TARGET_OFF), target, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&xh_stub_mutex);
+}
+
+#else
+
+int xh_stub_make_dispatch(xh_stub_dispatch_t dispatch, void *arg, void **stub)
+{
+    (void)dispatch, (void)arg, (void)stub;
+    return XH_ERRNO_NOTSUPP; //no stub templates for this architecture
+}
+
+int xh_stub_make_count_jump(void *target, uint64_t *counter, void **stub)
+{
+    (void)target, (void)counter, (void)stub;
+    return XH_ERRNO_NOTSUPP;
+}
+
+void xh_stub_set_target(void *stub, void *target)
+{
+    (void)stub, (void)target;
+}
+
+#endif
+
+void xh_stub_free(void *stub)
+{
+    xh_stub_freed_t *new_q;
+    size_t           cap, i;
+
+    if(NULL == stub) return;
+
+    pthread_mutex_lock(&xh_stub_mutex);
+
+    if(NULL == xh_stub_rw(stub)) goto end;
+
+    if(xh_stub_freeq_len == xh_stub_freeq_cap)
+    {
+        //grow the ring, unwrap it into the new buffer
+        cap = (0 == xh_stub_freeq_cap ? 128 : xh_stub_freeq_cap * 2);
+        if(NULL == (new_q = malloc(cap * sizeof(xh_stub_freed_t)))) goto end; //leak the stub
+        for(i = 0; i < xh_stub_freeq_len; i++)
+            new_q[i] = xh_stub_freeq[(xh_stub_freeq_head + i) % xh_stub_freeq_cap];
+        free(xh_stub_freeq);
+        xh_stub_freeq = new_q;
+        xh_stub_freeq_cap = cap;
+        xh_stub_freeq_head = 0;
+    }
+    i = (xh_stub_freeq_head + xh_stub_freeq_len) % xh_stub_freeq_cap;
+    xh_stub_freeq[i].stub = stub;
+    xh_stub_freeq[i].freed_ns = xh_stub_now_ns();
+    xh_stub_freeq_len++;
+
+ end:
+    pthread_mutex_unlock(&xh_stub_mutex);
+}
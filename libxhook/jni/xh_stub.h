@@ -0,0 +1,56 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#ifndef XH_STUB_H
+#define XH_STUB_H 1
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//Small code stubs allocated from a W^X arena. Each stub is written through the RW view
+//and executed through the RX view of the same memfd pages. The returned stub address
+//is always the RX one.
+
+//returns the function the stub jumps to, with all argument registers preserved,
+//ret_addr is the return address of the call to the stub
+typedef void *(*xh_stub_dispatch_t)(void *arg, void *ret_addr);
+
+//jmp dispatch(arg, ret_addr)
+int xh_stub_make_dispatch(xh_stub_dispatch_t dispatch, void *arg, void **stub);
+
+//atomically ++(*counter), then jmp target
+int xh_stub_make_count_jump(void *target, uint64_t *counter, void **stub);
+
+//change the target of a count jump stub, the threads already past the load keep the old one
+void xh_stub_set_target(void *stub, void *target);
+
+//the caller must make sure no slot points to the stub any more
+void xh_stub_free(void *stub);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
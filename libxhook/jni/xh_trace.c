@@ -0,0 +1,121 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include "xh_errno.h"
+#include "xh_log.h"
+#include "xh_trace.h"
+
+#define XH_TRACE_BUF_SZ 256
+
+//ATrace compatible, see frameworks/native/libs/cutils/trace-dev.c
+static const char *xh_trace_marker_paths[] = {
+    "/sys/kernel/tracing/trace_marker",
+    "/sys/kernel/debug/tracing/trace_marker"
+};
+
+volatile int           xh_trace_enabled = 0;
+static int             xh_trace_fd      = -1;
+static int             xh_trace_span_depth = 0; //only touched when holding the refresh mutex
+static pthread_mutex_t xh_trace_mutex   = PTHREAD_MUTEX_INITIALIZER;
+
+int xh_trace_enable(int flag)
+{
+    size_t i;
+    int    r = 0;
+
+    pthread_mutex_lock(&xh_trace_mutex);
+    if(flag)
+    {
+        for(i = 0; i < sizeof(xh_trace_marker_paths) / sizeof(xh_trace_marker_paths[0]) && xh_trace_fd < 0; i++)
+            xh_trace_fd = open(xh_trace_marker_paths[i], O_WRONLY | O_CLOEXEC);
+        if(xh_trace_fd < 0)
+        {
+            r = (0 == errno ? XH_ERRNO_UNKNOWN : errno);
+            XH_LOG_WARN("open trace_marker failed, errno: %d", r);
+        }
+        else
+        {
+            xh_trace_enabled = 1;
+        }
+    }
+    else
+    {
+        //keep the fd opened, a tracing thread may be still writing
+        xh_trace_enabled = 0;
+    }
+    pthread_mutex_unlock(&xh_trace_mutex);
+    return r;
+}
+
+static void xh_trace_write(const char *buf, int len)
+{
+    if(len <= 0) return;
+    if(len >= XH_TRACE_BUF_SZ) len = XH_TRACE_BUF_SZ - 1;
+    if(write(xh_trace_fd, buf, (size_t)len) < 0) {} //best effort
+}
+
+int xh_trace_begin(const char *fmt, ...)
+{
+    char    buf[XH_TRACE_BUF_SZ];
+    int     len;
+    va_list ap;
+
+    len = snprintf(buf, sizeof(buf), "B|%d|", getpid());
+    va_start(ap, fmt);
+    len += vsnprintf(buf + len, sizeof(buf) - (size_t)len, fmt, ap);
+    va_end(ap);
+    xh_trace_write(buf, len);
+    xh_trace_span_depth++;
+    return 1;
+}
+
+void xh_trace_end()
+{
+    char buf[32];
+
+    if(xh_trace_span_depth > 0) xh_trace_span_depth--;
+    xh_trace_write(buf, snprintf(buf, sizeof(buf), "E|%d", getpid()));
+}
+
+void xh_trace_counter(const char *name, int64_t value)
+{
+    char buf[XH_TRACE_BUF_SZ];
+
+    xh_trace_write(buf, snprintf(buf, sizeof(buf), "C|%d|%s|%"PRId64, getpid(), name, value));
+}
+
+int xh_trace_depth()
+{
+    return xh_trace_span_depth;
+}
+
+void xh_trace_unwind(int depth)
+{
+    while(xh_trace_span_depth > depth) xh_trace_end();
+}
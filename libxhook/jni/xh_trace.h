@@ -0,0 +1,53 @@
+// Copyright (c) 2018-present, iQIYI, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#ifndef XH_TRACE_H
+#define XH_TRACE_H 1
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//cached enabled flag, the only cost when tracing is off
+extern volatile int xh_trace_enabled;
+
+int xh_trace_enable(int flag);
+
+int xh_trace_begin(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void xh_trace_end();
+void xh_trace_counter(const char *name, int64_t value);
+
+//for unwinding the opened spans after siglongjmp()
+int xh_trace_depth();
+void xh_trace_unwind(int depth);
+
+//BEGIN returns whether it opened a span, END closes only that span, whatever the flag is by then
+#define XH_TRACE_BEGIN(fmt, ...)   (xh_trace_enabled ? xh_trace_begin(fmt, ##__VA_ARGS__) : 0)
+#define XH_TRACE_END(opened)       do{if(opened) xh_trace_end();}while(0)
+#define XH_TRACE_COUNTER(name, v)  do{if(xh_trace_enabled) xh_trace_counter(name, (int64_t)(v));}while(0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -27,41 +27,196 @@
 #include <elf.h>
 #include <link.h>
 #include <string.h>
-#include <stdio.h>
+#include <ctype.h>
 #include <errno.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/syscall.h>
+#include <fcntl.h>
 #include "xh_util.h"
 #include "xh_errno.h"
 #include "xh_log.h"
 
-#define PAGE_START(addr) ((addr) & PAGE_MASK)
-#define PAGE_END(addr)   (PAGE_START(addr + sizeof(uintptr_t) - 1) + PAGE_SIZE)
+//the page size is 16K or 64K on some aarch64 kernels, so it is not a compile-time constant
+#define PAGE_SIZE_RT     ((uintptr_t)getpagesize())
+#define PAGE_START(addr) ((addr) & ~(PAGE_SIZE_RT - 1))
+#define PAGE_END(addr)   (PAGE_START(addr + sizeof(uintptr_t) - 1) + PAGE_SIZE_RT)
 #define PAGE_COVER(addr) (PAGE_END(addr) - PAGE_START(addr))
 
+static const char *xh_util_maps_path = "/proc/self/maps";
+
+//for replaying a captured maps file, the recorded layout must be mapped at the same addresses
+void xh_util_set_maps_path(const char *path)
+{
+    xh_util_maps_path = (NULL == path ? "/proc/self/maps" : path);
+}
+
+const char *xh_util_get_maps_path()
+{
+    return xh_util_maps_path;
+}
+
+int xh_util_open(const char *path, int flags)
+{
+    int fd;
+
+    do fd = (int)syscall(SYS_openat, AT_FDCWD, path, flags | O_CLOEXEC, 0);
+    while(fd < 0 && EINTR == errno);
+    return fd;
+}
+
+ssize_t xh_util_read(int fd, void *buf, size_t len)
+{
+    ssize_t n;
+
+    do n = (ssize_t)syscall(SYS_read, fd, buf, len);
+    while(n < 0 && EINTR == errno);
+    return n;
+}
+
+void xh_util_close(int fd)
+{
+    syscall(SYS_close, fd);
+}
+
+int xh_util_reader_open(xh_util_reader_t *self, const char *path)
+{
+    self->start = 0;
+    self->end = 0;
+    self->eof = 0;
+    if((self->fd = xh_util_open(path, O_RDONLY)) < 0) return 0 == errno ? XH_ERRNO_UNKNOWN : errno;
+    return 0;
+}
+
+//return 1 with the next line (without '\n') in line, 0 at the end of file
+//an overlong line is truncated to line_size - 1, the rest of it is skipped
+int xh_util_reader_next(xh_util_reader_t *self, char *line, size_t line_size)
+{
+    size_t  len = 0, n, copy;
+    char   *nl;
+    ssize_t r;
+    int     got = 0;
+
+    while(1)
+    {
+        if(self->start == self->end)
+        {
+            if(self->eof) break;
+            if((r = xh_util_read(self->fd, self->buf, sizeof(self->buf))) <= 0)
+            {
+                self->eof = 1;
+                break;
+            }
+            self->start = 0;
+            self->end = (size_t)r;
+        }
+        got = 1;
+
+        nl = memchr(self->buf + self->start, '\n', self->end - self->start);
+        n = (NULL == nl ? self->end : (size_t)(nl - self->buf)) - self->start;
+        copy = (n < line_size - 1 - len ? n : line_size - 1 - len);
+        memcpy(line + len, self->buf + self->start, copy);
+        len += copy;
+        self->start += n;
+        if(NULL != nl)
+        {
+            self->start++;
+            break;
+        }
+    }
+
+    line[len] = '\0';
+    return got;
+}
+
+void xh_util_reader_close(xh_util_reader_t *self)
+{
+    if(self->fd >= 0) xh_util_close(self->fd);
+    self->fd = -1;
+}
+
+static char *xh_util_parse_hex(char *p, uintptr_t *value)
+{
+    uintptr_t v = 0;
+    char     *begin = p;
+
+    for(;; p++)
+    {
+        if(*p >= '0' && *p <= '9')      v = (v << 4) | (uintptr_t)(*p - '0');
+        else if(*p >= 'a' && *p <= 'f') v = (v << 4) | (uintptr_t)(*p - 'a' + 10);
+        else if(*p >= 'A' && *p <= 'F') v = (v << 4) | (uintptr_t)(*p - 'A' + 10);
+        else break;
+    }
+    if(p == begin) return NULL;
+
+    *value = v;
+    return p;
+}
+
+static char *xh_util_skip_field(char *p)
+{
+    if(*p != ' ') return NULL;
+    while(*p == ' ') p++;
+    if('\0' == *p) return NULL;
+    while(*p != ' ' && *p != '\0') p++;
+    return p;
+}
+
+int xh_util_parse_maps_line(char *line, uintptr_t *start, uintptr_t *end, char *perm,
+                            unsigned long *offset, char **pathname)
+{
+    char      *p = line;
+    uintptr_t  v;
+    size_t     i;
+
+    if(NULL == (p = xh_util_parse_hex(p, start)) || *p++ != '-') return XH_ERRNO_FORMAT;
+    if(NULL == (p = xh_util_parse_hex(p, end)) || *p++ != ' ') return XH_ERRNO_FORMAT;
+
+    for(i = 0; i < 4; i++)
+    {
+        if(' ' == p[i] || '\0' == p[i]) return XH_ERRNO_FORMAT;
+        perm[i] = p[i];
+    }
+    perm[4] = '\0';
+    p += 4;
+    if(*p++ != ' ') return XH_ERRNO_FORMAT;
+
+    if(NULL == (p = xh_util_parse_hex(p, &v))) return XH_ERRNO_FORMAT;
+    *offset = (unsigned long)v;
+
+    //dev and inode
+    if(NULL == (p = xh_util_skip_field(p))) return XH_ERRNO_FORMAT;
+    if(NULL == (p = xh_util_skip_field(p))) return XH_ERRNO_FORMAT;
+
+    while(isspace((unsigned char)*p)) p++;
+    *pathname = p;
+    return 0;
+}
+
 int xh_util_get_mem_protect(uintptr_t addr, size_t len, const char *pathname, unsigned int *prot)
 {
-    uintptr_t  start_addr = addr;
-    uintptr_t  end_addr = addr + len;
-    FILE      *fp;
-    char       line[512];
-    uintptr_t  start, end;
-    char       perm[5];
-    int        load0 = 1;
-    int        found_all = 0;
+    uintptr_t         start_addr = addr;
+    uintptr_t         end_addr = addr + len;
+    xh_util_reader_t  reader;
+    char              line[512];
+    uintptr_t         start, end;
+    unsigned long     offset;
+    char              perm[5];
+    char             *line_pathname;
+    int               load0 = 1;
+    int               found_all = 0;
 
     *prot = 0;
     
-    if(NULL == (fp = fopen("/proc/self/maps", "r"))) return XH_ERRNO_BADMAPS;
+    if(0 != xh_util_reader_open(&reader, xh_util_maps_path)) return XH_ERRNO_BADMAPS;
     
-    while(fgets(line, sizeof(line), fp))
+    while(xh_util_reader_next(&reader, line, sizeof(line)))
     {
+        if(0 != xh_util_parse_maps_line(line, &start, &end, perm, &offset, &line_pathname)) continue;
+
         if(NULL != pathname)
-            if(NULL == strstr(line, pathname)) continue;
-        
-        if(sscanf(line, "%"PRIxPTR"-%"PRIxPTR" %4s ", &start, &end, perm) != 3) continue;
+            if(NULL == strstr(line_pathname, pathname)) continue;
         
         if(perm[3] != 'p') continue;
         
@@ -95,7 +250,7 @@ int xh_util_get_mem_protect(uintptr_t addr, size_t len, const char *pathname, un
         }
     }
     
-    fclose(fp);
+    xh_util_reader_close(&reader);
 
     if(!found_all) return XH_ERRNO_SEGVERR;
     
@@ -109,12 +264,66 @@ int xh_util_get_addr_protect(uintptr_t addr, const char *pathname, unsigned int
 
 int xh_util_set_addr_protect(uintptr_t addr, unsigned int prot)
 {
-    if(0 != mprotect((void *)PAGE_START(addr), PAGE_COVER(addr), (int)prot))
+    if(0 != syscall(SYS_mprotect, (void *)PAGE_START(addr), (size_t)PAGE_COVER(addr), (int)prot))
         return 0 == errno ? XH_ERRNO_UNKNOWN : errno;
     
     return 0;
 }
 
+//write through /proc/self/mem, the kernel ignores the page protection (FOLL_FORCE),
+//so no mprotect (and no VMA split or TLB shootdown) is needed
+static int xh_util_proc_mem_fd = -1;
+int xh_util_write_proc_mem(uintptr_t addr, const void *buf, size_t len)
+{
+    int     fd = __atomic_load_n(&xh_util_proc_mem_fd, __ATOMIC_ACQUIRE);
+    int     expected = -1;
+    ssize_t n;
+
+    if(fd < 0)
+    {
+        if((fd = xh_util_open("/proc/self/mem", O_RDWR)) < 0)
+            return 0 == errno ? XH_ERRNO_UNKNOWN : errno;
+        if(!__atomic_compare_exchange_n(&xh_util_proc_mem_fd, &expected, fd, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            xh_util_close(fd);
+            fd = expected;
+        }
+    }
+
+#if defined(__LP64__)
+    do n = (ssize_t)syscall(SYS_pwrite64, fd, buf, len, (off_t)addr);
+#else
+    //the 64-bit offset is passed as a register pair with per-ABI alignment, leave it to libc
+    do n = pwrite64(fd, buf, len, (off64_t)addr);
+#endif
+    while(n < 0 && EINTR == errno);
+    if(n < 0) return 0 == errno ? XH_ERRNO_UNKNOWN : errno;
+    if((size_t)n != len) return XH_ERRNO_UNKNOWN;
+    
+    return 0;
+}
+
+//write value to a GOT slot if it still holds expected, the caller serializes the slot writes
+//XH_ERRNO_NOTFND: the slot is not mapped any more, XH_ERRNO_REPEAT: it holds something else
+int xh_util_replace_slot(uintptr_t addr, const char *pathname, void *expected, void *value)
+{
+    unsigned int prot;
+    int          r;
+
+    if(0 != xh_util_get_addr_protect(addr, pathname, &prot) || 0 == (prot & PROT_READ)) return XH_ERRNO_NOTFND;
+    if(expected != __atomic_load_n((void **)addr, __ATOMIC_ACQUIRE)) return XH_ERRNO_REPEAT;
+
+    if(0 != xh_util_write_proc_mem(addr, &value, sizeof(void *)))
+    {
+        if(prot != (PROT_READ | PROT_WRITE) && 0 != (r = xh_util_set_addr_protect(addr, PROT_READ | PROT_WRITE)))
+            return r;
+        __atomic_store_n((void **)addr, value, __ATOMIC_RELEASE);
+        if(prot != (PROT_READ | PROT_WRITE)) xh_util_set_addr_protect(addr, prot);
+    }
+    xh_util_flush_instruction_cache(addr);
+    return 0;
+}
+
 void xh_util_flush_instruction_cache(uintptr_t addr)
 {
     __builtin___clear_cache((void *)PAGE_START(addr), (void *)PAGE_END(addr));
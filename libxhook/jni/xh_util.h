@@ -24,6 +24,10 @@
 #ifndef XH_UTILS_H
 #define XH_UTILS_H 1
 
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -42,7 +46,34 @@ extern "C" {
 int xh_util_get_mem_protect(uintptr_t addr, size_t len, const char *pathname, unsigned int *prot);
 int xh_util_get_addr_protect(uintptr_t addr, const char *pathname, unsigned int *prot);
 int xh_util_set_addr_protect(uintptr_t addr, unsigned int prot);
+int xh_util_write_proc_mem(uintptr_t addr, const void *buf, size_t len);
+int xh_util_replace_slot(uintptr_t addr, const char *pathname, void *expected, void *value);
 void xh_util_flush_instruction_cache(uintptr_t addr);
+void xh_util_set_maps_path(const char *path);
+const char *xh_util_get_maps_path();
+
+//raw syscalls, so that xhook's own I/O never goes through a GOT slot which may be hooked
+int xh_util_open(const char *path, int flags);
+ssize_t xh_util_read(int fd, void *buf, size_t len);
+void xh_util_close(int fd);
+
+//line reader over xh_util_read(), no stdio
+typedef struct
+{
+    int    fd;
+    size_t start;
+    size_t end;
+    int    eof;
+    char   buf[4096];
+} xh_util_reader_t;
+
+int xh_util_reader_open(xh_util_reader_t *self, const char *path);
+int xh_util_reader_next(xh_util_reader_t *self, char *line, size_t line_size);
+void xh_util_reader_close(xh_util_reader_t *self);
+
+//"start-end perm offset dev inode pathname", pathname is "" for anonymous maps
+int xh_util_parse_maps_line(char *line, uintptr_t *start, uintptr_t *end, char *perm,
+                            unsigned long *offset, char **pathname);
 
 #ifdef __cplusplus
 }
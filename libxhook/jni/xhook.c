@@ -22,27 +22,132 @@
 // Created by caikelun on 2018-04-11.
 
 #include "xh_core.h"
+#include "xh_discovery.h"
+#include "xh_elf.h"
+#include "xh_governor.h"
+#include "xh_manifest.h"
+#include "xh_oneshot.h"
+#include "xh_stats.h"
 #include "xhook.h"
 
+_Static_assert(sizeof(xh_elf_import_iter_t) <= sizeof(xhook_import_iter_t), "xhook_import_iter_t is too small");
+
 int xhook_register(const char *pathname_regex_str, const char *symbol,
                    void *new_func, void **old_func)
 {
-    return xh_core_register(pathname_regex_str, symbol, new_func, old_func);
+    return xh_core_register(NULL, pathname_regex_str, symbol, new_func, old_func);
 }
 
 int xhook_ignore(const char *pathname_regex_str, const char *symbol)
 {
-    return xh_core_ignore(pathname_regex_str, symbol);
+    return xh_core_ignore(NULL, pathname_regex_str, symbol);
+}
+
+int xhook_register_batch(const xhook_rule_t *rules, size_t rules_cnt)
+{
+    return xh_core_register_batch(NULL, rules, rules_cnt);
+}
+
+int xhook_add_handlers(const xhook_handler_t *handlers, size_t handlers_cnt)
+{
+    return xh_manifest_add_handlers(handlers, handlers_cnt);
+}
+
+int xhook_register_manifest(const char *manifest, size_t manifest_len)
+{
+    return xh_manifest_register(NULL, manifest, manifest_len);
+}
+
+int xhook_register_manifest_file(const char *path)
+{
+    return xh_manifest_register_file(NULL, path);
 }
 
 int xhook_refresh(int async)
 {
-    return xh_core_refresh(async);
+    return xh_core_refresh(NULL, async);
+}
+
+int xhook_refresh_report(int flags, void **report, size_t *report_len)
+{
+    return xh_core_refresh_report(NULL, flags, report, report_len);
 }
 
 void xhook_clear()
 {
-    return xh_core_clear();
+    return xh_core_clear(NULL);
+}
+
+xhook_ctx_t *xhook_ctx_create()
+{
+    return xh_core_ctx_create();
+}
+
+void xhook_ctx_destroy(xhook_ctx_t *ctx)
+{
+    return xh_core_ctx_destroy(ctx);
+}
+
+int xhook_ctx_register(xhook_ctx_t *ctx, const char *pathname_regex_str, const char *symbol,
+                       void *new_func, void **old_func)
+{
+    return xh_core_register(ctx, pathname_regex_str, symbol, new_func, old_func);
+}
+
+int xhook_ctx_ignore(xhook_ctx_t *ctx, const char *pathname_regex_str, const char *symbol)
+{
+    return xh_core_ignore(ctx, pathname_regex_str, symbol);
+}
+
+int xhook_ctx_register_batch(xhook_ctx_t *ctx, const xhook_rule_t *rules, size_t rules_cnt)
+{
+    return xh_core_register_batch(ctx, rules, rules_cnt);
+}
+
+int xhook_ctx_register_manifest(xhook_ctx_t *ctx, const char *manifest, size_t manifest_len)
+{
+    return xh_manifest_register(ctx, manifest, manifest_len);
+}
+
+int xhook_ctx_refresh(xhook_ctx_t *ctx, int async)
+{
+    return xh_core_refresh(ctx, async);
+}
+
+int xhook_register_oneshot(const char *pathname_regex_str, const char *symbol)
+{
+    return xh_core_register_slots(NULL, pathname_regex_str, symbol, xh_oneshot_make, NULL, NULL);
+}
+
+int xhook_ctx_register_oneshot(xhook_ctx_t *ctx, const char *pathname_regex_str, const char *symbol)
+{
+    return xh_core_register_slots(ctx, pathname_regex_str, symbol, xh_oneshot_make, NULL, NULL);
+}
+
+size_t xhook_get_first_calls(xhook_first_call_t *calls, size_t calls_cnt)
+{
+    return xh_oneshot_get_first_calls(calls, calls_cnt);
+}
+
+int xhook_register_governed(const char *pathname_regex_str, const char *symbol,
+                            void *new_func, void **old_func, const xhook_governor_t *governor)
+{
+    return xhook_ctx_register_governed(NULL, pathname_regex_str, symbol, new_func, old_func, governor);
+}
+
+int xhook_ctx_register_governed(xhook_ctx_t *ctx, const char *pathname_regex_str, const char *symbol,
+                                void *new_func, void **old_func, const xhook_governor_t *governor)
+{
+    void *gov;
+    int   r;
+
+    if(0 != (r = xh_governor_create(symbol, new_func, old_func, governor, &gov))) return r;
+    return xh_core_register_slots(ctx, pathname_regex_str, symbol, xh_governor_make, gov, xh_governor_release);
+}
+
+size_t xhook_get_governor_states(xhook_governor_state_t *states, size_t states_cnt)
+{
+    return xh_governor_get_states(states, states_cnt);
 }
 
 void xhook_enable_debug(int flag)
@@ -54,3 +159,78 @@ void xhook_enable_sigsegv_protection(int flag)
 {
     return xh_core_enable_sigsegv_protection(flag);
 }
+
+int xhook_import_iter_init(xhook_import_iter_t *iter, uintptr_t base_addr, const char *pathname)
+{
+    return xh_core_import_iter_init((xh_elf_import_iter_t *)iter, base_addr, pathname);
+}
+
+int xhook_import_iter_next(xhook_import_iter_t *iter, xhook_import_t *import)
+{
+    return xh_core_import_iter_next((xh_elf_import_iter_t *)iter, import);
+}
+
+int xhook_add_lib_event_callback(xhook_lib_event_cb_t cb, void *arg)
+{
+    return xh_core_add_lib_event_callback(cb, arg);
+}
+
+int xhook_del_lib_event_callback(xhook_lib_event_cb_t cb, void *arg)
+{
+    return xh_core_del_lib_event_callback(cb, arg);
+}
+
+int xhook_verify(size_t *repaired_cnt)
+{
+    return xh_core_verify(repaired_cnt);
+}
+
+int xhook_enable_watchdog(unsigned int interval_ms)
+{
+    return xh_core_enable_watchdog(interval_ms);
+}
+
+int xhook_enable_discovery(unsigned int poll_interval_ms, int *backend)
+{
+    return xh_discovery_enable(poll_interval_ms, backend);
+}
+
+int xhook_set_patch_backend(int backend)
+{
+    return xh_core_set_patch_backend(backend);
+}
+
+int xhook_stats_enable(const char *path, int *fd)
+{
+    return xh_stats_enable(path, fd);
+}
+
+int xhook_stats_counter_register(const char *name)
+{
+    return xh_stats_counter_register(name);
+}
+
+void xhook_stats_counter_add(int id, uint64_t delta)
+{
+    xh_stats_counter_add(id, delta);
+}
+
+int xhook_stats_read(const xhook_stats_page_t *page, xhook_stats_page_t *snapshot)
+{
+    return xh_stats_read(page, snapshot);
+}
+
+int xhook_enable_trace(int flag)
+{
+    return xh_core_enable_trace(flag);
+}
+
+int xhook_set_log_sink(int sink)
+{
+    return xh_core_set_log_sink(sink);
+}
+
+void xhook_dump_log(xhook_log_cb_t cb, void *arg)
+{
+    return xh_core_dump_log(cb, arg);
+}
@@ -28,21 +28,257 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
+#include <stddef.h>
+
 #define XHOOK_EXPORT __attribute__((visibility("default")))
 
+#define XHOOK_LOG_SINK_RING   0
+#define XHOOK_LOG_SINK_LOGCAT 1
+
+#define XHOOK_LIB_EVENT_ADDED    0 //newly loaded, hooked
+#define XHOOK_LIB_EVENT_REHOOKED 1 //base address changed, re-hooked
+#define XHOOK_LIB_EVENT_REMOVED  2 //missing from maps, maybe dlclosed
+#define XHOOK_LIB_EVENT_UPDATED  3 //rules of a newly started xhook_ctx_t applied
+
+typedef void (*xhook_lib_event_cb_t)(int event, const char *pathname, uintptr_t base_addr,
+                                     size_t slots_patched, void *arg);
+
+#define XHOOK_IMPORT_SECTION_PLT     0 //.rel(a).plt
+#define XHOOK_IMPORT_SECTION_DYN     1 //.rel(a).dyn
+#define XHOOK_IMPORT_SECTION_ANDROID 2 //.rel(a).android (packed)
+
+//one import slot of a loaded ELF, "symbol" points into the mapped .dynstr
+typedef struct
+{
+    const char  *symbol;
+    uint32_t     symidx;
+    uint32_t     reloc_type;
+    int          section;
+    void       **slot;
+    void        *target;
+} xhook_import_t;
+
+//opaque, allocated by the caller (usually on the stack)
+typedef struct
+{
+    uintptr_t opaque[96];
+} xhook_import_iter_t;
+
+//hook rule for xhook_register_batch()
+//new_func == NULL means an ignore rule, then symbol == NULL means ignore all symbols
+typedef struct
+{
+    const char  *pathname_regex_str;
+    const char  *symbol;
+    void        *new_func;
+    void       **old_func;
+} xhook_rule_t;
+
+//named handler, referenced by the "hook" lines of a manifest
+typedef struct
+{
+    const char  *name;
+    void        *new_func;
+    void       **old_func;
+} xhook_handler_t;
+
+#define XHOOK_PATCH_BACKEND_MPROTECT 0 //mprotect around every slot (default)
+#define XHOOK_PATCH_BACKEND_BATCH    1 //mprotect once per page of each library
+#define XHOOK_PATCH_BACKEND_PROC_MEM 2 //write through /proc/self/mem, no mprotect
+
+#define XHOOK_REFRESH_FLAG_DRY_RUN 0x1 //compute the plan only, write no slot
+
+#define XHOOK_REPORT_MAGIC   0x50524858 //"XHRP"
+#define XHOOK_REPORT_VERSION 1
+
+#define XHOOK_REPORT_ELF_RELA     0x1
+#define XHOOK_REPORT_ELF_GNU_HASH 0x2
+
+//report = header + lib_cnt variable-length records (each is 8 bytes aligned)
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flags;       //XHOOK_REFRESH_FLAG_*
+    uint32_t lib_cnt;
+    uint64_t duration_ns;
+} xhook_report_header_t;
+
+typedef struct
+{
+    uint32_t record_len;  //including the pathname, jump to the next record with this
+    int32_t  status;      //0, XH_ERRNO_* (format, SIGSEGV ...) or errno of mprotect
+    uint64_t base_addr;
+    uint32_t event;       //XHOOK_LIB_EVENT_*
+    uint32_t elf_flags;   //XHOOK_REPORT_ELF_*
+    uint32_t relplt_cnt;
+    uint32_t reldyn_cnt;
+    uint32_t relandroid_cnt;
+    uint32_t symbols_found;
+    uint32_t symbols_not_found;
+    uint32_t slots_patched; //or to be patched, in dry run
+    uint64_t duration_ns;
+    uint32_t pathname_len;
+    char     pathname[];  //NUL terminated
+} xhook_report_lib_t;
+
+#define XHOOK_STATS_MAGIC        0x54534858 //"XHST"
+#define XHOOK_STATS_VERSION      1
+#define XHOOK_STATS_COUNTERS_MAX 64
+
+typedef struct
+{
+    char     name[48];
+    uint64_t value;
+} xhook_stats_counter_t;
+
+//one page shared with other processes, see xhook_stats_read() for the seqlock protocol
+typedef struct
+{
+    uint32_t              magic;
+    uint32_t              version;
+    uint32_t              seq; //odd while the page is being written
+    uint32_t              pid;
+    uint64_t              refresh_cnt;
+    uint64_t              last_refresh_ns;
+    uint64_t              libs_hooked;
+    uint64_t              slots_patched;
+    uint64_t              failures;
+    uint64_t              sigsegv_recoveries;
+    uint32_t              counters_cnt;
+    uint32_t              reserved;
+    xhook_stats_counter_t counters[XHOOK_STATS_COUNTERS_MAX];
+} xhook_stats_page_t;
+
+typedef void (*xhook_log_cb_t)(int prio, uint64_t timestamp_ns, const char *msg, void *arg);
+
+//the first call through one GOT slot hooked by xhook_register_oneshot()
+typedef struct
+{
+    uint64_t    timestamp_ns; //CLOCK_MONOTONIC
+    const char *pathname;     //the library which made the call
+    const char *symbol;
+    void       *caller;       //return address of the call
+    void       *slot;
+    int         tid;
+} xhook_first_call_t;
+
+//budget of a governed hook, see xhook_register_governed()
+#define XHOOK_GOVERNOR_POLICY_SAMPLE      0 //over budget: 1 in N calls enter the wrapper
+#define XHOOK_GOVERNOR_POLICY_PASSTHROUGH 1 //over budget: no call enters the wrapper
+
+typedef struct
+{
+    uint64_t max_calls_per_sec; //0: no limit
+    uint64_t max_ns_per_sec;    //0: no limit, estimated with ns_per_call
+    uint32_t ns_per_call;       //estimated cost of the wrapper
+    int      policy;            //XHOOK_GOVERNOR_POLICY_*
+} xhook_governor_t;
+
+#define XHOOK_GOVERNOR_MODE_FULL        0
+#define XHOOK_GOVERNOR_MODE_SAMPLED     1
+#define XHOOK_GOVERNOR_MODE_PASSTHROUGH 2
+
+typedef struct
+{
+    const char *symbol;
+    int         mode;          //XHOOK_GOVERNOR_MODE_*
+    uint32_t    sample_n;      //1 in sample_n calls enter the wrapper when sampled
+    uint64_t    calls_per_sec; //all calls, measured in the last tick
+    uint64_t    switches;
+} xhook_governor_state_t;
+
+//new library discovery backend, see xhook_enable_discovery()
+#define XHOOK_DISCOVERY_OFF  0
+#define XHOOK_DISCOVERY_PERF 1 //perf_event mmap records
+#define XHOOK_DISCOVERY_POLL 2 //full refresh every poll_interval_ms
+
+//an independent set of hook rules, all instances share one maps scan and ELF parse per refresh
+typedef struct xhook_ctx xhook_ctx_t;
+
 int xhook_register(const char *pathname_regex_str, const char *symbol,
                    void *new_func, void **old_func) XHOOK_EXPORT;
 
 int xhook_ignore(const char *pathname_regex_str, const char *symbol) XHOOK_EXPORT;
 
+int xhook_register_batch(const xhook_rule_t *rules, size_t rules_cnt) XHOOK_EXPORT;
+
+int xhook_add_handlers(const xhook_handler_t *handlers, size_t handlers_cnt) XHOOK_EXPORT;
+
+int xhook_register_manifest(const char *manifest, size_t manifest_len) XHOOK_EXPORT;
+
+int xhook_register_manifest_file(const char *path) XHOOK_EXPORT;
+
 int xhook_refresh(int async) XHOOK_EXPORT;
 
+int xhook_refresh_report(int flags, void **report, size_t *report_len) XHOOK_EXPORT;
+
 void xhook_clear() XHOOK_EXPORT;
 
+xhook_ctx_t *xhook_ctx_create() XHOOK_EXPORT;
+
+void xhook_ctx_destroy(xhook_ctx_t *ctx) XHOOK_EXPORT;
+
+int xhook_ctx_register(xhook_ctx_t *ctx, const char *pathname_regex_str, const char *symbol,
+                       void *new_func, void **old_func) XHOOK_EXPORT;
+
+int xhook_ctx_ignore(xhook_ctx_t *ctx, const char *pathname_regex_str, const char *symbol) XHOOK_EXPORT;
+
+int xhook_ctx_register_batch(xhook_ctx_t *ctx, const xhook_rule_t *rules, size_t rules_cnt) XHOOK_EXPORT;
+
+int xhook_ctx_register_manifest(xhook_ctx_t *ctx, const char *manifest, size_t manifest_len) XHOOK_EXPORT;
+
+int xhook_ctx_refresh(xhook_ctx_t *ctx, int async) XHOOK_EXPORT;
+
+int xhook_register_oneshot(const char *pathname_regex_str, const char *symbol) XHOOK_EXPORT;
+
+int xhook_ctx_register_oneshot(xhook_ctx_t *ctx, const char *pathname_regex_str, const char *symbol) XHOOK_EXPORT;
+
+size_t xhook_get_first_calls(xhook_first_call_t *calls, size_t calls_cnt) XHOOK_EXPORT;
+
+int xhook_register_governed(const char *pathname_regex_str, const char *symbol,
+                            void *new_func, void **old_func, const xhook_governor_t *governor) XHOOK_EXPORT;
+
+int xhook_ctx_register_governed(xhook_ctx_t *ctx, const char *pathname_regex_str, const char *symbol,
+                                void *new_func, void **old_func, const xhook_governor_t *governor) XHOOK_EXPORT;
+
+size_t xhook_get_governor_states(xhook_governor_state_t *states, size_t states_cnt) XHOOK_EXPORT;
+
 void xhook_enable_debug(int flag) XHOOK_EXPORT;
 
 void xhook_enable_sigsegv_protection(int flag) XHOOK_EXPORT;
 
+int xhook_import_iter_init(xhook_import_iter_t *iter, uintptr_t base_addr, const char *pathname) XHOOK_EXPORT;
+
+int xhook_import_iter_next(xhook_import_iter_t *iter, xhook_import_t *import) XHOOK_EXPORT;
+
+int xhook_add_lib_event_callback(xhook_lib_event_cb_t cb, void *arg) XHOOK_EXPORT;
+
+int xhook_del_lib_event_callback(xhook_lib_event_cb_t cb, void *arg) XHOOK_EXPORT;
+
+int xhook_verify(size_t *repaired_cnt) XHOOK_EXPORT;
+
+int xhook_enable_watchdog(unsigned int interval_ms) XHOOK_EXPORT;
+
+int xhook_enable_discovery(unsigned int poll_interval_ms, int *backend) XHOOK_EXPORT;
+
+int xhook_set_patch_backend(int backend) XHOOK_EXPORT;
+
+int xhook_stats_enable(const char *path, int *fd) XHOOK_EXPORT;
+
+int xhook_stats_counter_register(const char *name) XHOOK_EXPORT;
+
+void xhook_stats_counter_add(int id, uint64_t delta) XHOOK_EXPORT;
+
+int xhook_stats_read(const xhook_stats_page_t *page, xhook_stats_page_t *snapshot) XHOOK_EXPORT;
+
+int xhook_enable_trace(int flag) XHOOK_EXPORT;
+
+int xhook_set_log_sink(int sink) XHOOK_EXPORT;
+
+void xhook_dump_log(xhook_log_cb_t cb, void *arg) XHOOK_EXPORT;
+
 #ifdef __cplusplus
 }
 #endif
@@ -15,6 +15,7 @@ public class Biz {
     }
 
     public synchronized void init() {
+        System.loadLibrary("loglimit");
         System.loadLibrary("biz");
     }
 
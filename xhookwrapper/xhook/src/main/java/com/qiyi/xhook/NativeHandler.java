@@ -14,6 +14,8 @@ public class NativeHandler {
     private NativeHandler() {
     }
 
+    public native int registerManifest(String manifest);
+
     public native int refresh(boolean async);
 
     public native void clear();
@@ -22,4 +24,6 @@ public class NativeHandler {
 
     public native void enableSigSegvProtection(boolean flag);
 
+    public native void dumpLog();
+
 }
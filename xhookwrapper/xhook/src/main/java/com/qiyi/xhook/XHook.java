@@ -51,6 +51,26 @@ public class XHook {
         return inited;
     }
 
+    /**
+     * Register hook and ignore rules from a manifest in one call, before the first refresh.
+     * The handler names must be registered by native code with xhook_add_handlers().
+     * @param manifest one rule per line: "hook &lt;regex&gt; &lt;symbol&gt; &lt;handler&gt;" or "ignore &lt;regex&gt; [symbol]".
+     * @return true if successful, false otherwise.
+     */
+    public synchronized boolean registerManifest(String manifest) {
+        if(!inited) {
+            return false;
+        }
+
+        try {
+            return 0 == com.qiyi.xhook.NativeHandler.getInstance().registerManifest(manifest);
+        } catch (Throwable ex) {
+            ex.printStackTrace();
+            Log.e("xhook", "xhook native registerManifest failed");
+            return false;
+        }
+    }
+
     /**
      * Re-hook after System.loadLibrary() and System.load().
      * @param async true if to refresh in async mode; otherwise, refresh in sync mode.
@@ -102,6 +122,22 @@ public class XHook {
         }
     }
 
+    /**
+     * Dump the in-memory debug log to logcat.
+     */
+    public synchronized void dumpLog() {
+        if(!inited) {
+            return;
+        }
+
+        try {
+            com.qiyi.xhook.NativeHandler.getInstance().dumpLog();
+        } catch (Throwable ex) {
+            ex.printStackTrace();
+            Log.e("xhook", "xhook native dumpLog failed");
+        }
+    }
+
     /**
      * Enable/disable the segmentation fault protection. (enabled by default)
      * @param flag the bool flag.